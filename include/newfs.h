@@ -11,16 +11,29 @@
 #include <stddef.h>
 #include "ddriver.h"
 #include "errno.h"
+#include <pthread.h>
 #include "types.h"
 
 /******************************************************************************
 * SECTION: global region
 *******************************************************************************/
-struct custom_options 	newfs_options;			 
-struct newfs_super      newfs_super; 
+extern struct custom_options 	newfs_options;			 
+extern __thread struct newfs_super* newfs_ctx;			 /* 当前线程绑定的实例 */
 
 
-#define NEWFS_DBG(fmt, ...) do { printf("NEWFS_DBG: " fmt, ##__VA_ARGS__); } while(0) 
+extern int 						newfs_log_level;		 /* 文本日志级别 */
+extern int 						newfs_event_level;		 /* 二进制事件级别，未打开日志时为OFF */
+
+/* 高于NEWFS_LOG_MAX的日志在编译期去掉；其余的关闭时只有一次比较 */
+#define NEWFS_LOG_ON(lvl)   ((lvl) <= NEWFS_LOG_MAX && (lvl) <= newfs_log_level)
+#define NEWFS_LOG_TEXT(lvl, tag, fmt, ...) \
+	do { if (NEWFS_LOG_ON(lvl)) fprintf(stderr, "NEWFS_" tag ": " fmt, ##__VA_ARGS__); } while(0)
+#define NEWFS_ERR(fmt, ...)  NEWFS_LOG_TEXT(NEWFS_LOG_ERR, "ERR", fmt, ##__VA_ARGS__)
+#define NEWFS_INFO(fmt, ...) NEWFS_LOG_TEXT(NEWFS_LOG_INFO, "INFO", fmt, ##__VA_ARGS__)
+#define NEWFS_DBG(fmt, ...)  NEWFS_LOG_TEXT(NEWFS_LOG_DEBUG, "DBG", fmt, ##__VA_ARGS__)
+#define NEWFS_EVENT(lvl, type, a, b, c) \
+	do { if ((lvl) <= NEWFS_LOG_MAX && (lvl) <= __atomic_load_n(&newfs_event_level, __ATOMIC_RELAXED)) \
+			 newfs_event((type), (uint64_t)(a), (uint64_t)(b), (uint32_t)(c)); } while(0)
 
 
 /******************************************************************************
@@ -28,27 +41,212 @@ struct newfs_super      newfs_super;
 *******************************************************************************/
 char* 			   		newfs_get_fname(const char* path);
 int 			   		newfs_calc_lvl(const char * path);
-int 			   		newfs_driver_read(int offset, uint8_t *out_content, int size);
-int 			   		newfs_driver_write(int offset, uint8_t *in_content, int size);
+int 			   		newfs_dentry_lvl(struct newfs_dentry* dentry);
+int 			   		newfs_driver_read(uint64_t offset, uint8_t *out_content, int size);
+int 			   		newfs_driver_write(uint64_t offset, uint8_t *in_content, int size);
+int 			   		newfs_driver_write_data(uint64_t offset, uint8_t *in_content, int size);
 
 
 int 			   		newfs_mount(struct custom_options options);
+int 			   		newfs_umount();
 
 
 struct newfs_inode*		newfs_read_inode(struct newfs_dentry * dentry, int ino);
 struct newfs_dentry* 	newfs_get_dentry(struct newfs_inode * inode, int dir);
+struct newfs_inode*		newfs_dentry_inode(struct newfs_dentry * dentry);
 
 
 struct newfs_dentry* 	newfs_lookup(const char * path, boolean * is_find, boolean* is_root);
 
+struct newfs_dentry* 	new_dentry(struct newfs_inode * dir, const char * fname, int len,
+								   NEWFS_FILE_TYPE ftype);
+void 			   		newfs_free_dentry(struct newfs_dentry * dentry);
 int 			   		newfs_alloc_dentry(struct newfs_inode * inode, struct newfs_dentry * dentry);
+void 			   		newfs_remove_dentry(struct newfs_inode * inode, struct newfs_dentry * dentry);
 struct newfs_inode*		newfs_alloc_inode(struct newfs_dentry * dentry);
+void 			   		newfs_free_inode(struct newfs_inode * inode);
+int 			   		newfs_delete_inode(struct newfs_inode * inode);
+boolean 		   		newfs_inode_put(struct newfs_inode * inode);
+int 			   		newfs_reap_orphans();
+int 			   		newfs_alloc_data_blk();
+int 			   		newfs_alloc_data_blk_near(int64_t goal);
+void 			   		newfs_free_data_blk(int blkno);
+int 			   		newfs_read_extents(struct newfs_inode * inode, struct newfs_inode_d * inode_d);
+int 			   		newfs_sync_extents(struct newfs_inode * inode);
+int 			   		newfs_ext_reserve(struct newfs_inode * inode, int n);
+int 			   		newfs_ext_insert(struct newfs_inode * inode, uint64_t iblk, uint64_t pblk);
+int64_t					newfs_bmap_run(struct newfs_inode * inode, uint64_t iblk, uint64_t * run);
+int64_t					newfs_bmap(struct newfs_inode * inode, uint64_t iblk, boolean alloc);
+int 			   		newfs_read_data(struct newfs_inode * inode, uint8_t * buf, int size, uint64_t offset);
+int 			   		newfs_write_data(struct newfs_inode * inode, const uint8_t * buf, int size, uint64_t offset);
+int 			   		newfs_truncate_data(struct newfs_inode * inode, uint64_t size);
 int 			   		newfs_sync_inode(struct newfs_inode * inode);
+void 			   		newfs_mark_inode_dirty(struct newfs_inode * inode);
+int 			   		newfs_sync();
+/******************************************************************************
+* SECTION: newfs_backend.c
+*******************************************************************************/
+int 			   		newfs_backend_open(struct newfs_backend* be, const char* name,
+										   const char* path, int disk_mb);
+int 			   		newfs_backend_close(struct newfs_backend* be);
+int 			   		newfs_backend_read(struct newfs_backend* be, uint8_t* buf, int size, off_t offset);
+int 			   		newfs_backend_write(struct newfs_backend* be, const uint8_t* buf, int size, off_t offset);
+int 			   		newfs_backend_flush(struct newfs_backend* be);
+const char*				newfs_backend_default();
+/******************************************************************************
+* SECTION: newfs_dir.c
+*******************************************************************************/
+uint32_t				newfs_name_hash(const char* name, int len);
+struct newfs_dentry* 	newfs_dir_find(struct newfs_inode* inode, const char* name, int len,
+									   uint32_t hash);
+int 			   		newfs_dir_insert(struct newfs_inode* inode, struct newfs_dentry* dentry);
+int 			   		newfs_dir_load(struct newfs_inode* inode);
+int 			   		newfs_dir_sync(struct newfs_inode* inode);
+void 			   		newfs_dir_remove(struct newfs_inode* inode, struct newfs_dentry* dentry);
+boolean 		   		newfs_dir_fits(struct newfs_inode* inode, const char* name, int len,
+									   struct newfs_dentry* gone1, struct newfs_dentry* gone2);
+/******************************************************************************
+* SECTION: newfs_dcache.c
+*******************************************************************************/
+int 			   		newfs_dcache_init(int capacity);
+void 			   		newfs_dcache_destroy();
+boolean 		   		newfs_dcache_lookup(struct newfs_dentry* parent, const char* name, int len,
+											uint32_t hash, struct newfs_dentry** dentry);
+void 			   		newfs_dcache_add(struct newfs_dentry* parent, const char* name, int len,
+										 uint32_t hash, struct newfs_dentry* dentry);
+void 			   		newfs_dcache_invalidate(struct newfs_dentry* parent, const char* name,
+												int len, uint32_t hash);
+void 			   		newfs_dcache_purge(struct newfs_dentry* parent);
+/******************************************************************************
+* SECTION: newfs_icache.c
+*******************************************************************************/
+int 			   		newfs_icache_init(int cache_mb);
+void 			   		newfs_icache_destroy();
+void 			   		newfs_icache_add(struct newfs_inode* inode);
+void 			   		newfs_icache_remove(struct newfs_inode* inode);
+void 			   		newfs_icache_touch(struct newfs_inode* inode);
+boolean 				newfs_icache_over();
+void 			   		newfs_icache_shrink();
+void 			   		newfs_inode_release(struct newfs_inode* inode);
+/******************************************************************************
+* SECTION: newfs_writeback.c
+*******************************************************************************/
+int 			   		newfs_wb_start(int expire_ms, int ratio);
+void 			   		newfs_wb_stop();
+void 			   		newfs_wb_note_dirty();
+void 			   		newfs_wb_clean();
+int 			   		newfs_fsync_inode(struct newfs_inode* inode);
+/******************************************************************************
+* SECTION: newfs_readahead.c
+*******************************************************************************/
+int 			   		newfs_ra_start(int max_blks);
+void 			   		newfs_ra_stop();
+void 			   		newfs_ra_cancel(struct newfs_inode* inode);
+void 			   		newfs_ra_read(struct newfs_file* file, uint64_t offset, int size);
+/******************************************************************************
+* SECTION: newfs_delalloc.c
+*******************************************************************************/
+uint8_t* 				newfs_da_find(struct newfs_inode * inode, uint64_t iblk);
+uint8_t* 				newfs_da_page(struct newfs_inode * inode, uint64_t iblk);
+int 			   		newfs_da_flush(struct newfs_inode * inode);
+void 			   		newfs_da_truncate(struct newfs_inode * inode, uint64_t size);
+void 			   		newfs_da_free(struct newfs_inode * inode);
+/******************************************************************************
+* SECTION: newfs_mkfs.c
+*******************************************************************************/
+void 			   		newfs_geometry_default(struct newfs_geometry* geo);
+int 			   		newfs_mkfs(struct newfs_geometry* geo);
+/******************************************************************************
+* SECTION: newfs_stats.c
+*******************************************************************************/
+int 			   		newfs_stats_init();
+void 			   		newfs_stats_destroy();
+uint64_t 				newfs_stats_begin();
+void 			   		newfs_stats_end(NEWFS_OP op, uint64_t start, int ret);
+char* 			   		newfs_stats_snapshot(size_t* len);
+const char* 			newfs_op_name(NEWFS_OP op);
+/******************************************************************************
+* SECTION: newfs_log.c
+*******************************************************************************/
+int 			   		newfs_log_open(const char* path, int level);
+void 			   		newfs_log_close();
+void 			   		newfs_event(NEWFS_EVENT_TYPE type, uint64_t a, uint64_t b, uint32_t c);
+const char* 			newfs_event_name(NEWFS_EVENT_TYPE type);
+const char* 			newfs_event_arg(NEWFS_EVENT_TYPE type, int arg);
+/******************************************************************************
+* SECTION: newfs_trace.c
+*******************************************************************************/
+int 			   		newfs_trace_start(const char* path, int size_mb);
+void 			   		newfs_trace_stop();
+void 			   		newfs_trace_op(NEWFS_OP op, const char* path, uint64_t off, uint32_t size,
+									   uint32_t mode, uint64_t fh, uint64_t start, int ret);
+int 			   		newfs_trace_load(const char* path, struct newfs_trace_hdr* hdr, uint8_t** ring);
+struct newfs_trace_rec* newfs_trace_next(struct newfs_trace_hdr* hdr, uint8_t* ring, uint64_t* pos);
+/******************************************************************************
+* SECTION: newfs_journal.c
+*******************************************************************************/
+int 			   		newfs_journal_init(uint64_t offset, uint64_t blks, boolean is_init);
+int 			   		newfs_journal_commit();
+int 			   		newfs_journal_checkpoint();
+int 			   		newfs_journal_revoke(uint64_t blkno);
+boolean 		   		newfs_journal_need_commit();
+/******************************************************************************
+* SECTION: newfs_bitmap.c
+*******************************************************************************/
+int 			   		newfs_bitmap_init(struct newfs_bitmap* bm, uint8_t* map, int nbits);
+void 			   		newfs_bitmap_dirty_all(struct newfs_bitmap* bm);
+int 			   		newfs_bitmap_sync(struct newfs_bitmap* bm, uint64_t offset);
+void 			   		newfs_bitmap_destroy(struct newfs_bitmap* bm);
+int 			   		newfs_bitmap_alloc(struct newfs_bitmap* bm);
+int 			   		newfs_bitmap_alloc_near(struct newfs_bitmap* bm, int64_t goal);
+boolean 				newfs_bitmap_reserve(struct newfs_bitmap* bm, int n);
+void 			   		newfs_bitmap_unreserve(struct newfs_bitmap* bm, int n);
+int 			   		newfs_bitmap_alloc_run(struct newfs_bitmap* bm, int64_t goal, int want, int* got);
+void 			   		newfs_bitmap_unalloc_run(struct newfs_bitmap* bm, int start, int n);
+void 			   		newfs_bitmap_free(struct newfs_bitmap* bm, int idx);
+boolean 				newfs_bitmap_test(struct newfs_bitmap* bm, int idx);
+/******************************************************************************
+* SECTION: newfs_slab.c
+*******************************************************************************/
+int 			   		newfs_slab_init(struct newfs_slab* slab, const char* name, size_t obj_sz);
+void 			   		newfs_slab_destroy(struct newfs_slab* slab);
+void* 			   		newfs_slab_alloc(struct newfs_slab* slab);
+void 			   		newfs_slab_free(struct newfs_slab* slab, void* obj);
+const char* 			newfs_names_add(struct newfs_name_chunk** names, const char* name, int len);
+uint64_t 				newfs_names_bytes(struct newfs_name_chunk* names);
+void 			   		newfs_names_free(struct newfs_name_chunk** names);
+/******************************************************************************
+* SECTION: newfs_cache.c
+*******************************************************************************/
+int 			   		newfs_cache_init(int capacity);
+void 			   		newfs_cache_destroy();
+struct newfs_cache_blk* newfs_cache_get(uint64_t blkno, boolean need_load);
+int 			   		newfs_cache_read_direct(uint64_t blkno, int nblks, uint8_t* out_content);
+int 			   		newfs_cache_write_direct(uint64_t blkno, int nblks, uint8_t* in_content);
+int 			   		newfs_cache_prefetch(uint64_t blkno, int nblks);
+void 			   		newfs_cache_mark_dirty(struct newfs_cache_blk* blk);
+void 			   		newfs_cache_mark_meta_dirty(struct newfs_cache_blk* blk);
+int 			   		newfs_cache_freeze(struct newfs_cache_blk* blk);
+void 			   		newfs_cache_mark_committed(struct newfs_cache_blk* blk, uint64_t seq);
+void 			   		newfs_cache_discard(uint64_t blkno, uint64_t nblks);
+int 			   		newfs_cache_sync_range(uint64_t blkno, uint64_t nblks);
+struct newfs_cache_blk** newfs_cache_collect_meta(int* cnt);
+int 			   		newfs_cache_flush_data();
+int 			   		newfs_cache_flush();
+/******************************************************************************
+* SECTION: newfs_ctx.c
+*******************************************************************************/
+struct newfs_super*		newfs_ctx_create();
+void 			   		newfs_ctx_destroy(struct newfs_super* ctx);
+struct newfs_super*		newfs_ctx_switch(struct newfs_super* ctx);
 /******************************************************************************
 * SECTION: newfs.c
 *******************************************************************************/
 void* 			   		newfs_init(struct fuse_conn_info *);
 void  			   		newfs_destroy(void *);
+/******************************************************************************
+* SECTION: newfs_ops.c
+*******************************************************************************/
 int   			   		newfs_mkdir(const char *, mode_t);
 int   			   		newfs_getattr(const char *, struct stat *);
 int   			   		newfs_readdir(const char *, void *, fuse_fill_dir_t, off_t,
@@ -62,15 +260,31 @@ int						newfs_read(const char *, char *, size_t, off_t,
 int   				   	newfs_rename(const char *, const char *);
 int   			 	  	newfs_utimens(const char *, const struct timespec tv[2]);
 int   					newfs_truncate(const char *, off_t);
+int   					newfs_fsync(const char *, int, struct fuse_file_info *);
+int   					newfs_fsyncdir(const char *, int, struct fuse_file_info *);
+int   					newfs_flush(const char *, struct fuse_file_info *);
 int						newfs_access(const char *, int);
 int						newfs_unlink(const char *);
 int						newfs_rmdir(const char *);	
 		
 int   			   newfs_open(const char *, struct fuse_file_info *);
+int   			   newfs_release(const char *, struct fuse_file_info *);
 int   			   newfs_opendir(const char *, struct fuse_file_info *);
+int   			   newfs_releasedir(const char *, struct fuse_file_info *);
 
 /******************************************************************************
 * SECTION: newfs_debug.c
 *******************************************************************************/
 void 			   newfs_dump_map(int option);
+void 			   newfs_dump_cache(FILE* fp);
+void 			   newfs_dump_dcache(FILE* fp);
+void 			   newfs_dump_icache(FILE* fp);
+void 			   newfs_dump_backend(FILE* fp);
+void 			   newfs_dump_journal(FILE* fp);
+void 			   newfs_dump_writeback(FILE* fp);
+void 			   newfs_dump_readahead(FILE* fp);
+void 			   newfs_dump_delalloc(FILE* fp);
+void 			   newfs_dump_bitmap(FILE* fp, const char* name, struct newfs_bitmap* bm);
+void 			   newfs_dump_slab(FILE* fp, struct newfs_slab* slab);
+void 			   newfs_dump_all(FILE* fp);
 #endif  /* _newfs_H_ */
\ No newline at end of file
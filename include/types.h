@@ -16,10 +16,11 @@ typedef enum newfs_file_type {
 *******************************************************************************/
 #define TRUE                    1
 #define FALSE                   0
+#define UINT64_BITS             64
 #define UINT32_BITS             32
 #define UINT8_BITS              8
 
-#define NEWFS_MAGIC_NUM             4444544
+#define NEWFS_MAGIC_NUM             4444550    // 布局变更时递增
 #define NEWFS_SUPER_OFS             0
 #define NEWFS_ROOT_INO              0
 
@@ -27,48 +28,119 @@ typedef enum newfs_file_type {
 #define NEWFS_ERROR_ACCESS          EACCES
 #define NEWFS_ERROR_SEEK            ESPIPE     
 #define NEWFS_ERROR_ISDIR           EISDIR
+#define NEWFS_ERROR_NOTDIR          ENOTDIR
 #define NEWFS_ERROR_NOSPACE         ENOSPC
 #define NEWFS_ERROR_EXISTS          EEXIST
 #define NEWFS_ERROR_NOTFOUND        ENOENT
 #define NEWFS_ERROR_UNSUPPORTED     ENXIO
 #define NEWFS_ERROR_IO              EIO     /* Error Input/Output */
 #define NEWFS_ERROR_INVAL           EINVAL  /* Invalid Args */
+#define NEWFS_ERROR_FBIG            EFBIG   /* File too large */
+#define NEWFS_ERROR_NAMETOOLONG     ENAMETOOLONG
+#define NEWFS_ERROR_NOTEMPTY        ENOTEMPTY
+#define NEWFS_ERROR_BUSY            EBUSY      /* 文件仍被打开 */
 
 #define MAX_NAME_LEN                128     
 #define NEWFS_MAX_FILE_NAME         128
 #define NEWFS_INODE_PER_FILE        1
-#define NEWFS_DATA_PER_FILE         6          // 一个文件不能超过 6个（数据块）
+#define NEWFS_EXTENTS_INLINE        5          // inode内联的extent数，溢出后使用间接extent块
+#define NEWFS_INLINE_MAX            216        // 内联在inode记录中的文件数据上限（字节）
+#define NEWFS_INODE_INLINE          0x1        // inode记录的flags：文件数据内联
+#define NEWFS_BLK_NONE              (-1)       // 尚未分配的数据块
+#define NEWFS_BLK_NONE_D            UINT64_MAX // 磁盘上尚未分配的数据块
+#define NEWFS_MAX_FILE_BLKS         UINT32_MAX // extent的文件内块号为32位
 #define NEWFS_DEFAULT_PERM          0777
+#define NEWFS_DIR_HASH_INIT         16         // 目录哈希索引的初始桶数
+#define NEWFS_DIR_MAX_LEAVES        (1 << 20)  // 目录最多的哈希叶子块数
+#define NEWFS_SLAB_CHUNK_MIN        64         // slab第一个chunk的对象数
+#define NEWFS_SLAB_CHUNK_MAX        4096       // slab每个chunk最多的对象数
+#define NEWFS_NAMES_CHUNK_MIN       256        // 名字区第一块的字节数
+#define NEWFS_NAMES_CHUNK_MAX       65536      // 名字区每块最多的字节数
+#define NEWFS_DEFAULT_CACHE_SZ      (1 << 20)  // 块缓存默认大小（字节），按块大小换算成块数
+#define NEWFS_MIN_CACHE_BLKS        64         // 块缓存默认容量的下限（块数）
+#define NEWFS_DEFAULT_DCACHE_ENTS   4096       // 目录项缓存默认容量（项数）
+#define NEWFS_DEFAULT_CACHE_MB      64         // inode缓存默认内存上限（MB）
+#define NEWFS_DEFAULT_DIRTY_EXPIRE  5000       // 脏数据最长驻留时间（ms），0为关闭后台回写
+#define NEWFS_DEFAULT_DIRTY_RATIO   20         // 脏块占块缓存的百分比超过该值时立即回写
+#define NEWFS_DEFAULT_RA_MAX        256        // 预读窗口上限（块数），0为关闭预读
+#define NEWFS_RA_MIN                4          // 顺序流的初始预读窗口（块数）
+#define NEWFS_RA_QUEUE              64         // 预读请求队列长度，满时丢弃新请求
+#define NEWFS_DA_MAX_SZ             (256 << 10) // 每个文件延迟分配的脏页上限（字节），超过时立即分配并写回
+#define NEWFS_DA_MIN_PAGES          16         // 大块时脏页上限不低于该页数
+#define NEWFS_WB_TICK_MS            500        // 回写线程的检查周期（ms）
+#define NEWFS_JOURNAL_MAGIC         0x4E464A4C // "NFJL"
+#define NEWFS_JOURNAL_SZ            (256 << 10) // mkfs默认日志区大小（字节），含日志超级块
+#define NEWFS_JOURNAL_MIN_BLKS      64         // 大块时默认日志区不少于该块数
+#define NEWFS_JOURNAL_LEAST_BLKS    4          // 日志区至少要容纳日志超级块、一个描述块、一个副本与提交块
+#define NEWFS_JOURNAL_COMMIT_PCT    75         // 正在积累的事务估计超过日志区的该百分比时，先提交再执行下一个操作
+#define NEWFS_JOURNAL_DESC          1          // 描述块：其后紧跟cnt个元数据块的副本
+#define NEWFS_JOURNAL_COMMIT        2          // 提交块：校验和覆盖本事务所有描述块与副本
+#define NEWFS_JOURNAL_REVOKE        3          // 撤销块：列出已释放的元数据块，重放时跳过它们在之前事务中的副本
+#define NEWFS_DEFAULT_DISK_MB       4          // 镜像文件/RAM盘默认大小（MB）
+#define NEWFS_DEFAULT_IO_SZ         512        // 非ddriver后端的IO单位
+#define NEWFS_DEFAULT_BLK_SZ        4096       // mkfs默认块大小（字节）
+#define NEWFS_SMALL_BLK_SZ          1024       // 小设备的默认块大小
+#define NEWFS_SMALL_DISK_SZ         (512ULL << 20) // 小于该大小的设备默认使用小块
+#define NEWFS_MIN_BLK_SZ            1024
+#define NEWFS_MAX_BLK_SZ            65536      // 目录项rec_len为16位
+#define NEWFS_DEFAULT_INODE_RATIO   8192       // mkfs默认每8KB磁盘空间一个inode
+#define NEWFS_MKFS_ZERO_SZ          (1 << 20)  // mkfs清零元数据区时每次写的字节数
+#define NEWFS_LAT_BUCKETS           24         // 延迟直方图桶数，最后一桶含8秒以上
+#define NEWFS_STATS_DIR             "/.newfs"  // 只读的虚拟目录，不占用inode
+#define NEWFS_STATS_FILE            "/.newfs/stats"
+#define NEWFS_TRACE_MAGIC           0x4e465452 // "NFTR"
+#define NEWFS_TRACE_VERSION         1
+#define NEWFS_DEFAULT_TRACE_MB      16         // 跟踪环形区默认大小（MB），写满后覆盖最早的记录
+#define NEWFS_TRACE_PAD             0xff       // 环形区末尾放不下一条记录时的填充
+#define NEWFS_LOG_MAGIC             0x4e464c47 // "NFLG"
+#define NEWFS_LOG_VERSION           1
+#define NEWFS_LOG_RING_EVS          8192       // 每个线程的事件环形区容量，为2的幂
 
 /******************************************************************************
 * SECTION: Macro Function
 *******************************************************************************/
-#define NEWFS_IO_SZ()                   (newfs_super.sz_io)
-#define NEWFS_BLK_SZ()                  (newfs_super.sz_blk)
-#define NEWFS_DISK_SZ()                 (newfs_super.sz_disk)
-#define NEWFS_DRIVER()                  (newfs_super.driver_fd)
-#define NEWFS_MAX_INO()                 (newfs_super.max_ino)
-#define NEWFS_MAX_DATA()                (newfs_super.max_data)
+#define NEWFS_IO_SZ()                   (newfs_ctx->sz_io)
+#define NEWFS_BLK_SZ()                  (newfs_ctx->sz_blk)
+#define NEWFS_DISK_SZ()                 (newfs_ctx->sz_disk)
+#define NEWFS_DRIVER()                  (&newfs_ctx->backend)
+#define NEWFS_CACHE_PINNED(blk)         ((blk)->is_dirty && (blk)->is_meta && (blk)->jseq == 0)
+#define NEWFS_DA_MAX_PAGES()            (NEWFS_DA_MAX_SZ / NEWFS_BLK_SZ() > NEWFS_DA_MIN_PAGES ? \
+                                         NEWFS_DA_MAX_SZ / NEWFS_BLK_SZ() : NEWFS_DA_MIN_PAGES)
+#define NEWFS_JOURNAL_TAGS()            ((NEWFS_BLK_SZ() - sizeof(struct newfs_journal_hdr_d)) / sizeof(uint64_t))
+#define NEWFS_RDLOCK()                  pthread_rwlock_rdlock(&newfs_ctx->ns_lock)
+#define NEWFS_WRLOCK()                  pthread_rwlock_wrlock(&newfs_ctx->ns_lock)
+#define NEWFS_UNLOCK()                  pthread_rwlock_unlock(&newfs_ctx->ns_lock)
+#define NEWFS_CACHE_LOCK()              pthread_mutex_lock(&newfs_ctx->cache.lock)
+#define NEWFS_CACHE_UNLOCK()            pthread_mutex_unlock(&newfs_ctx->cache.lock)
+#define NEWFS_ATOMIC_INC(p)             __atomic_add_fetch((p), 1, __ATOMIC_RELAXED)
+#define NEWFS_ATOMIC_DEC(p)             __atomic_sub_fetch((p), 1, __ATOMIC_RELAXED)
+#define NEWFS_ATOMIC_ADD(p, v)          __atomic_add_fetch((p), (v), __ATOMIC_RELAXED)
+#define NEWFS_ATOMIC_GET(p)             __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define NEWFS_ATOMIC_SET(p, v)          __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define NEWFS_MAX_INO()                 (newfs_ctx->max_ino)
+#define NEWFS_MAX_DATA()                (newfs_ctx->max_data)
 
 #define NEWFS_ROUND_DOWN(value, round)  (value % round == 0 ? value : (value / round) * round)
 #define NEWFS_ROUND_UP(value, round)    (value % round == 0 ? value : (value / round + 1) * round)
 
-#define NEWFS_BLKS_SZ(blks)             (blks * NEWFS_BLK_SZ())
+#define NEWFS_BLKS_SZ(blks)             ((uint64_t)(blks) * NEWFS_BLK_SZ())
+#define NEWFS_DIRENT_LEN(name_len)      (((int)sizeof(struct newfs_dirent_d) + (name_len) + 3) & ~3)
+#define NEWFS_EXTENTS_PER_BLK()         ((NEWFS_BLK_SZ() - sizeof(struct newfs_extent_blk_d)) \
+                                         / sizeof(struct newfs_extent_d))
 
 
 #define NEWFS_IS_DIR(pinode)            (pinode->dentry->ftype == NEWFS_DIR)
 #define NEWFS_IS_REG(pinode)            (pinode->dentry->ftype == NEWFS_REG_FILE)
 
-#define NEWFS_ASSIGN_FNAME(pnewfs_dentry, _fname)\
-                                        memcpy(pnewfs_dentry->fname, _fname, strlen(_fname))
                             
 #define NEWFS_INO_SZ()                  (sizeof(struct newfs_inode_d))
-#define NEWFS_INO_OFS(ino)              (newfs_super.inode_offset + ino * NEWFS_INO_SZ())
-#define NEWFS_DATA_OFS(blk)             (newfs_super.data_offset +  NEWFS_BLKS_SZ((blk)))
+#define NEWFS_INO_OFS(ino)              (newfs_ctx->inode_offset + (uint64_t)(ino) * NEWFS_INO_SZ())
+#define NEWFS_DATA_OFS(blk)             (newfs_ctx->data_offset +  NEWFS_BLKS_SZ((blk)))
+#define NEWFS_DATA_BLKNO(blk)           (newfs_ctx->data_offset / NEWFS_BLK_SZ() + (blk))   // 数据块的设备块号
 /******************************************************************************            
-// #define NEWFS_INO_OFS(ino)                (newfs_super.inode_offset + ino * NEWFS_BLKS_SZ((\
+// #define NEWFS_INO_OFS(ino)                (newfs_ctx->inode_offset + ino * NEWFS_BLKS_SZ((\
 //                                          NEWFS_INODE_PER_FILE)))
-// #define NEWFS_DATA_OFS(ino)               (newfs_super.data_offset + ino * NEWFS_BLKS_SZ((\
+// #define NEWFS_DATA_OFS(ino)               (newfs_ctx->data_offset + ino * NEWFS_BLKS_SZ((\
 //                                         NEWFS_DATA_PER_FILE)))
 *******************************************************************************/
 
@@ -78,6 +150,466 @@ typedef enum newfs_file_type {
 
 struct custom_options {
 	 char*        device;
+	 char*        backend;                                  /* 设备后端: ddriver/file/mmap/ram */
+	 int          disk_mb;                                  /* 新建镜像或RAM盘的大小（MB） */
+	 int          cache_blks;                               /* 块缓存容量（块数），0时按NEWFS_DEFAULT_CACHE_SZ换算 */
+	 int          dcache_ents;                              /* 目录项缓存容量（项数） */
+	 int          cache_mb;                                 /* 内存中inode与目录项树的上限（MB） */
+	 int          dirty_expire;                             /* 脏数据最长驻留时间（ms） */
+	 int          dirty_ratio;                              /* 脏块百分比阈值 */
+	 int          ra_max;                                   /* 预读窗口上限（块数） */
+	 int          format;                                   /* 挂载前先按默认几何参数格式化 */
+	 char*        trace;                                    /* 操作跟踪文件，NULL为不跟踪 */
+	 int          trace_mb;                                 /* 跟踪环形区大小（MB） */
+	 char*        log;                                      /* 二进制事件日志文件，NULL为不记录 */
+	 int          log_level;                                /* 日志级别，0时保持默认（只输出错误） */
+};
+
+/******************************************************************************
+* SECTION: Format
+*******************************************************************************/
+struct newfs_geometry {
+    int                         sz_blk;                        /* 块大小（字节），2的幂，0时按设备大小选择 */
+    int                         inodes;                        /* inode数，0时按inode_ratio计算 */
+    int                         inode_ratio;                   /* 每多少字节磁盘空间一个inode */
+    int                         journal_blks;                  /* 日志区块数，含日志超级块，0时按NEWFS_JOURNAL_SZ换算 */
+};
+
+/******************************************************************************
+* SECTION: Block Device Backend
+*******************************************************************************/
+struct newfs_backend;
+
+struct newfs_backend_stats {
+    uint64_t                    reads;
+    uint64_t                    writes;
+    uint64_t                    bytes_read;
+    uint64_t                    bytes_written;
+    uint64_t                    flushes;
+};
+
+struct newfs_backend_ops {
+    const char*                 name;
+    int                         (*open)(struct newfs_backend* be, const char* path, int disk_mb);
+    int                         (*close)(struct newfs_backend* be);
+    /* pread风格读写，offset与size均按sz_io对齐 */
+    int                         (*read)(struct newfs_backend* be, uint8_t* buf, int size, off_t offset);
+    int                         (*write)(struct newfs_backend* be, const uint8_t* buf, int size, off_t offset);
+    int                         (*flush)(struct newfs_backend* be);
+    boolean                     serial;                        /* 读写依赖设备的文件位置，需互斥 */
+    boolean                     transient;                     /* 内容不持久，每次挂载都要格式化 */
+};
+
+struct newfs_backend {
+    const struct newfs_backend_ops* ops;
+    int                         fd;
+    uint8_t*                    base;                          /* mmap/RAM盘的映射地址 */
+    off_t                       sz_disk;
+    int                         sz_io;
+    pthread_mutex_t             lock;                          /* serial后端的读写互斥 */
+    struct newfs_backend_stats  stats;                         /* 原子累加 */
+};
+
+/******************************************************************************
+* SECTION: Block Cache
+*******************************************************************************/
+struct newfs_cache_blk {
+    uint64_t                    blkno;                         /* 设备块号 */
+    boolean                     is_dirty;
+    boolean                     is_meta;                       /* 元数据块，经日志提交后才能写回原位 */
+    boolean                     is_ra;                         /* 预读载入且尚未被访问 */
+    uint64_t                    jseq;                          /* 所属已提交事务号，0为尚未提交 */
+    uint8_t*                    data;
+    uint8_t*                    frozen;                        /* 已提交、未写回原位时又被修改，保存提交时的内容 */
+    struct newfs_cache_blk*     hnext;                         /* 哈希链 */
+    struct newfs_cache_blk*     prev;                          /* LRU链 */
+    struct newfs_cache_blk*     next;
+};
+
+struct newfs_cache_stats {
+    uint64_t                    hits;
+    uint64_t                    misses;
+    uint64_t                    evictions;
+    uint64_t                    writebacks;                    /* 脏块写回次数 */
+    uint64_t                    prefetched;                    /* 预读载入的块数 */
+    uint64_t                    ra_hits;                       /* 预读的块在淘汰前被访问 */
+    uint64_t                    ra_wasted;                     /* 预读的块未被访问就被淘汰 */
+};
+
+struct newfs_cache {
+    int                         capacity;
+    int                         count;
+    int                         dirty_cnt;                     /* 原子读写，回写线程不持锁读取 */
+    int                         meta_cnt;                      /* 尚未提交的元数据脏块数，原子读写 */
+    int                         nbuckets;
+    struct newfs_cache_blk**    buckets;
+    struct newfs_cache_blk      lru;                           /* 哨兵：next为最近使用，prev为最久未用 */
+    struct newfs_cache_stats    stats;
+    pthread_mutex_t             lock;                          /* 保护哈希表、LRU链与块内容 */
+};
+
+/******************************************************************************
+* SECTION: Dentry Cache
+*******************************************************************************/
+struct newfs_dentry;
+
+struct newfs_dcache_ent {
+    struct newfs_dentry*        parent;                        /* 所在目录的dentry，NULL为空闲项 */
+    struct newfs_dentry*        dentry;                        /* 查找结果，NULL为负向项（名字不存在） */
+    uint32_t                    hash;                          /* 名字哈希 */
+    int                         len;
+    char                        name[NEWFS_MAX_FILE_NAME];
+    struct newfs_dcache_ent*    hnext;                         /* 哈希链 */
+    struct newfs_dcache_ent*    prev;                          /* LRU链 */
+    struct newfs_dcache_ent*    next;
+};
+
+struct newfs_dcache_stats {
+    uint64_t                    hits;                          /* 命中正向项 */
+    uint64_t                    neg_hits;                      /* 命中负向项 */
+    uint64_t                    misses;
+    uint64_t                    evictions;
+    uint64_t                    invalidations;                 /* 创建文件使负向项失效 */
+};
+
+struct newfs_dcache {
+    int                         capacity;
+    int                         count;
+    int                         nbuckets;                      /* 2的幂 */
+    struct newfs_dcache_ent*    ents;                          /* 挂载时一次性分配的项池 */
+    struct newfs_dcache_ent**   buckets;
+    struct newfs_dcache_ent     lru;                           /* 哨兵：next为最近使用，prev为最久未用 */
+    struct newfs_dcache_stats   stats;
+    pthread_mutex_t             lock;
+};
+
+/******************************************************************************
+* SECTION: Inode Cache
+*******************************************************************************/
+struct newfs_icache_stats {
+    uint64_t                    loads;                         /* 从磁盘读入inode次数 */
+    uint64_t                    evictions;
+    uint64_t                    writebacks;                    /* 淘汰时写回脏inode次数 */
+};
+
+struct newfs_icache {
+    uint64_t                    capacity;                      /* 内存上限（字节） */
+    uint64_t                    bytes;                         /* 已载入inode及其目录项的估算占用 */
+    int                         count;
+    struct newfs_inode*         lru_head;                      /* 最近使用 */
+    struct newfs_inode*         lru_tail;                      /* 最久未用 */
+    struct newfs_icache_stats   stats;
+    pthread_mutex_t             lock;                          /* 保护LRU链与内存记账 */
+};
+
+/******************************************************************************
+* SECTION: Journal
+*******************************************************************************/
+struct newfs_journal_stats {
+    uint64_t                    commits;
+    uint64_t                    logged_blks;                   /* 写入日志的元数据块数 */
+    uint64_t                    checkpoints;
+    uint64_t                    overflows;                     /* 事务超过日志容量，拆成多次提交 */
+    uint64_t                    revoked_blks;                  /* 写入日志的撤销记录数 */
+    uint64_t                    replayed_txns;
+    uint64_t                    replayed_blks;
+};
+
+struct newfs_journal {
+    uint64_t                    sb_blkno;                      /* 日志超级块的设备块号 */
+    uint64_t                    nblks;                         /* 环形日志区块数（不含日志超级块） */
+    uint64_t                    head;                          /* 下一次追加的位置 */
+    uint64_t                    tail;                          /* 最早一个尚未检查点的事务的位置 */
+    uint64_t                    used;
+    uint64_t                    seq;                           /* 下一个事务号 */
+    uint64_t                    tail_seq;
+    uint32_t                    jid;                           /* 格式化时生成，区分旧文件系统残留的日志 */
+    uint64_t*                   revoked;                       /* 本事务中释放的元数据块，随下一次提交写入日志 */
+    int                         revoke_cnt;                    /* 原子读写，提交前不持锁估计事务大小 */
+    int                         revoke_cap;
+    struct newfs_journal_stats  stats;
+};
+
+/******************************************************************************
+* SECTION: Writeback
+*******************************************************************************/
+struct newfs_wb_stats {
+    uint64_t                    expire_runs;                   /* 因超时触发的回写 */
+    uint64_t                    ratio_runs;                    /* 因脏块过多触发的回写 */
+    uint64_t                    fsyncs;
+};
+
+struct newfs_writeback {
+    pthread_t                   thread;
+    pthread_mutex_t             lock;                          /* 配合cond等待 */
+    pthread_cond_t              cond;
+    boolean                     running;
+    boolean                     stop;
+    int                         expire_ms;
+    int                         ratio;
+    uint64_t                    dirty_since;                   /* 最早变脏的时刻（ms），0表示干净，原子读写 */
+    struct newfs_wb_stats       stats;
+};
+
+/******************************************************************************
+* SECTION: Readahead
+*******************************************************************************/
+struct newfs_inode;
+
+struct newfs_ra_req {
+    struct newfs_inode*         inode;                         /* 入队时引用，处理完释放 */
+    uint64_t                    lblk;                          /* 文件内起始块号 */
+    uint32_t                    nblks;
+};
+
+struct newfs_ra_stats {
+    uint64_t                    reqs;                          /* 提交的预读请求 */
+    uint64_t                    dropped;                       /* 队列满时丢弃的请求 */
+    uint64_t                    blks;                          /* 请求覆盖的块数 */
+    uint64_t                    resets;                        /* 随机访问收回窗口的次数 */
+};
+
+struct newfs_readahead {
+    pthread_t                   thread;
+    pthread_mutex_t             lock;                          /* 保护请求队列，配合cond等待 */
+    pthread_cond_t              cond;
+    boolean                     running;
+    boolean                     stop;
+    int                         max;                           /* 窗口上限（块数） */
+    struct newfs_ra_req         reqs[NEWFS_RA_QUEUE];          /* 环形队列 */
+    int                         head;
+    int                         cnt;
+    struct newfs_ra_stats       stats;
+};
+
+/* 打开文件的句柄，存放在fi->fh，记录该文件描述符的访问模式 */
+struct newfs_file {
+    struct newfs_inode*         inode;                         /* 打开期间引用，不会被淘汰 */
+    pthread_mutex_t             lock;                          /* 保护以下预读状态 */
+    uint64_t                    next_off;                      /* 上一次读结束的位置，从这里开始的读视为顺序 */
+    uint64_t                    ra_start;                      /* 当前预读窗口的文件内起始块号 */
+    uint32_t                    ra_size;                       /* 当前窗口块数，0为未在预读 */
+    char*                       snap;                          /* 统计文件打开时的快照，inode为NULL */
+    size_t                      snap_len;
+};
+
+/******************************************************************************
+* SECTION: Delayed Allocation
+*******************************************************************************/
+/* 尚未分配数据块的文件页，大小为一个块 */
+struct newfs_dpage {
+    uint32_t                    lblk;                          /* 文件内块号 */
+    uint8_t                     data[];
+};
+
+struct newfs_da_stats {
+    uint64_t                    flushes;                       /* 有脏页的文件被写回的次数 */
+    uint64_t                    full_flushes;                  /* 文件脏页达到上限，在写路径上写回 */
+    uint64_t                    runs;                          /* 分配的连续块段，每段一次设备写 */
+    uint64_t                    blks;
+};
+
+struct newfs_delalloc {
+    int                         pages;                         /* 所有文件的脏页数，原子增减 */
+    struct newfs_da_stats       stats;                         /* 原子累加 */
+};
+
+/******************************************************************************
+* SECTION: Stats
+*******************************************************************************/
+typedef enum newfs_op {
+    NEWFS_OP_GETATTR,
+    NEWFS_OP_MKDIR,
+    NEWFS_OP_MKNOD,
+    NEWFS_OP_READDIR,
+    NEWFS_OP_READ,
+    NEWFS_OP_WRITE,
+    NEWFS_OP_TRUNCATE,
+    NEWFS_OP_OPEN,
+    NEWFS_OP_RELEASE,
+    NEWFS_OP_OPENDIR,
+    NEWFS_OP_RELEASEDIR,
+    NEWFS_OP_FSYNC,
+    NEWFS_OP_FLUSH,
+    NEWFS_OP_UNLINK,
+    NEWFS_OP_RMDIR,
+    NEWFS_OP_RENAME,
+    NEWFS_OP_CNT
+} NEWFS_OP;
+
+/* 一种操作的计数与延迟直方图，第i桶为[2^i, 2^(i+1))微秒，第0桶含不足1微秒 */
+struct newfs_op_stats {
+    uint64_t                    calls;
+    uint64_t                    errors;
+    uint64_t                    total_ns;
+    uint64_t                    max_ns;
+    uint64_t                    hist[NEWFS_LAT_BUCKETS];
+};
+
+/* 每个线程一份，只由所属线程写，读取时汇总 */
+struct newfs_tstats {
+    struct newfs_op_stats       ops[NEWFS_OP_CNT];
+    struct newfs_stats*         owner;                         /* 所属实例，线程退出时不依赖当前实例 */
+    struct newfs_tstats*        prev;
+    struct newfs_tstats*        next;
+};
+
+struct newfs_stats {
+    pthread_key_t               key;                           /* 线程退出时并入retired */
+    pthread_mutex_t             lock;                          /* 保护线程链表与retired */
+    struct newfs_tstats*        threads;
+    struct newfs_tstats         retired;                       /* 已退出线程的计数 */
+    uint64_t                    mount_ns;
+    boolean                     running;
+};
+
+/******************************************************************************
+* SECTION: Trace
+*******************************************************************************/
+/* 跟踪文件头，之后是cap字节的环形区；head与tail为逻辑偏移，对cap取模得到位置 */
+struct newfs_trace_hdr {
+    uint32_t                    magic;
+    uint32_t                    version;
+    uint64_t                    cap;
+    uint64_t                    head;                          /* 下一条记录的写入位置 */
+    uint64_t                    tail;                          /* 最早一条未被覆盖的记录 */
+    uint64_t                    records;                       /* 累计记录数，含已被覆盖的 */
+    uint64_t                    start_ns;                      /* 开始跟踪时的墙上时间 */
+};
+
+/* 一次操作，路径紧随其后，整条按8字节对齐；填充记录只有len与op有效 */
+struct newfs_trace_rec {
+    uint32_t                    len;
+    uint8_t                     op;                            /* NEWFS_OP或NEWFS_TRACE_PAD */
+    uint8_t                     reserved;
+    uint16_t                    path_len;
+    uint64_t                    ts_ns;                         /* 相对开始跟踪的时间 */
+    uint64_t                    off;                           /* 读写、readdir的偏移，truncate的大小 */
+    uint64_t                    fh;                            /* 打开的句柄，0为未经open */
+    uint32_t                    size;
+    uint32_t                    mode;                          /* mkdir/mknod的mode，open的flags */
+    uint32_t                    lat_ns;                        /* 超过4秒的记为UINT32_MAX */
+    int32_t                     ret;
+    char                        path[];                        /* rename为源路径与目标路径，以'\0'分隔 */
+};
+
+struct newfs_trace {
+    pthread_mutex_t             lock;                          /* 保护环形区的写入 */
+    int                         fd;
+    struct newfs_trace_hdr*     hdr;                           /* 映射的文件头 */
+    uint8_t*                    ring;
+    uint64_t                    map_sz;
+    uint64_t                    start;                         /* 开始跟踪时的单调时钟（ns） */
+    boolean                     running;
+};
+
+/******************************************************************************
+* SECTION: Log
+*******************************************************************************/
+#define NEWFS_LOG_OFF               0
+#define NEWFS_LOG_ERR               1
+#define NEWFS_LOG_INFO              2
+#define NEWFS_LOG_DEBUG             3
+#ifdef NEWFS_DEBUG                              // 编译期上限，高于该级别的日志不进入二进制
+#define NEWFS_LOG_MAX               NEWFS_LOG_DEBUG
+#else
+#define NEWFS_LOG_MAX               NEWFS_LOG_INFO
+#endif
+
+typedef enum newfs_event_type {
+    NEWFS_EV_MOUNT,                                            /* sz_blk, max_ino, max_data */
+    NEWFS_EV_UMOUNT,
+    NEWFS_EV_DEV_READ,                                         /* offset, size */
+    NEWFS_EV_DEV_WRITE,                                        /* offset, size */
+    NEWFS_EV_CACHE_MISS,                                       /* blkno, nblks */
+    NEWFS_EV_CACHE_EVICT,                                      /* blkno, -, dirty */
+    NEWFS_EV_ALLOC,                                            /* goal, blk, len */
+    NEWFS_EV_ICACHE_EVICT,                                     /* ino, -, dirty */
+    NEWFS_EV_JOURNAL_COMMIT,                                   /* seq, -, blks */
+    NEWFS_EV_WB_RUN,                                           /* -, -, 0到期/1超过比例 */
+    NEWFS_EV_CNT
+} NEWFS_EVENT_TYPE;
+
+/* 一个事件，固定32字节 */
+struct newfs_event {
+    uint64_t                    ts_ns;                         /* 相对打开日志的时间 */
+    uint32_t                    type;
+    uint32_t                    c;
+    uint64_t                    a;
+    uint64_t                    b;
+};
+
+/* 每个线程一个，只由所属线程写入，写满后覆盖最早的事件 */
+struct newfs_log_ring {
+    uint64_t                    head;                          /* 累计写入的事件数 */
+    uint64_t                    base;                          /* 上次写出时的head，之前的事件不再写出 */
+    uint32_t                    tid;
+    boolean                     dead;                          /* 线程已退出，关闭日志时释放 */
+    struct newfs_log_ring*      next;
+    struct newfs_event          evs[NEWFS_LOG_RING_EVS];
+};
+
+/* 日志文件：文件头之后每个线程一段，段头之后是按时间排列的count个事件 */
+struct newfs_log_hdr {
+    uint32_t                    magic;
+    uint32_t                    version;
+    uint32_t                    ev_size;
+    uint32_t                    rings;
+    uint64_t                    start_ns;                      /* 打开日志时的墙上时间 */
+};
+
+struct newfs_log_chunk {
+    uint32_t                    tid;
+    uint32_t                    count;
+    uint64_t                    dropped;                       /* 被覆盖的事件数 */
+};
+
+/******************************************************************************
+* SECTION: Slab
+*******************************************************************************/
+struct newfs_slab_chunk {
+    struct newfs_slab_chunk*    next;
+    uint64_t                    nobjs;                         /* 之后紧跟nobjs个对象 */
+};
+
+struct newfs_slab {
+    const char*                 name;
+    size_t                      obj_sz;
+    int                         chunk_objs;                    /* 下一个chunk的对象数，逐次翻倍 */
+    void*                       free_list;                     /* 空闲对象链，链接指针存放在对象开头 */
+    struct newfs_slab_chunk*    chunks;
+    int                         nchunks;
+    uint64_t                    total;                         /* 已切分出的对象数 */
+    uint64_t                    in_use;
+    uint64_t                    peak;
+    pthread_mutex_t             lock;
+};
+
+struct newfs_name_chunk {
+    struct newfs_name_chunk*    next;
+    uint32_t                    used;
+    uint32_t                    cap;
+    char                        data[];
+};
+
+/******************************************************************************
+* SECTION: Bitmap Allocator
+*******************************************************************************/
+struct newfs_bitmap {
+    uint64_t*                   words;                         /* 位图本体，与磁盘上的字节位图共用内存 */
+    uint64_t*                   summary;                       /* 第i位为1表示words[i]中还有空闲位 */
+    int                         nbits;
+    int                         nwords;
+    int                         nsummary;
+    int                         cursor;                        /* 下一次分配从该字开始查找 */
+    int                         free_cnt;
+    int                         reserved;                      /* 已预留给延迟分配的位数，普通分配不能占用 */
+    uint64_t                    allocs;
+    uint64_t                    scan_words;                    /* 分配时累计扫描的字数 */
+    uint8_t*                    dirty;                         /* 每个位图块一个标志，sync时只写回脏块 */
+    int                         nchunks;                       /* 位图块数 */
+    int                         chunk_words;                   /* 每个位图块的字数 */
+    pthread_mutex_t             lock;                          /* 分配与释放互斥 */
 };
 
 struct newfs_super {
@@ -85,68 +617,114 @@ struct newfs_super {
     int      fd;
     /* TODO: Define yourself */
     
-    int                     driver_fd;
+    struct newfs_backend    backend;                    // 块设备后端
     int                     sz_io;
     int                     sz_blk;
-    int                     sz_disk;
-    int                     sz_usage;
+    uint64_t                sz_disk;
+    uint64_t                sz_usage;
     
     int                     max_ino;                    // 最多支持的文件数
     int                     max_data;                   // 最多数据块
     uint8_t*                map_inode;
     int                     map_inode_blks;
-    int                     map_inode_offset;           // inode位图偏移
+    uint64_t                map_inode_offset;           // inode位图偏移
     uint8_t*                map_data;
     int                     map_data_blks;              // data位图占用的块数
-    int                     map_data_offset;
+    uint64_t                map_data_offset;
 
-    int                     inode_offset;
+    uint64_t                inode_offset;
     
-    int                     data_offset;
+    uint64_t                data_offset;
+
+    struct newfs_bitmap     inode_bm;                   // inode分配器
+    struct newfs_bitmap     data_bm;                    // 数据块分配器
 
     boolean                 is_mounted;
 
     struct newfs_dentry*    root_dentry;
+    struct newfs_cache      cache;                      // 块缓存
+    struct newfs_dcache     dcache;                     // 目录项缓存
+    struct newfs_icache     icache;                     // inode缓存
+    struct newfs_inode*     dirty_inodes;               // 脏inode链表
+    struct newfs_dentry*    orphans;                    // 名字已删除、inode仍被引用的目录项，经brother串起
+    int                     dirty_cnt;                  // 原子读写，提交前不持锁估计事务大小
+    pthread_mutex_t         dirty_lock;                 // 保护脏inode链表
+    pthread_rwlock_t        ns_lock;                    // 命名空间锁：创建、同步与淘汰inode独占，其余操作共享
+    pthread_mutex_t         load_lock;                  // 共享模式下从磁盘载入inode互斥
+    struct newfs_writeback  wb;                         // 后台回写
+    struct newfs_readahead  ra;                         // 顺序预读
+    struct newfs_delalloc   da;                         // 延迟分配
+    struct newfs_journal    journal;                    // 元数据日志
+    struct newfs_slab       dentry_slab;                // 目录项分配器
+    struct newfs_slab       inode_slab;                 // inode分配器
+    struct newfs_stats      stats;                      // 操作计数与延迟
+    struct newfs_trace      trace;                      // 操作跟踪
 };
 
 
 
+/* 由inode_slab分配，字段按大小排列以免填充 */
 struct newfs_inode {
-    // uint32_t ino1;
-    /* TODO: Define yourself */
-    
-    int                         ino;                           /* 在inode位图中的下标 */
-    int                         size;                          /* 文件已占用空间 */
-    int                         dir_cnt;
+    uint64_t                    size;                          /* 文件已占用空间 */
+    uint64_t                    mem;                           /* 计入inode缓存的内存占用 */
     struct newfs_dentry*        dentry;                        /* 指向该inode的dentry */
+    struct newfs_extent*        extents;                       /* 按lblk有序的extent数组 */
+    int64_t*                    ext_blks;                      /* 间接extent块链 */
+    uint8_t*                    inline_data;                   /* 非NULL时文件数据内联，容量NEWFS_INLINE_MAX */
+    struct newfs_dpage**        dpages;                        /* 尚未分配数据块的脏页，按lblk有序 */
+    struct newfs_inode*         dirty_prev;                    /* 脏inode链表 */
+    struct newfs_inode*         dirty_next;
+    struct newfs_inode*         lru_prev;                      /* inode缓存LRU链，根inode不在链上 */
+    struct newfs_inode*         lru_next;
     struct newfs_dentry*        dentrys;                       /* 所有目录项 */
-    uint8_t*                    data;           
-    int                         data_blk[6];               // 数据块指针
+    struct newfs_name_chunk*    names;                         /* 子目录项的名字区 */
+    struct newfs_dentry**       dir_hash;                      /* 目录项哈希索引，按名字哈希分桶 */
+    struct newfs_dentry**       dir_leaf;                      /* 每个叶子块的目录项链表头 */
+    uint32_t*                   dir_used;                      /* 每个叶子块已用的字节数 */
+    uint8_t*                    dir_dirty;                     /* 每个叶子块一个脏标志 */
+    pthread_rwlock_t            rwlock;                        /* 保护size与extent：读共享，写/截断独占 */
+    int                         ino;                           /* 在inode位图中的下标 */
+    int                         ref;                           /* 已载入的子inode、打开句柄、目录游标与预读请求数，不为0时不可淘汰，原子增减 */
+    int                         ext_cnt;
+    int                         ext_cap;
+    int                         ext_blk_cnt;
+    int                         dp_cnt;
+    int                         dp_cap;
+    int                         dir_cnt;
+    int                         dir_hash_sz;
+    int                         dir_leaves;                    /* 叶子块数，为2的幂 */
+    uint32_t                    dir_gen;                       /* 每删除一个目录项加一，readdir游标据此判断next是否仍有效 */
+    boolean                     is_dirty;                      /* inode记录或目录项需要写回 */
+    boolean                     is_orphan;                     /* 名字已删除，最后一个引用释放后由newfs_reap_orphans删除 */
 };  
 
+struct newfs_extent {
+    uint32_t                    lblk;                          /* 文件内起始块号 */
+    uint32_t                    len;                           /* 连续块数 */
+    uint64_t                    pblk;                          /* 起始数据块号 */
+};
+
+/* 由dentry_slab分配，名字存放在父目录inode的名字区 */
 struct newfs_dentry {
-    char                        name[MAX_NAME_LEN];
-    // uint32_t ino;
-    /* TODO: Define yourself */
-    char                        fname[NEWFS_MAX_FILE_NAME];
+    const char*                 fname;                         /* 以0结尾 */
     struct newfs_dentry*        parent;                        /* 父亲Inode的dentry */
     struct newfs_dentry*        brother;                       /* 兄弟 */
-    int                         ino;
+    struct newfs_dentry*        hnext;                         /* 目录哈希索引链 */
+    struct newfs_dentry*        lnext;                         /* 同一叶子块的目录项链 */
     struct newfs_inode*         inode;                         /* 指向inode */
-    NEWFS_FILE_TYPE             ftype;
+    uint32_t                    hash;                          /* 名字哈希 */
+    int                         ino;
+    int                         leaf;                          /* 所在叶子块，-1为未放置 */
+    uint8_t                     name_len;
+    uint8_t                     ftype;                         /* NEWFS_FILE_TYPE */
 };
 
-
-static inline struct newfs_dentry* new_dentry(char * fname, NEWFS_FILE_TYPE ftype) {
-    struct newfs_dentry * dentry = (struct newfs_dentry *)malloc(sizeof(struct newfs_dentry));
-    memset(dentry, 0, sizeof(struct newfs_dentry));
-    NEWFS_ASSIGN_FNAME(dentry, fname);
-    dentry->ftype   = ftype;
-    dentry->ino     = -1;
-    dentry->inode   = NULL;
-    dentry->parent  = NULL;
-    dentry->brother = NULL;                                            
-}
+struct newfs_dir_cursor {
+    struct newfs_inode*         inode;                         /* 打开的目录，打开期间引用，不会被淘汰 */
+    struct newfs_dentry*        next;                          /* 下一个要输出的目录项 */
+    off_t                       off;                           /* next对应的readdir偏移 */
+    uint32_t                    gen;                           /* 记录next时目录的dir_gen */
+};
 
 /******************************************************************************
 * SECTION: FS Specific Structure - Disk structure
@@ -154,33 +732,81 @@ static inline struct newfs_dentry* new_dentry(char * fname, NEWFS_FILE_TYPE ftyp
 struct newfs_super_d
 {
     uint32_t            magic_num;
-    int                 sz_usage;
+    uint32_t            sz_blk;                         // 块大小（字节）
+    uint64_t            sz_usage;
     
-    int                 max_ino;
-    int                 max_data;                       // 最多数据块
-    int                 map_inode_blks;                 // inode位图占用的块数
-    int                 map_inode_offset;               // inode位图在磁盘上的偏移
-    int                 map_data_blks;                  // data位图占用的块数
-    int                 map_data_offset;                // data位图在磁盘上的偏移
-    int                 inode_offset;                   // inode在磁盘上的偏移
-    int                 data_offset;
-};
-// 32B
+    uint64_t            max_ino;
+    uint64_t            max_data;                       // 最多数据块
+    uint64_t            map_inode_blks;                 // inode位图占用的块数
+    uint64_t            map_inode_offset;               // inode位图在磁盘上的偏移
+    uint64_t            map_data_blks;                  // data位图占用的块数
+    uint64_t            map_data_offset;                // data位图在磁盘上的偏移
+    uint64_t            inode_offset;                   // inode在磁盘上的偏移
+    uint64_t            data_offset;
+    uint64_t            journal_offset;                 // 日志区在磁盘上的偏移
+    uint64_t            journal_blks;                   // 日志区块数
+};
+
+struct newfs_journal_sb_d
+{
+    uint32_t            magic;
+    uint32_t            jid;
+    uint64_t            tail;                           // 回放起点
+    uint64_t            tail_seq;                       // 回放起点的事务号
+};
+
+struct newfs_journal_hdr_d
+{
+    uint32_t            magic;
+    uint32_t            type;                           // NEWFS_JOURNAL_DESC/NEWFS_JOURNAL_COMMIT/NEWFS_JOURNAL_REVOKE
+    uint32_t            jid;
+    uint32_t            cnt;                            // 描述块：副本数；撤销块：块号数；提交块：本事务的副本总数
+    uint64_t            seq;
+    uint32_t            csum;                           // 提交块有效
+    uint32_t            reserved;
+    uint64_t            blknos[];                       // 描述块：各副本的原位设备块号；撤销块：被撤销的设备块号
+};
+
+struct newfs_extent_d
+{
+    uint32_t            lblk;                           /* 文件内起始块号 */
+    uint32_t            len;                            /* 连续块数 */
+    uint64_t            pblk;                           /* 起始数据块号 */
+};
+/* 间接extent块的块头，其后紧跟extent数组 */
+struct newfs_extent_blk_d
+{
+    uint64_t            next;                           /* 下一个间接extent块，NEWFS_BLK_NONE_D结尾 */
+    uint32_t            cnt;
+    uint32_t            reserved;
+    struct newfs_extent_d extents[];
+};
+// 256B
 struct newfs_inode_d
 {
-    int                 ino;                           /* 在inode位图中的下标 */
-    int                 size;                          /* 文件已占用空间 */
-    int                 dir_cnt;
+    uint32_t            ino;                           /* 在inode位图中的下标 */
     NEWFS_FILE_TYPE     ftype;   
-    int                 link;               // 链接数
-    uint16_t            data_blk[NEWFS_DATA_PER_FILE];
+    uint32_t            link;               // 链接数
+    uint32_t            dir_cnt;
+    uint64_t            size;                          /* 文件已占用空间 */
+    uint32_t            ext_cnt;                       /* extent总数，含间接块中的 */
+    uint32_t            flags;                         /* NEWFS_INODE_INLINE */
+    uint64_t            ext_blk;                       /* 间接extent块链表头，NEWFS_BLK_NONE_D表示没有 */
+    union {
+        struct newfs_extent_d extents[NEWFS_EXTENTS_INLINE];
+        uint8_t         inline_data[NEWFS_INLINE_MAX]; /* 内联时存放文件内容，不使用extent */
+    };
 };  
 
-struct newfs_dentry_d
+/* 目录文件由2^k个叶子块组成，名字哈希的低k位决定目录项所在的叶子块；
+ * 叶子块内依次排放变长记录，rec_len为0表示块内记录结束，name_len为0表示空闲记录 */
+struct newfs_dirent_d
 {
-    char                fname[NEWFS_MAX_FILE_NAME];
-    NEWFS_FILE_TYPE     ftype;
-    int                 ino;                           /* 指向的ino号 */
+    uint32_t            ino;                           /* 指向的ino号 */
+    uint16_t            rec_len;                       /* 到下一条记录的字节数，4字节对齐 */
+    uint8_t             name_len;                      /* 名字长度，不含结尾0 */
+    uint8_t             ftype;
+    char                name[];                        /* 名字，不以0结尾 */
 };  
 
 
@@ -0,0 +1,331 @@
+#include "../include/newfs.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <linux/fs.h>
+/******************************************************************************
+* SECTION: ddriver后端，依赖课程提供的libddriver.a
+*******************************************************************************/
+#ifdef NEWFS_HAVE_DDRIVER
+static int newfs_ddriver_open(struct newfs_backend* be, const char* path, int disk_mb) {
+    int sz_disk;
+    be->fd = ddriver_open((char*)path);
+    if (be->fd < 0) {
+        return -NEWFS_ERROR_IO;
+    }
+    ddriver_ioctl(be->fd, IOC_REQ_DEVICE_SIZE,  &sz_disk);
+    ddriver_ioctl(be->fd, IOC_REQ_DEVICE_IO_SZ, &be->sz_io);
+    be->sz_disk = sz_disk;
+    return NEWFS_ERROR_NONE;
+}
+
+static int newfs_ddriver_close(struct newfs_backend* be) {
+    return ddriver_close(be->fd);
+}
+
+/* ddriver每次只能读写一个IO单位，且需要先seek */
+static int newfs_ddriver_read(struct newfs_backend* be, uint8_t* buf, int size, off_t offset) {
+    ddriver_seek(be->fd, offset, SEEK_SET);
+    while (size != 0) {
+        if (ddriver_read(be->fd, (char*)buf, be->sz_io) < 0) {
+            return -NEWFS_ERROR_IO;
+        }
+        buf  += be->sz_io;
+        size -= be->sz_io;
+    }
+    return NEWFS_ERROR_NONE;
+}
+
+static int newfs_ddriver_write(struct newfs_backend* be, const uint8_t* buf, int size, off_t offset) {
+    ddriver_seek(be->fd, offset, SEEK_SET);
+    while (size != 0) {
+        if (ddriver_write(be->fd, (char*)buf, be->sz_io) < 0) {
+            return -NEWFS_ERROR_IO;
+        }
+        buf  += be->sz_io;
+        size -= be->sz_io;
+    }
+    return NEWFS_ERROR_NONE;
+}
+
+static int newfs_ddriver_flush(struct newfs_backend* be) {
+    return NEWFS_ERROR_NONE;
+}
+
+static const struct newfs_backend_ops newfs_ddriver_ops = {
+    .name  = "ddriver",
+    .open  = newfs_ddriver_open,
+    .close = newfs_ddriver_close,
+    .read  = newfs_ddriver_read,
+    .write = newfs_ddriver_write,
+    .flush = newfs_ddriver_flush,
+    .serial = TRUE,
+};
+#endif
+/******************************************************************************
+* SECTION: 镜像文件后端，pread/pwrite直接按偏移读写
+*******************************************************************************/
+/**
+ * @brief 打开镜像文件或块设备，空文件按disk_mb扩展
+ * 
+ * @param be 
+ * @param path 
+ * @param disk_mb 
+ * @return int 
+ */
+static int newfs_file_open(struct newfs_backend* be, const char* path, int disk_mb) {
+    struct stat st;
+    uint64_t    sz_dev;
+    be->fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (be->fd < 0) {
+        return -NEWFS_ERROR_IO;
+    }
+    if (fstat(be->fd, &st) < 0) {
+        goto err;
+    }
+    be->sz_io = NEWFS_DEFAULT_IO_SZ;
+    if (S_ISBLK(st.st_mode)) {
+        if (ioctl(be->fd, BLKGETSIZE64, &sz_dev) < 0) {
+            goto err;
+        }
+        be->sz_disk = sz_dev;
+        return NEWFS_ERROR_NONE;
+    }
+    if (st.st_size == 0) {
+        st.st_size = (off_t)disk_mb * 1024 * 1024;
+        if (ftruncate(be->fd, st.st_size) < 0) {
+            goto err;
+        }
+    }
+    be->sz_disk = st.st_size;
+    return NEWFS_ERROR_NONE;
+err:
+    close(be->fd);
+    be->fd = -1;
+    return -NEWFS_ERROR_IO;
+}
+
+static int newfs_file_close(struct newfs_backend* be) {
+    return close(be->fd);
+}
+
+static int newfs_file_read(struct newfs_backend* be, uint8_t* buf, int size, off_t offset) {
+    ssize_t ret;
+    while (size > 0) {
+        ret = pread(be->fd, buf, size, offset);
+        if (ret <= 0) {
+            return -NEWFS_ERROR_IO;
+        }
+        buf    += ret;
+        size   -= ret;
+        offset += ret;
+    }
+    return NEWFS_ERROR_NONE;
+}
+
+static int newfs_file_write(struct newfs_backend* be, const uint8_t* buf, int size, off_t offset) {
+    ssize_t ret;
+    while (size > 0) {
+        ret = pwrite(be->fd, buf, size, offset);
+        if (ret <= 0) {
+            return -NEWFS_ERROR_IO;
+        }
+        buf    += ret;
+        size   -= ret;
+        offset += ret;
+    }
+    return NEWFS_ERROR_NONE;
+}
+
+static int newfs_file_flush(struct newfs_backend* be) {
+    return fdatasync(be->fd) < 0 ? -NEWFS_ERROR_IO : NEWFS_ERROR_NONE;
+}
+
+static const struct newfs_backend_ops newfs_file_ops = {
+    .name  = "file",
+    .open  = newfs_file_open,
+    .close = newfs_file_close,
+    .read  = newfs_file_read,
+    .write = newfs_file_write,
+    .flush = newfs_file_flush,
+};
+/******************************************************************************
+* SECTION: mmap后端，镜像文件整体映射进内存
+*******************************************************************************/
+static int newfs_mmap_open(struct newfs_backend* be, const char* path, int disk_mb) {
+    if (newfs_file_open(be, path, disk_mb) != NEWFS_ERROR_NONE) {
+        return -NEWFS_ERROR_IO;
+    }
+    be->base = (uint8_t*)mmap(NULL, be->sz_disk, PROT_READ | PROT_WRITE, MAP_SHARED, be->fd, 0);
+    if (be->base == MAP_FAILED) {
+        be->base = NULL;
+        close(be->fd);
+        return -NEWFS_ERROR_IO;
+    }
+    return NEWFS_ERROR_NONE;
+}
+
+static int newfs_mmap_close(struct newfs_backend* be) {
+    munmap(be->base, be->sz_disk);
+    return close(be->fd);
+}
+
+/* 访问须落在映射区内 */
+static inline boolean newfs_mmap_in_range(struct newfs_backend* be, int size, off_t offset) {
+    return offset >= 0 && size >= 0 && (uint64_t)offset + size <= (uint64_t)be->sz_disk;
+}
+
+static int newfs_mmap_read(struct newfs_backend* be, uint8_t* buf, int size, off_t offset) {
+    if (!newfs_mmap_in_range(be, size, offset)) {
+        return -NEWFS_ERROR_IO;
+    }
+    memcpy(buf, be->base + offset, size);
+    return NEWFS_ERROR_NONE;
+}
+
+static int newfs_mmap_write(struct newfs_backend* be, const uint8_t* buf, int size, off_t offset) {
+    if (!newfs_mmap_in_range(be, size, offset)) {
+        return -NEWFS_ERROR_IO;
+    }
+    memcpy(be->base + offset, buf, size);
+    return NEWFS_ERROR_NONE;
+}
+
+static int newfs_mmap_flush(struct newfs_backend* be) {
+    return msync(be->base, be->sz_disk, MS_SYNC) < 0 ? -NEWFS_ERROR_IO : NEWFS_ERROR_NONE;
+}
+
+static const struct newfs_backend_ops newfs_mmap_ops = {
+    .name  = "mmap",
+    .open  = newfs_mmap_open,
+    .close = newfs_mmap_close,
+    .read  = newfs_mmap_read,
+    .write = newfs_mmap_write,
+    .flush = newfs_mmap_flush,
+};
+/******************************************************************************
+* SECTION: RAM盘后端，内容不落盘，卸载即丢弃
+*******************************************************************************/
+static int newfs_ram_open(struct newfs_backend* be, const char* path, int disk_mb) {
+    be->fd      = -1;
+    be->sz_io   = NEWFS_DEFAULT_IO_SZ;
+    be->sz_disk = (off_t)disk_mb * 1024 * 1024;
+    be->base    = (uint8_t*)calloc(1, be->sz_disk);
+    return be->base == NULL ? -NEWFS_ERROR_NOSPACE : NEWFS_ERROR_NONE;
+}
+
+static int newfs_ram_close(struct newfs_backend* be) {
+    free(be->base);
+    be->base = NULL;
+    return NEWFS_ERROR_NONE;
+}
+
+static int newfs_ram_flush(struct newfs_backend* be) {
+    return NEWFS_ERROR_NONE;
+}
+
+static const struct newfs_backend_ops newfs_ram_ops = {
+    .name  = "ram",
+    .open  = newfs_ram_open,
+    .close = newfs_ram_close,
+    .read  = newfs_mmap_read,
+    .write = newfs_mmap_write,
+    .flush = newfs_ram_flush,
+    .transient = TRUE,
+};
+/******************************************************************************
+* SECTION: 后端接口
+*******************************************************************************/
+static const struct newfs_backend_ops* newfs_backends[] = {
+#ifdef NEWFS_HAVE_DDRIVER
+    &newfs_ddriver_ops,
+#endif
+    &newfs_file_ops,
+    &newfs_mmap_ops,
+    &newfs_ram_ops,
+    NULL
+};
+
+/**
+ * @brief 默认后端：有libddriver时为ddriver，否则为镜像文件
+ * 
+ * @return const char* 
+ */
+const char* newfs_backend_default() {
+    return newfs_backends[0]->name;
+}
+
+/**
+ * @brief 按名字选择后端并打开设备
+ * 
+ * @param be 
+ * @param name 后端名，NULL则使用默认后端
+ * @param path 设备或镜像路径，RAM盘忽略
+ * @param disk_mb 新建镜像或RAM盘的大小
+ * @return int 
+ */
+int newfs_backend_open(struct newfs_backend* be, const char* name, const char* path, int disk_mb) {
+    int i;
+    if (name == NULL) {
+        name = newfs_backend_default();
+    }
+    if (disk_mb <= 0) {
+        disk_mb = NEWFS_DEFAULT_DISK_MB;
+    }
+    memset(be, 0, sizeof(struct newfs_backend));
+    pthread_mutex_init(&be->lock, NULL);
+    for (i = 0; newfs_backends[i] != NULL; i++) {
+        if (strcmp(newfs_backends[i]->name, name) == 0) {
+            be->ops = newfs_backends[i];
+            return be->ops->open(be, path, disk_mb);
+        }
+    }
+    NEWFS_ERR("[%s] unknown backend %s\n", __func__, name);
+    return -NEWFS_ERROR_UNSUPPORTED;
+}
+
+int newfs_backend_close(struct newfs_backend* be) {
+    int ret = be->ops->close(be);
+    pthread_mutex_destroy(&be->lock);
+    return ret;
+}
+
+/* 以下接口可被多个线程同时调用：pread/pwrite与内存拷贝本身线程安全，serial后端互斥 */
+int newfs_backend_read(struct newfs_backend* be, uint8_t* buf, int size, off_t offset) {
+    int ret;
+    NEWFS_ATOMIC_INC(&be->stats.reads);
+    NEWFS_ATOMIC_ADD(&be->stats.bytes_read, size);
+    NEWFS_EVENT(NEWFS_LOG_DEBUG, NEWFS_EV_DEV_READ, offset, size, 0);
+    if (!be->ops->serial) {
+        return be->ops->read(be, buf, size, offset);
+    }
+    pthread_mutex_lock(&be->lock);
+    ret = be->ops->read(be, buf, size, offset);
+    pthread_mutex_unlock(&be->lock);
+    return ret;
+}
+
+int newfs_backend_write(struct newfs_backend* be, const uint8_t* buf, int size, off_t offset) {
+    int ret;
+    NEWFS_ATOMIC_INC(&be->stats.writes);
+    NEWFS_ATOMIC_ADD(&be->stats.bytes_written, size);
+    NEWFS_EVENT(NEWFS_LOG_DEBUG, NEWFS_EV_DEV_WRITE, offset, size, 0);
+    if (!be->ops->serial) {
+        return be->ops->write(be, buf, size, offset);
+    }
+    pthread_mutex_lock(&be->lock);
+    ret = be->ops->write(be, buf, size, offset);
+    pthread_mutex_unlock(&be->lock);
+    return ret;
+}
+
+int newfs_backend_flush(struct newfs_backend* be) {
+    int ret;
+    NEWFS_ATOMIC_INC(&be->stats.flushes);
+    if (!be->ops->serial) {
+        return be->ops->flush(be);
+    }
+    pthread_mutex_lock(&be->lock);
+    ret = be->ops->flush(be);
+    pthread_mutex_unlock(&be->lock);
+    return ret;
+}
@@ -0,0 +1,358 @@
+#include "../include/newfs.h"
+/******************************************************************************
+* SECTION: 两级位图分配器
+* 
+* 位图按64位字扫描，summary的每一位记录对应的字是否还有空闲位，
+* 分配时先用ctz在summary中找到有空闲的字，再用ctz在字内找到空闲位，
+* 即使设备接近写满，单次分配也只需扫描少量的字。
+* 每个位图一把锁，文件写入可在共享模式下并发分配数据块。
+* 延迟分配的脏页在写入时预留位数，普通分配不能占用预留部分，
+* 写回时按连续段分配并从预留中扣除，写回不会因空间不足失败。
+*******************************************************************************/
+#define NEWFS_WORD_FULL         (~(uint64_t)0)
+
+/**
+ * @brief 第w个字中属于位图范围的位，末尾字的越界位视为已占用
+ * 
+ * @param bm 
+ * @param w 
+ * @return uint64_t 
+ */
+static inline uint64_t newfs_bitmap_valid(struct newfs_bitmap* bm, int w) {
+    int tail = bm->nbits - w * UINT64_BITS;
+    return tail >= UINT64_BITS ? NEWFS_WORD_FULL : (((uint64_t)1 << tail) - 1);
+}
+
+static inline boolean newfs_bitmap_word_full(struct newfs_bitmap* bm, int w) {
+    uint64_t valid = newfs_bitmap_valid(bm, w);
+    return (bm->words[w] & valid) == valid;
+}
+
+static inline void newfs_bitmap_update_summary(struct newfs_bitmap* bm, int w) {
+    bm->dirty[w / bm->chunk_words] = TRUE;
+    if (newfs_bitmap_word_full(bm, w)) {
+        bm->summary[w / UINT64_BITS] &= ~((uint64_t)1 << (w % UINT64_BITS));
+    }
+    else {
+        bm->summary[w / UINT64_BITS] |= ((uint64_t)1 << (w % UINT64_BITS));
+    }
+}
+
+/**
+ * @brief 建立位图的summary层，map须按8字节对齐且长度覆盖nbits
+ * 
+ * @param bm 
+ * @param map 磁盘位图在内存中的副本
+ * @param nbits 位图管理的对象数
+ * @return int 
+ */
+int newfs_bitmap_init(struct newfs_bitmap* bm, uint8_t* map, int nbits) {
+    int w;
+    memset(bm, 0, sizeof(struct newfs_bitmap));
+    bm->words    = (uint64_t*)map;
+    bm->nbits    = nbits;
+    bm->nwords   = NEWFS_ROUND_UP(nbits, UINT64_BITS) / UINT64_BITS;
+    bm->nsummary = NEWFS_ROUND_UP(bm->nwords, UINT64_BITS) / UINT64_BITS;
+    bm->summary  = (uint64_t*)calloc(bm->nsummary > 0 ? bm->nsummary : 1, sizeof(uint64_t));
+    bm->chunk_words = NEWFS_BLK_SZ() / sizeof(uint64_t);
+    bm->nchunks  = NEWFS_ROUND_UP(bm->nwords, bm->chunk_words) / bm->chunk_words;
+    bm->dirty    = (uint8_t*)calloc(bm->nchunks > 0 ? bm->nchunks : 1, sizeof(uint8_t));
+    if (bm->summary == NULL || bm->dirty == NULL) {
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    for (w = 0; w < bm->nwords; w++) {
+        bm->free_cnt += __builtin_popcountll(~bm->words[w] & newfs_bitmap_valid(bm, w));
+        newfs_bitmap_update_summary(bm, w);
+    }
+    memset(bm->dirty, 0, bm->nchunks);                /* 与磁盘一致，格式化时由调用者整体标脏 */
+    pthread_mutex_init(&bm->lock, NULL);
+    return NEWFS_ERROR_NONE;
+}
+
+void newfs_bitmap_destroy(struct newfs_bitmap* bm) {
+    pthread_mutex_destroy(&bm->lock);
+    free(bm->summary);
+    free(bm->dirty);
+    bm->summary = NULL;
+    bm->dirty   = NULL;
+}
+
+/**
+ * @brief 将整个位图标脏，格式化时使用
+ * 
+ * @param bm 
+ * @return void
+ */
+void newfs_bitmap_dirty_all(struct newfs_bitmap* bm) {
+    memset(bm->dirty, TRUE, bm->nchunks);
+}
+
+/**
+ * @brief 只写回被修改过的位图块
+ * 
+ * @param bm 
+ * @param offset 位图在磁盘上的偏移
+ * @return int 
+ */
+int newfs_bitmap_sync(struct newfs_bitmap* bm, uint64_t offset) {
+    int c, ret = NEWFS_ERROR_NONE;
+    pthread_mutex_lock(&bm->lock);
+    for (c = 0; c < bm->nchunks; c++) {
+        if (!bm->dirty[c]) {
+            continue;
+        }
+        if (newfs_driver_write(offset + NEWFS_BLKS_SZ(c), (uint8_t *)(bm->words + c * bm->chunk_words),
+                               NEWFS_BLK_SZ()) != NEWFS_ERROR_NONE) {
+            ret = -NEWFS_ERROR_IO;
+            break;
+        }
+        bm->dirty[c] = FALSE;
+    }
+    pthread_mutex_unlock(&bm->lock);
+    return ret;
+}
+
+/**
+ * @brief 从第start个字开始（循环）查找有空闲位的字
+ * 
+ * @param bm 
+ * @param start 
+ * @return int 字下标，没有空闲返回-1
+ */
+static int newfs_bitmap_find_word(struct newfs_bitmap* bm, int start) {
+    int      s    = start / UINT64_BITS;
+    uint64_t mask = NEWFS_WORD_FULL << (start % UINT64_BITS);
+    uint64_t sum;
+    int      i;
+    for (i = 0; i <= bm->nsummary; i++) {
+        sum = bm->summary[s] & mask;
+        bm->scan_words++;
+        if (sum != 0) {
+            return s * UINT64_BITS + __builtin_ctzll(sum);
+        }
+        mask = NEWFS_WORD_FULL;
+        s    = s + 1 == bm->nsummary ? 0 : s + 1;
+    }
+    return -1;
+}
+
+/**
+ * @brief 占用第w个字中最低的空闲位
+ * 
+ * @param bm 
+ * @param w 
+ * @return int 位下标
+ */
+static int newfs_bitmap_take(struct newfs_bitmap* bm, int w) {
+    int bit = __builtin_ctzll(~bm->words[w] & newfs_bitmap_valid(bm, w));
+    bm->words[w] |= ((uint64_t)1 << bit);
+    bm->free_cnt--;
+    bm->allocs++;
+    newfs_bitmap_update_summary(bm, w);
+    return w * UINT64_BITS + bit;
+}
+
+static inline boolean newfs_bitmap_bit(struct newfs_bitmap* bm, int idx) {
+    return (bm->words[idx / UINT64_BITS] >> (idx % UINT64_BITS)) & 1;
+}
+
+static int newfs_bitmap_alloc_locked(struct newfs_bitmap* bm) {
+    int w;
+    if (bm->free_cnt <= bm->reserved) {
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    w = newfs_bitmap_find_word(bm, bm->cursor);
+    if (w < 0) {
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    bm->cursor = w;
+    return newfs_bitmap_take(bm, w);
+}
+
+/**
+ * @brief 分配一个空闲位，从上一次分配的位置继续查找
+ * 
+ * @param bm 
+ * @return int 位下标，已满返回-NEWFS_ERROR_NOSPACE
+ */
+int newfs_bitmap_alloc(struct newfs_bitmap* bm) {
+    int idx;
+    pthread_mutex_lock(&bm->lock);
+    idx = newfs_bitmap_alloc_locked(bm);
+    pthread_mutex_unlock(&bm->lock);
+    return idx;
+}
+
+/**
+ * @brief 优先分配goal，否则从goal所在的字向后查找，使分配结果靠近goal
+ * 
+ * @param bm 
+ * @param goal 
+ * @return int 位下标，已满返回-NEWFS_ERROR_NOSPACE
+ */
+int newfs_bitmap_alloc_near(struct newfs_bitmap* bm, int64_t goal) {
+    int w, idx;
+    pthread_mutex_lock(&bm->lock);
+    w = goal / UINT64_BITS;
+    if (goal < 0 || goal >= bm->nbits) {
+        idx = newfs_bitmap_alloc_locked(bm);
+    }
+    else if (bm->free_cnt <= bm->reserved) {
+        idx = -NEWFS_ERROR_NOSPACE;
+    }
+    else if (!newfs_bitmap_bit(bm, goal)) {
+        bm->words[w] |= ((uint64_t)1 << (goal % UINT64_BITS));
+        bm->free_cnt--;
+        bm->allocs++;
+        newfs_bitmap_update_summary(bm, w);
+        idx = goal;
+    }
+    else if (!newfs_bitmap_word_full(bm, w)) {
+        bm->scan_words++;
+        idx = newfs_bitmap_take(bm, w);
+    }
+    else {
+        w   = newfs_bitmap_find_word(bm, w);
+        idx = w < 0 ? -NEWFS_ERROR_NOSPACE : newfs_bitmap_take(bm, w);
+    }
+    pthread_mutex_unlock(&bm->lock);
+    return idx;
+}
+
+/**
+ * @brief 预留n位，之后由newfs_bitmap_alloc_run分配
+ * 
+ * @param bm 
+ * @param n 
+ * @return boolean 空闲位不足时返回FALSE
+ */
+boolean newfs_bitmap_reserve(struct newfs_bitmap* bm, int n) {
+    boolean ok;
+    pthread_mutex_lock(&bm->lock);
+    ok = bm->free_cnt - bm->reserved >= n;
+    if (ok) {
+        bm->reserved += n;
+    }
+    pthread_mutex_unlock(&bm->lock);
+    return ok;
+}
+
+/**
+ * @brief 归还未使用的预留
+ * 
+ * @param bm 
+ * @param n 
+ * @return void
+ */
+void newfs_bitmap_unreserve(struct newfs_bitmap* bm, int n) {
+    pthread_mutex_lock(&bm->lock);
+    bm->reserved -= n;
+    pthread_mutex_unlock(&bm->lock);
+}
+
+/**
+ * @brief 从goal开始（循环）查找want个连续空闲位，找不到时取途中最长的一段；
+ * 分配的位从预留中扣除，调用者须已预留至少want位
+ * 
+ * @param bm 
+ * @param goal 期望的起始位，越界时从上一次分配的位置开始
+ * @param want 
+ * @param got 输出，实际分配的位数，不超过want
+ * @return int 起始位下标，已满返回-NEWFS_ERROR_NOSPACE
+ */
+int newfs_bitmap_alloc_run(struct newfs_bitmap* bm, int64_t goal, int want, int* got) {
+    int idx, len, n = 0;
+    int best = -1, best_len = 0;
+    pthread_mutex_lock(&bm->lock);
+    idx = goal >= 0 && goal < bm->nbits ? (int)goal : bm->cursor * UINT64_BITS;
+    while (n < bm->nbits && best_len < want && bm->free_cnt > 0) {
+        if (idx >= bm->nbits) {
+            idx = 0;
+        }
+        if (idx % UINT64_BITS == 0 && newfs_bitmap_word_full(bm, idx / UINT64_BITS)) {
+            bm->scan_words++;                         /* 整字已满，直接跳过 */
+            idx += UINT64_BITS;
+            n   += UINT64_BITS;
+            continue;
+        }
+        if (newfs_bitmap_bit(bm, idx)) {
+            idx++;
+            n++;
+            continue;
+        }
+        for (len = 1; len < want && idx + len < bm->nbits && !newfs_bitmap_bit(bm, idx + len); len++);
+        if (len > best_len) {
+            best     = idx;
+            best_len = len;
+        }
+        idx += len;
+        n   += len;
+    }
+    if (best < 0) {
+        pthread_mutex_unlock(&bm->lock);
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    for (idx = best; idx < best + best_len; idx++) {
+        bm->words[idx / UINT64_BITS] |= ((uint64_t)1 << (idx % UINT64_BITS));
+        if (idx % UINT64_BITS == UINT64_BITS - 1 || idx == best + best_len - 1) {
+            newfs_bitmap_update_summary(bm, idx / UINT64_BITS);
+        }
+    }
+    bm->free_cnt -= best_len;
+    bm->reserved -= best_len;
+    bm->allocs   += best_len;
+    bm->cursor    = (best + best_len) / UINT64_BITS % bm->nwords;
+    *got = best_len;
+    pthread_mutex_unlock(&bm->lock);
+    NEWFS_EVENT(NEWFS_LOG_INFO, NEWFS_EV_ALLOC, goal, best, best_len);
+    return best;
+}
+
+/**
+ * @brief 撤销newfs_bitmap_alloc_run：释放[start, start + n)并重新计入预留；
+ * 在同一把锁内完成，释放的位不会先被普通分配取走，预留因此总能恢复
+ * 
+ * @param bm 
+ * @param start 
+ * @param n 
+ * @return void
+ */
+void newfs_bitmap_unalloc_run(struct newfs_bitmap* bm, int start, int n) {
+    int idx;
+    pthread_mutex_lock(&bm->lock);
+    for (idx = start; idx < start + n; idx++) {
+        bm->words[idx / UINT64_BITS] &= ~((uint64_t)1 << (idx % UINT64_BITS));
+        if (idx % UINT64_BITS == UINT64_BITS - 1 || idx == start + n - 1) {
+            newfs_bitmap_update_summary(bm, idx / UINT64_BITS);
+        }
+    }
+    bm->free_cnt += n;
+    bm->reserved += n;
+    pthread_mutex_unlock(&bm->lock);
+}
+
+/**
+ * @brief 释放一个位
+ * 
+ * @param bm 
+ * @param idx 
+ * @return void
+ */
+void newfs_bitmap_free(struct newfs_bitmap* bm, int idx) {
+    int w = idx / UINT64_BITS;
+    pthread_mutex_lock(&bm->lock);
+    if (newfs_bitmap_bit(bm, idx)) {
+        bm->words[w] &= ~((uint64_t)1 << (idx % UINT64_BITS));
+        bm->free_cnt++;
+        newfs_bitmap_update_summary(bm, w);
+    }
+    pthread_mutex_unlock(&bm->lock);
+}
+
+boolean newfs_bitmap_test(struct newfs_bitmap* bm, int idx) {
+    boolean ret;
+    pthread_mutex_lock(&bm->lock);
+    ret = newfs_bitmap_bit(bm, idx);
+    pthread_mutex_unlock(&bm->lock);
+    return ret;
+}
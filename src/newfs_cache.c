@@ -0,0 +1,653 @@
+#include "../include/newfs.h"
+/******************************************************************************
+* SECTION: 设备块读写
+*******************************************************************************/
+/**
+ * @brief 从设备读入一个完整的块，一次后端调用
+ * 
+ * @param blkno 设备块号
+ * @param out_content 
+ * @return int 
+ */
+static int newfs_dev_read_blk(uint64_t blkno, uint8_t* out_content) {
+    return newfs_backend_read(NEWFS_DRIVER(), out_content, NEWFS_BLK_SZ(), 
+                              (off_t)NEWFS_BLKS_SZ(blkno));
+}
+
+/**
+ * @brief 将一个完整的块写回设备
+ * 
+ * @param blkno 设备块号
+ * @param in_content 
+ * @return int 
+ */
+static int newfs_dev_write_blk(uint64_t blkno, uint8_t* in_content) {
+    return newfs_backend_write(NEWFS_DRIVER(), in_content, NEWFS_BLK_SZ(), 
+                               (off_t)NEWFS_BLKS_SZ(blkno));
+}
+/******************************************************************************
+* SECTION: LRU链表与哈希表
+*******************************************************************************/
+static inline void newfs_lru_unlink(struct newfs_cache_blk* blk) {
+    blk->prev->next = blk->next;
+    blk->next->prev = blk->prev;
+}
+
+static inline void newfs_lru_push_front(struct newfs_cache_blk* blk) {
+    struct newfs_cache_blk* head = &newfs_ctx->cache.lru;
+    blk->next       = head->next;
+    blk->prev       = head;
+    head->next->prev = blk;
+    head->next      = blk;
+}
+
+static inline struct newfs_cache_blk** newfs_hash_slot(uint64_t blkno) {
+    return &newfs_ctx->cache.buckets[blkno % newfs_ctx->cache.nbuckets];
+}
+
+static void newfs_hash_remove(struct newfs_cache_blk* blk) {
+    struct newfs_cache_blk** pp = newfs_hash_slot(blk->blkno);
+    while (*pp != NULL) {
+        if (*pp == blk) {
+            *pp = blk->hnext;
+            return;
+        }
+        pp = &(*pp)->hnext;
+    }
+}
+
+/**
+ * @brief 把冻结的已提交内容写回原位，块本身仍是未提交的脏块
+ * 
+ * @param blk 
+ * @return int 
+ */
+static int newfs_cache_write_frozen(struct newfs_cache_blk* blk) {
+    if (newfs_dev_write_blk(blk->blkno, blk->frozen) != NEWFS_ERROR_NONE) {
+        NEWFS_ERR("[%s] io error\n", __func__);
+        return -NEWFS_ERROR_IO;
+    }
+    free(blk->frozen);
+    blk->frozen = NULL;
+    newfs_ctx->cache.stats.writebacks++;
+    return NEWFS_ERROR_NONE;
+}
+
+static int newfs_cache_writeback(struct newfs_cache_blk* blk) {
+    if (newfs_dev_write_blk(blk->blkno, blk->data) != NEWFS_ERROR_NONE) {
+        NEWFS_ERR("[%s] io error\n", __func__);
+        return -NEWFS_ERROR_IO;
+    }
+    blk->is_dirty = FALSE;
+    NEWFS_ATOMIC_DEC(&newfs_ctx->cache.dirty_cnt);
+    newfs_ctx->cache.stats.writebacks++;
+    return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 从LRU尾部找一个可淘汰的块，尚未提交到日志的元数据块不能写回原位
+ * 
+ * @return struct newfs_cache_blk* 全部被钉住时返回NULL
+ */
+static struct newfs_cache_blk* newfs_cache_victim() {
+    struct newfs_cache_blk* blk = newfs_ctx->cache.lru.prev;
+    while (blk != &newfs_ctx->cache.lru && NEWFS_CACHE_PINNED(blk)) {
+        blk = blk->prev;
+    }
+    return blk == &newfs_ctx->cache.lru ? NULL : blk;
+}
+/******************************************************************************
+* SECTION: 块缓存
+*
+* 哈希表、LRU链与块内容由cache.lock保护。newfs_cache_get与newfs_cache_mark_*
+* 返回或修改块指针，调用者须持有NEWFS_CACHE_LOCK()直到不再访问该块；
+* 其余接口自行加锁。
+*******************************************************************************/
+/**
+ * @brief 初始化块缓存
+ * 
+ * @param capacity 缓存容量（块数）
+ * @return int 
+ */
+int newfs_cache_init(int capacity) {
+    struct newfs_cache* cache = &newfs_ctx->cache;
+    if (capacity <= 0) {                              /* 默认按字节数换算，大块时块数相应减少 */
+        capacity = NEWFS_DEFAULT_CACHE_SZ / NEWFS_BLK_SZ();
+        capacity = capacity < NEWFS_MIN_CACHE_BLKS ? NEWFS_MIN_CACHE_BLKS : capacity;
+    }
+    memset(cache, 0, sizeof(struct newfs_cache));
+    cache->capacity = capacity;
+    cache->nbuckets = capacity;
+    cache->buckets  = (struct newfs_cache_blk**)calloc(cache->nbuckets, 
+                                                       sizeof(struct newfs_cache_blk*));
+    if (cache->buckets == NULL) {
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    cache->lru.next = &cache->lru;
+    cache->lru.prev = &cache->lru;
+    pthread_mutex_init(&cache->lock, NULL);
+    return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 释放块缓存，调用前应先newfs_cache_flush
+ * 
+ * @return void
+ */
+void newfs_cache_destroy() {
+    struct newfs_cache*     cache = &newfs_ctx->cache;
+    struct newfs_cache_blk* blk   = cache->lru.next;
+    struct newfs_cache_blk* next;
+    while (blk != &cache->lru) {
+        next = blk->next;
+        free(blk->frozen);
+        free(blk->data);
+        free(blk);
+        blk = next;
+    }
+    free(cache->buckets);
+    cache->buckets = NULL;
+    cache->count   = 0;
+    pthread_mutex_destroy(&cache->lock);
+}
+
+/**
+ * @brief 为blkno准备一个缓存块，必要时淘汰LRU块（脏则先写回）；
+ * 未提交的元数据块不淘汰，全部钉住时暂时超出容量，之后再逐步收回
+ * 
+ * @param blkno 设备块号
+ * @return struct newfs_cache_blk* 尚未加入哈希表与LRU链，出错返回NULL
+ */
+static struct newfs_cache_blk* newfs_cache_alloc(uint64_t blkno) {
+    struct newfs_cache*     cache = &newfs_ctx->cache;
+    struct newfs_cache_blk* blk;
+
+    while (cache->count > cache->capacity && (blk = newfs_cache_victim()) != NULL) {
+        if (blk->is_dirty && newfs_cache_writeback(blk) != NEWFS_ERROR_NONE) {
+            return NULL;
+        }
+        NEWFS_EVENT(NEWFS_LOG_INFO, NEWFS_EV_CACHE_EVICT, blk->blkno, 0, blk->is_dirty);
+        newfs_lru_unlink(blk);
+        newfs_hash_remove(blk);
+        cache->stats.evictions++;
+        cache->stats.ra_wasted += blk->is_ra;
+        free(blk->data);
+        free(blk);
+        cache->count--;
+    }
+    blk = cache->count < cache->capacity ? NULL : newfs_cache_victim();
+    if (blk == NULL) {
+        blk = (struct newfs_cache_blk*)malloc(sizeof(struct newfs_cache_blk));
+        blk->data = (uint8_t*)malloc(NEWFS_BLK_SZ());
+        cache->count++;
+    }
+    else {                                            /* 淘汰最久未用的块 */
+        if (blk->is_dirty && newfs_cache_writeback(blk) != NEWFS_ERROR_NONE) {
+            return NULL;
+        }
+        NEWFS_EVENT(NEWFS_LOG_INFO, NEWFS_EV_CACHE_EVICT, blk->blkno, 0, blk->is_dirty);
+        newfs_lru_unlink(blk);
+        newfs_hash_remove(blk);
+        cache->stats.evictions++;
+        cache->stats.ra_wasted += blk->is_ra;
+    }
+
+    blk->blkno    = blkno;
+    blk->is_dirty = FALSE;
+    blk->is_meta  = FALSE;
+    blk->is_ra    = FALSE;
+    blk->jseq     = 0;
+    blk->frozen   = NULL;                             /* 冻结的块仍被钉住，不会被淘汰 */
+    return blk;
+}
+
+static void newfs_cache_insert(struct newfs_cache_blk* blk) {
+    blk->hnext = *newfs_hash_slot(blk->blkno);
+    *newfs_hash_slot(blk->blkno) = blk;
+    newfs_lru_push_front(blk);
+}
+
+/**
+ * @brief 命中时记账，预读载入的块第一次被访问计为预读命中
+ * 
+ * @param blk 
+ * @return void
+ */
+static inline void newfs_cache_hit(struct newfs_cache_blk* blk) {
+    newfs_ctx->cache.stats.hits++;
+    if (blk->is_ra) {
+        blk->is_ra = FALSE;
+        newfs_ctx->cache.stats.ra_hits++;
+    }
+}
+
+/**
+ * @brief 获取一个块的缓存，未命中时由newfs_cache_alloc腾出位置；调用者持有cache锁
+ * 
+ * @param blkno 设备块号
+ * @param need_load 未命中时是否从设备读入，整块覆盖写时可传FALSE
+ * @return struct newfs_cache_blk* 出错返回NULL
+ */
+struct newfs_cache_blk* newfs_cache_get(uint64_t blkno, boolean need_load) {
+    struct newfs_cache*     cache = &newfs_ctx->cache;
+    struct newfs_cache_blk* blk   = *newfs_hash_slot(blkno);
+
+    while (blk != NULL) {
+        if (blk->blkno == blkno) {
+            newfs_cache_hit(blk);
+            newfs_lru_unlink(blk);
+            newfs_lru_push_front(blk);
+            return blk;
+        }
+        blk = blk->hnext;
+    }
+    cache->stats.misses++;
+    NEWFS_EVENT(NEWFS_LOG_INFO, NEWFS_EV_CACHE_MISS, blkno, 1, 0);
+
+    blk = newfs_cache_alloc(blkno);
+    if (blk == NULL) {
+        return NULL;
+    }
+    if (need_load) {
+        if (newfs_dev_read_blk(blkno, blk->data) != NEWFS_ERROR_NONE) {
+            NEWFS_ERR("[%s] io error\n", __func__);
+            free(blk->data);
+            free(blk);
+            cache->count--;
+            return NULL;
+        }
+    }
+    else {
+        memset(blk->data, 0, NEWFS_BLK_SZ());
+    }
+    newfs_cache_insert(blk);
+    return blk;
+}
+
+/**
+ * @brief 查找已缓存的块，不改变LRU顺序
+ * 
+ * @param blkno 
+ * @return struct newfs_cache_blk* 未缓存返回NULL
+ */
+static struct newfs_cache_blk* newfs_cache_lookup(uint64_t blkno) {
+    struct newfs_cache_blk* blk = *newfs_hash_slot(blkno);
+    while (blk != NULL && blk->blkno != blkno) {
+        blk = blk->hnext;
+    }
+    return blk;
+}
+
+/**
+ * @brief 连续读多个块，已缓存的块从缓存复制，未缓存的连续块合并成一次设备读，
+ * 且不进入缓存，避免顺序大读冲刷缓存；设备读不持有cache锁，
+ * 调用者须持有文件的inode锁，保证这些块不会被并发写入
+ * 
+ * @param blkno 起始设备块号
+ * @param nblks 块数
+ * @param out_content 
+ * @return int 
+ */
+int newfs_cache_read_direct(uint64_t blkno, int nblks, uint8_t* out_content) {
+    struct newfs_cache_blk* blk;
+    int i = 0, start;
+    NEWFS_CACHE_LOCK();
+    while (i < nblks) {
+        blk = newfs_cache_lookup(blkno + i);
+        if (blk != NULL) {
+            newfs_cache_hit(blk);
+            memcpy(out_content + NEWFS_BLKS_SZ(i), blk->data, NEWFS_BLK_SZ());
+            i++;
+            continue;
+        }
+        start = i;
+        while (i < nblks && newfs_cache_lookup(blkno + i) == NULL) {
+            i++;
+        }
+        newfs_ctx->cache.stats.misses += i - start;
+        NEWFS_EVENT(NEWFS_LOG_INFO, NEWFS_EV_CACHE_MISS, blkno + start, i - start, 0);
+        NEWFS_CACHE_UNLOCK();
+        if (newfs_backend_read(NEWFS_DRIVER(), out_content + NEWFS_BLKS_SZ(start), 
+                               NEWFS_BLKS_SZ(i - start), 
+                               (off_t)NEWFS_BLKS_SZ(blkno + start)) != NEWFS_ERROR_NONE) {
+            return -NEWFS_ERROR_IO;
+        }
+        NEWFS_CACHE_LOCK();
+    }
+    NEWFS_CACHE_UNLOCK();
+    return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 连续写多个整块，合并成一次设备写，不进入缓存；已缓存的副本同步更新，
+ * 避免之后读到旧内容。调用者须持有文件的inode写锁，且这些块不是元数据块
+ * 
+ * @param blkno 起始设备块号
+ * @param nblks 块数
+ * @param in_content 
+ * @return int 
+ */
+int newfs_cache_write_direct(uint64_t blkno, int nblks, uint8_t* in_content) {
+    struct newfs_cache_blk* blk;
+    int i;
+    NEWFS_CACHE_LOCK();
+    for (i = 0; i < nblks; i++) {
+        blk = newfs_cache_lookup(blkno + i);
+        if (blk != NULL) {
+            memcpy(blk->data, in_content + NEWFS_BLKS_SZ(i), NEWFS_BLK_SZ());
+        }
+    }
+    NEWFS_CACHE_UNLOCK();
+    return newfs_backend_write(NEWFS_DRIVER(), in_content, NEWFS_BLKS_SZ(nblks), 
+                               (off_t)NEWFS_BLKS_SZ(blkno));
+}
+
+/**
+ * @brief 把连续多个块预读进缓存，已缓存的块跳过，未缓存的连续块合并成一次设备读；
+ * 设备读不持有cache锁，读完后只插入期间仍未被载入的块。
+ * 调用者须持有文件的inode读锁，保证这些块不会被并发写入或释放
+ * 
+ * @param blkno 起始设备块号
+ * @param nblks 块数
+ * @return int 
+ */
+int newfs_cache_prefetch(uint64_t blkno, int nblks) {
+    struct newfs_cache_blk* blk;
+    uint8_t* buf;
+    int i = 0, j, start;
+    buf = (uint8_t*)malloc(NEWFS_BLKS_SZ(nblks));
+    if (buf == NULL) {
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    NEWFS_CACHE_LOCK();
+    while (i < nblks) {
+        if (newfs_cache_lookup(blkno + i) != NULL) {
+            i++;
+            continue;
+        }
+        start = i;
+        while (i < nblks && newfs_cache_lookup(blkno + i) == NULL) {
+            i++;
+        }
+        NEWFS_CACHE_UNLOCK();
+        if (newfs_backend_read(NEWFS_DRIVER(), buf, NEWFS_BLKS_SZ(i - start), 
+                               (off_t)NEWFS_BLKS_SZ(blkno + start)) != NEWFS_ERROR_NONE) {
+            free(buf);
+            return -NEWFS_ERROR_IO;
+        }
+        NEWFS_CACHE_LOCK();
+        for (j = start; j < i; j++) {
+            if (newfs_cache_lookup(blkno + j) != NULL) {   /* 设备读期间已被载入 */
+                continue;
+            }
+            blk = newfs_cache_alloc(blkno + j);
+            if (blk == NULL) {
+                NEWFS_CACHE_UNLOCK();
+                free(buf);
+                return -NEWFS_ERROR_IO;
+            }
+            memcpy(blk->data, buf + NEWFS_BLKS_SZ(j - start), NEWFS_BLK_SZ());
+            blk->is_ra = TRUE;
+            newfs_cache_insert(blk);
+            newfs_ctx->cache.stats.prefetched++;
+        }
+    }
+    NEWFS_CACHE_UNLOCK();
+    free(buf);
+    return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 标记缓存块为脏，用于文件数据块，可随时写回原位
+ * 
+ * @param blk 
+ * @return void
+ */
+void newfs_cache_mark_dirty(struct newfs_cache_blk* blk) {
+    if (!blk->is_dirty) {
+        blk->is_dirty = TRUE;
+        blk->is_meta  = FALSE;
+        NEWFS_ATOMIC_INC(&newfs_ctx->cache.dirty_cnt);
+        newfs_wb_note_dirty();
+    }
+}
+
+/**
+ * @brief 标记元数据块为脏，在下一次日志提交前钉在缓存中
+ * 
+ * @param blk 
+ * @return void
+ */
+void newfs_cache_mark_meta_dirty(struct newfs_cache_blk* blk) {
+    if (!NEWFS_CACHE_PINNED(blk)) {
+        NEWFS_ATOMIC_INC(&newfs_ctx->cache.meta_cnt);
+    }
+    if (!blk->is_dirty) {
+        blk->is_dirty = TRUE;
+        NEWFS_ATOMIC_INC(&newfs_ctx->cache.dirty_cnt);
+        newfs_wb_note_dirty();
+    }
+    blk->is_meta = TRUE;
+    blk->jseq    = 0;
+}
+
+/**
+ * @brief 元数据块已提交到日志、尚未写回原位时，修改前冻结提交时的内容：
+ * 块再次变脏后被钉住，检查点清空日志前须把冻结的内容写回原位，否则已提交的修改只存在于被丢弃的日志中。
+ * 调用者持有cache锁
+ * 
+ * @param blk 
+ * @return int 内存不足时改为立即写回原位
+ */
+int newfs_cache_freeze(struct newfs_cache_blk* blk) {
+    if (!blk->is_dirty || !blk->is_meta || blk->jseq == 0) {
+        return NEWFS_ERROR_NONE;
+    }
+    blk->frozen = (uint8_t*)malloc(NEWFS_BLK_SZ());
+    if (blk->frozen == NULL) {
+        return newfs_cache_writeback(blk);
+    }
+    memcpy(blk->frozen, blk->data, NEWFS_BLK_SZ());
+    return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 元数据块已随事务seq提交，可以写回原位，冻结的旧内容随之作废；调用者持有cache锁
+ * 
+ * @param blk 
+ * @param seq 
+ * @return void
+ */
+void newfs_cache_mark_committed(struct newfs_cache_blk* blk, uint64_t seq) {
+    if (NEWFS_CACHE_PINNED(blk)) {
+        NEWFS_ATOMIC_DEC(&newfs_ctx->cache.meta_cnt);
+    }
+    blk->jseq = seq;
+    free(blk->frozen);
+    blk->frozen = NULL;
+}
+
+static inline void newfs_cache_discard_blk(struct newfs_cache_blk* blk) {
+    if (blk == NULL) {
+        return;
+    }
+    if (NEWFS_CACHE_PINNED(blk)) {
+        NEWFS_ATOMIC_DEC(&newfs_ctx->cache.meta_cnt);
+    }
+    if (blk->is_dirty) {
+        blk->is_dirty = FALSE;
+        NEWFS_ATOMIC_DEC(&newfs_ctx->cache.dirty_cnt);
+    }
+    free(blk->frozen);
+    blk->frozen = NULL;
+}
+
+/**
+ * @brief 丢弃[blkno, blkno + nblks)范围内块的脏内容，块被释放时调用，
+ * 避免把失效的元数据写入日志，或把已截断的文件数据写到被重新分配的块上
+ * 
+ * @param blkno 起始设备块号
+ * @param nblks 
+ * @return void
+ */
+void newfs_cache_discard(uint64_t blkno, uint64_t nblks) {
+    struct newfs_cache*     cache = &newfs_ctx->cache;
+    struct newfs_cache_blk* blk;
+    uint64_t i;
+    NEWFS_CACHE_LOCK();
+    if (nblks > (uint64_t)cache->count) {             /* 范围比缓存大时改为遍历缓存 */
+        for (blk = cache->lru.next; blk != &cache->lru; blk = blk->next) {
+            if (blk->blkno >= blkno && blk->blkno < blkno + nblks) {
+                newfs_cache_discard_blk(blk);
+            }
+        }
+    }
+    else {
+        for (i = 0; i < nblks; i++) {
+            newfs_cache_discard_blk(newfs_cache_lookup(blkno + i));
+        }
+    }
+    NEWFS_CACHE_UNLOCK();
+}
+
+static int newfs_cache_sync_range_locked(uint64_t blkno, uint64_t nblks) {
+    struct newfs_cache*     cache = &newfs_ctx->cache;
+    struct newfs_cache_blk* blk;
+    struct newfs_cache_blk* next;
+    uint64_t i;
+    if (nblks > (uint64_t)cache->count) {             /* 范围比缓存大时改为遍历缓存 */
+        for (blk = cache->lru.next; blk != &cache->lru; blk = next) {
+            next = blk->next;
+            if (blk->is_dirty && !NEWFS_CACHE_PINNED(blk) && blk->blkno >= blkno &&
+                blk->blkno < blkno + nblks && newfs_cache_writeback(blk) != NEWFS_ERROR_NONE) {
+                return -NEWFS_ERROR_IO;
+            }
+        }
+        return NEWFS_ERROR_NONE;
+    }
+    for (i = 0; i < nblks; i++) {
+        blk = newfs_cache_lookup(blkno + i);
+        if (blk != NULL && blk->is_dirty && !NEWFS_CACHE_PINNED(blk) &&
+            newfs_cache_writeback(blk) != NEWFS_ERROR_NONE) {
+            return -NEWFS_ERROR_IO;
+        }
+    }
+    return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 只写回[blkno, blkno + nblks)范围内的脏块，跳过未提交的元数据块，不刷写后端
+ * 
+ * @param blkno 起始设备块号
+ * @param nblks 
+ * @return int 
+ */
+int newfs_cache_sync_range(uint64_t blkno, uint64_t nblks) {
+    int ret;
+    NEWFS_CACHE_LOCK();
+    ret = newfs_cache_sync_range_locked(blkno, nblks);
+    NEWFS_CACHE_UNLOCK();
+    return ret;
+}
+
+static int newfs_cache_blk_cmp(const void* a, const void* b) {
+    uint64_t x = (*(struct newfs_cache_blk**)a)->blkno;
+    uint64_t y = (*(struct newfs_cache_blk**)b)->blkno;
+    return (x > y) - (x < y);
+}
+
+#define NEWFS_CACHE_UNPINNED   0                      /* 可写回原位的脏块与冻结的已提交内容 */
+#define NEWFS_CACHE_DATA       1                      /* 文件数据脏块 */
+#define NEWFS_CACHE_RUNNING    2                      /* 尚未提交的元数据脏块 */
+
+static boolean newfs_cache_match(struct newfs_cache_blk* blk, int kind) {
+    switch (kind) {
+    case NEWFS_CACHE_DATA:    return blk->is_dirty && !blk->is_meta;
+    case NEWFS_CACHE_RUNNING: return NEWFS_CACHE_PINNED(blk);
+    default:                  return (blk->is_dirty && !NEWFS_CACHE_PINNED(blk)) || blk->frozen != NULL;
+    }
+}
+
+/**
+ * @brief 按块号顺序收集某一类脏块
+ * 
+ * @param kind NEWFS_CACHE_UNPINNED/NEWFS_CACHE_DATA/NEWFS_CACHE_RUNNING
+ * @param cnt 返回块数
+ * @return struct newfs_cache_blk** 由调用者释放，没有脏块时返回NULL
+ */
+static struct newfs_cache_blk** newfs_cache_collect(int kind, int* cnt) {
+    struct newfs_cache*      cache = &newfs_ctx->cache;
+    struct newfs_cache_blk*  blk;
+    struct newfs_cache_blk** dirty;
+    *cnt = 0;
+    if (cache->dirty_cnt == 0) {
+        return NULL;
+    }
+    dirty = (struct newfs_cache_blk**)malloc(cache->dirty_cnt * sizeof(struct newfs_cache_blk*));
+    for (blk = cache->lru.next; blk != &cache->lru; blk = blk->next) {
+        if (newfs_cache_match(blk, kind)) {
+            dirty[(*cnt)++] = blk;
+        }
+    }
+    qsort(dirty, *cnt, sizeof(struct newfs_cache_blk*), newfs_cache_blk_cmp);
+    return dirty;
+}
+
+static int newfs_cache_write_kind(int kind) {
+    struct newfs_cache_blk** dirty;
+    int cnt, i;
+    int ret = NEWFS_ERROR_NONE;
+    dirty = newfs_cache_collect(kind, &cnt);
+    for (i = 0; i < cnt; i++) {
+        if (dirty[i]->frozen != NULL ? newfs_cache_write_frozen(dirty[i]) != NEWFS_ERROR_NONE
+                                     : newfs_cache_writeback(dirty[i]) != NEWFS_ERROR_NONE) {
+            ret = -NEWFS_ERROR_IO;
+            break;
+        }
+    }
+    free(dirty);
+    return ret;
+}
+
+/**
+ * @brief 收集尚未提交的元数据脏块，供日志提交；调用者持有命名空间写锁，返回的块不会被淘汰
+ * 
+ * @param cnt 返回块数
+ * @return struct newfs_cache_blk** 按块号排序，由调用者释放
+ */
+struct newfs_cache_blk** newfs_cache_collect_meta(int* cnt) {
+    struct newfs_cache_blk** blks;
+    NEWFS_CACHE_LOCK();
+    blks = newfs_cache_collect(NEWFS_CACHE_RUNNING, cnt);
+    NEWFS_CACHE_UNLOCK();
+    return blks;
+}
+
+/**
+ * @brief 按块号顺序写回所有文件数据脏块，不刷写后端（日志提交前的ordered模式）
+ * 
+ * @return int 
+ */
+int newfs_cache_flush_data() {
+    int ret;
+    NEWFS_CACHE_LOCK();
+    ret = newfs_cache_write_kind(NEWFS_CACHE_DATA);
+    NEWFS_CACHE_UNLOCK();
+    return ret;
+}
+
+/**
+ * @brief 将所有可写回的脏块按块号顺序写回设备，未提交的元数据块除外，但写回其冻结的已提交内容
+ * 
+ * @return int 
+ */
+int newfs_cache_flush() {
+    int ret;
+    NEWFS_CACHE_LOCK();
+    ret = newfs_cache_write_kind(NEWFS_CACHE_UNPINNED);
+    NEWFS_CACHE_UNLOCK();
+    if (ret != NEWFS_ERROR_NONE) {
+        return -NEWFS_ERROR_IO;
+    }
+    return newfs_backend_flush(NEWFS_DRIVER());
+}
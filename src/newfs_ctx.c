@@ -0,0 +1,49 @@
+#include "../include/newfs.h"
+/******************************************************************************
+* SECTION: 文件系统实例
+*
+* 一个挂载的全部状态都在struct newfs_super中，各模块通过线程私有的newfs_ctx访问当前实例。
+* newfs_ctx默认指向进程内的默认实例，单实例的程序（FUSE入口、mkfs）不需要任何设置；
+* 同一进程中的多个实例由newfs_ctx_create创建，调用方在操作前用newfs_ctx_switch
+* 把线程绑定到目标实例。后台回写与预读线程在启动时绑定启动它们的实例。
+* 同一实例可被多个线程并发使用，一个线程同一时刻只属于一个实例。
+*******************************************************************************/
+static struct newfs_super newfs_default;
+__thread struct newfs_super* newfs_ctx = &newfs_default;
+
+/**
+ * @brief 创建一个未挂载的实例，之后切换到该实例再调用newfs_mount
+ *
+ * @return struct newfs_super* 失败返回NULL
+ */
+struct newfs_super* newfs_ctx_create() {
+    return (struct newfs_super*)calloc(1, sizeof(struct newfs_super));
+}
+
+/**
+ * @brief 释放newfs_ctx_create创建的实例，实例须已卸载；
+ * 若调用线程正绑定该实例，则切回默认实例
+ *
+ * @param ctx
+ * @return void
+ */
+void newfs_ctx_destroy(struct newfs_super* ctx) {
+    if (ctx == NULL || ctx == &newfs_default) {
+        return;
+    }
+    if (newfs_ctx == ctx) {
+        newfs_ctx = &newfs_default;
+    }
+    free(ctx);
+}
+
+/**
+ * @brief 把调用线程绑定到实例
+ *
+ * @param ctx NULL为默认实例
+ * @return struct newfs_super* 绑定后的实例
+ */
+struct newfs_super* newfs_ctx_switch(struct newfs_super* ctx) {
+    newfs_ctx = ctx != NULL ? ctx : &newfs_default;
+    return newfs_ctx;
+}
@@ -0,0 +1,232 @@
+#include "../include/newfs.h"
+/******************************************************************************
+* SECTION: 目录项缓存
+*
+* 以(父目录dentry, 名字)为键缓存路径分量的查找结果，包括名字不存在的负向项。
+* 项池在挂载时一次性分配，查找与插入均不再分配内存，满时淘汰LRU项。
+* 共享模式下并发的查找都会调整LRU，所有接口在dcache.lock下进行。
+*******************************************************************************/
+static inline void newfs_dcache_lru_unlink(struct newfs_dcache_ent* ent) {
+    ent->prev->next = ent->next;
+    ent->next->prev = ent->prev;
+}
+
+static inline void newfs_dcache_lru_push_front(struct newfs_dcache_ent* ent) {
+    struct newfs_dcache_ent* head = &newfs_ctx->dcache.lru;
+    ent->next        = head->next;
+    ent->prev        = head;
+    head->next->prev = ent;
+    head->next       = ent;
+}
+
+static inline struct newfs_dcache_ent** newfs_dcache_slot(struct newfs_dentry* parent, uint32_t hash) {
+    uint64_t key = ((uint64_t)(uintptr_t)parent >> 4) * 0x9E3779B97F4A7C15ull;
+    return &newfs_ctx->dcache.buckets[(hash ^ (key >> 32)) & (newfs_ctx->dcache.nbuckets - 1)];
+}
+
+static void newfs_dcache_hash_remove(struct newfs_dcache_ent* ent) {
+    struct newfs_dcache_ent** pp = newfs_dcache_slot(ent->parent, ent->hash);
+    while (*pp != NULL) {
+        if (*pp == ent) {
+            *pp = ent->hnext;
+            return;
+        }
+        pp = &(*pp)->hnext;
+    }
+}
+
+static struct newfs_dcache_ent* newfs_dcache_find(struct newfs_dentry* parent, const char* name,
+                                                  int len, uint32_t hash) {
+    struct newfs_dcache_ent* ent = *newfs_dcache_slot(parent, hash);
+    while (ent != NULL) {
+        if (ent->parent == parent && ent->hash == hash && ent->len == len &&
+            memcmp(ent->name, name, len) == 0) {
+            return ent;
+        }
+        ent = ent->hnext;
+    }
+    return NULL;
+}
+
+/**
+ * @brief 初始化目录项缓存
+ *
+ * @param capacity 缓存容量（项数）
+ * @return int
+ */
+int newfs_dcache_init(int capacity) {
+    struct newfs_dcache* dcache = &newfs_ctx->dcache;
+    if (capacity <= 0) {
+        capacity = NEWFS_DEFAULT_DCACHE_ENTS;
+    }
+    memset(dcache, 0, sizeof(struct newfs_dcache));
+    dcache->capacity = capacity;
+    dcache->nbuckets = 1;
+    while (dcache->nbuckets < capacity) {
+        dcache->nbuckets <<= 1;
+    }
+    dcache->ents    = (struct newfs_dcache_ent*)calloc(capacity, sizeof(struct newfs_dcache_ent));
+    dcache->buckets = (struct newfs_dcache_ent**)calloc(dcache->nbuckets,
+                                                        sizeof(struct newfs_dcache_ent*));
+    if (dcache->ents == NULL || dcache->buckets == NULL) {
+        free(dcache->ents);
+        free(dcache->buckets);
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    dcache->lru.next = &dcache->lru;
+    dcache->lru.prev = &dcache->lru;
+    pthread_mutex_init(&dcache->lock, NULL);
+    return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 释放目录项缓存
+ *
+ * @return void
+ */
+void newfs_dcache_destroy() {
+    struct newfs_dcache* dcache = &newfs_ctx->dcache;
+    free(dcache->ents);
+    free(dcache->buckets);
+    dcache->ents    = NULL;
+    dcache->buckets = NULL;
+    dcache->count   = 0;
+    pthread_mutex_destroy(&dcache->lock);
+}
+
+/**
+ * @brief 查找路径分量
+ *
+ * @param parent 所在目录的dentry
+ * @param name 分量名，无需以'\0'结尾
+ * @param len
+ * @param hash newfs_name_hash(name, len)
+ * @param dentry 命中时返回查找结果，负向项返回NULL
+ * @return boolean 是否命中
+ */
+boolean newfs_dcache_lookup(struct newfs_dentry* parent, const char* name, int len,
+                            uint32_t hash, struct newfs_dentry** dentry) {
+    struct newfs_dcache*     dcache = &newfs_ctx->dcache;
+    struct newfs_dcache_ent* ent;
+    pthread_mutex_lock(&dcache->lock);
+    ent = newfs_dcache_find(parent, name, len, hash);
+    if (ent == NULL) {
+        dcache->stats.misses++;
+        pthread_mutex_unlock(&dcache->lock);
+        return FALSE;
+    }
+    if (ent->dentry != NULL) {
+        dcache->stats.hits++;
+    }
+    else {
+        dcache->stats.neg_hits++;
+    }
+    newfs_dcache_lru_unlink(ent);
+    newfs_dcache_lru_push_front(ent);
+    *dentry = ent->dentry;
+    pthread_mutex_unlock(&dcache->lock);
+    return TRUE;
+}
+
+/**
+ * @brief 记录一次查找结果，已存在则覆盖，满时淘汰最久未用项
+ *
+ * @param parent
+ * @param name
+ * @param len 须小于NEWFS_MAX_FILE_NAME
+ * @param hash
+ * @param dentry NULL表示名字不存在
+ * @return void
+ */
+void newfs_dcache_add(struct newfs_dentry* parent, const char* name, int len,
+                      uint32_t hash, struct newfs_dentry* dentry) {
+    struct newfs_dcache*      dcache = &newfs_ctx->dcache;
+    struct newfs_dcache_ent*  ent;
+    struct newfs_dcache_ent** slot;
+    pthread_mutex_lock(&dcache->lock);
+    ent = newfs_dcache_find(parent, name, len, hash);
+    if (ent != NULL) {
+        ent->dentry = dentry;
+        newfs_dcache_lru_unlink(ent);
+        newfs_dcache_lru_push_front(ent);
+        pthread_mutex_unlock(&dcache->lock);
+        return;
+    }
+    ent = dcache->lru.prev;
+    if (ent != &dcache->lru && ent->parent == NULL) {   /* 复用失效项 */
+        newfs_dcache_lru_unlink(ent);
+    }
+    else if (dcache->count < dcache->capacity) {
+        ent = &dcache->ents[dcache->count++];
+    }
+    else {
+        newfs_dcache_lru_unlink(ent);
+        newfs_dcache_hash_remove(ent);
+        dcache->stats.evictions++;
+    }
+    ent->parent = parent;
+    ent->dentry = dentry;
+    ent->hash   = hash;
+    ent->len    = len;
+    memcpy(ent->name, name, len);
+    slot        = newfs_dcache_slot(parent, hash);
+    ent->hnext  = *slot;
+    *slot       = ent;
+    newfs_dcache_lru_push_front(ent);
+    pthread_mutex_unlock(&dcache->lock);
+}
+
+/**
+ * @brief 将缓存项从哈希表摘下，移到LRU尾部作为空闲项，下次插入时优先复用
+ *
+ * @param ent
+ * @return void
+ */
+static void newfs_dcache_release(struct newfs_dcache_ent* ent) {
+    struct newfs_dcache* dcache = &newfs_ctx->dcache;
+    newfs_dcache_lru_unlink(ent);
+    newfs_dcache_hash_remove(ent);
+    ent->parent       = NULL;
+    ent->prev         = dcache->lru.prev;
+    ent->next         = &dcache->lru;
+    ent->prev->next   = ent;
+    dcache->lru.prev  = ent;
+}
+
+/**
+ * @brief 目录中新建或删除了名字为name的目录项，使对应的缓存项失效
+ *
+ * @param parent
+ * @param name
+ * @param len
+ * @param hash
+ * @return void
+ */
+void newfs_dcache_invalidate(struct newfs_dentry* parent, const char* name, int len, uint32_t hash) {
+    struct newfs_dcache_ent* ent;
+    pthread_mutex_lock(&newfs_ctx->dcache.lock);
+    ent = newfs_dcache_find(parent, name, len, hash);
+    if (ent != NULL) {
+        newfs_dcache_release(ent);
+        newfs_ctx->dcache.stats.invalidations++;
+    }
+    pthread_mutex_unlock(&newfs_ctx->dcache.lock);
+}
+
+/**
+ * @brief 目录的子目录项即将被释放，丢弃以该目录为父的所有缓存项
+ *
+ * @param parent
+ * @return void
+ */
+void newfs_dcache_purge(struct newfs_dentry* parent) {
+    struct newfs_dcache* dcache = &newfs_ctx->dcache;
+    int i;
+    pthread_mutex_lock(&dcache->lock);
+    for (i = 0; i < dcache->count; i++) {
+        if (dcache->ents[i].parent == parent) {
+            newfs_dcache_release(&dcache->ents[i]);
+        }
+    }
+    pthread_mutex_unlock(&dcache->lock);
+}
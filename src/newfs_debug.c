@@ -9,13 +9,13 @@ void newfs_dump_map(int option) {
 
     if(option ==0){
         printf("inode bitmap:\n");
-        map = newfs_super.map_inode;
-        // blks = newfs_super.map_inode_blks;
+        map = newfs_ctx->map_inode;
+        // blks = newfs_ctx->map_inode_blks;
         bytes = NEWFS_MAX_INO() / UINT8_BITS;
     }else{
         printf("data bitmap:\n");
-        map = newfs_super.map_data;
-        // blks = newfs_super.map_data_blks;
+        map = newfs_ctx->map_data;
+        // blks = newfs_ctx->map_data_blks;
         bytes = NEWFS_MAX_DATA() / UINT8_BITS;
     }
     
@@ -42,4 +42,130 @@ void newfs_dump_map(int option) {
         }
         printf("\n");
     }
-}
\ No newline at end of file
+}
+
+void newfs_dump_cache(FILE* fp) {
+    struct newfs_cache_stats* stats = &newfs_ctx->cache.stats;
+    uint64_t total;
+    NEWFS_CACHE_LOCK();
+    total = stats->hits + stats->misses;
+    fprintf(fp, "block cache: capacity %d blks, cached %d blks, dirty %d blks\n",
+            newfs_ctx->cache.capacity, newfs_ctx->cache.count, newfs_ctx->cache.dirty_cnt);
+    fprintf(fp, "  hits %lu, misses %lu, hit rate %.2f%%\n", 
+            (unsigned long)stats->hits, (unsigned long)stats->misses,
+            total == 0 ? 0.0 : 100.0 * stats->hits / total);
+    fprintf(fp, "  evictions %lu, writebacks %lu\n", 
+            (unsigned long)stats->evictions, (unsigned long)stats->writebacks);
+    fprintf(fp, "  prefetched %lu, readahead hits %lu, wasted %lu\n", 
+            (unsigned long)stats->prefetched, (unsigned long)stats->ra_hits,
+            (unsigned long)stats->ra_wasted);
+    NEWFS_CACHE_UNLOCK();
+}
+
+void newfs_dump_dcache(FILE* fp) {
+    struct newfs_dcache_stats* stats = &newfs_ctx->dcache.stats;
+    uint64_t total;
+    pthread_mutex_lock(&newfs_ctx->dcache.lock);
+    total = stats->hits + stats->neg_hits + stats->misses;
+    fprintf(fp, "dentry cache: capacity %d ents, used %d ents\n",
+            newfs_ctx->dcache.capacity, newfs_ctx->dcache.count);
+    fprintf(fp, "  hits %lu, negative hits %lu, misses %lu, hit rate %.2f%%\n", 
+            (unsigned long)stats->hits, (unsigned long)stats->neg_hits, (unsigned long)stats->misses,
+            total == 0 ? 0.0 : 100.0 * (stats->hits + stats->neg_hits) / total);
+    fprintf(fp, "  evictions %lu, invalidations %lu\n", 
+            (unsigned long)stats->evictions, (unsigned long)stats->invalidations);
+    pthread_mutex_unlock(&newfs_ctx->dcache.lock);
+}
+
+void newfs_dump_icache(FILE* fp) {
+    struct newfs_icache_stats* stats = &newfs_ctx->icache.stats;
+    fprintf(fp, "inode cache: limit %lu bytes, used %lu bytes, %d inodes\n",
+            (unsigned long)newfs_ctx->icache.capacity, (unsigned long)newfs_ctx->icache.bytes,
+            newfs_ctx->icache.count);
+    fprintf(fp, "  loads %lu, evictions %lu, writebacks %lu\n", 
+            (unsigned long)stats->loads, (unsigned long)stats->evictions,
+            (unsigned long)stats->writebacks);
+}
+
+void newfs_dump_backend(FILE* fp) {
+    struct newfs_backend_stats* stats = &NEWFS_DRIVER()->stats;
+    fprintf(fp, "backend %s: size %ld bytes, io size %d bytes, block size %d bytes\n", NEWFS_DRIVER()->ops->name,
+            (long)NEWFS_DRIVER()->sz_disk, NEWFS_DRIVER()->sz_io, NEWFS_BLK_SZ());
+    fprintf(fp, "  reads %lu (%lu bytes), writes %lu (%lu bytes), flushes %lu\n",
+            (unsigned long)stats->reads, (unsigned long)stats->bytes_read,
+            (unsigned long)stats->writes, (unsigned long)stats->bytes_written,
+            (unsigned long)stats->flushes);
+}
+void newfs_dump_journal(FILE* fp) {
+    struct newfs_journal*       j     = &newfs_ctx->journal;
+    struct newfs_journal_stats* stats = &j->stats;
+    fprintf(fp, "journal: %lu blks from blk %lu, head %lu, tail %lu, used %lu blks, next seq %lu\n",
+            (unsigned long)j->nblks, (unsigned long)(j->sb_blkno + 1), (unsigned long)j->head,
+            (unsigned long)j->tail, (unsigned long)j->used, (unsigned long)j->seq);
+    fprintf(fp, "  commits %lu, logged blks %lu, checkpoints %lu, overflows %lu\n",
+            (unsigned long)stats->commits, (unsigned long)stats->logged_blks,
+            (unsigned long)stats->checkpoints, (unsigned long)stats->overflows);
+    fprintf(fp, "  revoked blks %lu, replayed txns %lu, replayed blks %lu\n", (unsigned long)stats->revoked_blks,
+            (unsigned long)stats->replayed_txns, (unsigned long)stats->replayed_blks);
+}
+
+void newfs_dump_readahead(FILE* fp) {
+    struct newfs_ra_stats* stats = &newfs_ctx->ra.stats;
+    fprintf(fp, "readahead: max window %d blks\n", newfs_ctx->ra.max);
+    fprintf(fp, "  requests %lu, dropped %lu, requested blks %lu, window resets %lu\n",
+            (unsigned long)stats->reqs, (unsigned long)stats->dropped,
+            (unsigned long)stats->blks, (unsigned long)stats->resets);
+}
+void newfs_dump_delalloc(FILE* fp) {
+    struct newfs_da_stats* stats = &newfs_ctx->da.stats;
+    fprintf(fp, "delalloc: pending %d pages, reserved %d blks\n",
+            newfs_ctx->da.pages, newfs_ctx->data_bm.reserved);
+    fprintf(fp, "  flushes %lu (full %lu), runs %lu, blks %lu, avg run %.2f blks\n",
+            (unsigned long)stats->flushes, (unsigned long)stats->full_flushes,
+            (unsigned long)stats->runs, (unsigned long)stats->blks,
+            stats->runs == 0 ? 0.0 : (double)stats->blks / stats->runs);
+}
+void newfs_dump_slab(FILE* fp, struct newfs_slab* slab) {
+    pthread_mutex_lock(&slab->lock);
+    fprintf(fp, "slab %s: %lu B objs, in use %lu / %lu (%.2f%%), peak %lu, %d chunks\n",
+            slab->name, (unsigned long)slab->obj_sz, (unsigned long)slab->in_use,
+            (unsigned long)slab->total,
+            slab->total == 0 ? 0.0 : (double)slab->in_use * 100 / slab->total,
+            (unsigned long)slab->peak, slab->nchunks);
+    pthread_mutex_unlock(&slab->lock);
+}
+void newfs_dump_writeback(FILE* fp) {
+    struct newfs_wb_stats* stats = &newfs_ctx->wb.stats;
+    fprintf(fp, "writeback: expire %d ms, dirty ratio %d%%\n", newfs_ctx->wb.expire_ms, newfs_ctx->wb.ratio);
+    fprintf(fp, "  expire runs %lu, ratio runs %lu, fsyncs %lu\n",
+            (unsigned long)stats->expire_runs, (unsigned long)stats->ratio_runs,
+            (unsigned long)stats->fsyncs);
+}
+void newfs_dump_bitmap(FILE* fp, const char* name, struct newfs_bitmap* bm) {
+    pthread_mutex_lock(&bm->lock);
+    fprintf(fp, "%s bitmap: %d bits, free %d, reserved %d\n", name, bm->nbits, bm->free_cnt, bm->reserved);
+    fprintf(fp, "  allocs %lu, scanned words %lu, avg scan %.2f words\n",
+            (unsigned long)bm->allocs, (unsigned long)bm->scan_words,
+            bm->allocs == 0 ? 0.0 : (double)bm->scan_words / bm->allocs);
+    pthread_mutex_unlock(&bm->lock);
+}
+/**
+ * @brief 输出所有子系统的统计，卸载时输出到stdout，统计文件输出到内存
+ *
+ * @param fp
+ * @return void
+ */
+void newfs_dump_all(FILE* fp) {
+    newfs_dump_backend(fp);
+    newfs_dump_cache(fp);
+    newfs_dump_dcache(fp);
+    newfs_dump_icache(fp);
+    newfs_dump_journal(fp);
+    newfs_dump_writeback(fp);
+    newfs_dump_readahead(fp);
+    newfs_dump_delalloc(fp);
+    newfs_dump_bitmap(fp, "inode", &newfs_ctx->inode_bm);
+    newfs_dump_bitmap(fp, "data", &newfs_ctx->data_bm);
+    newfs_dump_slab(fp, &newfs_ctx->dentry_slab);
+    newfs_dump_slab(fp, &newfs_ctx->inode_slab);
+}
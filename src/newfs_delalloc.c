@@ -0,0 +1,216 @@
+#include "../include/newfs.h"
+/******************************************************************************
+* SECTION: 延迟分配
+*
+* 写入普通文件的空洞（包括追加）时不立即选择数据块，数据暂存在inode的脏页中，
+* 只在数据位图中预留相应的块数。写回时把文件内连续的脏页作为一段，
+* 一次分配一段连续的数据块并用一次设备写写出，追加写的日志文件因此几乎不产生碎片。
+* 脏页与extent一样由inode写锁保护；读者持有inode读锁，可以直接读取脏页。
+*******************************************************************************/
+/**
+ * @brief 二分查找第一个lblk不小于iblk的脏页
+ *
+ * @param inode
+ * @param iblk
+ * @return int 下标，[0, dp_cnt]
+ */
+static int newfs_da_lower(struct newfs_inode * inode, uint64_t iblk) {
+    int lo = 0, hi = inode->dp_cnt, mid;
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if (inode->dpages[mid]->lblk < iblk) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/**
+ * @brief 释放脏页并归还预留
+ *
+ * @param page
+ * @return void
+ */
+static void newfs_da_put(struct newfs_dpage * page) {
+    free(page);
+    newfs_bitmap_unreserve(&newfs_ctx->data_bm, 1);
+    NEWFS_ATOMIC_DEC(&newfs_ctx->da.pages);
+}
+
+/**
+ * @brief 查找文件第iblk块的脏页
+ *
+ * @param inode
+ * @param iblk
+ * @return uint8_t* 页内容，没有时返回NULL
+ */
+uint8_t* newfs_da_find(struct newfs_inode * inode, uint64_t iblk) {
+    int i = newfs_da_lower(inode, iblk);
+    return i < inode->dp_cnt && inode->dpages[i]->lblk == iblk ? inode->dpages[i]->data : NULL;
+}
+
+/**
+ * @brief 取得文件第iblk块的脏页，没有时预留一个数据块并新建清零的脏页；调用者持有inode写锁
+ *
+ * @param inode
+ * @param iblk 尚未映射的文件内块号
+ * @return uint8_t* 页内容，空间不足返回NULL
+ */
+uint8_t* newfs_da_page(struct newfs_inode * inode, uint64_t iblk) {
+    struct newfs_dpage*  page;
+    struct newfs_dpage** dpages;
+    int i = newfs_da_lower(inode, iblk);
+    if (i < inode->dp_cnt && inode->dpages[i]->lblk == iblk) {
+        return inode->dpages[i]->data;
+    }
+    if (!newfs_bitmap_reserve(&newfs_ctx->data_bm, 1)) {
+        return NULL;
+    }
+    page = (struct newfs_dpage*)calloc(1, sizeof(struct newfs_dpage) + NEWFS_BLK_SZ());
+    if (page == NULL) {
+        newfs_bitmap_unreserve(&newfs_ctx->data_bm, 1);
+        return NULL;
+    }
+    page->lblk = iblk;
+    if (inode->dp_cnt == inode->dp_cap) {
+        dpages = (struct newfs_dpage**)realloc(inode->dpages,
+                                               (inode->dp_cap == 0 ? 8 : inode->dp_cap * 2) * sizeof(struct newfs_dpage*));
+        if (dpages == NULL) {
+            free(page);
+            newfs_bitmap_unreserve(&newfs_ctx->data_bm, 1);
+            return NULL;
+        }
+        inode->dpages = dpages;
+        inode->dp_cap = inode->dp_cap == 0 ? 8 : inode->dp_cap * 2;
+    }
+    memmove(&inode->dpages[i + 1], &inode->dpages[i],
+            (inode->dp_cnt - i) * sizeof(struct newfs_dpage*));
+    inode->dpages[i] = page;
+    inode->dp_cnt++;
+    NEWFS_ATOMIC_INC(&newfs_ctx->da.pages);
+    newfs_mark_inode_dirty(inode);                    /* 由newfs_sync分配并写回 */
+    newfs_wb_note_dirty();
+    return page->data;
+}
+
+/**
+ * @brief 为[i, i + n)这段连续脏页分配数据块并写出，分配不到整段时拆成多段；
+ * 每段至多NEWFS_DA_MAX_PAGES()块，拼接缓冲区的大小因此有界。
+ * 每段的块号与文件内块号都连续，至多新增一个extent，写出前预留好，
+ * 数据落盘后建立映射不会失败
+ *
+ * @param inode
+ * @param i 起始脏页下标
+ * @param n 脏页数
+ * @return int
+ */
+static int newfs_da_flush_run(struct newfs_inode * inode, int i, int n) {
+    uint64_t lblk = inode->dpages[i]->lblk;
+    uint64_t run;
+    uint8_t* buf;
+    int64_t  goal = -1, prev;
+    int      start, got, k;
+    int      cap = n < NEWFS_DA_MAX_PAGES() ? n : NEWFS_DA_MAX_PAGES();
+    buf = (uint8_t*)malloc(NEWFS_BLKS_SZ(cap));
+    if (buf == NULL) {                                /* 尚未分配数据块，脏页仍占用预留 */
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    while (n > 0) {
+        prev = lblk > 0 ? newfs_bmap_run(inode, lblk - 1, &run) : NEWFS_BLK_NONE;
+        goal = prev != NEWFS_BLK_NONE ? prev + 1 : goal;
+        if (newfs_ext_reserve(inode, 1) != NEWFS_ERROR_NONE) {
+            free(buf);
+            return -NEWFS_ERROR_NOSPACE;
+        }
+        start = newfs_bitmap_alloc_run(&newfs_ctx->data_bm, goal, n < cap ? n : cap, &got);
+        if (start < 0) {
+            free(buf);
+            return start;
+        }
+        for (k = 0; k < got; k++) {
+            memcpy(buf + NEWFS_BLKS_SZ(k), inode->dpages[i + k]->data, NEWFS_BLK_SZ());
+        }
+        if (newfs_cache_write_direct(NEWFS_DATA_BLKNO(start), got, buf) != NEWFS_ERROR_NONE) {
+            free(buf);
+            newfs_bitmap_unalloc_run(&newfs_ctx->data_bm, start, got);   /* 归还数据块，脏页重新占用预留 */
+            return -NEWFS_ERROR_IO;
+        }
+        for (k = 0; k < got; k++) {                   /* 数据已落到设备，再建立映射 */
+            newfs_ext_insert(inode, lblk + k, start + k);
+            free(inode->dpages[i + k]);
+            inode->dpages[i + k] = NULL;
+            NEWFS_ATOMIC_DEC(&newfs_ctx->da.pages);
+        }
+        NEWFS_ATOMIC_INC(&newfs_ctx->da.stats.runs);
+        NEWFS_ATOMIC_ADD(&newfs_ctx->da.stats.blks, got);
+        goal  = start + got;
+        lblk += got;
+        i    += got;
+        n    -= got;
+    }
+    free(buf);
+    return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 分配并写出文件的所有脏页；调用者持有inode写锁或命名空间写锁
+ *
+ * @param inode
+ * @return int
+ */
+int newfs_da_flush(struct newfs_inode * inode) {
+    int i, j, k, ret = NEWFS_ERROR_NONE;
+    if (inode->dp_cnt == 0) {
+        return NEWFS_ERROR_NONE;
+    }
+    for (i = 0; i < inode->dp_cnt && ret == NEWFS_ERROR_NONE; i = j) {
+        for (j = i + 1; j < inode->dp_cnt && inode->dpages[j]->lblk == inode->dpages[j - 1]->lblk + 1; j++);
+        ret = newfs_da_flush_run(inode, i, j - i);
+    }
+    for (i = 0, k = 0; i < inode->dp_cnt; i++) {      /* 出错时保留尚未写出的脏页 */
+        if (inode->dpages[i] != NULL) {
+            inode->dpages[k++] = inode->dpages[i];
+        }
+    }
+    inode->dp_cnt = k;
+    NEWFS_ATOMIC_INC(&newfs_ctx->da.stats.flushes);
+    return ret;
+}
+
+/**
+ * @brief 文件缩小时丢弃size之后的脏页，并清零尾页超出size的部分
+ *
+ * @param inode
+ * @param size
+ * @return void
+ */
+void newfs_da_truncate(struct newfs_inode * inode, uint64_t size) {
+    uint64_t nblks = size / NEWFS_BLK_SZ();
+    int      bias  = size % NEWFS_BLK_SZ();
+    int      i     = newfs_da_lower(inode, nblks);
+    int      k;
+    if (i < inode->dp_cnt && bias != 0 && inode->dpages[i]->lblk == nblks) {
+        memset(inode->dpages[i]->data + bias, 0, NEWFS_BLK_SZ() - bias);
+        i++;
+    }
+    for (k = i; k < inode->dp_cnt; k++) {
+        newfs_da_put(inode->dpages[k]);
+    }
+    inode->dp_cnt = i;
+}
+
+/**
+ * @brief 释放inode时丢弃剩余的脏页
+ *
+ * @param inode
+ * @return void
+ */
+void newfs_da_free(struct newfs_inode * inode) {
+    newfs_da_truncate(inode, 0);
+    free(inode->dpages);
+    inode->dpages = NULL;
+    inode->dp_cap = 0;
+}
@@ -0,0 +1,364 @@
+#include "../include/newfs.h"
+/******************************************************************************
+* SECTION: 目录哈希索引
+*
+* 内存中每个目录inode维护一张名字哈希表，查找、创建前的存在性检查均为O(1)；
+* 磁盘上目录文件由2^k个叶子块组成，目录项按名字哈希的低k位放入对应叶子块，
+* 叶子块放满时叶子数翻倍并重新分布。叶子块内是紧凑排放的变长记录，
+* 写回时按内存中的叶子链重新排放，删除留下的空闲记录随之回收。
+*******************************************************************************/
+/**
+ * @brief FNV-1a名字哈希
+ *
+ * @param name
+ * @param len
+ * @return uint32_t
+ */
+uint32_t newfs_name_hash(const char* name, int len) {
+    uint32_t hash = 2166136261u;
+    int      i;
+    for (i = 0; i < len; i++) {
+        hash ^= (uint8_t)name[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/**
+ * @brief 哈希表扩容为new_sz个桶并重新分布
+ *
+ * @param inode
+ * @param new_sz 2的幂
+ * @return void
+ */
+static void newfs_dir_rehash(struct newfs_inode* inode, int new_sz) {
+    struct newfs_dentry** buckets = (struct newfs_dentry**)calloc(new_sz, sizeof(struct newfs_dentry*));
+    struct newfs_dentry*  dentry;
+    struct newfs_dentry*  next;
+    int i;
+    for (i = 0; i < inode->dir_hash_sz; i++) {
+        for (dentry = inode->dir_hash[i]; dentry != NULL; dentry = next) {
+            next = dentry->hnext;
+            dentry->hnext = buckets[dentry->hash & (new_sz - 1)];
+            buckets[dentry->hash & (new_sz - 1)] = dentry;
+        }
+    }
+    free(inode->dir_hash);
+    inode->dir_hash    = buckets;
+    inode->dir_hash_sz = new_sz;
+}
+
+/**
+ * @brief 在目录中按名字查找目录项，比较完整的名字
+ *
+ * @param inode 目录inode
+ * @param name
+ * @param len 名字长度
+ * @param hash newfs_name_hash(name, len)
+ * @return struct newfs_dentry* 未找到返回NULL
+ */
+struct newfs_dentry* newfs_dir_find(struct newfs_inode* inode, const char* name, int len,
+                                    uint32_t hash) {
+    struct newfs_dentry* dentry;
+    if (inode->dir_hash_sz == 0) {
+        return NULL;
+    }
+    for (dentry = inode->dir_hash[hash & (inode->dir_hash_sz - 1)]; dentry != NULL;
+         dentry = dentry->hnext) {
+        if (dentry->hash == hash && dentry->name_len == len &&
+            memcmp(dentry->fname, name, len) == 0) {
+            return dentry;
+        }
+    }
+    return NULL;
+}
+
+static inline int newfs_dir_reclen(struct newfs_dentry* dentry) {
+    return NEWFS_DIRENT_LEN(dentry->name_len);
+}
+
+/**
+ * @brief 将目录项重新分布到new_leaves个叶子块，某个叶子块放不下时继续翻倍
+ *
+ * @param inode
+ * @param new_leaves
+ * @return int
+ */
+static int newfs_dir_split(struct newfs_inode* inode, int new_leaves) {
+    struct newfs_dentry** heads;
+    uint32_t*             used;
+    struct newfs_dentry*  dentry;
+    int leaf;
+retry:
+    if (new_leaves > NEWFS_DIR_MAX_LEAVES) {
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    used = (uint32_t*)calloc(new_leaves, sizeof(uint32_t));
+    for (dentry = inode->dentrys; dentry != NULL; dentry = dentry->brother) {
+        if (dentry->leaf < 0) {
+            continue;
+        }
+        leaf = dentry->hash & (new_leaves - 1);
+        used[leaf] += newfs_dir_reclen(dentry);
+        if (used[leaf] > NEWFS_BLK_SZ()) {
+            free(used);
+            new_leaves *= 2;
+            goto retry;
+        }
+    }
+    heads = (struct newfs_dentry**)calloc(new_leaves, sizeof(struct newfs_dentry*));
+    for (dentry = inode->dentrys; dentry != NULL; dentry = dentry->brother) {
+        if (dentry->leaf < 0) {
+            continue;
+        }
+        leaf          = dentry->hash & (new_leaves - 1);
+        dentry->leaf  = leaf;
+        dentry->lnext = heads[leaf];
+        heads[leaf]   = dentry;
+    }
+    free(inode->dir_leaf);
+    free(inode->dir_used);
+    free(inode->dir_dirty);
+    inode->dir_leaf   = heads;
+    inode->dir_used   = used;
+    inode->dir_leaves = new_leaves;
+    inode->dir_dirty  = (uint8_t*)malloc(new_leaves);  /* 重新分布后所有叶子块都要写回 */
+    memset(inode->dir_dirty, TRUE, new_leaves);
+    return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 把目录项放入其哈希对应的叶子块，剩余空间不足时分裂
+ *
+ * @param inode
+ * @param dentry
+ * @return int
+ */
+static int newfs_dir_place(struct newfs_inode* inode, struct newfs_dentry* dentry) {
+    int len = newfs_dir_reclen(dentry);
+    int leaf, ret;
+    while (TRUE) {
+        if (inode->dir_leaves > 0) {
+            leaf = dentry->hash & (inode->dir_leaves - 1);
+            if (inode->dir_used[leaf] + len <= NEWFS_BLK_SZ()) {
+                dentry->leaf           = leaf;
+                dentry->lnext          = inode->dir_leaf[leaf];
+                inode->dir_leaf[leaf]  = dentry;
+                inode->dir_used[leaf] += len;
+                inode->dir_dirty[leaf] = TRUE;
+                return NEWFS_ERROR_NONE;
+            }
+        }
+        ret = newfs_dir_split(inode, inode->dir_leaves == 0 ? 1 : inode->dir_leaves * 2);
+        if (ret != NEWFS_ERROR_NONE) {
+            return ret;
+        }
+    }
+}
+
+/**
+ * @brief 检查名字为name的新目录项能否放入目录，必要时按newfs_dir_place的方式分裂，
+ * 但不修改目录；gone1、gone2是随后将移出该目录的目录项（可为NULL），不计其记录
+ *
+ * @param inode 目录inode
+ * @param name
+ * @param len 名字长度
+ * @param gone1
+ * @param gone2
+ * @return boolean
+ */
+boolean newfs_dir_fits(struct newfs_inode* inode, const char* name, int len,
+                       struct newfs_dentry* gone1, struct newfs_dentry* gone2) {
+    struct newfs_dentry* dentry;
+    uint32_t* used;
+    uint32_t  hash = newfs_name_hash(name, len);
+    int       leaves, leaf;
+    if (inode->dir_leaves > 0 &&
+        inode->dir_used[hash & (inode->dir_leaves - 1)] + NEWFS_DIRENT_LEN(len) <= NEWFS_BLK_SZ()) {
+        return TRUE;
+    }
+    for (leaves = inode->dir_leaves == 0 ? 1 : inode->dir_leaves; leaves <= NEWFS_DIR_MAX_LEAVES; leaves *= 2) {
+        used = (uint32_t*)calloc(leaves, sizeof(uint32_t));
+        if (used == NULL) {
+            return FALSE;
+        }
+        used[hash & (leaves - 1)] = NEWFS_DIRENT_LEN(len);
+        for (dentry = inode->dentrys; dentry != NULL; dentry = dentry->brother) {
+            if (dentry->leaf < 0 || dentry == gone1 || dentry == gone2) {
+                continue;
+            }
+            leaf        = dentry->hash & (leaves - 1);
+            used[leaf] += newfs_dir_reclen(dentry);
+            if (used[leaf] > NEWFS_BLK_SZ()) {
+                break;
+            }
+        }
+        free(used);
+        if (dentry == NULL) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+/**
+ * @brief 将目录项移出目录的哈希索引
+ *
+ * @param inode 目录inode
+ * @param dentry
+ * @return void
+ */
+static void newfs_dir_unhash(struct newfs_inode* inode, struct newfs_dentry* dentry) {
+    struct newfs_dentry** link = &inode->dir_hash[dentry->hash & (inode->dir_hash_sz - 1)];
+    while (*link != dentry) {
+        link = &(*link)->hnext;
+    }
+    *link         = dentry->hnext;
+    dentry->hnext = NULL;
+}
+
+/**
+ * @brief 将目录项加入目录的哈希索引，尚未放置的目录项同时放入叶子块
+ *
+ * @param inode 目录inode
+ * @param dentry
+ * @return int
+ */
+int newfs_dir_insert(struct newfs_inode* inode, struct newfs_dentry* dentry) {
+    uint32_t idx;
+    if (inode->dir_hash_sz == 0) {
+        newfs_dir_rehash(inode, NEWFS_DIR_HASH_INIT);
+    }
+    else if (inode->dir_cnt > 2 * inode->dir_hash_sz) {
+        newfs_dir_rehash(inode, inode->dir_hash_sz * 2);
+    }
+    if (dentry->leaf < 0) {
+        dentry->hash = newfs_name_hash(dentry->fname, dentry->name_len);
+    }
+    idx = dentry->hash & (inode->dir_hash_sz - 1);
+    dentry->hnext = inode->dir_hash[idx];
+    inode->dir_hash[idx] = dentry;
+    if (dentry->leaf < 0 && newfs_dir_place(inode, dentry) != NEWFS_ERROR_NONE) {
+        newfs_dir_unhash(inode, dentry);
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 将目录项移出哈希索引与所在叶子块，叶子块标脏，写回时其记录空间被回收
+ *
+ * @param inode 目录inode
+ * @param dentry
+ * @return void
+ */
+void newfs_dir_remove(struct newfs_inode* inode, struct newfs_dentry* dentry) {
+    struct newfs_dentry** link;
+    newfs_dir_unhash(inode, dentry);
+    if (dentry->leaf < 0) {
+        return;
+    }
+    for (link = &inode->dir_leaf[dentry->leaf]; *link != dentry; link = &(*link)->lnext);
+    *link = dentry->lnext;
+    inode->dir_used[dentry->leaf] -= newfs_dir_reclen(dentry);
+    inode->dir_dirty[dentry->leaf] = TRUE;
+    dentry->lnext = NULL;
+    dentry->leaf  = -1;
+}
+
+/**
+ * @brief 从磁盘读入目录的所有叶子块，建立目录项链表、叶子链与哈希索引
+ *
+ * @param inode 目录inode
+ * @return int 记录越界或长度不合法时返回-NEWFS_ERROR_IO
+ */
+int newfs_dir_load(struct newfs_inode* inode) {
+    struct newfs_dirent_d* dirent;
+    struct newfs_dentry*   sub_dentry;
+    uint8_t* leaf_d;
+    int      leaves = inode->size / NEWFS_BLK_SZ();
+    int      leaf, off;
+    int      ret = NEWFS_ERROR_NONE;
+    if (leaves == 0) {
+        return NEWFS_ERROR_NONE;
+    }
+    inode->dir_leaves = leaves;
+    inode->dir_leaf   = (struct newfs_dentry**)calloc(leaves, sizeof(struct newfs_dentry*));
+    inode->dir_used   = (uint32_t*)calloc(leaves, sizeof(uint32_t));
+    inode->dir_dirty  = (uint8_t*)calloc(leaves, sizeof(uint8_t));
+    leaf_d = (uint8_t*)malloc(NEWFS_BLK_SZ());
+    for (leaf = 0; leaf < leaves && ret == NEWFS_ERROR_NONE; leaf++) {
+        if (newfs_read_data(inode, leaf_d, NEWFS_BLK_SZ(), NEWFS_BLKS_SZ(leaf)) != NEWFS_BLK_SZ()) {
+            ret = -NEWFS_ERROR_IO;
+            break;
+        }
+        for (off = 0; off + (int)sizeof(struct newfs_dirent_d) <= NEWFS_BLK_SZ(); off += dirent->rec_len) {
+            dirent = (struct newfs_dirent_d*)(leaf_d + off);
+            if (dirent->rec_len == 0) {                /* 块内记录结束 */
+                break;
+            }
+            if (dirent->rec_len % 4 != 0 || off + dirent->rec_len > NEWFS_BLK_SZ() ||
+                NEWFS_DIRENT_LEN(dirent->name_len) > dirent->rec_len ||
+                dirent->name_len >= NEWFS_MAX_FILE_NAME) {
+                NEWFS_ERR("[%s] bad dirent in leaf %d\n", __func__, leaf);
+                ret = -NEWFS_ERROR_IO;
+                break;
+            }
+            if (dirent->name_len == 0) {               /* 空闲记录 */
+                continue;
+            }
+            sub_dentry = new_dentry(inode, dirent->name, dirent->name_len, dirent->ftype);
+            if (sub_dentry == NULL) {
+                ret = -NEWFS_ERROR_NOSPACE;
+                break;
+            }
+            sub_dentry->ino    = dirent->ino;
+            sub_dentry->hash   = newfs_name_hash(dirent->name, dirent->name_len);
+            sub_dentry->leaf   = leaf;
+            sub_dentry->lnext  = inode->dir_leaf[leaf];
+            inode->dir_leaf[leaf]  = sub_dentry;
+            inode->dir_used[leaf] += NEWFS_DIRENT_LEN(dirent->name_len);
+            newfs_alloc_dentry(inode, sub_dentry);
+        }
+    }
+    free(leaf_d);
+    return ret;
+}
+
+/**
+ * @brief 将目录中被修改过的叶子块按叶子链紧凑排放后写回
+ *
+ * @param inode 目录inode
+ * @return int
+ */
+int newfs_dir_sync(struct newfs_inode* inode) {
+    struct newfs_dirent_d* dirent;
+    struct newfs_dentry*   dentry;
+    uint8_t* leaf_d;
+    int      leaf, off, len;
+    leaf_d = (uint8_t*)malloc(NEWFS_BLK_SZ());
+    for (leaf = 0; leaf < inode->dir_leaves; leaf++) {
+        if (!inode->dir_dirty[leaf]) {
+            continue;
+        }
+        memset(leaf_d, 0, NEWFS_BLK_SZ());             /* 末尾的全0记录头标记结束 */
+        off = 0;
+        for (dentry = inode->dir_leaf[leaf]; dentry != NULL; dentry = dentry->lnext) {
+            len              = dentry->name_len;
+            dirent           = (struct newfs_dirent_d*)(leaf_d + off);
+            dirent->ino      = dentry->ino;
+            dirent->rec_len  = NEWFS_DIRENT_LEN(len);
+            dirent->name_len = len;
+            dirent->ftype    = dentry->ftype;
+            memcpy(dirent->name, dentry->fname, len);
+            off += dirent->rec_len;
+        }
+        if (newfs_write_data(inode, leaf_d, NEWFS_BLK_SZ(), NEWFS_BLKS_SZ(leaf)) != NEWFS_BLK_SZ()) {
+            free(leaf_d);
+            return -NEWFS_ERROR_IO;
+        }
+        inode->dir_dirty[leaf] = FALSE;
+    }
+    free(leaf_d);
+    return NEWFS_ERROR_NONE;
+}
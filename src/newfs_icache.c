@@ -0,0 +1,265 @@
+#include "../include/newfs.h"
+/******************************************************************************
+* SECTION: inode缓存
+*
+* 已载入的inode（根inode除外）按LRU串成链表，并估算每个inode连同其目录项、
+* 哈希索引、extent数组、延迟分配的脏页所占的内存。超过上限时从最久未用的一端淘汰：
+* 脏inode先写回，再释放其子目录项，dentry->inode置NULL，
+* 下次访问时由newfs_lookup重新读入。
+* 有子inode仍在内存中的目录被子inode引用，不会被淘汰。
+* LRU链与记账由icache.lock保护；淘汰会释放inode，只在持有命名空间写锁时进行，
+* 共享模式下的操作因此可以不加引用地使用查找得到的inode。
+*******************************************************************************/
+static void newfs_icache_unlink(struct newfs_inode* inode) {
+    struct newfs_icache* icache = &newfs_ctx->icache;
+    if (inode->lru_prev != NULL) {
+        inode->lru_prev->lru_next = inode->lru_next;
+    }
+    else {
+        icache->lru_head = inode->lru_next;
+    }
+    if (inode->lru_next != NULL) {
+        inode->lru_next->lru_prev = inode->lru_prev;
+    }
+    else {
+        icache->lru_tail = inode->lru_prev;
+    }
+    inode->lru_prev = NULL;
+    inode->lru_next = NULL;
+}
+
+static void newfs_icache_push_front(struct newfs_inode* inode) {
+    struct newfs_icache* icache = &newfs_ctx->icache;
+    inode->lru_prev = NULL;
+    inode->lru_next = icache->lru_head;
+    if (icache->lru_head != NULL) {
+        icache->lru_head->lru_prev = inode;
+    }
+    else {
+        icache->lru_tail = inode;
+    }
+    icache->lru_head = inode;
+}
+
+static inline boolean newfs_icache_is_root(struct newfs_inode* inode) {
+    return inode->dentry->parent == NULL;
+}
+
+/**
+ * @brief 估算inode及其附属结构的内存占用
+ *
+ * @param inode
+ * @return uint64_t 字节数
+ */
+static uint64_t newfs_icache_footprint(struct newfs_inode* inode) {
+    uint64_t mem = sizeof(struct newfs_inode);
+    mem += (uint64_t)inode->ext_cap * sizeof(struct newfs_extent);
+    mem += (uint64_t)inode->ext_blk_cnt * sizeof(int64_t);
+    mem += inode->inline_data != NULL ? NEWFS_INLINE_MAX : 0;
+    mem += (uint64_t)inode->dp_cap * sizeof(struct newfs_dpage*);
+    mem += (uint64_t)inode->dp_cnt * (sizeof(struct newfs_dpage) + NEWFS_BLK_SZ());
+    if (NEWFS_IS_DIR(inode)) {
+        mem += (uint64_t)inode->dir_cnt * sizeof(struct newfs_dentry) + newfs_names_bytes(inode->names);
+        mem += (uint64_t)inode->dir_hash_sz * sizeof(struct newfs_dentry*);
+        mem += (uint64_t)inode->dir_leaves * (sizeof(struct newfs_dentry*) + sizeof(uint32_t) + 1);
+    }
+    return mem;
+}
+
+/**
+ * @brief 重新估算inode的内存占用并更新总量
+ *
+ * @param inode
+ * @return void
+ */
+static void newfs_icache_account(struct newfs_inode* inode) {
+    uint64_t mem = newfs_icache_footprint(inode);
+    newfs_ctx->icache.bytes = newfs_ctx->icache.bytes - inode->mem + mem;
+    inode->mem = mem;
+}
+
+/**
+ * @brief 初始化inode缓存
+ *
+ * @param cache_mb 内存上限（MB）
+ * @return int
+ */
+int newfs_icache_init(int cache_mb) {
+    struct newfs_icache* icache = &newfs_ctx->icache;
+    if (cache_mb <= 0) {
+        cache_mb = NEWFS_DEFAULT_CACHE_MB;
+    }
+    memset(icache, 0, sizeof(struct newfs_icache));
+    icache->capacity = (uint64_t)cache_mb << 20;
+    pthread_mutex_init(&icache->lock, NULL);
+    return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 卸载时释放缓存中各inode及根inode的附属结构，调用者已将它们写回；
+ * 目录项与inode对象随后由slab整体释放
+ *
+ * @return void
+ */
+void newfs_icache_destroy() {
+    struct newfs_icache* icache = &newfs_ctx->icache;
+    struct newfs_inode*  inode;
+    for (inode = icache->lru_head; inode != NULL; inode = inode->lru_next) {
+        newfs_inode_release(inode);
+    }
+    if (newfs_ctx->root_dentry->inode != NULL) {
+        newfs_inode_release(newfs_ctx->root_dentry->inode);
+    }
+    icache->lru_head = NULL;
+    icache->lru_tail = NULL;
+    icache->bytes    = 0;
+    icache->count    = 0;
+    pthread_mutex_destroy(&icache->lock);
+}
+
+/**
+ * @brief 新载入或新分配的inode加入缓存，并引用其父目录inode
+ *
+ * @param inode 已与dentry互相指向
+ * @return void
+ */
+void newfs_icache_add(struct newfs_inode* inode) {
+    struct newfs_dentry* parent = inode->dentry->parent;
+    pthread_mutex_lock(&newfs_ctx->icache.lock);
+    inode->mem = 0;
+    newfs_icache_account(inode);
+    if (!newfs_icache_is_root(inode)) {
+        if (parent->inode != NULL) {
+            NEWFS_ATOMIC_INC(&parent->inode->ref);
+        }
+        newfs_icache_push_front(inode);
+        newfs_ctx->icache.count++;
+    }
+    pthread_mutex_unlock(&newfs_ctx->icache.lock);
+}
+
+/**
+ * @brief 将要释放的inode移出缓存，并解除对父目录inode的引用
+ *
+ * @param inode
+ * @return void
+ */
+void newfs_icache_remove(struct newfs_inode* inode) {
+    struct newfs_dentry* parent = inode->dentry->parent;
+    pthread_mutex_lock(&newfs_ctx->icache.lock);
+    newfs_icache_unlink(inode);
+    newfs_ctx->icache.bytes -= inode->mem;
+    newfs_ctx->icache.count--;
+    pthread_mutex_unlock(&newfs_ctx->icache.lock);
+    if (parent->inode != NULL) {
+        NEWFS_ATOMIC_DEC(&parent->inode->ref);
+    }
+}
+
+/**
+ * @brief 访问inode时调用，移到LRU头部并更新内存占用；
+ * extent数组可能正被写入者修改，估算时持有inode读锁
+ *
+ * @param inode
+ * @return void
+ */
+void newfs_icache_touch(struct newfs_inode* inode) {
+    uint64_t mem;
+    pthread_rwlock_rdlock(&inode->rwlock);
+    mem = newfs_icache_footprint(inode);
+    pthread_rwlock_unlock(&inode->rwlock);
+    pthread_mutex_lock(&newfs_ctx->icache.lock);
+    newfs_ctx->icache.bytes = newfs_ctx->icache.bytes - inode->mem + mem;
+    inode->mem = mem;
+    if (!newfs_icache_is_root(inode) && newfs_ctx->icache.lru_head != inode) {
+        newfs_icache_unlink(inode);
+        newfs_icache_push_front(inode);
+    }
+    pthread_mutex_unlock(&newfs_ctx->icache.lock);
+}
+
+/**
+ * @brief 内存占用是否超过上限
+ *
+ * @return boolean
+ */
+boolean newfs_icache_over() {
+    boolean over;
+    pthread_mutex_lock(&newfs_ctx->icache.lock);
+    over = newfs_ctx->icache.bytes > newfs_ctx->icache.capacity;
+    pthread_mutex_unlock(&newfs_ctx->icache.lock);
+    return over;
+}
+
+/**
+ * @brief 释放inode的附属结构：目录索引、名字区、extent、内联数据与延迟分配的脏页；
+ * 子目录项与inode对象本身由调用者释放
+ *
+ * @param inode
+ * @return void
+ */
+void newfs_inode_release(struct newfs_inode* inode) {
+    free(inode->dir_hash);
+    free(inode->dir_leaf);
+    free(inode->dir_used);
+    free(inode->dir_dirty);
+    newfs_names_free(&inode->names);
+    free(inode->extents);
+    free(inode->ext_blks);
+    free(inode->inline_data);
+    newfs_da_free(inode);
+    pthread_rwlock_destroy(&inode->rwlock);
+}
+
+/**
+ * @brief 淘汰一个未被引用的inode，脏则先写回
+ *
+ * @param inode
+ * @return int
+ */
+static int newfs_icache_evict(struct newfs_inode* inode) {
+    struct newfs_dentry* dentry = inode->dentry;
+    struct newfs_dentry* child;
+    struct newfs_dentry* next;
+    NEWFS_EVENT(NEWFS_LOG_INFO, NEWFS_EV_ICACHE_EVICT, inode->ino, 0, inode->is_dirty);
+    if (inode->is_dirty) {
+        if (newfs_sync_inode(inode) != NEWFS_ERROR_NONE) {
+            return -NEWFS_ERROR_IO;
+        }
+        newfs_ctx->icache.stats.writebacks++;
+    }
+    if (NEWFS_IS_DIR(inode)) {
+        newfs_dcache_purge(dentry);                  /* 以该目录为父的缓存项即将失效 */
+        for (child = inode->dentrys; child != NULL; child = next) {
+            next = child->brother;
+            newfs_free_dentry(child);
+        }
+    }
+    newfs_inode_release(inode);
+    newfs_icache_remove(inode);
+    newfs_ctx->icache.stats.evictions++;
+    dentry->inode = NULL;
+    newfs_slab_free(&newfs_ctx->inode_slab, inode);
+    return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 内存占用超过上限时从LRU尾部淘汰inode，调用者持有命名空间写锁，
+ * 且没有持有inode指针
+ *
+ * @return void
+ */
+void newfs_icache_shrink() {
+    struct newfs_icache* icache = &newfs_ctx->icache;
+    struct newfs_inode*  inode  = icache->lru_tail;
+    struct newfs_inode*  prev;
+    while (inode != NULL && icache->bytes > icache->capacity) {
+        prev = inode->lru_prev;
+        if (NEWFS_ATOMIC_GET(&inode->ref) == 0 && !inode->is_orphan &&    /* 孤儿由newfs_reap_orphans删除 */
+            newfs_icache_evict(inode) != NEWFS_ERROR_NONE) {
+            NEWFS_ERR("[%s] io error\n", __func__);
+            return;
+        }
+        inode = prev;
+    }
+}
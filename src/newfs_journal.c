@@ -0,0 +1,484 @@
+#include "../include/newfs.h"
+#include <time.h>
+/******************************************************************************
+* SECTION: 元数据日志
+*
+* 日志区位于inode表与数据区之间：第一块是日志超级块，其余块组成环形日志。
+* 元数据（inode表、目录叶子块、extent块、位图、超级块）只在块缓存中修改，
+* 提交前钉在缓存里，不会被淘汰写回原位。newfs_sync把两次提交之间的所有修改
+* 合成一个事务（group commit）：先写回文件数据块（ordered模式），再顺序追加
+*   | 描述块 | 元数据块副本 ... | 描述块 | 副本 ... | 提交块 |
+* 提交块落盘后事务即持久，元数据块之后随缓存淘汰或检查点写回原位；
+* 写回原位之前又被修改的块先冻结提交时的内容，检查点写回冻结的内容。
+* 释放的元数据块以撤销块记入事务，重放时跳过它们在更早事务中的副本。
+* 日志空间不足、脏块过多或卸载时做检查点，挂载时从tail开始重放完整的事务。
+* 提交与检查点的调用者持有命名空间写锁，日志本身不另加锁。
+*******************************************************************************/
+#define NEWFS_JOURNAL_POS(pos)          ((newfs_ctx->journal.sb_blkno + 1 + (pos)) * NEWFS_BLK_SZ())
+
+static uint32_t newfs_journal_csum(uint32_t csum, const uint8_t* data, int size) {
+    int i;
+    for (i = 0; i < size; i++) {
+        csum ^= data[i];
+        csum *= 16777619u;
+    }
+    return csum;
+}
+
+/**
+ * @brief 从环形日志的pos处读写nblks块，跨过末尾时分两次
+ *
+ * @param pos 日志内位置
+ * @param buf
+ * @param nblks
+ * @param is_write
+ * @return int
+ */
+static int newfs_journal_io(uint64_t pos, uint8_t* buf, uint64_t nblks, boolean is_write) {
+    struct newfs_journal* j = &newfs_ctx->journal;
+    uint64_t n;
+    int      ret;
+    while (nblks > 0) {
+        n   = j->nblks - pos < nblks ? j->nblks - pos : nblks;
+        ret = is_write ? newfs_backend_write(NEWFS_DRIVER(), buf, NEWFS_BLKS_SZ(n), (off_t)NEWFS_JOURNAL_POS(pos))
+                       : newfs_backend_read(NEWFS_DRIVER(), buf, NEWFS_BLKS_SZ(n), (off_t)NEWFS_JOURNAL_POS(pos));
+        if (ret != NEWFS_ERROR_NONE) {
+            return -NEWFS_ERROR_IO;
+        }
+        buf   += NEWFS_BLKS_SZ(n);
+        nblks -= n;
+        pos    = 0;
+    }
+    return NEWFS_ERROR_NONE;
+}
+
+static int newfs_journal_write_sb() {
+    struct newfs_journal*     j   = &newfs_ctx->journal;
+    uint8_t*                  buf = (uint8_t*)calloc(1, NEWFS_BLK_SZ());
+    struct newfs_journal_sb_d* jsb = (struct newfs_journal_sb_d*)buf;
+    int ret;
+    jsb->magic    = NEWFS_JOURNAL_MAGIC;
+    jsb->jid      = j->jid;
+    jsb->tail     = j->tail;
+    jsb->tail_seq = j->tail_seq;
+    ret = newfs_backend_write(NEWFS_DRIVER(), buf, NEWFS_BLK_SZ(), (off_t)NEWFS_BLKS_SZ(j->sb_blkno));
+    free(buf);
+    return ret == NEWFS_ERROR_NONE ? NEWFS_ERROR_NONE : -NEWFS_ERROR_IO;
+}
+
+#define NEWFS_JOURNAL_BLK(log, p)       ((log) + NEWFS_BLKS_SZ((p) % newfs_ctx->journal.nblks))
+#define NEWFS_JOURNAL_REC_BLKS(hdr)     ((hdr)->type == NEWFS_JOURNAL_DESC ? 1 + (uint64_t)(hdr)->cnt : 1)
+
+struct newfs_journal_revoke_ent {
+    uint64_t blkno;
+    uint64_t seq;                                     /* 撤销记录所在的事务 */
+};
+
+static int newfs_journal_revoke_cmp(const void* l, const void* r) {
+    const struct newfs_journal_revoke_ent* a = (const struct newfs_journal_revoke_ent*)l;
+    const struct newfs_journal_revoke_ent* b = (const struct newfs_journal_revoke_ent*)r;
+    return a->blkno < b->blkno ? -1 : (a->blkno > b->blkno ? 1 : 0);
+}
+
+/**
+ * @brief 检查从start开始、序号为seq的事务是否完整且校验和正确
+ *
+ * @param log 读入内存的日志区
+ * @param start 日志内位置
+ * @param seq 期望的事务序号
+ * @param room 最多扫描的块数
+ * @param len 返回事务的块数，含提交块
+ * @return boolean
+ */
+static boolean newfs_journal_scan(uint8_t* log, uint64_t start, uint64_t seq, uint64_t room, uint64_t* len) {
+    struct newfs_journal*       j = &newfs_ctx->journal;
+    struct newfs_journal_hdr_d* hdr;
+    uint64_t ncopies = 0, n, k;
+    uint32_t csum = 2166136261u;
+
+    for (*len = 0; *len < room; *len += n) {
+        hdr = (struct newfs_journal_hdr_d*)NEWFS_JOURNAL_BLK(log, start + *len);
+        if (hdr->magic != NEWFS_JOURNAL_MAGIC || hdr->jid != j->jid || hdr->seq != seq) {
+            return FALSE;
+        }
+        if (hdr->type == NEWFS_JOURNAL_COMMIT) {
+            (*len)++;
+            return hdr->cnt == ncopies && hdr->csum == csum;
+        }
+        if ((hdr->type != NEWFS_JOURNAL_DESC && hdr->type != NEWFS_JOURNAL_REVOKE) ||
+            hdr->cnt > NEWFS_JOURNAL_TAGS()) {
+            return FALSE;
+        }
+        n = NEWFS_JOURNAL_REC_BLKS(hdr);
+        if (*len + n >= room) {                       /* 放不下提交块 */
+            return FALSE;
+        }
+        for (k = 0; k < n; k++) {
+            csum = newfs_journal_csum(csum, NEWFS_JOURNAL_BLK(log, start + *len + k), NEWFS_BLK_SZ());
+        }
+        if (hdr->type == NEWFS_JOURNAL_DESC) {
+            ncopies += hdr->cnt;
+        }
+    }
+    return FALSE;
+}
+
+/**
+ * @brief 从tail开始重放完整且校验和正确的事务，遇到第一个不完整的事务即停止。
+ * 第一遍收集撤销记录，第二遍把副本载入块缓存并视为已提交，跳过在之后的事务中被撤销的块
+ *（它可能已被重新分配为文件数据；同一事务中撤销后重新分配为元数据的副本仍有效），
+ * 最后由检查点写回原位
+ *
+ * @return int
+ */
+static int newfs_journal_replay() {
+    struct newfs_journal*            j    = &newfs_ctx->journal;
+    struct newfs_journal_hdr_d*      hdr;
+    struct newfs_journal_revoke_ent* revs = NULL;
+    struct newfs_journal_revoke_ent* grown;
+    struct newfs_journal_revoke_ent* hit;
+    struct newfs_journal_revoke_ent  key;
+    struct newfs_cache_blk*          blk;
+    uint8_t*  log;
+    uint64_t  pos = j->tail, len, scanned = 0, done, ntxns = 0, nrevs = 0, cap = 0, ncopies, p, k, t;
+    uint64_t  max_blkno = NEWFS_DISK_SZ() / NEWFS_BLK_SZ();
+
+    log = (uint8_t*)malloc(NEWFS_BLKS_SZ(j->nblks));
+    if (log == NULL) {
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    if (newfs_journal_io(0, log, j->nblks, FALSE) != NEWFS_ERROR_NONE) {
+        free(log);
+        return -NEWFS_ERROR_IO;
+    }
+    while (scanned < j->nblks && newfs_journal_scan(log, pos, j->seq + ntxns, j->nblks - scanned, &len)) {
+        for (p = pos; p < pos + len - 1; p += NEWFS_JOURNAL_REC_BLKS(hdr)) {
+            hdr = (struct newfs_journal_hdr_d*)NEWFS_JOURNAL_BLK(log, p);
+            if (hdr->type != NEWFS_JOURNAL_REVOKE) {
+                continue;
+            }
+            if (nrevs + hdr->cnt > cap) {
+                cap   = (nrevs + hdr->cnt) * 2;
+                grown = (struct newfs_journal_revoke_ent*)realloc(revs, cap * sizeof(*revs));
+                if (grown == NULL) {
+                    free(revs);
+                    free(log);
+                    return -NEWFS_ERROR_NOSPACE;
+                }
+                revs = grown;
+            }
+            for (k = 0; k < hdr->cnt; k++, nrevs++) {
+                revs[nrevs].blkno = hdr->blknos[k];
+                revs[nrevs].seq   = j->seq + ntxns;
+            }
+        }
+        pos      = (pos + len) % j->nblks;
+        scanned += len;
+        ntxns++;
+    }
+    /* 同一块保留最后一次撤销 */
+    if (nrevs > 0) {
+        qsort(revs, nrevs, sizeof(*revs), newfs_journal_revoke_cmp);
+        for (k = 1, p = 0; k < nrevs; k++) {
+            if (revs[k].blkno != revs[p].blkno) {
+                revs[++p] = revs[k];
+            } else if (revs[k].seq > revs[p].seq) {
+                revs[p].seq = revs[k].seq;
+            }
+        }
+        nrevs = p + 1;
+    }
+
+    for (t = 0, pos = j->tail, done = 0; t < ntxns; t++) {
+        newfs_journal_scan(log, pos, j->seq, j->nblks - done, &len);
+        ncopies = 0;
+        for (p = pos; p < pos + len - 1; p += NEWFS_JOURNAL_REC_BLKS(hdr)) {
+            hdr = (struct newfs_journal_hdr_d*)NEWFS_JOURNAL_BLK(log, p);
+            if (hdr->type != NEWFS_JOURNAL_DESC) {
+                continue;
+            }
+            for (k = 0; k < hdr->cnt; k++) {
+                key.blkno = hdr->blknos[k];
+                hit = nrevs > 0 ? (struct newfs_journal_revoke_ent*)bsearch(&key, revs, nrevs, sizeof(*revs),
+                                                                             newfs_journal_revoke_cmp) : NULL;
+                if (hit != NULL && hit->seq > j->seq) {
+                    continue;
+                }
+                NEWFS_CACHE_LOCK();
+                blk = hdr->blknos[k] < max_blkno ? newfs_cache_get(hdr->blknos[k], FALSE) : NULL;
+                if (blk == NULL) {
+                    NEWFS_CACHE_UNLOCK();
+                    free(revs);
+                    free(log);
+                    return -NEWFS_ERROR_IO;
+                }
+                memcpy(blk->data, NEWFS_JOURNAL_BLK(log, p + 1 + k), NEWFS_BLK_SZ());
+                newfs_cache_mark_meta_dirty(blk);
+                newfs_cache_mark_committed(blk, j->seq);
+                NEWFS_CACHE_UNLOCK();
+                ncopies++;
+            }
+        }
+        pos   = (pos + len) % j->nblks;
+        done += len;
+        j->seq++;
+        j->stats.replayed_txns++;
+        j->stats.replayed_blks += ncopies;
+    }
+    free(revs);
+    free(log);
+    j->head = pos;
+    j->used = scanned;
+    j->seq++;                                         /* 跳过可能残留的半个事务的序号 */
+    return newfs_journal_checkpoint();
+}
+
+/**
+ * @brief 挂载时初始化日志，格式化时写入新的日志超级块，否则重放日志
+ *
+ * @param offset 日志区在磁盘上的偏移
+ * @param blks 日志区块数，含日志超级块
+ * @param is_init 是否刚格式化
+ * @return int
+ */
+int newfs_journal_init(uint64_t offset, uint64_t blks, boolean is_init) {
+    struct newfs_journal*      j = &newfs_ctx->journal;
+    struct newfs_journal_sb_d* jsb;
+    uint8_t*                   buf;
+    memset(j, 0, sizeof(struct newfs_journal));
+    j->sb_blkno = offset / NEWFS_BLK_SZ();
+    j->nblks    = blks - 1;
+    j->seq      = 1;
+    if (!is_init) {
+        buf = (uint8_t*)malloc(NEWFS_BLK_SZ());
+        if (newfs_backend_read(NEWFS_DRIVER(), buf, NEWFS_BLK_SZ(),
+                               (off_t)NEWFS_BLKS_SZ(j->sb_blkno)) != NEWFS_ERROR_NONE) {
+            free(buf);
+            return -NEWFS_ERROR_IO;
+        }
+        jsb = (struct newfs_journal_sb_d*)buf;
+        if (jsb->magic == NEWFS_JOURNAL_MAGIC && jsb->tail < j->nblks) {
+            j->jid      = jsb->jid;
+            j->tail     = jsb->tail;
+            j->head     = jsb->tail;
+            j->tail_seq = jsb->tail_seq;
+            j->seq      = jsb->tail_seq;
+            free(buf);
+            return newfs_journal_replay();
+        }
+        free(buf);
+        NEWFS_INFO("[%s] invalid journal super block, journal reset\n", __func__);
+    }
+    j->jid      = (uint32_t)time(NULL) ^ ((uint32_t)getpid() << 16);
+    j->tail_seq = j->seq;
+    return newfs_journal_write_sb();
+}
+
+/**
+ * @brief 检查点：把所有已提交的元数据块与数据块写回原位并落盘，再清空日志；
+ * 提交后又被修改的元数据块写回冻结的提交时内容
+ *
+ * @return int
+ */
+int newfs_journal_checkpoint() {
+    struct newfs_journal* j = &newfs_ctx->journal;
+    if (newfs_cache_flush() != NEWFS_ERROR_NONE) {
+        return -NEWFS_ERROR_IO;
+    }
+    free(j->revoked);                                 /* 清空日志后不再有需要撤销的旧副本 */
+    j->revoked    = NULL;
+    j->revoke_cap = 0;
+    NEWFS_ATOMIC_SET(&j->revoke_cnt, 0);
+    if (j->used == 0 && j->tail_seq == j->seq) {
+        return NEWFS_ERROR_NONE;
+    }
+    j->tail     = j->head;
+    j->tail_seq = j->seq;
+    j->used     = 0;
+    if (newfs_journal_write_sb() != NEWFS_ERROR_NONE) {
+        return -NEWFS_ERROR_IO;
+    }
+    j->stats.checkpoints++;
+    return newfs_backend_flush(NEWFS_DRIVER());     /* 新的tail落盘后才能覆盖旧事务 */
+}
+
+/**
+ * @brief 把nrev条撤销记录与cnt个元数据块作为一个事务追加到日志，日志剩余空间不足时先做检查点
+ *
+ * @param blks 按块号排序
+ * @param cnt
+ * @param revs 撤销的设备块号
+ * @param nrev 撤销块、描述块、副本与提交块合计不超过日志容量
+ * @return int
+ */
+static int newfs_journal_write_txn(struct newfs_cache_blk** blks, int cnt, uint64_t* revs, int nrev) {
+    struct newfs_journal*       j = &newfs_ctx->journal;
+    struct newfs_journal_hdr_d* hdr;
+    uint8_t* buf;
+    uint64_t nrblk, ndesc, total, tags = NEWFS_JOURNAL_TAGS();
+    uint32_t csum = 2166136261u;
+    int      i, k, ret;
+
+    nrblk = (nrev + tags - 1) / tags;
+    ndesc = (cnt + tags - 1) / tags;
+    total = nrblk + ndesc + cnt + 1;
+    if (j->nblks - j->used < total && newfs_journal_checkpoint() != NEWFS_ERROR_NONE) {
+        return -NEWFS_ERROR_IO;
+    }
+
+    buf = (uint8_t*)calloc(total, NEWFS_BLK_SZ());
+    if (buf == NULL) {
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    for (i = 0, k = 0; i < nrev; k++) {
+        hdr        = (struct newfs_journal_hdr_d*)(buf + NEWFS_BLKS_SZ(k));
+        hdr->magic = NEWFS_JOURNAL_MAGIC;
+        hdr->type  = NEWFS_JOURNAL_REVOKE;
+        hdr->jid   = j->jid;
+        hdr->seq   = j->seq;
+        for (hdr->cnt = 0; hdr->cnt < tags && i < nrev; hdr->cnt++, i++) {
+            hdr->blknos[hdr->cnt] = revs[i];
+        }
+    }
+    for (i = 0; i < cnt; k++) {
+        hdr        = (struct newfs_journal_hdr_d*)(buf + NEWFS_BLKS_SZ(k));
+        hdr->magic = NEWFS_JOURNAL_MAGIC;
+        hdr->type  = NEWFS_JOURNAL_DESC;
+        hdr->jid   = j->jid;
+        hdr->seq   = j->seq;
+        for (hdr->cnt = 0; hdr->cnt < tags && i < cnt; hdr->cnt++, i++) {
+            hdr->blknos[hdr->cnt] = blks[i]->blkno;
+            memcpy(buf + NEWFS_BLKS_SZ(++k), blks[i]->data, NEWFS_BLK_SZ());
+        }
+    }
+    csum       = newfs_journal_csum(csum, buf, NEWFS_BLKS_SZ(total - 1));
+    hdr        = (struct newfs_journal_hdr_d*)(buf + NEWFS_BLKS_SZ(total - 1));
+    hdr->magic = NEWFS_JOURNAL_MAGIC;
+    hdr->type  = NEWFS_JOURNAL_COMMIT;
+    hdr->jid   = j->jid;
+    hdr->cnt   = cnt;
+    hdr->seq   = j->seq;
+    hdr->csum  = csum;
+    /* 副本与数据块落盘后再写提交块 */
+    ret = newfs_journal_io(j->head, buf, total - 1, TRUE);
+    if (ret == NEWFS_ERROR_NONE) {
+        ret = newfs_backend_flush(NEWFS_DRIVER());
+    }
+    if (ret == NEWFS_ERROR_NONE) {
+        ret = newfs_journal_io((j->head + total - 1) % j->nblks, (uint8_t*)hdr, 1, TRUE);
+    }
+    if (ret == NEWFS_ERROR_NONE) {
+        ret = newfs_backend_flush(NEWFS_DRIVER());
+    }
+    free(buf);
+    if (ret != NEWFS_ERROR_NONE) {
+        return -NEWFS_ERROR_IO;
+    }
+    NEWFS_CACHE_LOCK();
+    for (i = 0; i < cnt; i++) {
+        newfs_cache_mark_committed(blks[i], j->seq);
+    }
+    NEWFS_CACHE_UNLOCK();
+    NEWFS_EVENT(NEWFS_LOG_INFO, NEWFS_EV_JOURNAL_COMMIT, j->seq, 0, cnt);
+    j->head  = (j->head + total) % j->nblks;
+    j->used += total;
+    j->seq++;
+    j->stats.commits++;
+    j->stats.logged_blks += cnt;
+    j->stats.revoked_blks += nrev;
+    return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 提交一个事务：写回文件数据块后，把所有未提交的元数据块追加到日志。
+ * newfs_enter在事务接近日志容量时提前提交，单个操作仍使事务超过日志容量时
+ * 拆成多次提交，每次都经过日志，不直接写回原位；撤销记录放在最前面的提交中
+ *
+ * @return int
+ */
+int newfs_journal_commit() {
+    struct newfs_journal*    j    = &newfs_ctx->journal;
+    struct newfs_cache_blk** blks;
+    uint64_t* revs = j->revoked;
+    uint64_t  room, tags = NEWFS_JOURNAL_TAGS();
+    int       nrev = j->revoke_cnt, cnt, i, n, r, nr;
+
+    if (newfs_cache_flush_data() != NEWFS_ERROR_NONE) {
+        return -NEWFS_ERROR_IO;
+    }
+    blks = newfs_cache_collect_meta(&cnt);
+    if (cnt == 0 && nrev == 0) {
+        free(blks);
+        return newfs_backend_flush(NEWFS_DRIVER());
+    }
+    j->revoked    = NULL;                             /* 写入日志前的检查点不能清掉这些记录 */
+    j->revoke_cap = 0;
+    NEWFS_ATOMIC_SET(&j->revoke_cnt, 0);
+    if ((nrev + tags - 1) / tags + cnt + (cnt + tags - 1) / tags + 1 > j->nblks) {
+        NEWFS_INFO("[%s] transaction of %d blks and %d revokes overflows journal, split\n",
+                   __func__, cnt, nrev);
+        j->stats.overflows++;
+    }
+    for (i = 0, r = 0; i < cnt || r < nrev; i += n, r += nr) {
+        room = j->nblks - 1;
+        nr   = (uint64_t)(nrev - r) < room * tags ? nrev - r : (int)(room * tags);
+        room -= (nr + tags - 1) / tags;
+        n    = (int)(room - (room + tags) / (tags + 1));  /* 剩余空间能容纳的副本数 */
+        n    = cnt - i < n ? cnt - i : n;
+        if (newfs_journal_write_txn(blks + i, n, revs + r, nr) != NEWFS_ERROR_NONE) {
+            free(revs);
+            free(blks);
+            return -NEWFS_ERROR_IO;
+        }
+    }
+    free(revs);
+    free(blks);
+    return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 正在积累的事务估计已超过日志区的NEWFS_JOURNAL_COMMIT_PCT，应在下一个操作前提交；
+ * 脏inode在newfs_sync中才写进块缓存，按每个占一块估计。不持锁读取计数
+ *
+ * @return boolean
+ */
+boolean newfs_journal_need_commit() {
+    struct newfs_journal* j    = &newfs_ctx->journal;
+    uint64_t              tags = NEWFS_JOURNAL_TAGS();
+    uint64_t              cnt  = NEWFS_ATOMIC_GET(&newfs_ctx->cache.meta_cnt) +
+                                 NEWFS_ATOMIC_GET(&newfs_ctx->dirty_cnt);
+    uint64_t              nrev = NEWFS_ATOMIC_GET(&j->revoke_cnt);
+    return (cnt + (cnt + tags - 1) / tags + (nrev + tags - 1) / tags + 1) * 100 >
+           j->nblks * NEWFS_JOURNAL_COMMIT_PCT;
+}
+
+/**
+ * @brief 元数据块被释放前调用：丢弃其未提交的内容，日志中若还有已提交的事务则记下撤销记录，
+ * 随下一次提交写入日志，避免重放时旧的元数据覆盖该块被重新分配后写入的文件数据。
+ * 块号与该块的重新分配在同一次或更晚的提交中落盘，崩溃后不会出现已分配却未撤销的块
+ *
+ * @param blkno 设备块号
+ * @return int
+ */
+int newfs_journal_revoke(uint64_t blkno) {
+    struct newfs_journal* j = &newfs_ctx->journal;
+    uint64_t* grown;
+    int       cap;
+
+    newfs_cache_discard(blkno, 1);
+    if (j->used == 0) {                               /* 日志中没有可能被重放的旧副本 */
+        return NEWFS_ERROR_NONE;
+    }
+    if (j->revoke_cnt == j->revoke_cap) {
+        cap   = j->revoke_cap == 0 ? 64 : j->revoke_cap * 2;
+        grown = (uint64_t*)realloc(j->revoked, cap * sizeof(uint64_t));
+        if (grown == NULL) {
+            return newfs_journal_checkpoint();        /* 内存不足时改为清空日志 */
+        }
+        j->revoked    = grown;
+        j->revoke_cap = cap;
+    }
+    j->revoked[j->revoke_cnt] = blkno;
+    NEWFS_ATOMIC_INC(&j->revoke_cnt);
+    return NEWFS_ERROR_NONE;
+}
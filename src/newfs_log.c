@@ -0,0 +1,207 @@
+#include "../include/newfs.h"
+#include <time.h>
+/******************************************************************************
+* SECTION: 日志
+*
+* 文本日志（NEWFS_ERR/NEWFS_INFO/NEWFS_DBG）按newfs_log_level输出到stderr；
+* 高于NEWFS_LOG_MAX的级别在编译期去掉，未定义NEWFS_DEBUG时NEWFS_DBG不产生任何代码。
+* 热路径上的二进制事件由NEWFS_EVENT记录：挂载时指定--log后newfs_event_level才不为OFF，
+* 每个线程第一次记录时创建自己的环形区，之后只由该线程写入，不加锁；写满后覆盖最早的事件。
+* 卸载时把各线程的环形区写入日志文件，由newfs_logdump解码。
+* 日志状态为进程共用，同一进程中的多个实例共享一个日志文件，由第一个卸载的实例写出。
+*******************************************************************************/
+struct newfs_log {
+    pthread_mutex_t        lock;                              /* 保护环形区链表 */
+    pthread_key_t          key;                               /* 线程退出时标记环形区 */
+    pthread_once_t         once;
+    struct newfs_log_ring* rings;
+    char*                  path;
+    uint32_t               next_tid;
+    uint64_t               start;                             /* 打开日志时的单调时钟（ns） */
+    uint64_t               start_ns;                          /* 打开日志时的墙上时间 */
+};
+
+int newfs_log_level   = NEWFS_LOG_ERR;
+int newfs_event_level = NEWFS_LOG_OFF;
+
+static struct newfs_log newfs_log = { PTHREAD_MUTEX_INITIALIZER, 0, PTHREAD_ONCE_INIT };
+static __thread struct newfs_log_ring* newfs_log_self;
+
+/* 事件名与参数a、b、c的名字，NULL为不使用该参数 */
+static const char* newfs_event_names[NEWFS_EV_CNT][4] = {
+    { "mount",          "sz_blk", "max_ino", "max_data" },
+    { "umount",         NULL,     NULL,      NULL       },
+    { "dev_read",       "off",    "size",    NULL       },
+    { "dev_write",      "off",    "size",    NULL       },
+    { "cache_miss",     "blkno",  "nblks",   NULL       },
+    { "cache_evict",    "blkno",  NULL,      "dirty"    },
+    { "alloc",          "goal",   "blk",     "len"      },
+    { "icache_evict",   "ino",    NULL,      "dirty"    },
+    { "journal_commit", "seq",    NULL,      "blks"     },
+    { "wb_run",         NULL,     NULL,      "ratio"    },
+};
+
+static uint64_t newfs_log_now(clockid_t clk) {
+    struct timespec ts;
+    clock_gettime(clk, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void newfs_log_retire(void* arg) {
+    __atomic_store_n(&((struct newfs_log_ring*)arg)->dead, TRUE, __ATOMIC_RELEASE);
+}
+
+static void newfs_log_key_init() {
+    pthread_key_create(&newfs_log.key, newfs_log_retire);
+}
+
+/**
+ * @brief 为当前线程创建环形区
+ *
+ * @return struct newfs_log_ring* 失败返回NULL
+ */
+static struct newfs_log_ring* newfs_log_ring_new() {
+    struct newfs_log_ring* ring = (struct newfs_log_ring*)calloc(1, sizeof(struct newfs_log_ring));
+    if (ring == NULL) {
+        return NULL;
+    }
+    pthread_mutex_lock(&newfs_log.lock);
+    ring->tid        = ++newfs_log.next_tid;
+    ring->next       = newfs_log.rings;
+    newfs_log.rings  = ring;
+    pthread_mutex_unlock(&newfs_log.lock);
+    pthread_setspecific(newfs_log.key, ring);
+    newfs_log_self = ring;
+    return ring;
+}
+
+/**
+ * @brief 事件名
+ *
+ * @param type
+ * @return const char*
+ */
+const char* newfs_event_name(NEWFS_EVENT_TYPE type) {
+    return type < NEWFS_EV_CNT ? newfs_event_names[type][0] : "unknown";
+}
+
+/**
+ * @brief 事件参数的名字
+ *
+ * @param type
+ * @param arg 0、1、2依次为a、b、c
+ * @return const char* 该事件不使用这个参数时返回NULL
+ */
+const char* newfs_event_arg(NEWFS_EVENT_TYPE type, int arg) {
+    return type < NEWFS_EV_CNT && arg >= 0 && arg < 3 ? newfs_event_names[type][arg + 1] : NULL;
+}
+
+/**
+ * @brief 打开二进制事件日志，挂载时调用
+ *
+ * @param path 卸载时写出的日志文件
+ * @param level 记录的最高级别
+ * @return int 日志已打开时返回-NEWFS_ERROR_EXISTS
+ */
+int newfs_log_open(const char* path, int level) {
+    pthread_once(&newfs_log.once, newfs_log_key_init);
+    pthread_mutex_lock(&newfs_log.lock);
+    if (newfs_log.path != NULL) {
+        pthread_mutex_unlock(&newfs_log.lock);
+        return -NEWFS_ERROR_EXISTS;
+    }
+    newfs_log.path     = strdup(path);
+    newfs_log.start    = newfs_log_now(CLOCK_MONOTONIC);
+    newfs_log.start_ns = newfs_log_now(CLOCK_REALTIME);
+    pthread_mutex_unlock(&newfs_log.lock);
+    __atomic_store_n(&newfs_event_level, level, __ATOMIC_RELAXED);
+    return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 记录一个事件，由NEWFS_EVENT在级别打开时调用
+ *
+ * @param type
+ * @param a
+ * @param b
+ * @param c
+ * @return void
+ */
+void newfs_event(NEWFS_EVENT_TYPE type, uint64_t a, uint64_t b, uint32_t c) {
+    struct newfs_log_ring* ring = newfs_log_self;
+    struct newfs_event*    ev;
+    if (ring == NULL && (ring = newfs_log_ring_new()) == NULL) {
+        return;
+    }
+    ev        = &ring->evs[ring->head & (NEWFS_LOG_RING_EVS - 1)];
+    ev->ts_ns = newfs_log_now(CLOCK_MONOTONIC) - newfs_log.start;
+    ev->type  = type;
+    ev->c     = c;
+    ev->a     = a;
+    ev->b     = b;
+    __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief 停止记录并写出日志文件，卸载时调用；已退出线程的环形区随之释放，
+ * 其余线程的环形区保留，下次只写出之后的事件
+ *
+ * @return void
+ */
+void newfs_log_close() {
+    struct newfs_log_hdr   hdr;
+    struct newfs_log_chunk chunk;
+    struct newfs_log_ring* ring;
+    struct newfs_log_ring** link;
+    uint64_t head, first, i;
+    FILE*    fp;
+
+    pthread_mutex_lock(&newfs_log.lock);
+    if (newfs_log.path == NULL) {
+        pthread_mutex_unlock(&newfs_log.lock);
+        return;
+    }
+    __atomic_store_n(&newfs_event_level, NEWFS_LOG_OFF, __ATOMIC_RELAXED);
+    fp = fopen(newfs_log.path, "wb");
+    if (fp == NULL) {
+        NEWFS_ERR("[%s] cannot write %s\n", __func__, newfs_log.path);
+    }
+    memset(&hdr, 0, sizeof(struct newfs_log_hdr));
+    hdr.magic    = NEWFS_LOG_MAGIC;
+    hdr.version  = NEWFS_LOG_VERSION;
+    hdr.ev_size  = sizeof(struct newfs_event);
+    hdr.start_ns = newfs_log.start_ns;
+    for (ring = newfs_log.rings; ring != NULL; ring = ring->next) {
+        hdr.rings++;
+    }
+    if (fp != NULL) {
+        fwrite(&hdr, sizeof(struct newfs_log_hdr), 1, fp);
+    }
+    for (link = &newfs_log.rings; (ring = *link) != NULL; ) {
+        head          = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        first         = head > NEWFS_LOG_RING_EVS ? head - NEWFS_LOG_RING_EVS : 0;
+        first         = first > ring->base ? first : ring->base;
+        chunk.tid     = ring->tid;
+        chunk.count   = head - first;
+        chunk.dropped = first - ring->base;
+        if (fp != NULL) {
+            fwrite(&chunk, sizeof(struct newfs_log_chunk), 1, fp);
+            for (i = first; i < head; i++) {
+                fwrite(&ring->evs[i & (NEWFS_LOG_RING_EVS - 1)], sizeof(struct newfs_event), 1, fp);
+            }
+        }
+        if (__atomic_load_n(&ring->dead, __ATOMIC_ACQUIRE)) {
+            *link = ring->next;
+            free(ring);
+            continue;
+        }
+        ring->base = head;
+        link = &ring->next;
+    }
+    if (fp != NULL) {
+        fclose(fp);
+    }
+    free(newfs_log.path);
+    newfs_log.path = NULL;
+    pthread_mutex_unlock(&newfs_log.lock);
+}
@@ -0,0 +1,135 @@
+#include "../include/newfs.h"
+/******************************************************************************
+* SECTION: 格式化
+*
+* 按给定的块大小、inode数与日志大小计算布局，布局与挂载时一致：
+* | Super | Inode Map | Data Map | Inodes | Journal | Data |
+* 数据位图按数据区大小计算，覆盖整个设备。位图、inode表与日志区用大块顺序写清零，
+* 再写入根目录inode与日志超级块，最后写超级块，格式化中途失败的设备不会被挂载。
+*******************************************************************************/
+/**
+ * @brief 默认几何参数
+ *
+ * @param geo
+ * @return void
+ */
+void newfs_geometry_default(struct newfs_geometry* geo) {
+    memset(geo, 0, sizeof(struct newfs_geometry));
+    geo->inode_ratio  = NEWFS_DEFAULT_INODE_RATIO;   /* 块大小与日志大小在格式化时按设备决定 */
+}
+
+/**
+ * @brief 按布局计算超级块
+ *
+ * @param geo
+ * @param super_d 输出
+ * @return int 参数不合法或设备太小返回-NEWFS_ERROR_INVAL
+ */
+static int newfs_mkfs_layout(struct newfs_geometry* geo, struct newfs_super_d* super_d) {
+    uint64_t total_blks, inodes, inode_blks, map_inode_blks, map_data_blks, meta_blks, rest;
+    uint64_t per_blk, map_bits, map_cover;
+
+    if (geo->sz_blk == 0) {
+        geo->sz_blk = NEWFS_DISK_SZ() < NEWFS_SMALL_DISK_SZ ? NEWFS_SMALL_BLK_SZ : NEWFS_DEFAULT_BLK_SZ;
+    }
+    if (geo->sz_blk < NEWFS_MIN_BLK_SZ || geo->sz_blk > NEWFS_MAX_BLK_SZ ||
+        (geo->sz_blk & (geo->sz_blk - 1)) != 0 || geo->sz_blk % NEWFS_IO_SZ() != 0) {
+        NEWFS_ERR("[%s] bad block size %d\n", __func__, geo->sz_blk);
+        return -NEWFS_ERROR_INVAL;
+    }
+    if (geo->journal_blks == 0) {
+        geo->journal_blks = NEWFS_JOURNAL_SZ / geo->sz_blk;
+        geo->journal_blks = geo->journal_blks < NEWFS_JOURNAL_MIN_BLKS ? NEWFS_JOURNAL_MIN_BLKS : geo->journal_blks;
+    }
+    if (geo->journal_blks < NEWFS_JOURNAL_LEAST_BLKS) {
+        NEWFS_ERR("[%s] journal needs at least %d blocks\n", __func__, NEWFS_JOURNAL_LEAST_BLKS);
+        return -NEWFS_ERROR_INVAL;
+    }
+    total_blks = NEWFS_DISK_SZ() / geo->sz_blk;
+    per_blk    = geo->sz_blk / NEWFS_INO_SZ();
+    map_bits   = (uint64_t)geo->sz_blk * UINT8_BITS;            /* 一个位图块管理的对象数 */
+    map_cover  = map_bits + 1;                                  /* 一个数据位图块连同它管理的数据块 */
+    inodes = geo->inodes > 0 ? (uint64_t)geo->inodes
+                             : (uint64_t)NEWFS_DISK_SZ() / (geo->inode_ratio > 0 ? geo->inode_ratio
+                                                                                 : NEWFS_DEFAULT_INODE_RATIO);
+    inodes         = NEWFS_ROUND_UP(inodes, per_blk);           /* 填满inode表的最后一块 */
+    inode_blks     = inodes / per_blk;
+    map_inode_blks = NEWFS_ROUND_UP(inodes, map_bits) / map_bits;
+    meta_blks      = 1 + map_inode_blks + inode_blks + geo->journal_blks;
+    if (inodes > INT32_MAX || meta_blks + 2 > total_blks) {
+        NEWFS_ERR("[%s] device too small: %lu blks, %lu inodes\n", __func__,
+                  (unsigned long)total_blks, (unsigned long)inodes);
+        return -NEWFS_ERROR_INVAL;
+    }
+    rest           = total_blks - meta_blks;                   /* 数据位图与数据区共用 */
+    map_data_blks  = NEWFS_ROUND_UP(rest, map_cover) / map_cover;
+
+    memset(super_d, 0, sizeof(struct newfs_super_d));
+    super_d->magic_num        = NEWFS_MAGIC_NUM;
+    super_d->sz_blk           = geo->sz_blk;
+    super_d->max_ino          = inodes;
+    super_d->max_data         = rest - map_data_blks;
+    super_d->map_inode_blks   = map_inode_blks;
+    super_d->map_data_blks    = map_data_blks;
+    super_d->map_inode_offset = NEWFS_SUPER_OFS + geo->sz_blk;
+    super_d->map_data_offset  = super_d->map_inode_offset + map_inode_blks * geo->sz_blk;
+    super_d->inode_offset     = super_d->map_data_offset + map_data_blks * geo->sz_blk;
+    super_d->journal_offset   = super_d->inode_offset + inode_blks * geo->sz_blk;
+    super_d->journal_blks     = geo->journal_blks;
+    super_d->data_offset      = super_d->journal_offset + (uint64_t)geo->journal_blks * geo->sz_blk;
+    return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 格式化已打开的设备
+ *
+ * @param geo 几何参数
+ * @return int
+ */
+int newfs_mkfs(struct newfs_geometry* geo) {
+    struct newfs_super_d  super_d;
+    struct newfs_inode_d* root_d;
+    uint8_t* buf;
+    uint64_t off, len;
+    int      ret;
+
+    newfs_ctx->sz_disk = NEWFS_DRIVER()->sz_disk;
+    newfs_ctx->sz_io   = NEWFS_DRIVER()->sz_io;
+    ret = newfs_mkfs_layout(geo, &super_d);
+    if (ret != NEWFS_ERROR_NONE) {
+        return ret;
+    }
+    newfs_ctx->sz_blk = geo->sz_blk;
+    buf = (uint8_t*)calloc(1, NEWFS_MKFS_ZERO_SZ);
+    if (buf == NULL) {
+        return -NEWFS_ERROR_NOSPACE;
+    }
+                                                      /* 位图、inode表与日志区清零 */
+    for (off = super_d.map_inode_offset; off < super_d.data_offset; off += len) {
+        len = super_d.data_offset - off < NEWFS_MKFS_ZERO_SZ ? super_d.data_offset - off : NEWFS_MKFS_ZERO_SZ;
+        if (newfs_backend_write(NEWFS_DRIVER(), buf, (int)len, (off_t)off) != NEWFS_ERROR_NONE) {
+            free(buf);
+            return -NEWFS_ERROR_IO;
+        }
+    }
+    buf[0] = 1;                                       /* 根目录占用0号inode */
+    ret = newfs_backend_write(NEWFS_DRIVER(), buf, geo->sz_blk, (off_t)super_d.map_inode_offset);
+    memset(buf, 0, geo->sz_blk);
+    root_d          = (struct newfs_inode_d*)buf;
+    root_d->ino     = NEWFS_ROOT_INO;
+    root_d->ftype   = NEWFS_DIR;
+    root_d->ext_blk = NEWFS_BLK_NONE_D;
+    ret |= newfs_backend_write(NEWFS_DRIVER(), buf, geo->sz_blk, (off_t)super_d.inode_offset);
+    ret |= newfs_journal_init(super_d.journal_offset, super_d.journal_blks, TRUE);
+    memset(buf, 0, geo->sz_blk);
+    memcpy(buf, &super_d, sizeof(struct newfs_super_d));
+    ret |= newfs_backend_write(NEWFS_DRIVER(), buf, geo->sz_blk, NEWFS_SUPER_OFS);
+    free(buf);
+    if (ret != NEWFS_ERROR_NONE || newfs_backend_flush(NEWFS_DRIVER()) != NEWFS_ERROR_NONE) {
+        return -NEWFS_ERROR_IO;
+    }
+    printf("newfs: %lu bytes, %d B blocks, %lu inodes, %lu data blocks, %lu journal blocks\n",
+           (unsigned long)NEWFS_DISK_SZ(), geo->sz_blk, (unsigned long)super_d.max_ino,
+           (unsigned long)super_d.max_data, (unsigned long)super_d.journal_blks);
+    return NEWFS_ERROR_NONE;
+}
@@ -0,0 +1,1042 @@
+#include "../include/newfs.h"
+/******************************************************************************
+* SECTION: 并发控制
+*
+* FUSE默认以多线程运行。改变命名空间或提交日志的操作独占命名空间锁，
+* 查找、读写等其他操作共享该锁，再按需持有inode的读写锁；
+* inode缓存超限时先独占一次命名空间锁完成淘汰，正在积累的日志事务
+* 接近日志容量时同样先独占一次提交，使每个事务都能完整写入日志。
+*******************************************************************************/
+/**
+ * @brief 进入一个FUSE操作，取得命名空间锁
+ * 
+ * @param exclusive 是否独占
+ * @return void
+ */
+static void newfs_enter(boolean exclusive) {
+	if (newfs_icache_over() || newfs_journal_need_commit()) {
+		NEWFS_WRLOCK();
+		newfs_icache_shrink();
+		if (newfs_journal_need_commit() && newfs_sync() != NEWFS_ERROR_NONE) {
+			NEWFS_ERR("[%s] journal commit failed\n", __func__);
+		}
+		if (exclusive) {
+			return;
+		}
+		NEWFS_UNLOCK();
+	}
+	if (exclusive) {
+		NEWFS_WRLOCK();
+	}
+	else {
+		NEWFS_RDLOCK();
+	}
+}
+/******************************************************************************
+* SECTION: 统计文件
+*
+* /.newfs/stats是只读的虚拟文件，不占用inode，也不出现在根目录的列表中；
+* 打开时生成快照，以direct_io读出，因此getattr报告的大小为0不影响读取。
+*******************************************************************************/
+/**
+ * @brief 路径是否为统计目录或其下的路径
+ * 
+ * @param path 
+ * @return boolean 
+ */
+static boolean newfs_in_stats(const char* path) {
+	int len = strlen(NEWFS_STATS_DIR);
+	return strncmp(path, NEWFS_STATS_DIR, len) == 0 && (path[len] == '\0' || path[len] == '/');
+}
+
+/**
+ * @brief 在统计目录中创建或修改时的错误码
+ * 
+ * @param path 
+ * @return int 
+ */
+static int newfs_stats_readonly(const char* path) {
+	if (strcmp(path, NEWFS_STATS_DIR) == 0 || strcmp(path, NEWFS_STATS_FILE) == 0) {
+		return -NEWFS_ERROR_EXISTS;
+	}
+	return -NEWFS_ERROR_ACCESS;
+}
+
+/**
+ * @brief 操作返回前调用：记入统计，挂载时指定了--trace则同时追加一条跟踪记录
+ * 
+ * @param op 操作类别
+ * @param start newfs_stats_begin的返回值
+ * @param ret 操作的返回值
+ * @param path 
+ * @param off 偏移，truncate为新的大小
+ * @param size 
+ * @param mode mkdir/mknod的mode，open的flags
+ * @param fh 句柄，0为未经open
+ * @return void
+ */
+static void newfs_op_end(NEWFS_OP op, uint64_t start, int ret, const char* path,
+						 uint64_t off, uint32_t size, uint32_t mode, uint64_t fh) {
+	newfs_stats_end(op, start, ret);
+	if (newfs_ctx->trace.running) {
+		newfs_trace_op(op, path, off, size, mode, fh, start, ret);
+	}
+}
+/******************************************************************************
+* SECTION: 必做函数实现
+*******************************************************************************/
+/**
+ * @brief 创建目录
+ * 
+ * @param path 相对于挂载点的路径
+ * @param mode 创建模式（只读？只写？），可忽略
+ * @return int 0成功，否则失败
+ */
+int newfs_mkdir(const char* path, mode_t mode) {
+	/* TODO: 解析路径，创建目录 */
+	boolean is_find, is_root;
+	char* fname;
+	struct newfs_dentry* last_dentry;
+	struct newfs_dentry* dentry;
+	struct newfs_inode*  inode;
+	uint64_t start = newfs_stats_begin();
+	int ret = NEWFS_ERROR_NONE;
+
+	if (newfs_in_stats(path)) {
+		ret = newfs_stats_readonly(path);
+		newfs_op_end(NEWFS_OP_MKDIR, start, ret, path, 0, 0, mode, 0);
+		return ret;
+	}
+	newfs_enter(TRUE);
+	last_dentry = newfs_lookup(path, &is_find, &is_root);
+	fname       = newfs_get_fname(path);
+	if (last_dentry == NULL) {
+		ret = -NEWFS_ERROR_IO;
+	}
+	else if (is_find) {
+		ret = -NEWFS_ERROR_EXISTS;
+	}
+	else if (NEWFS_IS_REG(last_dentry->inode)) {
+		ret = -NEWFS_ERROR_NOTDIR;
+	}
+	else if (newfs_dentry_lvl(last_dentry) != newfs_calc_lvl(path) - 1) {
+		ret = -NEWFS_ERROR_NOTFOUND;				/* 中间目录不存在 */
+	}
+	else if (strlen(fname) >= NEWFS_MAX_FILE_NAME) {
+		ret = -NEWFS_ERROR_NAMETOOLONG;
+	}
+	else {
+		dentry = new_dentry(last_dentry->inode, fname, strlen(fname), NEWFS_DIR); 
+		inode  = dentry == NULL ? NULL : newfs_alloc_inode(dentry);
+		if (inode == NULL) {
+			newfs_free_dentry(dentry);
+			ret = -NEWFS_ERROR_NOSPACE;
+		}
+		else if (newfs_alloc_dentry(last_dentry->inode, dentry) < 0) {
+			newfs_free_inode(inode);
+			newfs_free_dentry(dentry);
+			ret = -NEWFS_ERROR_NOSPACE;
+		}
+	}
+	NEWFS_UNLOCK();
+	newfs_op_end(NEWFS_OP_MKDIR, start, ret, path, 0, 0, mode, 0);
+	return ret;
+}
+/**
+ * @brief 按目录项填充文件属性，getattr与readdir共用
+ * 
+ * @param dentry 
+ * @param newfs_stat 
+ * @return int inode读入失败返回-NEWFS_ERROR_IO
+ */
+static int newfs_fill_stat(struct newfs_dentry* dentry, struct stat* newfs_stat) {
+	struct newfs_inode* inode = newfs_dentry_inode(dentry);
+
+	memset(newfs_stat, 0, sizeof(struct stat));
+	if (inode == NULL) {
+		return -NEWFS_ERROR_IO;
+	}
+	pthread_rwlock_rdlock(&inode->rwlock);
+	if (NEWFS_IS_DIR(inode)) {
+		newfs_stat->st_mode = S_IFDIR | NEWFS_DEFAULT_PERM;
+		newfs_stat->st_size = NEWFS_BLKS_SZ(inode->dir_leaves);
+	}
+	else if (NEWFS_IS_REG(inode)) {
+		newfs_stat->st_mode = S_IFREG | NEWFS_DEFAULT_PERM;
+		newfs_stat->st_size = inode->size;
+	}
+	pthread_rwlock_unlock(&inode->rwlock);
+
+	newfs_stat->st_nlink = 1;
+	newfs_stat->st_uid 	 = getuid();
+	newfs_stat->st_gid 	 = getgid();
+	newfs_stat->st_atime   = time(NULL);
+	newfs_stat->st_mtime   = time(NULL);
+	newfs_stat->st_blksize = NEWFS_BLK_SZ();
+	return NEWFS_ERROR_NONE;
+}
+/**
+ * @brief 获取文件或目录的属性，该函数非常重要
+ * 
+ * @param path 相对于挂载点的路径
+ * @param newfs_stat 返回状态
+ * @return int 0成功，否则失败
+ */
+int newfs_getattr(const char* path, struct stat * newfs_stat) {
+	/* TODO: 解析路径，获取Inode，填充newfs_stat，可参考/fs/simplefs/sfs.c的sfs_getattr()函数实现 */
+	boolean	is_find, is_root;
+	struct newfs_dentry* dentry;
+	uint64_t start = newfs_stats_begin();
+	int ret = NEWFS_ERROR_NONE;
+
+	if (newfs_in_stats(path)) {
+		memset(newfs_stat, 0, sizeof(struct stat));
+		if (strcmp(path, NEWFS_STATS_DIR) == 0) {
+			newfs_stat->st_mode  = S_IFDIR | 0555;
+			newfs_stat->st_nlink = 2;
+		}
+		else if (strcmp(path, NEWFS_STATS_FILE) == 0) {
+			newfs_stat->st_mode  = S_IFREG | 0444;
+			newfs_stat->st_nlink = 1;
+		}
+		else {
+			ret = -NEWFS_ERROR_NOTFOUND;
+		}
+		newfs_stat->st_uid = getuid();
+		newfs_stat->st_gid = getgid();
+		newfs_op_end(NEWFS_OP_GETATTR, start, ret, path, 0, 0, 0, 0);
+		return ret;
+	}
+	newfs_enter(FALSE);
+	dentry = newfs_lookup(path, &is_find, &is_root);
+	if (dentry == NULL) {
+		ret = -NEWFS_ERROR_IO;
+	}
+	else if (is_find == FALSE) {
+		ret = -NEWFS_ERROR_NOTFOUND;
+	}
+	else if ((ret = newfs_fill_stat(dentry, newfs_stat)) == NEWFS_ERROR_NONE) {
+		if (is_root) {
+			newfs_stat->st_size	= newfs_ctx->sz_usage; 
+			newfs_stat->st_blocks = NEWFS_DISK_SZ() / NEWFS_BLK_SZ();
+			newfs_stat->st_nlink  = 2;		/* !特殊，根目录link数为2 */
+		}
+	}
+	NEWFS_UNLOCK();
+	newfs_op_end(NEWFS_OP_GETATTR, start, ret, path, 0, 0, 0, 0);
+	return ret;
+}
+
+
+/**
+ * @brief 遍历目录项，填充至buf，并交给FUSE输出
+ * 
+ * @param path 相对于挂载点的路径
+ * @param buf 输出buffer
+ * @param filler 参数讲解:
+ * 
+ * typedef int (*fuse_fill_dir_t) (void *buf, const char *name,
+ *				const struct stat *stbuf, off_t off)
+ * buf: name会被复制到buf中
+ * name: dentry名字
+ * stbuf: 文件状态，一并填充，ls -l不必再逐个getattr
+ * off: 下一次offset从哪里开始，这里可以理解为第几个dentry
+ * 
+ * 一次调用连续输出目录项，直到filler返回buf已满；
+ * 下一次调用从opendir建立的游标继续，不再从链表头数到offset
+ * 
+ * @param offset 第几个目录项？
+ * @param fi fi->fh为opendir建立的游标，为0时按offset定位
+ * @return int 0成功，否则失败
+ */
+int newfs_readdir(const char * path, void * buf, fuse_fill_dir_t filler, off_t offset,
+			    		 struct fuse_file_info * fi) {
+	boolean	is_find, is_root;
+	struct newfs_dir_cursor* cursor = fi != NULL ? (struct newfs_dir_cursor *)(uintptr_t)fi->fh : NULL;
+	struct newfs_dentry* dentry;
+	struct newfs_dentry* sub_dentry;
+	struct newfs_inode* inode;
+	struct stat sub_stat;
+	off_t first = offset;
+	uint64_t fh = fi != NULL ? fi->fh : 0;
+	uint64_t start = newfs_stats_begin();
+	int ret;
+
+	if (cursor == NULL && strcmp(path, NEWFS_STATS_DIR) == 0) {
+		if (offset == 0) {
+			memset(&sub_stat, 0, sizeof(struct stat));
+			sub_stat.st_mode = S_IFREG | 0444;
+			filler(buf, NEWFS_STATS_FILE + strlen(NEWFS_STATS_DIR) + 1, &sub_stat, 1);
+		}
+		newfs_op_end(NEWFS_OP_READDIR, start, NEWFS_ERROR_NONE, path, first, offset - first, 0, fh);
+		return NEWFS_ERROR_NONE;
+	}
+	newfs_enter(FALSE);
+	if (cursor != NULL) {
+		inode = cursor->inode;
+	}
+	else {
+		dentry = newfs_lookup(path, &is_find, &is_root);
+		if (dentry == NULL || !is_find) {
+			ret = dentry == NULL ? -NEWFS_ERROR_IO : -NEWFS_ERROR_NOTFOUND;
+			NEWFS_UNLOCK();
+			newfs_op_end(NEWFS_OP_READDIR, start, ret, path, first, offset - first, 0, fh);
+			return ret;
+		}
+		inode = dentry->inode;
+	}
+	if (cursor != NULL && cursor->off == offset && cursor->gen == inode->dir_gen) {
+		sub_dentry = cursor->next;
+	}
+	else {											/* 首次调用、seekdir，或之后有目录项被删除 */
+		sub_dentry = newfs_get_dentry(inode, offset);
+	}
+	while (sub_dentry != NULL) {
+		/* 读不出inode的目录项仍然列出，不带属性，之后的getattr返回错误 */
+		ret = newfs_fill_stat(sub_dentry, &sub_stat);
+		if (filler(buf, sub_dentry->fname, ret == NEWFS_ERROR_NONE ? &sub_stat : NULL, offset + 1) != 0) {
+			break;
+		}
+		offset++;
+		sub_dentry = sub_dentry->brother;
+	}
+	if (cursor != NULL) {
+		cursor->next = sub_dentry;
+		cursor->off  = offset;
+		cursor->gen  = inode->dir_gen;
+	}
+	NEWFS_UNLOCK();
+	newfs_op_end(NEWFS_OP_READDIR, start, NEWFS_ERROR_NONE, path, first, offset - first, 0, fh);
+	return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 创建文件
+ * 
+ * @param path 相对于挂载点的路径
+ * @param mode 创建文件的模式，可忽略
+ * @param dev 设备类型，可忽略
+ * @return int 0成功，否则失败
+ */
+int newfs_mknod(const char* path, mode_t mode, dev_t dev) {
+	/* TODO: 解析路径，并创建相应的文件 */
+	boolean	is_find, is_root;
+	
+	struct newfs_dentry* last_dentry;
+	struct newfs_dentry* dentry;
+	struct newfs_inode* inode;
+	char* fname;
+	uint64_t start = newfs_stats_begin();
+	int ret = NEWFS_ERROR_NONE;
+	
+	if (newfs_in_stats(path)) {
+		ret = newfs_stats_readonly(path);
+		newfs_op_end(NEWFS_OP_MKNOD, start, ret, path, 0, 0, mode, 0);
+		return ret;
+	}
+	newfs_enter(TRUE);
+	last_dentry = newfs_lookup(path, &is_find, &is_root);
+	fname       = newfs_get_fname(path);
+	if (last_dentry == NULL) {
+		ret = -NEWFS_ERROR_IO;
+	}
+	else if (is_find == TRUE) {
+		ret = -NEWFS_ERROR_EXISTS;
+	}
+	else if (NEWFS_IS_REG(last_dentry->inode)) {
+		ret = -NEWFS_ERROR_NOTDIR;
+	}
+	else if (newfs_dentry_lvl(last_dentry) != newfs_calc_lvl(path) - 1) {
+		ret = -NEWFS_ERROR_NOTFOUND;				/* 中间目录不存在 */
+	}
+	else if (strlen(fname) >= NEWFS_MAX_FILE_NAME) {
+		ret = -NEWFS_ERROR_NAMETOOLONG;
+	}
+	else {
+		if (S_ISDIR(mode)) {// 文件夹
+			dentry = new_dentry(last_dentry->inode, fname, strlen(fname), NEWFS_DIR);
+		} else {// 文件
+			dentry = new_dentry(last_dentry->inode, fname, strlen(fname), NEWFS_REG_FILE);
+		}
+		inode = dentry == NULL ? NULL : newfs_alloc_inode(dentry);
+		if (inode == NULL) {
+			newfs_free_dentry(dentry);
+			ret = -NEWFS_ERROR_NOSPACE;
+		}
+		else if (newfs_alloc_dentry(last_dentry->inode, dentry) < 0) {
+			newfs_free_inode(inode);
+			newfs_free_dentry(dentry);
+			ret = -NEWFS_ERROR_NOSPACE;
+		}
+	}
+	NEWFS_UNLOCK();
+	newfs_op_end(NEWFS_OP_MKNOD, start, ret, path, 0, 0, mode, 0);
+	return ret;
+}
+/**
+ * @brief 修改时间，为了不让touch报错 
+ * 
+ * @param path 相对于挂载点的路径
+ * @param tv 实践
+ * @return int 0成功，否则失败
+ */
+int newfs_utimens(const char* path, const struct timespec tv[2]) {
+	(void)path;
+	return 0;
+}
+/******************************************************************************
+* SECTION: 选做函数实现
+*******************************************************************************/
+/**
+ * @brief 写入文件
+ * 
+ * @param path 相对于挂载点的路径
+ * @param buf 写入的内容
+ * @param size 写入的字节数
+ * @param offset 相对文件的偏移
+ * @param fi 打开的句柄，为NULL时按路径查找
+ * @return int 写入大小
+ */
+int newfs_write(const char* path, const char* buf, size_t size, off_t offset,
+		        struct fuse_file_info* fi) {
+	boolean	is_find, is_root;
+	struct newfs_dentry* dentry;
+	struct newfs_file* file = fi != NULL ? (struct newfs_file *)(uintptr_t)fi->fh : NULL;
+	struct newfs_inode* inode;
+	uint64_t start = newfs_stats_begin();
+	int ret;
+
+	if (newfs_in_stats(path)) {
+		ret = -NEWFS_ERROR_ACCESS;
+		newfs_op_end(NEWFS_OP_WRITE, start, ret, path, offset, size, 0, fi != NULL ? fi->fh : 0);
+		return ret;
+	}
+	newfs_enter(FALSE);
+	if (file != NULL) {								/* 打开期间inode一直在内存中，名字删除后仍可写 */
+		inode = file->inode;
+	}
+	else {
+		dentry = newfs_lookup(path, &is_find, &is_root);
+		inode  = dentry != NULL && is_find ? dentry->inode : NULL;
+	}
+	if (inode == NULL) {
+		ret = file == NULL && dentry == NULL ? -NEWFS_ERROR_IO : -NEWFS_ERROR_NOTFOUND;
+	}
+	else if (NEWFS_IS_DIR(inode)) {
+		ret = -NEWFS_ERROR_ISDIR;
+	}
+	else {
+		pthread_rwlock_wrlock(&inode->rwlock);
+		ret = newfs_write_data(inode, (const uint8_t *)buf, size, offset);
+		pthread_rwlock_unlock(&inode->rwlock);
+	}
+	NEWFS_UNLOCK();
+	newfs_op_end(NEWFS_OP_WRITE, start, ret, path, offset, size, 0, fi != NULL ? fi->fh : 0);
+	return ret;
+}
+
+/**
+ * @brief 读取文件
+ * 
+ * @param path 相对于挂载点的路径
+ * @param buf 读取的内容
+ * @param size 读取的字节数
+ * @param offset 相对文件的偏移
+ * @param fi 可忽略
+ * @return int 读取大小
+ */
+int newfs_read(const char* path, char* buf, size_t size, off_t offset,
+		       struct fuse_file_info* fi) {
+	boolean	is_find, is_root;
+	struct newfs_dentry* dentry;
+	struct newfs_file* file = fi != NULL ? (struct newfs_file *)(uintptr_t)fi->fh : NULL;
+	struct newfs_inode* inode;
+	uint64_t start = newfs_stats_begin();
+	int ret;
+
+	if (file != NULL && file->snap != NULL) {		/* 统计文件，从打开时的快照复制 */
+		ret = 0;
+		if (offset < (off_t)file->snap_len) {
+			ret = file->snap_len - offset < size ? file->snap_len - offset : size;
+			memcpy(buf, file->snap + offset, ret);
+		}
+		newfs_op_end(NEWFS_OP_READ, start, ret, path, offset, size, 0, fi != NULL ? fi->fh : 0);
+		return ret;
+	}
+	newfs_enter(FALSE);
+	if (file != NULL) {								/* 打开期间inode一直在内存中 */
+		inode = file->inode;
+	}
+	else {
+		dentry = newfs_lookup(path, &is_find, &is_root);
+		inode  = dentry != NULL && is_find ? dentry->inode : NULL;
+	}
+	if (inode == NULL) {
+		ret = file == NULL && dentry == NULL ? -NEWFS_ERROR_IO : -NEWFS_ERROR_NOTFOUND;
+	}
+	else if (NEWFS_IS_DIR(inode)) {
+		ret = -NEWFS_ERROR_ISDIR;
+	}
+	else {
+		pthread_rwlock_rdlock(&inode->rwlock);
+		ret = newfs_read_data(inode, (uint8_t *)buf, size, offset);
+		if (file != NULL) {
+			newfs_ra_read(file, offset, ret);
+		}
+		pthread_rwlock_unlock(&inode->rwlock);
+	}
+	NEWFS_UNLOCK();
+	newfs_op_end(NEWFS_OP_READ, start, ret, path, offset, size, 0, fi != NULL ? fi->fh : 0);
+	return ret;
+}
+
+/**
+ * @brief 删除目录项及其指向的文件或空目录，unlink、rmdir与rename覆盖目标时共用；
+ * 调用者持有命名空间写锁。inode仍被打开时只删除名字，inode成为孤儿，
+ * 已打开的句柄照常读写，最后一个引用释放后由newfs_reap_orphans删除
+ * 
+ * @param dentry 已载入inode的目录项
+ * @return int 
+ */
+static int newfs_remove(struct newfs_dentry* dentry) {
+	struct newfs_inode* dir   = dentry->parent->inode;
+	struct newfs_inode* inode = dentry->inode;
+	newfs_ra_cancel(inode);							/* 排队的预读请求也引用inode */
+	if (NEWFS_IS_DIR(inode)) {
+		newfs_dcache_purge(dentry);					/* 以该目录为父的缓存项随之失效 */
+	}
+	if (NEWFS_ATOMIC_GET(&inode->ref) != 0) {
+		newfs_remove_dentry(dir, dentry);
+		inode->is_orphan   = TRUE;
+		dentry->brother    = newfs_ctx->orphans;
+		newfs_ctx->orphans = dentry;
+		return NEWFS_ERROR_NONE;
+	}
+	if (newfs_delete_inode(inode) != NEWFS_ERROR_NONE) {
+		return -NEWFS_ERROR_IO;
+	}
+	newfs_remove_dentry(dir, dentry);
+	newfs_free_dentry(dentry);
+	return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 删除文件
+ * 
+ * @param path 相对于挂载点的路径
+ * @return int 0成功，否则失败
+ */
+int newfs_unlink(const char* path) {
+	boolean	is_find, is_root;
+	struct newfs_dentry* dentry;
+	uint64_t start = newfs_stats_begin();
+	int ret;
+
+	if (newfs_in_stats(path)) {
+		newfs_op_end(NEWFS_OP_UNLINK, start, -NEWFS_ERROR_ACCESS, path, 0, 0, 0, 0);
+		return -NEWFS_ERROR_ACCESS;
+	}
+	newfs_enter(TRUE);
+	dentry = newfs_lookup(path, &is_find, &is_root);
+	if (dentry == NULL) {
+		ret = -NEWFS_ERROR_IO;
+	}
+	else if (is_find == FALSE) {
+		ret = -NEWFS_ERROR_NOTFOUND;
+	}
+	else if (NEWFS_IS_DIR(dentry->inode)) {
+		ret = -NEWFS_ERROR_ISDIR;
+	}
+	else {
+		ret = newfs_remove(dentry);
+	}
+	NEWFS_UNLOCK();
+	newfs_op_end(NEWFS_OP_UNLINK, start, ret, path, 0, 0, 0, 0);
+	return ret;
+}
+
+/**
+ * @brief 删除目录
+ * 
+ * 一个可能的删除目录操作如下：
+ * rm ./tests/mnt/j/ -r
+ *  1) Step 1. rm ./tests/mnt/j/j
+ *  2) Step 2. rm ./tests/mnt/j
+ * 即，先删除最深层的文件，再删除目录文件本身
+ * 
+ * @param path 相对于挂载点的路径
+ * @return int 0成功，否则失败
+ */
+int newfs_rmdir(const char* path) {
+	boolean	is_find, is_root;
+	struct newfs_dentry* dentry;
+	uint64_t start = newfs_stats_begin();
+	int ret;
+
+	if (newfs_in_stats(path)) {
+		newfs_op_end(NEWFS_OP_RMDIR, start, -NEWFS_ERROR_ACCESS, path, 0, 0, 0, 0);
+		return -NEWFS_ERROR_ACCESS;
+	}
+	newfs_enter(TRUE);
+	dentry = newfs_lookup(path, &is_find, &is_root);
+	if (dentry == NULL) {
+		ret = -NEWFS_ERROR_IO;
+	}
+	else if (is_find == FALSE) {
+		ret = -NEWFS_ERROR_NOTFOUND;
+	}
+	else if (is_root) {
+		ret = -NEWFS_ERROR_BUSY;
+	}
+	else if (!NEWFS_IS_DIR(dentry->inode)) {
+		ret = -NEWFS_ERROR_NOTDIR;
+	}
+	else if (dentry->inode->dir_cnt != 0) {
+		ret = -NEWFS_ERROR_NOTEMPTY;
+	}
+	else {
+		ret = newfs_remove(dentry);
+	}
+	NEWFS_UNLOCK();
+	newfs_op_end(NEWFS_OP_RMDIR, start, ret, path, 0, 0, 0, 0);
+	return ret;
+}
+
+/**
+ * @brief 重命名文件 
+ * 
+ * @param from 源文件路径
+ * @param to 目标文件路径
+ * @return int 0成功，否则失败
+ */
+int newfs_rename(const char* from, const char* to) {
+	boolean	is_find, is_root;
+	struct newfs_dentry* src;
+	struct newfs_dentry* dst;
+	struct newfs_dentry* cursor;
+	struct newfs_inode*  old_dir;
+	struct newfs_inode*  new_dir;
+	const char* old_name;
+	const char* name;
+	char*    trace_path;
+	char*    fname = newfs_get_fname(to);
+	int      len   = strlen(fname);
+	int      old_len;
+	uint64_t start = newfs_stats_begin();
+	int ret = NEWFS_ERROR_NONE;
+
+	if (newfs_in_stats(from) || newfs_in_stats(to)) {
+		ret = -NEWFS_ERROR_ACCESS;
+		goto out;
+	}
+	newfs_enter(TRUE);
+	src = newfs_lookup(from, &is_find, &is_root);
+	if (src == NULL || is_find == FALSE || is_root) {
+		ret = src == NULL ? -NEWFS_ERROR_IO : is_root ? -NEWFS_ERROR_BUSY : -NEWFS_ERROR_NOTFOUND;
+		goto unlock;
+	}
+	dst = newfs_lookup(to, &is_find, &is_root);
+	if (dst == NULL) {
+		ret = -NEWFS_ERROR_IO;
+		goto unlock;
+	}
+	if (is_find) {									/* 目标已存在时覆盖 */
+		new_dir = is_root ? NULL : dst->parent->inode;
+	}
+	else if (NEWFS_IS_REG(dst->inode)) {
+		ret = -NEWFS_ERROR_NOTDIR;
+		goto unlock;
+	}
+	else if (newfs_dentry_lvl(dst) != newfs_calc_lvl(to) - 1) {
+		ret = -NEWFS_ERROR_NOTFOUND;
+		goto unlock;
+	}
+	else {
+		new_dir = dst->inode;
+		dst     = NULL;
+	}
+	if (dst == src) {								/* 同一个目录项 */
+		goto unlock;
+	}
+	if (new_dir == NULL) {
+		ret = -NEWFS_ERROR_BUSY;
+		goto unlock;
+	}
+	if (len >= NEWFS_MAX_FILE_NAME) {
+		ret = -NEWFS_ERROR_NAMETOOLONG;
+		goto unlock;
+	}
+	for (cursor = new_dir->dentry; cursor != NULL && NEWFS_IS_DIR(src->inode); cursor = cursor->parent) {
+		if (cursor == src) {						/* 目录不能移到自己的子树中 */
+			ret = -NEWFS_ERROR_INVAL;
+			goto unlock;
+		}
+	}
+	if (dst != NULL) {
+		if (NEWFS_IS_DIR(src->inode) != NEWFS_IS_DIR(dst->inode)) {
+			ret = NEWFS_IS_DIR(dst->inode) ? -NEWFS_ERROR_ISDIR : -NEWFS_ERROR_NOTDIR;
+			goto unlock;
+		}
+		if (NEWFS_IS_DIR(dst->inode) && dst->inode->dir_cnt != 0) {
+			ret = -NEWFS_ERROR_NOTEMPTY;
+			goto unlock;
+		}
+	}
+	/* 删除目标之前确认新目录放得下，覆盖的目标与同目录内改名的源不占空间 */
+	if (!newfs_dir_fits(new_dir, fname, len, dst, src)) {
+		ret = -NEWFS_ERROR_NOSPACE;
+		goto unlock;
+	}
+	name = newfs_names_add(&new_dir->names, fname, len);	/* 先取得名字，之后的步骤不会因内存不足失败一半 */
+	if (name == NULL) {
+		ret = -NEWFS_ERROR_NOSPACE;
+		goto unlock;
+	}
+	if (dst != NULL && (ret = newfs_remove(dst)) != NEWFS_ERROR_NONE) {
+		goto unlock;
+	}
+	/* 目录项对象原样移入新目录，子目录项的parent与inode->dentry保持有效 */
+	old_dir  = src->parent->inode;
+	old_name = src->fname;
+	old_len  = src->name_len;
+	newfs_remove_dentry(old_dir, src);
+	src->fname    = name;
+	src->name_len = len;
+	src->parent   = new_dir->dentry;
+	if (newfs_alloc_dentry(new_dir, src) < 0) {	/* 已检查过空间，不应发生；放回刚空出的原位置 */
+		src->fname    = old_name;
+		src->name_len = old_len;
+		src->parent   = old_dir->dentry;
+		if (newfs_alloc_dentry(old_dir, src) < 0) {
+			NEWFS_ERR("[%s] failed to restore %s\n", __func__, from);
+		}
+		ret = -NEWFS_ERROR_NOSPACE;
+	}
+	else if (old_dir != new_dir) {					/* 已载入的inode引用其父目录 */
+		NEWFS_ATOMIC_DEC(&old_dir->ref);
+		NEWFS_ATOMIC_INC(&new_dir->ref);
+	}
+unlock:
+	NEWFS_UNLOCK();
+out:
+	newfs_stats_end(NEWFS_OP_RENAME, start, ret);
+	if (newfs_ctx->trace.running) {					/* 跟踪记录的路径为from与to，以'\0'分隔 */
+		trace_path = (char*)malloc(strlen(from) + strlen(to) + 2);
+		if (trace_path != NULL) {
+			strcpy(trace_path, from);
+			strcpy(trace_path + strlen(from) + 1, to);
+			newfs_trace_op(NEWFS_OP_RENAME, trace_path, 0, 0, 0, 0, start, ret);
+			free(trace_path);
+		}
+	}
+	return ret;
+}
+
+/**
+ * @brief 打开文件，可以在这里维护fi的信息，例如，fi->fh可以理解为一个64位指针，可以把自己想保存的数据结构
+ * 保存在fh中；这里保存打开文件的句柄，记录访问模式供顺序预读使用
+ * 
+ * @param path 相对于挂载点的路径
+ * @param fi 文件信息
+ * @return int 0成功，否则失败
+ */
+int newfs_open(const char* path, struct fuse_file_info* fi) {
+	boolean	is_find, is_root;
+	struct newfs_dentry* dentry;
+	struct newfs_file* file;
+	uint64_t start = newfs_stats_begin();
+	int ret = NEWFS_ERROR_NONE;
+
+	newfs_enter(FALSE);
+	if (newfs_in_stats(path)) {
+		if (strcmp(path, NEWFS_STATS_FILE) != 0) {
+			ret = strcmp(path, NEWFS_STATS_DIR) == 0 ? -NEWFS_ERROR_ISDIR : -NEWFS_ERROR_NOTFOUND;
+		}
+		else if ((fi->flags & O_ACCMODE) != O_RDONLY) {
+			ret = -NEWFS_ERROR_ACCESS;
+		}
+		else {
+			file = (struct newfs_file *)calloc(1, sizeof(struct newfs_file));
+			file->snap = newfs_stats_snapshot(&file->snap_len);
+			if (file->snap == NULL) {
+				free(file);
+				ret = -NEWFS_ERROR_NOSPACE;
+			}
+			else {
+				fi->direct_io = 1;					/* 大小报告为0，读取不受其限制 */
+				fi->fh = (uint64_t)(uintptr_t)file;
+			}
+		}
+		NEWFS_UNLOCK();
+		newfs_op_end(NEWFS_OP_OPEN, start, ret, path, 0, 0, fi->flags, ret == 0 ? fi->fh : 0);
+		return ret;
+	}
+	dentry = newfs_lookup(path, &is_find, &is_root);
+	if (dentry == NULL) {
+		ret = -NEWFS_ERROR_IO;
+	}
+	else if (is_find == FALSE) {
+		ret = -NEWFS_ERROR_NOTFOUND;
+	}
+	else if (NEWFS_IS_DIR(dentry->inode)) {
+		ret = -NEWFS_ERROR_ISDIR;
+	}
+	else {
+		file = (struct newfs_file *)calloc(1, sizeof(struct newfs_file));
+		file->inode = dentry->inode;
+		pthread_mutex_init(&file->lock, NULL);
+		NEWFS_ATOMIC_INC(&file->inode->ref);		/* 打开期间inode不会被淘汰 */
+		fi->fh = (uint64_t)(uintptr_t)file;
+	}
+	NEWFS_UNLOCK();
+	newfs_op_end(NEWFS_OP_OPEN, start, ret, path, 0, 0, fi->flags, ret == 0 ? fi->fh : 0);
+	return ret;
+}
+
+/**
+ * @brief 释放句柄或游标对inode的引用，名字已删除的inode在最后一个引用释放后删除
+ * 
+ * @param inode 
+ * @return void
+ */
+static void newfs_put_handle(struct newfs_inode* inode) {
+	boolean reap;
+	NEWFS_RDLOCK();
+	reap = newfs_inode_put(inode);
+	NEWFS_UNLOCK();
+	if (reap) {
+		NEWFS_WRLOCK();
+		if (newfs_reap_orphans() != NEWFS_ERROR_NONE) {
+			NEWFS_ERR("[%s] io error\n", __func__);
+		}
+		NEWFS_UNLOCK();
+	}
+}
+
+/**
+ * @brief 关闭文件，释放打开文件的句柄
+ * 
+ * @param path 相对于挂载点的路径
+ * @param fi 文件信息
+ * @return int 0成功，否则失败
+ */
+int newfs_release(const char* path, struct fuse_file_info* fi) {
+	struct newfs_file* file = (struct newfs_file *)(uintptr_t)fi->fh;
+	uint64_t start = newfs_stats_begin();
+	newfs_op_end(NEWFS_OP_RELEASE, start, NEWFS_ERROR_NONE, path, 0, 0, 0, fi->fh);
+	if (file != NULL && file->snap != NULL) {
+		free(file->snap);
+		free(file);
+		fi->fh = 0;
+	}
+	else if (file != NULL) {
+		newfs_put_handle(file->inode);
+		pthread_mutex_destroy(&file->lock);
+		free(file);
+		fi->fh = 0;
+	}
+	return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 打开目录文件
+ * 
+ * @param path 相对于挂载点的路径
+ * @param fi 文件信息
+ * @return int 0成功，否则失败
+ */
+int newfs_opendir(const char* path, struct fuse_file_info* fi) {
+	boolean	is_find, is_root;
+	struct newfs_dentry* dentry;
+	struct newfs_dir_cursor* cursor;
+	uint64_t start = newfs_stats_begin();
+	int ret = NEWFS_ERROR_NONE;
+
+	if (newfs_in_stats(path)) {						/* 统计目录不用游标，readdir按路径处理 */
+		fi->fh = 0;
+		ret = strcmp(path, NEWFS_STATS_DIR) == 0 ? NEWFS_ERROR_NONE
+			: strcmp(path, NEWFS_STATS_FILE) == 0 ? -NEWFS_ERROR_NOTDIR : -NEWFS_ERROR_NOTFOUND;
+		newfs_op_end(NEWFS_OP_OPENDIR, start, ret, path, 0, 0, 0, 0);
+		return ret;
+	}
+	newfs_enter(FALSE);
+	dentry = newfs_lookup(path, &is_find, &is_root);
+	if (dentry == NULL) {
+		ret = -NEWFS_ERROR_IO;
+	}
+	else if (is_find == FALSE) {
+		ret = -NEWFS_ERROR_NOTFOUND;
+	}
+	else if (!NEWFS_IS_DIR(dentry->inode)) {
+		ret = -NEWFS_ERROR_NOTDIR;
+	}
+	else {
+		cursor = (struct newfs_dir_cursor *)malloc(sizeof(struct newfs_dir_cursor));
+		cursor->inode = dentry->inode;
+		cursor->next  = dentry->inode->dentrys;
+		cursor->off   = 0;
+		cursor->gen   = dentry->inode->dir_gen;
+		NEWFS_ATOMIC_INC(&cursor->inode->ref);		/* 打开期间目录项链表不会被释放 */
+		fi->fh = (uint64_t)(uintptr_t)cursor;
+	}
+	NEWFS_UNLOCK();
+	newfs_op_end(NEWFS_OP_OPENDIR, start, ret, path, 0, 0, 0, ret == 0 ? fi->fh : 0);
+	return ret;
+}
+
+/**
+ * @brief 关闭目录文件，释放readdir游标
+ * 
+ * @param path 相对于挂载点的路径
+ * @param fi 文件信息
+ * @return int 0成功，否则失败
+ */
+int newfs_releasedir(const char* path, struct fuse_file_info* fi) {
+	struct newfs_dir_cursor* cursor = (struct newfs_dir_cursor *)(uintptr_t)fi->fh;
+	uint64_t start = newfs_stats_begin();
+	newfs_op_end(NEWFS_OP_RELEASEDIR, start, NEWFS_ERROR_NONE, path, 0, 0, 0, fi->fh);
+	if (cursor != NULL) {
+		newfs_put_handle(cursor->inode);
+		free(cursor);
+		fi->fh = 0;
+	}
+	return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 改变文件大小
+ * 
+ * @param path 相对于挂载点的路径
+ * @param offset 改变后文件大小
+ * @return int 0成功，否则失败
+ */
+int newfs_truncate(const char* path, off_t offset) {
+	boolean	is_find, is_root;
+	struct newfs_dentry* dentry;
+	uint64_t start = newfs_stats_begin();
+	int ret;
+
+	if (newfs_in_stats(path)) {
+		newfs_op_end(NEWFS_OP_TRUNCATE, start, -NEWFS_ERROR_ACCESS, path, offset, 0, 0, 0);
+		return -NEWFS_ERROR_ACCESS;
+	}
+	newfs_enter(FALSE);
+	dentry = newfs_lookup(path, &is_find, &is_root);
+	if (dentry == NULL) {
+		ret = -NEWFS_ERROR_IO;
+	}
+	else if (is_find == FALSE) {
+		ret = -NEWFS_ERROR_NOTFOUND;
+	}
+	else if (NEWFS_IS_DIR(dentry->inode)) {
+		ret = -NEWFS_ERROR_ISDIR;
+	}
+	else {
+		pthread_rwlock_wrlock(&dentry->inode->rwlock);
+		ret = newfs_truncate_data(dentry->inode, offset);
+		pthread_rwlock_unlock(&dentry->inode->rwlock);
+	}
+	NEWFS_UNLOCK();
+	newfs_op_end(NEWFS_OP_TRUNCATE, start, ret, path, offset, 0, 0, 0);
+	return ret;
+}
+
+/**
+ * @brief 将文件的脏状态写回设备，用于fsync/fsyncdir/flush
+ * 
+ * @param path 相对于挂载点的路径
+ * @param fi 非NULL时按打开的句柄找到inode，名字删除后仍可写回
+ * @param barrier 是否要求后端落盘
+ * @return int 0成功，否则失败
+ */
+static int newfs_fsync_path(const char* path, struct fuse_file_info* fi, boolean barrier) {
+	boolean	is_find, is_root;
+	struct newfs_dentry* dentry;
+	struct newfs_file* file = fi != NULL ? (struct newfs_file *)(uintptr_t)fi->fh : NULL;
+	struct newfs_inode* inode;
+	NEWFS_OP op = barrier ? NEWFS_OP_FSYNC : NEWFS_OP_FLUSH;
+	uint64_t start = newfs_stats_begin();
+	int ret;
+
+	if (newfs_in_stats(path)) {						/* 统计文件没有需要写回的内容 */
+		newfs_op_end(op, start, NEWFS_ERROR_NONE, path, 0, 0, 0, 0);
+		return NEWFS_ERROR_NONE;
+	}
+	newfs_enter(FALSE);                            /* 写回数据只需该文件的inode锁 */
+	if (file != NULL && file->inode != NULL) {
+		inode = file->inode;
+	}
+	else {
+		dentry = newfs_lookup(path, &is_find, &is_root);
+		inode  = dentry != NULL && is_find ? dentry->inode : NULL;
+	}
+	if (inode == NULL) {
+		ret = dentry == NULL ? -NEWFS_ERROR_IO : -NEWFS_ERROR_NOTFOUND;
+	}
+	else {
+		pthread_rwlock_wrlock(&inode->rwlock);		/* 延迟分配会修改extent */
+		ret = newfs_fsync_inode(inode);
+		pthread_rwlock_unlock(&inode->rwlock);
+	}
+	NEWFS_UNLOCK();
+	if (ret == NEWFS_ERROR_NONE && barrier) {		/* 只有提交日志需要独占 */
+		NEWFS_WRLOCK();
+		ret = newfs_sync();
+		NEWFS_UNLOCK();
+	}
+	newfs_op_end(op, start, ret, path, 0, 0, 0, 0);
+	return ret;
+}
+
+/**
+ * @brief 同步文件，写回该文件的数据块后提交一次日志事务
+ * 
+ * @param path 相对于挂载点的路径
+ * @param datasync 可忽略，inode与数据一并写回
+ * @param fi 打开的句柄，为NULL时按路径查找
+ * @return int 0成功，否则失败
+ */
+int newfs_fsync(const char* path, int datasync, struct fuse_file_info* fi) {
+	return newfs_fsync_path(path, fi, TRUE);
+}
+
+/**
+ * @brief 同步目录，提交一次日志事务
+ * 
+ * @param path 相对于挂载点的路径
+ * @param datasync 可忽略
+ * @param fi 可忽略
+ * @return int 0成功，否则失败
+ */
+int newfs_fsyncdir(const char* path, int datasync, struct fuse_file_info* fi) {
+	return newfs_fsync_path(path, NULL, TRUE);				/* fh为readdir游标 */
+}
+
+/**
+ * @brief 关闭文件描述符时调用，将该文件的数据块写到设备，不提交日志
+ * 
+ * @param path 相对于挂载点的路径
+ * @param fi 打开的句柄，为NULL时按路径查找
+ * @return int 0成功，否则失败
+ */
+int newfs_flush(const char* path, struct fuse_file_info* fi) {
+	return newfs_fsync_path(path, fi, FALSE);
+}
+
+
+/**
+ * @brief 访问文件，因为读写文件时需要查看权限
+ * 
+ * @param path 相对于挂载点的路径
+ * @param type 访问类别
+ * R_OK: Test for read permission. 
+ * W_OK: Test for write permission.
+ * X_OK: Test for execute permission.
+ * F_OK: Test for existence. 
+ * 
+ * @return int 0成功，否则失败
+ */
+int newfs_access(const char* path, int type) {
+	/* 选做: 解析路径，判断是否存在 */
+	return 0;
+}	
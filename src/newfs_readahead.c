@@ -0,0 +1,232 @@
+#include "../include/newfs.h"
+/******************************************************************************
+* SECTION: 顺序预读
+*
+* 每个打开的文件在fi->fh中记录上一次读结束的位置。从该位置开始的读视为顺序，
+* 第一次建立窗口，之后读进当前窗口时提交下一个窗口，窗口逐次翻倍直到上限，
+* 始终领先读者一个窗口；不从该位置开始的读视为随机，收回窗口，不再预读。
+* 预读请求放入环形队列，由预读线程取出，持有命名空间读锁与inode读锁，
+* 把映射到的数据块读进块缓存；之后的读从缓存复制，不再等待设备。
+* 预读线程先取得命名空间读锁再出队，持有写锁的操作看到的请求都还在队列中，
+* 删除文件前可以用newfs_ra_cancel丢弃它们。
+*******************************************************************************/
+static void newfs_ra_fill(struct newfs_ra_req* req) {
+    struct newfs_inode* inode = req->inode;
+    uint64_t i = 0, run;
+    int64_t  blkno;
+    pthread_rwlock_rdlock(&inode->rwlock);
+    while (i < req->nblks && inode->inline_data == NULL) {
+        blkno = newfs_bmap_run(inode, req->lblk + i, &run);
+        if (run > req->nblks - i) {
+            run = req->nblks - i;
+        }
+        if (blkno != NEWFS_BLK_NONE &&
+            newfs_cache_prefetch(NEWFS_DATA_BLKNO(blkno), (int)run) != NEWFS_ERROR_NONE) {
+            NEWFS_ERR("[%s] io error\n", __func__);
+            break;
+        }
+        i += run;
+    }
+    pthread_rwlock_unlock(&inode->rwlock);
+}
+
+static void* newfs_ra_thread(void* arg) {
+    struct newfs_readahead* ra = &newfs_ctx_switch((struct newfs_super*)arg)->ra;
+    struct newfs_ra_req     req;
+    boolean                 reap;
+    pthread_mutex_lock(&ra->lock);
+    while (!ra->stop) {
+        if (ra->cnt == 0) {
+            pthread_cond_wait(&ra->cond, &ra->lock);
+            continue;
+        }
+        pthread_mutex_unlock(&ra->lock);
+        NEWFS_RDLOCK();
+        pthread_mutex_lock(&ra->lock);
+        if (ra->cnt == 0) {                           /* 等锁期间请求被取消 */
+            pthread_mutex_unlock(&ra->lock);
+            NEWFS_UNLOCK();
+            pthread_mutex_lock(&ra->lock);
+            continue;
+        }
+        req      = ra->reqs[ra->head];
+        ra->head = (ra->head + 1) % NEWFS_RA_QUEUE;
+        ra->cnt--;
+        pthread_mutex_unlock(&ra->lock);
+        newfs_ra_fill(&req);
+        reap = newfs_inode_put(req.inode);
+        NEWFS_UNLOCK();
+        if (reap) {                                   /* 文件已被删除，句柄也已关闭 */
+            NEWFS_WRLOCK();
+            if (newfs_reap_orphans() != NEWFS_ERROR_NONE) {
+                NEWFS_ERR("[%s] io error\n", __func__);
+            }
+            NEWFS_UNLOCK();
+        }
+        pthread_mutex_lock(&ra->lock);
+    }
+    while (ra->cnt > 0) {                             /* 卸载时丢弃未处理的请求 */
+        NEWFS_ATOMIC_DEC(&ra->reqs[ra->head].inode->ref);
+        ra->head = (ra->head + 1) % NEWFS_RA_QUEUE;
+        ra->cnt--;
+    }
+    pthread_mutex_unlock(&ra->lock);
+    return NULL;
+}
+
+/**
+ * @brief 提交一个预读请求，队列满时丢弃
+ *
+ * @param inode
+ * @param lblk 文件内起始块号
+ * @param nblks
+ * @return void
+ */
+static void newfs_ra_submit(struct newfs_inode* inode, uint64_t lblk, uint32_t nblks) {
+    struct newfs_readahead* ra = &newfs_ctx->ra;
+    struct newfs_ra_req*    req;
+    pthread_mutex_lock(&ra->lock);
+    if (ra->cnt == NEWFS_RA_QUEUE) {
+        ra->stats.dropped++;
+        pthread_mutex_unlock(&ra->lock);
+        return;
+    }
+    req = &ra->reqs[(ra->head + ra->cnt) % NEWFS_RA_QUEUE];
+    req->inode = inode;
+    req->lblk  = lblk;
+    req->nblks = nblks;
+    NEWFS_ATOMIC_INC(&inode->ref);                    /* 处理前不会被淘汰 */
+    ra->cnt++;
+    ra->stats.reqs++;
+    ra->stats.blks += nblks;
+    pthread_cond_signal(&ra->cond);
+    pthread_mutex_unlock(&ra->lock);
+}
+
+/**
+ * @brief 丢弃队列中该inode的预读请求，删除文件前调用，调用者持有命名空间写锁
+ *
+ * @param inode
+ * @return void
+ */
+void newfs_ra_cancel(struct newfs_inode* inode) {
+    struct newfs_readahead* ra = &newfs_ctx->ra;
+    int i, k;
+    if (!ra->running) {
+        return;
+    }
+    pthread_mutex_lock(&ra->lock);
+    for (i = 0, k = 0; i < ra->cnt; i++) {
+        if (ra->reqs[(ra->head + i) % NEWFS_RA_QUEUE].inode == inode) {
+            NEWFS_ATOMIC_DEC(&inode->ref);
+            continue;
+        }
+        ra->reqs[(ra->head + k++) % NEWFS_RA_QUEUE] = ra->reqs[(ra->head + i) % NEWFS_RA_QUEUE];
+    }
+    ra->cnt = k;
+    pthread_mutex_unlock(&ra->lock);
+}
+
+/**
+ * @brief 启动预读线程，挂载完成后调用
+ *
+ * @param max_blks 窗口上限（块数），<=0时不预读；不超过块缓存容量的1/4
+ * @return int
+ */
+int newfs_ra_start(int max_blks) {
+    struct newfs_readahead* ra = &newfs_ctx->ra;
+    memset(ra, 0, sizeof(struct newfs_readahead));
+    if (max_blks > newfs_ctx->cache.capacity / 4) {
+        max_blks = newfs_ctx->cache.capacity / 4;
+    }
+    if (max_blks < NEWFS_RA_MIN) {
+        return NEWFS_ERROR_NONE;
+    }
+    ra->max = max_blks;
+    pthread_mutex_init(&ra->lock, NULL);
+    pthread_cond_init(&ra->cond, NULL);
+    if (pthread_create(&ra->thread, NULL, newfs_ra_thread, newfs_ctx) != 0) {
+        pthread_cond_destroy(&ra->cond);
+        pthread_mutex_destroy(&ra->lock);
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    ra->running = TRUE;
+    return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 停止预读线程，卸载前调用，调用者不能持有命名空间锁
+ *
+ * @return void
+ */
+void newfs_ra_stop() {
+    struct newfs_readahead* ra = &newfs_ctx->ra;
+    if (!ra->running) {
+        return;
+    }
+    pthread_mutex_lock(&ra->lock);
+    ra->stop = TRUE;
+    pthread_cond_signal(&ra->cond);
+    pthread_mutex_unlock(&ra->lock);
+    pthread_join(ra->thread, NULL);
+    pthread_cond_destroy(&ra->cond);
+    pthread_mutex_destroy(&ra->lock);
+    ra->running = FALSE;
+}
+
+/**
+ * @brief 一次读完成后调用，更新该文件的访问模式，顺序读时按需提交下一个窗口；
+ * 调用者持有inode读锁
+ *
+ * @param file 打开文件的句柄
+ * @param offset 本次读的起始位置
+ * @param size 实际读出的字节数
+ * @return void
+ */
+void newfs_ra_read(struct newfs_file* file, uint64_t offset, int size) {
+    struct newfs_readahead* ra    = &newfs_ctx->ra;
+    struct newfs_inode*     inode = file->inode;
+    uint64_t end, eof, start = 0;
+    uint64_t nblks = 0;
+    if (!ra->running || size <= 0 || inode->inline_data != NULL) {
+        return;
+    }
+    end = offset + size;
+    end = NEWFS_ROUND_UP(end, NEWFS_BLK_SZ()) / NEWFS_BLK_SZ();
+    eof = NEWFS_ROUND_UP(inode->size, NEWFS_BLK_SZ()) / NEWFS_BLK_SZ();
+    pthread_mutex_lock(&file->lock);
+    if (offset != file->next_off) {                   /* 随机访问，收回窗口 */
+        if (file->ra_size > 0) {
+            NEWFS_ATOMIC_INC(&ra->stats.resets);
+        }
+        file->ra_size = 0;
+    }
+    else if (file->ra_size == 0) {                    /* 新的顺序流，窗口为本次读的两倍 */
+        start = end;
+        nblks = 2 * (end - offset / NEWFS_BLK_SZ());
+        nblks = nblks < NEWFS_RA_MIN ? NEWFS_RA_MIN : nblks;
+    }
+    else if (end > file->ra_start) {                  /* 读进了当前窗口，提交下一个 */
+        start = file->ra_start + file->ra_size;
+        start = start < end ? end : start;
+        nblks = 2 * (uint64_t)file->ra_size;
+    }
+    if (nblks > (uint64_t)ra->max) {
+        nblks = ra->max;
+    }
+    if (nblks > 0 && start < eof) {
+        if (start + nblks > eof) {
+            nblks = eof - start;
+        }
+        file->ra_start = start;
+        file->ra_size  = (uint32_t)nblks;
+    }
+    else {
+        nblks = 0;
+    }
+    file->next_off = offset + size;
+    pthread_mutex_unlock(&file->lock);
+    if (nblks > 0) {
+        newfs_ra_submit(inode, start, (uint32_t)nblks);
+    }
+}
@@ -0,0 +1,188 @@
+#include "../include/newfs.h"
+/******************************************************************************
+* SECTION: slab分配器
+*
+* 目录项与inode都是定长对象，按chunk批量分配，每个chunk切分成若干对象，
+* 释放的对象挂入空闲链表供下次复用。chunk的对象数逐次翻倍直到上限，
+* 载入10万个目录项只需几十次malloc；chunk在卸载时统一释放。
+*******************************************************************************/
+/**
+ * @brief 初始化slab
+ *
+ * @param slab
+ * @param name 统计输出用的名字
+ * @param obj_sz 对象大小
+ * @return int
+ */
+int newfs_slab_init(struct newfs_slab* slab, const char* name, size_t obj_sz) {
+    memset(slab, 0, sizeof(struct newfs_slab));
+    slab->name       = name;
+    slab->obj_sz     = NEWFS_ROUND_UP(obj_sz, sizeof(void*));
+    slab->chunk_objs = NEWFS_SLAB_CHUNK_MIN;
+    pthread_mutex_init(&slab->lock, NULL);
+    return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 释放所有chunk，其中的对象随之失效
+ *
+ * @param slab
+ * @return void
+ */
+void newfs_slab_destroy(struct newfs_slab* slab) {
+    struct newfs_slab_chunk* chunk;
+    struct newfs_slab_chunk* next;
+    for (chunk = slab->chunks; chunk != NULL; chunk = next) {
+        next = chunk->next;
+        free(chunk);
+    }
+    slab->chunks    = NULL;
+    slab->free_list = NULL;
+    pthread_mutex_destroy(&slab->lock);
+}
+
+/**
+ * @brief 新增一个chunk，把其中的对象全部挂入空闲链表
+ *
+ * @param slab
+ * @return int
+ */
+static int newfs_slab_grow(struct newfs_slab* slab) {
+    struct newfs_slab_chunk* chunk;
+    uint8_t* obj;
+    uint64_t i;
+    chunk = (struct newfs_slab_chunk*)malloc(sizeof(struct newfs_slab_chunk) +
+                                             (size_t)slab->chunk_objs * slab->obj_sz);
+    if (chunk == NULL) {
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    chunk->nobjs  = slab->chunk_objs;
+    chunk->next   = slab->chunks;
+    slab->chunks  = chunk;
+    slab->nchunks++;
+    slab->total  += chunk->nobjs;
+    obj = (uint8_t*)(chunk + 1);
+    for (i = 0; i < chunk->nobjs; i++, obj += slab->obj_sz) {
+        *(void**)obj    = slab->free_list;
+        slab->free_list = obj;
+    }
+    if (slab->chunk_objs < NEWFS_SLAB_CHUNK_MAX) {
+        slab->chunk_objs *= 2;
+    }
+    return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 分配一个清零的对象
+ *
+ * @param slab
+ * @return void* 内存不足返回NULL
+ */
+void* newfs_slab_alloc(struct newfs_slab* slab) {
+    void* obj = NULL;
+    pthread_mutex_lock(&slab->lock);
+    if (slab->free_list != NULL || newfs_slab_grow(slab) == NEWFS_ERROR_NONE) {
+        obj             = slab->free_list;
+        slab->free_list = *(void**)obj;
+        slab->in_use++;
+        if (slab->in_use > slab->peak) {
+            slab->peak = slab->in_use;
+        }
+    }
+    pthread_mutex_unlock(&slab->lock);
+    if (obj != NULL) {
+        memset(obj, 0, slab->obj_sz);
+    }
+    return obj;
+}
+
+/**
+ * @brief 对象放回空闲链表
+ *
+ * @param slab
+ * @param obj
+ * @return void
+ */
+void newfs_slab_free(struct newfs_slab* slab, void* obj) {
+    if (obj == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&slab->lock);
+    *(void**)obj    = slab->free_list;
+    slab->free_list = obj;
+    slab->in_use--;
+    pthread_mutex_unlock(&slab->lock);
+}
+
+/******************************************************************************
+* SECTION: 名字区
+*
+* 每个目录inode拥有一个名字区，存放其子目录项的名字（以0结尾）。
+* 名字区由大小逐次翻倍的块组成，只追加，目录inode被淘汰时整体释放。
+* 调用者持有命名空间写锁，或目录尚在载入、还未对其他线程可见。
+*******************************************************************************/
+/**
+ * @brief 把名字复制进名字区
+ *
+ * @param names 目录inode的名字区
+ * @param name
+ * @param len 名字长度
+ * @return const char* 名字区中的副本，内存不足返回NULL
+ */
+const char* newfs_names_add(struct newfs_name_chunk** names, const char* name, int len) {
+    struct newfs_name_chunk* chunk = *names;
+    uint32_t cap;
+    char*    copy;
+    if (chunk == NULL || chunk->used + len + 1 > chunk->cap) {
+        cap = chunk == NULL ? NEWFS_NAMES_CHUNK_MIN : chunk->cap;
+        if (chunk != NULL && cap < NEWFS_NAMES_CHUNK_MAX) {
+            cap *= 2;
+        }
+        if (cap < (uint32_t)len + 1) {
+            cap = len + 1;
+        }
+        chunk = (struct newfs_name_chunk*)malloc(sizeof(struct newfs_name_chunk) + cap);
+        if (chunk == NULL) {
+            return NULL;
+        }
+        chunk->next = *names;
+        chunk->used = 0;
+        chunk->cap  = cap;
+        *names      = chunk;
+    }
+    copy = chunk->data + chunk->used;
+    memcpy(copy, name, len);
+    copy[len]    = '\0';
+    chunk->used += len + 1;
+    return copy;
+}
+
+/**
+ * @brief 名字区占用的字节数
+ *
+ * @param names
+ * @return uint64_t
+ */
+uint64_t newfs_names_bytes(struct newfs_name_chunk* names) {
+    uint64_t bytes = 0;
+    for (; names != NULL; names = names->next) {
+        bytes += sizeof(struct newfs_name_chunk) + names->cap;
+    }
+    return bytes;
+}
+
+/**
+ * @brief 释放名字区
+ *
+ * @param names
+ * @return void
+ */
+void newfs_names_free(struct newfs_name_chunk** names) {
+    struct newfs_name_chunk* chunk;
+    struct newfs_name_chunk* next;
+    for (chunk = *names; chunk != NULL; chunk = next) {
+        next = chunk->next;
+        free(chunk);
+    }
+    *names = NULL;
+}
@@ -0,0 +1,252 @@
+#include "../include/newfs.h"
+#include <time.h>
+/******************************************************************************
+* SECTION: 统计
+*
+* FUSE操作返回前调用newfs_stats_end，调用次数与延迟直方图记在线程私有的newfs_tstats中。
+* 计数只由所属线程写，用relaxed原子读写代替加锁；统计文件在stats.lock下遍历线程链表汇总，
+* 得到的是近似一致的快照。线程退出时其计数并入retired，挂载期间不会丢失。
+* 统计文件/.newfs/stats在打开时生成文本快照，之后的读从快照复制。
+*******************************************************************************/
+static const char* newfs_op_names[NEWFS_OP_CNT] = {
+    "getattr", "mkdir", "mknod", "readdir", "read", "write",
+    "truncate", "open", "release", "opendir", "releasedir", "fsync", "flush",
+    "unlink", "rmdir", "rename"
+};
+
+static inline uint64_t newfs_stats_get(uint64_t* p) {
+    return __atomic_load_n(p, __ATOMIC_RELAXED);
+}
+
+/* 只有所属线程写，读出再写回即可，不需要加锁的原子加 */
+static inline void newfs_stats_add(uint64_t* p, uint64_t v) {
+    __atomic_store_n(p, __atomic_load_n(p, __ATOMIC_RELAXED) + v, __ATOMIC_RELAXED);
+}
+
+static uint64_t newfs_stats_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * @brief 把src的计数累加到dst，调用者持有stats.lock
+ *
+ * @param dst
+ * @param src
+ * @return void
+ */
+static void newfs_stats_merge(struct newfs_tstats* dst, struct newfs_tstats* src) {
+    struct newfs_op_stats* d;
+    struct newfs_op_stats* s;
+    uint64_t max;
+    int op, b;
+    for (op = 0; op < NEWFS_OP_CNT; op++) {
+        d = &dst->ops[op];
+        s = &src->ops[op];
+        d->calls    += newfs_stats_get(&s->calls);
+        d->errors   += newfs_stats_get(&s->errors);
+        d->total_ns += newfs_stats_get(&s->total_ns);
+        max          = newfs_stats_get(&s->max_ns);
+        d->max_ns    = max > d->max_ns ? max : d->max_ns;
+        for (b = 0; b < NEWFS_LAT_BUCKETS; b++) {
+            d->hist[b] += newfs_stats_get(&s->hist[b]);
+        }
+    }
+}
+
+/**
+ * @brief 线程退出时由pthread调用，计数并入retired
+ *
+ * @param arg 该线程的newfs_tstats
+ * @return void
+ */
+static void newfs_stats_retire(void* arg) {
+    struct newfs_tstats* ts    = (struct newfs_tstats*)arg;
+    struct newfs_stats*  stats = ts->owner;
+    pthread_mutex_lock(&stats->lock);
+    if (ts->prev != NULL) {
+        ts->prev->next = ts->next;
+    }
+    else {
+        stats->threads = ts->next;
+    }
+    if (ts->next != NULL) {
+        ts->next->prev = ts->prev;
+    }
+    newfs_stats_merge(&stats->retired, ts);
+    pthread_mutex_unlock(&stats->lock);
+    free(ts);
+}
+
+/**
+ * @brief 取得当前线程的计数，第一次调用时创建
+ *
+ * @return struct newfs_tstats*
+ */
+static struct newfs_tstats* newfs_stats_self() {
+    struct newfs_stats*  stats = &newfs_ctx->stats;
+    struct newfs_tstats* ts    = (struct newfs_tstats*)pthread_getspecific(stats->key);
+    if (ts != NULL) {
+        return ts;
+    }
+    ts = (struct newfs_tstats*)calloc(1, sizeof(struct newfs_tstats));
+    if (ts == NULL) {
+        return NULL;
+    }
+    ts->owner = stats;
+    pthread_mutex_lock(&stats->lock);
+    ts->next = stats->threads;
+    if (stats->threads != NULL) {
+        stats->threads->prev = ts;
+    }
+    stats->threads = ts;
+    pthread_mutex_unlock(&stats->lock);
+    pthread_setspecific(stats->key, ts);
+    return ts;
+}
+
+/**
+ * @brief 操作类别的名字
+ *
+ * @param op
+ * @return const char*
+ */
+const char* newfs_op_name(NEWFS_OP op) {
+    return op >= 0 && op < NEWFS_OP_CNT ? newfs_op_names[op] : "unknown";
+}
+
+/**
+ * @brief 挂载时初始化统计
+ *
+ * @return int
+ */
+int newfs_stats_init() {
+    struct newfs_stats* stats = &newfs_ctx->stats;
+    memset(stats, 0, sizeof(struct newfs_stats));
+    if (pthread_key_create(&stats->key, newfs_stats_retire) != 0) {
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    pthread_mutex_init(&stats->lock, NULL);
+    stats->mount_ns = newfs_stats_now();
+    stats->running  = TRUE;
+    return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 卸载时释放所有线程的计数，之后线程退出不再回调
+ *
+ * @return void
+ */
+void newfs_stats_destroy() {
+    struct newfs_stats*  stats = &newfs_ctx->stats;
+    struct newfs_tstats* ts;
+    if (!stats->running) {
+        return;
+    }
+    stats->running = FALSE;
+    pthread_key_delete(stats->key);
+    while (stats->threads != NULL) {
+        ts = stats->threads;
+        stats->threads = ts->next;
+        free(ts);
+    }
+    pthread_mutex_destroy(&stats->lock);
+}
+
+/**
+ * @brief 操作开始时取得时间戳
+ *
+ * @return uint64_t 单调时钟（ns）
+ */
+uint64_t newfs_stats_begin() {
+    return newfs_stats_now();
+}
+
+/**
+ * @brief 操作返回前记录一次调用
+ *
+ * @param op 操作类别
+ * @param start newfs_stats_begin的返回值
+ * @param ret 操作的返回值，小于0计为出错
+ * @return void
+ */
+void newfs_stats_end(NEWFS_OP op, uint64_t start, int ret) {
+    struct newfs_tstats*   ts;
+    struct newfs_op_stats* os;
+    uint64_t ns, us;
+    int      b;
+    if (!newfs_ctx->stats.running || (ts = newfs_stats_self()) == NULL) {
+        return;
+    }
+    ns = newfs_stats_now() - start;
+    us = ns / 1000;
+    b  = us == 0 ? 0 : 63 - __builtin_clzll(us);
+    b  = b < NEWFS_LAT_BUCKETS ? b : NEWFS_LAT_BUCKETS - 1;
+    os = &ts->ops[op];
+    newfs_stats_add(&os->calls, 1);
+    newfs_stats_add(&os->errors, ret < 0 ? 1 : 0);
+    newfs_stats_add(&os->total_ns, ns);
+    newfs_stats_add(&os->hist[b], 1);
+    if (ns > os->max_ns) {
+        __atomic_store_n(&os->max_ns, ns, __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * @brief 生成统计文件的文本：各操作的计数与延迟直方图，以及各子系统的统计
+ *
+ * @param len 输出文本长度
+ * @return char* 需由调用者free，失败返回NULL
+ */
+char* newfs_stats_snapshot(size_t* len) {
+    struct newfs_stats*    stats = &newfs_ctx->stats;
+    struct newfs_tstats    sum;
+    struct newfs_tstats*   ts;
+    struct newfs_op_stats* os;
+    char*  buf = NULL;
+    FILE*  fp;
+    int    op, b;
+
+    fp = open_memstream(&buf, len);
+    if (fp == NULL) {
+        return NULL;
+    }
+    memset(&sum, 0, sizeof(struct newfs_tstats));
+    pthread_mutex_lock(&stats->lock);
+    newfs_stats_merge(&sum, &stats->retired);
+    for (ts = stats->threads; ts != NULL; ts = ts->next) {
+        newfs_stats_merge(&sum, ts);
+    }
+    pthread_mutex_unlock(&stats->lock);
+
+    fprintf(fp, "uptime %.3f s\n", (double)(newfs_stats_now() - stats->mount_ns) / 1e9);
+    fprintf(fp, "%-10s %12s %8s %12s %12s\n", "op", "calls", "errors", "avg us", "max us");
+    for (op = 0; op < NEWFS_OP_CNT; op++) {
+        os = &sum.ops[op];
+        fprintf(fp, "%-10s %12lu %8lu %12.2f %12.2f\n", newfs_op_names[op],
+                (unsigned long)os->calls, (unsigned long)os->errors,
+                os->calls == 0 ? 0.0 : (double)os->total_ns / os->calls / 1000,
+                (double)os->max_ns / 1000);
+    }
+    fprintf(fp, "latency histogram (us, bucket = [2^i, 2^(i+1)))\n");
+    for (op = 0; op < NEWFS_OP_CNT; op++) {
+        os = &sum.ops[op];
+        if (os->calls == 0) {
+            continue;
+        }
+        fprintf(fp, "  %-10s", newfs_op_names[op]);
+        for (b = 0; b < NEWFS_LAT_BUCKETS; b++) {
+            if (os->hist[b] != 0) {
+                fprintf(fp, " %lu:%lu", b == 0 ? 0UL : 1UL << b, (unsigned long)os->hist[b]);
+            }
+        }
+        fprintf(fp, "\n");
+    }
+    newfs_dump_all(fp);
+    if (fclose(fp) != 0) {
+        free(buf);
+        return NULL;
+    }
+    return buf;
+}
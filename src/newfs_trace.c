@@ -0,0 +1,200 @@
+#include "../include/newfs.h"
+#include <sys/mman.h>
+#include <time.h>
+/******************************************************************************
+* SECTION: 操作跟踪
+*
+* 挂载时指定--trace后，每个操作返回前追加一条记录：操作、路径、偏移、大小、句柄、
+* 开始时间、延迟与返回值。跟踪文件是固定大小的环形区，以MAP_SHARED映射，
+* 写满后覆盖最早的记录，保留的是最近的一段负载。记录在trace.lock下写入映射，
+* 文件头中的head/tail随每条记录更新，进程异常退出时已写入的记录仍可读出。
+* 记录按操作完成的顺序排列，newfs_replay按该顺序在新的镜像上重放。
+*******************************************************************************/
+static uint64_t newfs_trace_now(clockid_t clk) {
+    struct timespec ts;
+    clock_gettime(clk, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline struct newfs_trace_rec* newfs_trace_at(uint8_t* ring, uint64_t cap, uint64_t pos) {
+    return (struct newfs_trace_rec*)(ring + pos % cap);
+}
+
+/**
+ * @brief 在环形区中预留len字节，覆盖掉放不下的最早记录，调用者持有trace.lock
+ *
+ * @param hdr
+ * @param ring
+ * @param len 8字节对齐
+ * @return uint64_t 预留区域的逻辑偏移
+ */
+static uint64_t newfs_trace_reserve(struct newfs_trace_hdr* hdr, uint8_t* ring, uint64_t len) {
+    uint64_t pos = hdr->head;
+    while (hdr->head + len - hdr->tail > hdr->cap) {
+        hdr->tail += newfs_trace_at(ring, hdr->cap, hdr->tail)->len;
+    }
+    hdr->head += len;
+    return pos;
+}
+
+/**
+ * @brief 创建跟踪文件并开始记录，挂载完成后调用
+ *
+ * @param path 跟踪文件路径，已存在则覆盖
+ * @param size_mb 环形区大小（MB），<=0时取默认值
+ * @return int
+ */
+int newfs_trace_start(const char* path, int size_mb) {
+    struct newfs_trace* trace = &newfs_ctx->trace;
+    uint64_t cap = (uint64_t)(size_mb > 0 ? size_mb : NEWFS_DEFAULT_TRACE_MB) << 20;
+    void*    map;
+
+    memset(trace, 0, sizeof(struct newfs_trace));
+    trace->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (trace->fd < 0) {
+        NEWFS_ERR("[%s] cannot open %s\n", __func__, path);
+        return -NEWFS_ERROR_IO;
+    }
+    trace->map_sz = sizeof(struct newfs_trace_hdr) + cap;
+    if (ftruncate(trace->fd, (off_t)trace->map_sz) != 0 ||
+        (map = mmap(NULL, trace->map_sz, PROT_READ | PROT_WRITE, MAP_SHARED, trace->fd, 0)) == MAP_FAILED) {
+        close(trace->fd);
+        return -NEWFS_ERROR_IO;
+    }
+    trace->hdr           = (struct newfs_trace_hdr*)map;
+    trace->ring          = (uint8_t*)map + sizeof(struct newfs_trace_hdr);
+    trace->hdr->magic    = NEWFS_TRACE_MAGIC;
+    trace->hdr->version  = NEWFS_TRACE_VERSION;
+    trace->hdr->cap      = cap;
+    trace->hdr->start_ns = newfs_trace_now(CLOCK_REALTIME);
+    trace->start         = newfs_stats_begin();
+    pthread_mutex_init(&trace->lock, NULL);
+    trace->running       = TRUE;
+    return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 停止记录并写回跟踪文件，卸载时调用
+ *
+ * @return void
+ */
+void newfs_trace_stop() {
+    struct newfs_trace* trace = &newfs_ctx->trace;
+    if (!trace->running) {
+        return;
+    }
+    pthread_mutex_lock(&trace->lock);
+    trace->running = FALSE;
+    pthread_mutex_unlock(&trace->lock);
+    msync(trace->hdr, trace->map_sz, MS_SYNC);
+    munmap(trace->hdr, trace->map_sz);
+    close(trace->fd);
+    pthread_mutex_destroy(&trace->lock);
+}
+
+/**
+ * @brief 记录一次操作，调用者已确认trace.running
+ *
+ * @param op
+ * @param path rename为from与to，以'\0'分隔
+ * @param off 偏移，truncate为新的大小
+ * @param size
+ * @param mode mkdir/mknod的mode，open的flags
+ * @param fh 句柄，0为未经open
+ * @param start newfs_stats_begin的返回值
+ * @param ret
+ * @return void
+ */
+void newfs_trace_op(NEWFS_OP op, const char* path, uint64_t off, uint32_t size, uint32_t mode,
+                    uint64_t fh, uint64_t start, int ret) {
+    struct newfs_trace*     trace = &newfs_ctx->trace;
+    struct newfs_trace_rec* rec;
+    uint64_t now = newfs_stats_begin();
+    uint64_t path_len = strlen(path), len, rest;
+
+    if (op == NEWFS_OP_RENAME) {
+        path_len += 1 + strlen(path + path_len + 1);
+    }
+    path_len = path_len < UINT16_MAX ? path_len : UINT16_MAX;
+    len      = sizeof(struct newfs_trace_rec) + path_len;
+    len      = NEWFS_ROUND_UP(len, 8);
+    pthread_mutex_lock(&trace->lock);
+    if (!trace->running || len > trace->hdr->cap) {
+        pthread_mutex_unlock(&trace->lock);
+        return;
+    }
+    rest = trace->hdr->cap - trace->hdr->head % trace->hdr->cap;
+    if (rest < len) {                                 /* 记录不跨越环形区末尾 */
+        rec = newfs_trace_at(trace->ring, trace->hdr->cap, newfs_trace_reserve(trace->hdr, trace->ring, rest));
+        rec->len = rest;
+        rec->op  = NEWFS_TRACE_PAD;
+    }
+    rec = newfs_trace_at(trace->ring, trace->hdr->cap, newfs_trace_reserve(trace->hdr, trace->ring, len));
+    rec->len      = len;
+    rec->op       = op;
+    rec->reserved = 0;
+    rec->path_len = path_len;
+    rec->ts_ns    = start - trace->start;
+    rec->off      = off;
+    rec->fh       = fh;
+    rec->size     = size;
+    rec->mode     = mode;
+    rec->lat_ns   = now - start < UINT32_MAX ? now - start : UINT32_MAX;
+    rec->ret      = ret;
+    memcpy(rec->path, path, path_len);
+    trace->hdr->records++;
+    pthread_mutex_unlock(&trace->lock);
+}
+
+/**
+ * @brief 读入跟踪文件，供newfs_replay逐条遍历
+ *
+ * @param path
+ * @param hdr 输出，文件头
+ * @param ring 输出，环形区的副本，需由调用者free
+ * @return int 文件不完整或不是跟踪文件返回-NEWFS_ERROR_INVAL
+ */
+int newfs_trace_load(const char* path, struct newfs_trace_hdr* hdr, uint8_t** ring) {
+    FILE* fp = fopen(path, "rb");
+    if (fp == NULL) {
+        return -NEWFS_ERROR_NOTFOUND;
+    }
+    *ring = NULL;
+    if (fread(hdr, sizeof(struct newfs_trace_hdr), 1, fp) != 1 || hdr->magic != NEWFS_TRACE_MAGIC ||
+        hdr->version != NEWFS_TRACE_VERSION || hdr->cap == 0 || hdr->head < hdr->tail ||
+        hdr->head - hdr->tail > hdr->cap || (*ring = (uint8_t*)malloc(hdr->cap)) == NULL ||
+        fread(*ring, hdr->cap, 1, fp) != 1) {
+        free(*ring);
+        fclose(fp);
+        return -NEWFS_ERROR_INVAL;
+    }
+    fclose(fp);
+    return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 从pos开始取下一条操作记录，跳过填充
+ *
+ * @param hdr
+ * @param ring
+ * @param pos 逻辑偏移，从hdr->tail开始，返回时指向下一条
+ * @return struct newfs_trace_rec* 没有更多记录或记录损坏时返回NULL
+ */
+struct newfs_trace_rec* newfs_trace_next(struct newfs_trace_hdr* hdr, uint8_t* ring, uint64_t* pos) {
+    struct newfs_trace_rec* rec;
+    while (*pos < hdr->head) {
+        rec = newfs_trace_at(ring, hdr->cap, *pos);
+        if (rec->len < 8 || rec->len % 8 != 0 || rec->len > hdr->head - *pos) {
+            return NULL;
+        }
+        *pos += rec->len;
+        if (rec->op == NEWFS_TRACE_PAD) {
+            continue;
+        }
+        if (rec->op >= NEWFS_OP_CNT || sizeof(struct newfs_trace_rec) + rec->path_len > rec->len) {
+            return NULL;
+        }
+        return rec;
+    }
+    return NULL;
+}
@@ -12,22 +12,17 @@ char* newfs_get_fname(const char* path) {
 }
 
 /**
- * @brief 计算路径的层级
+ * @brief 计算路径的层级，连续的'/'与newfs_lookup一样视为一个
  * exm: /av/c/d/f
  * -> lvl = 4
  * @param path 
  * @return int 
  */
 int newfs_calc_lvl(const char * path) {
-    // char* path_cpy = (char *)malloc(strlen(path));
-    // strcpy(path_cpy, path);
-    char* str = (char*)path;
-    int   lvl = 0;
-    if (strcmp(path, "/") == 0) {
-        return lvl;
-    }
+    const char* str = path;
+    int         lvl = 0;
     while (*str != '\0') {
-        if (*str == '/') {
+        if (*str != '/' && (str == path || str[-1] == '/')) {
             lvl++;
         }
         str++;
@@ -36,73 +31,157 @@ int newfs_calc_lvl(const char * path) {
 }
 
 /**
- * @brief 驱动读
+ * @brief 计算目录项的层级，与newfs_calc_lvl一致，根目录为0
+ * 
+ * @param dentry 
+ * @return int 
+ */
+int newfs_dentry_lvl(struct newfs_dentry* dentry) {
+    int lvl = 0;
+    while (dentry->parent != NULL) {
+        lvl++;
+        dentry = dentry->parent;
+    }
+    return lvl;
+}
+
+/**
+ * @brief 驱动读，经由块缓存
  * 
  * @param offset 
  * @param out_content 
  * @param size 
  * @return int 
  */
-int newfs_driver_read(int offset, uint8_t *out_content, int size) {
-    int      offset_aligned = NEWFS_ROUND_DOWN(offset, NEWFS_IO_SZ());
-    int      bias           = offset - offset_aligned;
-    int      size_aligned   = NEWFS_ROUND_UP((size + bias), NEWFS_IO_SZ());
-    uint8_t* temp_content   = (uint8_t*)malloc(size_aligned);
-    uint8_t* cur            = temp_content;
-    // lseek(NEWFS_DRIVER(), offset_aligned, SEEK_SET);
-    ddriver_seek(NEWFS_DRIVER(), offset_aligned, SEEK_SET);
-    while (size_aligned != 0)
+int newfs_driver_read(uint64_t offset, uint8_t *out_content, int size) {
+    struct newfs_cache_blk* blk;
+    uint64_t blkno = offset / NEWFS_BLK_SZ();
+    int      bias  = offset % NEWFS_BLK_SZ();
+    int      len;
+    NEWFS_CACHE_LOCK();
+    while (size > 0)
     {
-        // read(NEWFS_DRIVER(), cur, NEWFS_IO_SZ());
-        ddriver_read(NEWFS_DRIVER(), (char*)cur, NEWFS_IO_SZ());
-        cur          += NEWFS_IO_SZ();
-        size_aligned -= NEWFS_IO_SZ();   
+        len = NEWFS_BLK_SZ() - bias < size ? NEWFS_BLK_SZ() - bias : size;
+        blk = newfs_cache_get(blkno, TRUE);
+        if (blk == NULL) {
+            NEWFS_CACHE_UNLOCK();
+            return -NEWFS_ERROR_IO;
+        }
+        memcpy(out_content, blk->data + bias, len);
+        out_content += len;
+        size        -= len;
+        bias         = 0;
+        blkno++;
     }
-    memcpy(out_content, temp_content + bias, size);
-    free(temp_content);
+    NEWFS_CACHE_UNLOCK();
     return NEWFS_ERROR_NONE;
 }
 
 
+static int newfs_driver_write_blks(uint64_t offset, uint8_t *in_content, int size, boolean is_meta) {
+    struct newfs_cache_blk* blk;
+    uint64_t blkno = offset / NEWFS_BLK_SZ();
+    int      bias  = offset % NEWFS_BLK_SZ();
+    int      len;
+    NEWFS_CACHE_LOCK();
+    while (size > 0)
+    {
+        len = NEWFS_BLK_SZ() - bias < size ? NEWFS_BLK_SZ() - bias : size;
+        blk = newfs_cache_get(blkno, len != NEWFS_BLK_SZ());  /* 整块覆盖无需读入 */
+        if (blk == NULL || (is_meta && newfs_cache_freeze(blk) != NEWFS_ERROR_NONE)) {
+            NEWFS_CACHE_UNLOCK();
+            return -NEWFS_ERROR_IO;
+        }
+        memcpy(blk->data + bias, in_content, len);
+        if (is_meta) {
+            newfs_cache_mark_meta_dirty(blk);
+        }
+        else {
+            newfs_cache_mark_dirty(blk);
+        }
+        in_content += len;
+        size       -= len;
+        bias        = 0;
+        blkno++;
+    }
+    NEWFS_CACHE_UNLOCK();
+    return NEWFS_ERROR_NONE;
+}
+
 /**
- * @brief 驱动写
+ * @brief 驱动写元数据，只修改缓存块并标脏，由日志提交后再写回设备
  * 
  * @param offset 
  * @param in_content 
  * @param size 
  * @return int 
  */
-int newfs_driver_write(int offset, uint8_t *in_content, int size) {
-    int      offset_aligned = NEWFS_ROUND_DOWN(offset, NEWFS_IO_SZ());
-    int      bias           = offset - offset_aligned;
-    int      size_aligned   = NEWFS_ROUND_UP((size + bias), NEWFS_IO_SZ());
-    uint8_t* temp_content   = (uint8_t*)malloc(size_aligned);
-    uint8_t* cur            = temp_content;
-    newfs_driver_read(offset_aligned, temp_content, size_aligned);
-    memcpy(temp_content + bias, in_content, size);
-    
-    // lseek(NEWFS_DRIVER(), offset_aligned, SEEK_SET);
-    ddriver_seek(NEWFS_DRIVER(), offset_aligned, SEEK_SET);
-    while (size_aligned != 0)
-    {
-        // write(NEWFS_DRIVER(), cur, NEWFS_IO_SZ());
-        ddriver_write(NEWFS_DRIVER(), (char*)cur, NEWFS_IO_SZ());
-        cur          += NEWFS_IO_SZ();
-        size_aligned -= NEWFS_IO_SZ();   
+int newfs_driver_write(uint64_t offset, uint8_t *in_content, int size) {
+    return newfs_driver_write_blks(offset, in_content, size, TRUE);
+}
+
+/**
+ * @brief 驱动写文件数据，不经过日志，日志提交前写回设备
+ * 
+ * @param offset 
+ * @param in_content 
+ * @param size 
+ * @return int 
+ */
+int newfs_driver_write_data(uint64_t offset, uint8_t *in_content, int size) {
+    return newfs_driver_write_blks(offset, in_content, size, FALSE);
+}
+
+/**
+ * @brief 从dentry_slab分配一个目录项，名字复制进父目录的名字区
+ * 
+ * @param dir 父目录inode，根目录项为NULL
+ * @param fname 
+ * @param len 名字长度
+ * @param ftype 
+ * @return struct newfs_dentry* 内存不足返回NULL
+ */
+struct newfs_dentry* new_dentry(struct newfs_inode * dir, const char * fname, int len,
+                                NEWFS_FILE_TYPE ftype) {
+    struct newfs_dentry* dentry = (struct newfs_dentry*)newfs_slab_alloc(&newfs_ctx->dentry_slab);
+    if (dentry == NULL) {
+        return NULL;
+    }
+    dentry->fname = dir == NULL ? "/" : newfs_names_add(&dir->names, fname, len);
+    if (dentry->fname == NULL) {
+        newfs_slab_free(&newfs_ctx->dentry_slab, dentry);
+        return NULL;
     }
+    dentry->name_len = len;
+    dentry->ftype    = ftype;
+    dentry->ino      = -1;
+    dentry->leaf     = -1;
+    dentry->parent   = dir == NULL ? NULL : dir->dentry;
+    return dentry;
+}
 
-    free(temp_content);
-    return NEWFS_ERROR_NONE;
+/**
+ * @brief 释放目录项，名字随父目录的名字区一起释放
+ * 
+ * @param dentry 
+ * @return void
+ */
+void newfs_free_dentry(struct newfs_dentry * dentry) {
+    newfs_slab_free(&newfs_ctx->dentry_slab, dentry);
 }
 
 /**
- * @brief 为一个inode分配dentry，采用头插法
+ * @brief 为一个inode分配dentry，先加入目录哈希索引，成功后再头插进目录项链表
  * 
  * @param inode 
  * @param dentry 
- * @return int 
+ * @return int 目录项数，目录叶子块无法再分裂时返回-NEWFS_ERROR_NOSPACE，目录不变
  */
 int newfs_alloc_dentry(struct newfs_inode* inode, struct newfs_dentry* dentry) {
+    boolean is_new = dentry->leaf < 0;                /* 从磁盘载入的目录项已放置在叶子块中 */
+    if (newfs_dir_insert(inode, dentry) != NEWFS_ERROR_NONE) {
+        return -NEWFS_ERROR_NOSPACE;
+    }
     if (inode->dentrys == NULL) {
         inode->dentrys = dentry;
     }
@@ -111,73 +190,90 @@ int newfs_alloc_dentry(struct newfs_inode* inode, struct newfs_dentry* dentry) {
         inode->dentrys = dentry;
     }
     inode->dir_cnt++;
+    if (is_new) {
+        newfs_mark_inode_dirty(inode);
+        newfs_dcache_invalidate(inode->dentry, dentry->fname, dentry->name_len, dentry->hash);
+    }
     return inode->dir_cnt;
 }
+
+/**
+ * @brief 将dentry移出inode的目录项链表与目录哈希索引，与newfs_alloc_dentry相对；
+ * dentry本身由调用者释放或放入其他目录
+ * 
+ * @param inode 
+ * @param dentry 
+ * @return void
+ */
+void newfs_remove_dentry(struct newfs_inode* inode, struct newfs_dentry* dentry) {
+    struct newfs_dentry** link;
+    for (link = &inode->dentrys; *link != dentry; link = &(*link)->brother);
+    *link           = dentry->brother;
+    dentry->brother = NULL;
+    inode->dir_cnt--;
+    inode->dir_gen++;                                 /* 打开的readdir游标可能指向该目录项 */
+    newfs_dir_remove(inode, dentry);
+    newfs_mark_inode_dirty(inode);
+    newfs_dcache_invalidate(inode->dentry, dentry->fname, dentry->name_len, dentry->hash);
+}
 /**
  * @brief 分配一个数据块
  * 
- * @return 返回块号
+ * @return 返回块号，空间不足返回-NEWFS_ERROR_NOSPACE
  */
-int
-newfs_alloc_data_blk(){
-    
-    int byte_cursor = 0; 
-    int bit_cursor  = 0; 
-    int data_blk_cursor  = 0;
-    boolean is_find_free_blk = FALSE;
-    for (byte_cursor = 0; byte_cursor < NEWFS_MAX_DATA()/UINT8_BITS;          byte_cursor++)
-    {
-        for (bit_cursor = 0; bit_cursor < UINT8_BITS; bit_cursor++) {
-            if((newfs_super.map_data[byte_cursor] & (0x1 << bit_cursor)) == 0) {    
-                                                      /* 当前data_blk_cursor位置空闲 */
-                newfs_super.map_data[byte_cursor] |= (0x1 << bit_cursor);
-                is_find_free_blk = TRUE;           
-                break;
-            }
-            data_blk_cursor++;
-        }
-        if (is_find_free_blk) {
-            return data_blk_cursor;
-        }
-    }
-    return -NEWFS_ERROR_NOSPACE;
+int newfs_alloc_data_blk() {
+    return newfs_bitmap_alloc(&newfs_ctx->data_bm);
+}
+
+/**
+ * @brief 释放一个数据块
+ * 
+ * @param blkno 数据块号
+ * @return void
+ */
+void newfs_free_data_blk(int blkno) {
+    newfs_bitmap_free(&newfs_ctx->data_bm, blkno);
+}
+
+/**
+ * @brief 优先分配goal处的数据块，使文件的块尽量连续
+ * 
+ * @param goal 期望的数据块号
+ * @return int 块号，失败返回负错误码
+ */
+int newfs_alloc_data_blk_near(int64_t goal) {
+    return newfs_bitmap_alloc_near(&newfs_ctx->data_bm, goal);
 }
 /**
  * @brief 为dentry分配一个inode，占用位图
  * 
  * @param dentry 该dentry指向分配的inode
- * @return newfs_inode
+ * @return newfs_inode inode用尽时返回NULL
  */
 struct newfs_inode* newfs_alloc_inode(struct newfs_dentry * dentry) {
     struct newfs_inode* inode;
-    int byte_cursor = 0; 
-    int bit_cursor  = 0; 
-    int ino_cursor  = 0;
-    boolean is_find_free_entry = FALSE;
+    int ino_cursor = newfs_bitmap_alloc(&newfs_ctx->inode_bm);
 
-    // for (byte_cursor = 0; byte_cursor < NEWFS_BLKS_SZ(newfs_super.map_inode_blks);          byte_cursor++)
-    for (byte_cursor = 0; byte_cursor < NEWFS_MAX_INO()/UINT8_BITS;          byte_cursor++)
-    {
-        for (bit_cursor = 0; bit_cursor < UINT8_BITS; bit_cursor++) {
-            if((newfs_super.map_inode[byte_cursor] & (0x1 << bit_cursor)) == 0) {    
-                                                      /* 当前ino_cursor位置空闲 */
-                newfs_super.map_inode[byte_cursor] |= (0x1 << bit_cursor);
-                is_find_free_entry = TRUE;           
-                break;
-            }
-            ino_cursor++;
-        }
-        if (is_find_free_entry) {
-            break;
-        }
+    if (ino_cursor < 0) {
+        return NULL;
     }
 
-    // if (!is_find_free_entry || ino_cursor == newfs_super.max_ino)
-    //     return -NEWFS_ERROR_NOSPACE;
-
-    inode = (struct newfs_inode*)malloc(sizeof(struct newfs_inode));
+    inode = (struct newfs_inode*)newfs_slab_alloc(&newfs_ctx->inode_slab);
+    if (inode == NULL) {
+        newfs_bitmap_free(&newfs_ctx->inode_bm, ino_cursor);
+        return NULL;
+    }
+    if (dentry->ftype != NEWFS_DIR) {                 /* 小文件的数据内联在inode记录中 */
+        inode->inline_data = (uint8_t *)calloc(1, NEWFS_INLINE_MAX);
+        if (inode->inline_data == NULL) {
+            newfs_slab_free(&newfs_ctx->inode_slab, inode);
+            newfs_bitmap_free(&newfs_ctx->inode_bm, ino_cursor);
+            return NULL;
+        }
+    }
     inode->ino  = ino_cursor; 
     inode->size = 0;
+    pthread_rwlock_init(&inode->rwlock, NULL);
                                                       /* dentry指向inode */
     dentry->inode = inode;
     dentry->ino   = inode->ino;
@@ -186,133 +282,770 @@ struct newfs_inode* newfs_alloc_inode(struct newfs_dentry * dentry) {
     
     inode->dir_cnt = 0;
     inode->dentrys = NULL;
-    inode->data_blk[0] = newfs_alloc_data_blk();
-    
-    if (NEWFS_IS_REG(inode)) {
-        inode->data = (uint8_t *)malloc(NEWFS_BLKS_SZ(1));
-    }
+                                                      /* 数据块在写入时按需分配 */
+    inode->extents = NULL;
+    inode->ext_cnt = 0;
+    inode->ext_cap = 0;
+    inode->ext_blks = NULL;
+    inode->ext_blk_cnt = 0;
+    newfs_mark_inode_dirty(inode);
+    newfs_icache_add(inode);
 
     return inode;
 }
 
 
 /**
- * @brief 将内存inode及其下方结构全部刷回磁盘
+ * @brief 删除文件或空目录：释放数据块、目录叶子块与间接extent块，再释放inode；
+ * 目录叶子块与extent块属于元数据，释放前撤销日志中的副本。调用者持有命名空间写锁，
+ * 且inode已没有打开句柄与预读请求
+ * 
+ * @param inode 
+ * @return int 
+ */
+int newfs_delete_inode(struct newfs_inode * inode) {
+    uint64_t j;
+    int      i;
+    for (i = 0; i < inode->ext_cnt && NEWFS_IS_DIR(inode); i++) {
+        for (j = 0; j < inode->extents[i].len; j++) {
+            if (newfs_journal_revoke(NEWFS_DATA_BLKNO(inode->extents[i].pblk + j)) != NEWFS_ERROR_NONE) {
+                return -NEWFS_ERROR_IO;
+            }
+        }
+    }
+    if (newfs_truncate_data(inode, 0) != NEWFS_ERROR_NONE ||
+        newfs_sync_extents(inode) != NEWFS_ERROR_NONE) {    /* extent为空，只释放间接extent块 */
+        return -NEWFS_ERROR_IO;
+    }
+    newfs_free_inode(inode);
+    return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 释放打开句柄、目录游标或预读请求对inode的引用，调用者持有命名空间读锁，
+ * 孤儿标志在读锁下不会变化；孤儿inode不会再被打开，引用不会从0回升
+ * 
+ * @param inode 
+ * @return boolean 孤儿inode的最后一个引用已释放，调用者应取得写锁后调用newfs_reap_orphans
+ */
+boolean newfs_inode_put(struct newfs_inode * inode) {
+    return NEWFS_ATOMIC_DEC(&inode->ref) == 0 && inode->is_orphan;
+}
+
+/**
+ * @brief 删除不再被引用的孤儿inode及其目录项。孤儿文件引用着所在目录，
+ * 目录被删除后若也成了孤儿，随最后一个孤儿文件一起删除。调用者持有命名空间写锁；
+ * 崩溃时尚未删除的孤儿inode不在任何目录中，只占用inode与数据块
+ * 
+ * @return int 
+ */
+int newfs_reap_orphans() {
+    struct newfs_dentry** link = &newfs_ctx->orphans;
+    struct newfs_dentry*  dentry;
+    int ret = NEWFS_ERROR_NONE;
+    while (*link != NULL) {
+        dentry = *link;
+        if (NEWFS_ATOMIC_GET(&dentry->inode->ref) != 0) {
+            link = &dentry->brother;
+            continue;
+        }
+        if (newfs_delete_inode(dentry->inode) != NEWFS_ERROR_NONE) {
+            ret  = -NEWFS_ERROR_IO;
+            link = &dentry->brother;
+            continue;
+        }
+        *link = dentry->brother;
+        newfs_free_dentry(dentry);
+        link  = &newfs_ctx->orphans;                  /* 父目录的引用随之减少，从头再找 */
+    }
+    return ret;
+}
+
+/**
+ * @brief 将inode加入脏inode链表，由newfs_sync统一写回
+ * 
+ * @param inode 
+ * @return void
+ */
+void newfs_mark_inode_dirty(struct newfs_inode * inode) {
+    pthread_mutex_lock(&newfs_ctx->dirty_lock);
+    if (inode->is_dirty) {
+        pthread_mutex_unlock(&newfs_ctx->dirty_lock);
+        return;
+    }
+    inode->is_dirty   = TRUE;
+    inode->dirty_prev = NULL;
+    inode->dirty_next = newfs_ctx->dirty_inodes;
+    if (newfs_ctx->dirty_inodes != NULL) {
+        newfs_ctx->dirty_inodes->dirty_prev = inode;
+    }
+    newfs_ctx->dirty_inodes = inode;
+    NEWFS_ATOMIC_INC(&newfs_ctx->dirty_cnt);
+    pthread_mutex_unlock(&newfs_ctx->dirty_lock);
+    newfs_wb_note_dirty();
+}
+
+static void newfs_clear_inode_dirty(struct newfs_inode * inode) {
+    pthread_mutex_lock(&newfs_ctx->dirty_lock);
+    if (!inode->is_dirty) {
+        pthread_mutex_unlock(&newfs_ctx->dirty_lock);
+        return;
+    }
+    if (inode->dirty_prev != NULL) {
+        inode->dirty_prev->dirty_next = inode->dirty_next;
+    }
+    else {
+        newfs_ctx->dirty_inodes = inode->dirty_next;
+    }
+    if (inode->dirty_next != NULL) {
+        inode->dirty_next->dirty_prev = inode->dirty_prev;
+    }
+    inode->is_dirty   = FALSE;
+    inode->dirty_prev = NULL;
+    inode->dirty_next = NULL;
+    NEWFS_ATOMIC_DEC(&newfs_ctx->dirty_cnt);
+    pthread_mutex_unlock(&newfs_ctx->dirty_lock);
+}
+
+/**
+ * @brief 释放inode：移出脏链表与inode缓存，归还inode号，dentry不再指向它；
+ * 数据块与子目录项由调用者先行释放
+ * 
+ * @param inode 
+ * @return void
+ */
+void newfs_free_inode(struct newfs_inode * inode) {
+    newfs_clear_inode_dirty(inode);
+    newfs_icache_remove(inode);
+    newfs_bitmap_free(&newfs_ctx->inode_bm, inode->ino);
+    inode->dentry->inode = NULL;
+    newfs_inode_release(inode);
+    newfs_slab_free(&newfs_ctx->inode_slab, inode);
+}
+
+/**
+ * @brief 将一个inode刷回磁盘：延迟分配的脏页、目录的脏叶子块、extent和inode记录，不递归
  * 
  * @param inode 
  * @return int 
  */
 int newfs_sync_inode(struct newfs_inode * inode) {
     struct newfs_inode_d  inode_d;
-    struct newfs_dentry*  dentry_cursor;
-    struct newfs_dentry_d dentry_d;
     int ino             = inode->ino;
-    int offset;
+    if (newfs_da_flush(inode) != NEWFS_ERROR_NONE) { /* 先为脏页分配数据块，extent随后写回 */
+        NEWFS_ERR("[%s] io error\n", __func__);
+        return -NEWFS_ERROR_IO;
+    }
+    if (NEWFS_IS_DIR(inode)) {                        /* 目录文件的内容为哈希叶子块 */
+        if (newfs_dir_sync(inode) != NEWFS_ERROR_NONE) {
+            NEWFS_ERR("[%s] io error\n", __func__);
+            return -NEWFS_ERROR_IO;                     
+        }
+    }
+    if (newfs_sync_extents(inode) != NEWFS_ERROR_NONE) {
+        return -NEWFS_ERROR_IO;
+    }
+    memset(&inode_d, 0, sizeof(struct newfs_inode_d));
     inode_d.ino         = ino;
     inode_d.size        = inode->size;
     inode_d.ftype       = inode->dentry->ftype;
     inode_d.dir_cnt     = inode->dir_cnt;
-    
-    for(int i = 0;i<NEWFS_DATA_PER_FILE;i++)
-        inode_d.data_blk[i] = (uint16_t)inode->data_blk[i];
-    // int offset;
-    // int a = NEWFS_INO_OFS(ino);
-    // int c = sizeof(struct newfs_inode_d);
-    // uint8_t* b = (uint8_t *)&inode_d;
-    // printf("a,b,c:%d %d %d",a,b,c);
-    // int flag = newfs_driver_write(NEWFS_INO_OFS(ino), (uint8_t *)&inode_d, sizeof(struct newfs_inode_d)) ;
-    // int flag = newfs_driver_write(a, b,c) ;
+    inode_d.ext_cnt     = inode->ext_cnt;
+    inode_d.ext_blk     = inode->ext_blk_cnt == 0 ? NEWFS_BLK_NONE_D : (uint64_t)inode->ext_blks[0];
+    if (inode->inline_data != NULL) {
+        inode_d.flags  |= NEWFS_INODE_INLINE;
+        memcpy(inode_d.inline_data, inode->inline_data, inode->size);
+    }
+    for (int i = 0; i < inode->ext_cnt && i < NEWFS_EXTENTS_INLINE; i++) {
+        inode_d.extents[i].lblk = inode->extents[i].lblk;
+        inode_d.extents[i].len  = inode->extents[i].len;
+        inode_d.extents[i].pblk = inode->extents[i].pblk;
+    }
+                                                      /* Cycle 1: 写 目录项，文件数据已由写路径写入缓存 */
+                                                      /* Cycle 2: 写 INODE */
     if (newfs_driver_write(NEWFS_INO_OFS(ino), (uint8_t *)&inode_d, sizeof(struct newfs_inode_d)) != (NEWFS_ERROR_NONE)){
-        NEWFS_DBG("[%s] io error\n", __func__);
+        NEWFS_ERR("[%s] io error\n", __func__);
         return -NEWFS_ERROR_IO;
     }
-                                                      /* Cycle 1: 写 INODE */
-                                                      /* Cycle 2: 写 数据 */
-    if (NEWFS_IS_DIR(inode)) {  
-        // 目录文件                        
-        dentry_cursor = inode->dentrys;
-        // 不再使用固定数据块
-        // 改为使用inode指示数据块
-        offset        = NEWFS_DATA_OFS(inode->data_blk[0]);
-        // offset        = inode(ino);
-        while (dentry_cursor != NULL)
-        {
-            memcpy(dentry_d.fname, dentry_cursor->fname, NEWFS_MAX_FILE_NAME);
-            dentry_d.ftype = dentry_cursor->ftype;
-            dentry_d.ino = dentry_cursor->ino;
-            if (newfs_driver_write(offset, (uint8_t *)&dentry_d, 
-                                 sizeof(struct newfs_dentry_d)) != NEWFS_ERROR_NONE) {
-                NEWFS_DBG("[%s] io error\n", __func__);
-                return -NEWFS_ERROR_IO;                     
-            }
-            // 递归写回各个子目录项的inode
-            if (dentry_cursor->inode != NULL) {
-                newfs_sync_inode(dentry_cursor->inode);
-            }
+    newfs_clear_inode_dirty(inode);
+    return NEWFS_ERROR_NONE;
+}
 
-            dentry_cursor = dentry_cursor->brother;
-            offset += sizeof(struct newfs_dentry_d);
+static int newfs_ino_cmp(const void* a, const void* b) {
+    int x = (*(struct newfs_inode* const*)a)->ino;
+    int y = (*(struct newfs_inode* const*)b)->ino;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief 只写回脏inode（按inode号即磁盘偏移排序）和脏位图块，再作为一个事务提交到日志
+ * 
+ * @return int 
+ */
+int newfs_sync() {
+    struct newfs_inode** inodes;
+    struct newfs_inode*  inode;
+    int cnt = 0, i;
+    if (newfs_ctx->dirty_cnt > 0) {
+        inodes = (struct newfs_inode**)malloc(newfs_ctx->dirty_cnt * sizeof(struct newfs_inode*));
+        if (inodes == NULL) {                         /* 脏inode仍在链表上，下次同步时写回 */
+            return -NEWFS_ERROR_NOSPACE;
         }
-    }
-    else if (NEWFS_IS_REG(inode)) {
-        // 数据文件             
-        if (newfs_driver_write(offset, inode->data, 
-                             NEWFS_BLKS_SZ(1)) != NEWFS_ERROR_NONE) {
-            NEWFS_DBG("[%s] io error\n", __func__);
-            return -NEWFS_ERROR_IO;
+        for (inode = newfs_ctx->dirty_inodes; inode != NULL; inode = inode->dirty_next) {
+            inodes[cnt++] = inode;
+        }
+        qsort(inodes, cnt, sizeof(struct newfs_inode*), newfs_ino_cmp);
+        for (i = 0; i < cnt; i++) {
+            if (newfs_sync_inode(inodes[i]) != NEWFS_ERROR_NONE) {
+                free(inodes);
+                return -NEWFS_ERROR_IO;
+            }
         }
+        free(inodes);
+    }
+    if (newfs_bitmap_sync(&newfs_ctx->inode_bm, newfs_ctx->map_inode_offset) != NEWFS_ERROR_NONE ||
+        newfs_bitmap_sync(&newfs_ctx->data_bm, newfs_ctx->map_data_offset) != NEWFS_ERROR_NONE) {
+        return -NEWFS_ERROR_IO;
     }
+    if (newfs_journal_commit() != NEWFS_ERROR_NONE) {
+        return -NEWFS_ERROR_IO;
+    }
+    newfs_wb_clean();
     return NEWFS_ERROR_NONE;
 }
 
 
+/**
+ * @brief 读入失败时释放尚未加入缓存的inode，连同已载入的子目录项
+ * 
+ * @param inode 
+ * @param ino 
+ * @return struct newfs_inode* NULL
+ */
+static struct newfs_inode* newfs_read_inode_fail(struct newfs_inode* inode, int ino) {
+    struct newfs_dentry* child;
+    struct newfs_dentry* next;
+    NEWFS_ERR("[newfs_read_inode] cannot load inode %d\n", ino);
+    for (child = inode->dentrys; child != NULL; child = next) {
+        next = child->brother;
+        newfs_free_dentry(child);
+    }
+    newfs_inode_release(inode);
+    newfs_slab_free(&newfs_ctx->inode_slab, inode);
+    return NULL;
+}
+
 /**
  * @brief 
  * 
  * @param dentry dentry指向ino，读取该inode
  * @param ino inode唯一编号
- * @return struct newfs_inode* 
+ * @return struct newfs_inode* 读取失败或inode记录损坏时返回NULL
  */
 struct newfs_inode* newfs_read_inode(struct newfs_dentry * dentry, int ino) {
-    struct newfs_inode* inode = (struct newfs_inode*)malloc(sizeof(struct newfs_inode));
+    struct newfs_inode* inode = (struct newfs_inode*)newfs_slab_alloc(&newfs_ctx->inode_slab);
     struct newfs_inode_d inode_d;
-    struct newfs_dentry* sub_dentry;
-    struct newfs_dentry_d dentry_d;
-    int    dir_cnt = 0, i;
+    if (inode == NULL) {
+        return NULL;
+    }
+    pthread_rwlock_init(&inode->rwlock, NULL);
+    inode->dentry = dentry;
     if (newfs_driver_read(NEWFS_INO_OFS(ino), (uint8_t *)&inode_d, sizeof(struct newfs_inode_d)) != NEWFS_ERROR_NONE) {
-        NEWFS_DBG("[%s] io error\n", __func__);
-        return NULL;                    
+        return newfs_read_inode_fail(inode, ino);
     }
     inode->dir_cnt = 0;
     inode->ino = inode_d.ino;
     inode->size = inode_d.size;
-    inode->dentry = dentry;
     inode->dentrys = NULL;
-    for(int i = 0;i<NEWFS_DATA_PER_FILE;i++)
-        inode->data_blk[i] = (int)(inode_d.data_blk[i]);
-    if (NEWFS_IS_DIR(inode)) {
-        dir_cnt = inode_d.dir_cnt;
-        for (i = 0; i < dir_cnt; i++){
-            if (newfs_driver_read(NEWFS_DATA_OFS(inode->data_blk[0]) + i * sizeof(struct newfs_dentry_d), 
-                                (uint8_t *)&dentry_d, 
-                                sizeof(struct newfs_dentry_d)) != NEWFS_ERROR_NONE) {
-                NEWFS_DBG("[%s] io error\n", __func__);
-                return NULL;                    
+    if (inode_d.flags & NEWFS_INODE_INLINE) {        /* 内联数据随inode记录一次读入 */
+        if (inode->size > NEWFS_INLINE_MAX) {
+            return newfs_read_inode_fail(inode, ino);
+        }
+        inode->inline_data = (uint8_t *)calloc(1, NEWFS_INLINE_MAX);
+        if (inode->inline_data == NULL) {
+            return newfs_read_inode_fail(inode, ino);
+        }
+        memcpy(inode->inline_data, inode_d.inline_data, inode->size);
+        inode_d.ext_cnt = 0;
+    }
+    if (newfs_read_extents(inode, &inode_d) != NEWFS_ERROR_NONE) {
+        return newfs_read_inode_fail(inode, ino);
+    }
+    if (NEWFS_IS_DIR(inode) && newfs_dir_load(inode) != NEWFS_ERROR_NONE) {
+        return newfs_read_inode_fail(inode, ino);
+    }
+    inode->is_dirty = FALSE;
+    newfs_icache_add(inode);
+    newfs_ctx->icache.stats.loads++;
+    return inode;
+}
+
+/**
+ * @brief 从磁盘inode中读入extent，超出内联槽位的部分沿间接extent块链读入
+ * 
+ * @param inode 
+ * @param inode_d 
+ * @return int 
+ */
+int newfs_read_extents(struct newfs_inode * inode, struct newfs_inode_d * inode_d) {
+    struct newfs_extent_blk_d* ext_blk_d;
+    uint64_t next = inode_d->ext_blk;
+    int i, j;
+    inode->ext_cnt     = inode_d->ext_cnt;
+    inode->ext_cap     = inode->ext_cnt > NEWFS_EXTENTS_INLINE ? inode->ext_cnt : NEWFS_EXTENTS_INLINE;
+    inode->extents     = (struct newfs_extent*)malloc(inode->ext_cap * sizeof(struct newfs_extent));
+    inode->ext_blks    = NULL;
+    inode->ext_blk_cnt = 0;
+    for (i = 0; i < inode->ext_cnt && i < NEWFS_EXTENTS_INLINE; i++) {
+        inode->extents[i].lblk = inode_d->extents[i].lblk;
+        inode->extents[i].len  = inode_d->extents[i].len;
+        inode->extents[i].pblk = inode_d->extents[i].pblk;
+    }
+    if (inode->ext_cnt <= NEWFS_EXTENTS_INLINE) {
+        return NEWFS_ERROR_NONE;
+    }
+    ext_blk_d = (struct newfs_extent_blk_d*)malloc(NEWFS_BLK_SZ());
+    while (next != NEWFS_BLK_NONE_D && i < inode->ext_cnt) {
+        if (newfs_driver_read(NEWFS_DATA_OFS(next), (uint8_t *)ext_blk_d, NEWFS_BLK_SZ()) != NEWFS_ERROR_NONE) {
+            free(ext_blk_d);
+            return -NEWFS_ERROR_IO;
+        }
+        inode->ext_blks = (int64_t*)realloc(inode->ext_blks, (inode->ext_blk_cnt + 1) * sizeof(int64_t));
+        inode->ext_blks[inode->ext_blk_cnt++] = next;
+        for (j = 0; j < (int)ext_blk_d->cnt && i < inode->ext_cnt; j++, i++) {
+            inode->extents[i].lblk = ext_blk_d->extents[j].lblk;
+            inode->extents[i].len  = ext_blk_d->extents[j].len;
+            inode->extents[i].pblk = ext_blk_d->extents[j].pblk;
+        }
+        next = ext_blk_d->next;
+    }
+    free(ext_blk_d);
+    if (i != inode->ext_cnt) {
+        NEWFS_ERR("[%s] broken extent chain of inode %d\n", __func__, inode->ino);
+        return -NEWFS_ERROR_IO;
+    }
+    return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 将溢出内联槽位的extent写入间接extent块链，按需分配或释放链上的块
+ * 
+ * @param inode 
+ * @return int 
+ */
+int newfs_sync_extents(struct newfs_inode * inode) {
+    struct newfs_extent_blk_d* ext_blk_d;
+    int over = inode->ext_cnt > NEWFS_EXTENTS_INLINE ? inode->ext_cnt - NEWFS_EXTENTS_INLINE : 0;
+    int need = NEWFS_ROUND_UP(over, (int)NEWFS_EXTENTS_PER_BLK()) / (int)NEWFS_EXTENTS_PER_BLK();
+    int i, j, k, blkno, ret = NEWFS_ERROR_NONE;
+
+    while (inode->ext_blk_cnt > need) {
+        blkno = inode->ext_blks[--inode->ext_blk_cnt];
+        if (newfs_journal_revoke(NEWFS_DATA_BLKNO(blkno)) != NEWFS_ERROR_NONE) {
+            return -NEWFS_ERROR_IO;
+        }
+        newfs_free_data_blk(blkno);
+    }
+    if (need > inode->ext_blk_cnt) {
+        inode->ext_blks = (int64_t*)realloc(inode->ext_blks, need * sizeof(int64_t));
+        while (inode->ext_blk_cnt < need) {
+            blkno = newfs_alloc_data_blk();
+            if (blkno < 0) {
+                return blkno;
             }
-            sub_dentry = new_dentry(dentry_d.fname, dentry_d.ftype);
-            sub_dentry->parent = inode->dentry;
-            sub_dentry->ino    = dentry_d.ino; 
-            newfs_alloc_dentry(inode, sub_dentry);
+            inode->ext_blks[inode->ext_blk_cnt++] = blkno;
         }
     }
-    else if (NEWFS_IS_REG(inode)) {
-        inode->data = (uint8_t *)malloc(NEWFS_BLKS_SZ(1));
-        if (newfs_driver_read(NEWFS_DATA_OFS(inode->data_blk[0]), (uint8_t *)inode->data, NEWFS_BLKS_SZ(1)) != NEWFS_ERROR_NONE) {
-            NEWFS_DBG("[%s] io error\n", __func__);
-            return NULL;                    
+    ext_blk_d = (struct newfs_extent_blk_d*)malloc(NEWFS_BLK_SZ());
+    for (i = 0, k = NEWFS_EXTENTS_INLINE; i < need && ret == NEWFS_ERROR_NONE; i++) {
+        memset(ext_blk_d, 0, NEWFS_BLK_SZ());
+        ext_blk_d->next = i + 1 < need ? (uint64_t)inode->ext_blks[i + 1] : NEWFS_BLK_NONE_D;
+        for (j = 0; j < (int)NEWFS_EXTENTS_PER_BLK() && k < inode->ext_cnt; j++, k++) {
+            ext_blk_d->extents[j].lblk = inode->extents[k].lblk;
+            ext_blk_d->extents[j].len  = inode->extents[k].len;
+            ext_blk_d->extents[j].pblk = inode->extents[k].pblk;
         }
+        ext_blk_d->cnt = j;
+        ret = newfs_driver_write(NEWFS_DATA_OFS(inode->ext_blks[i]), (uint8_t *)ext_blk_d, NEWFS_BLK_SZ());
     }
-    return inode;
+    free(ext_blk_d);
+    return ret;
+}
+
+/**
+ * @brief 二分查找第一个lblk大于iblk的extent
+ *
+ * @param inode
+ * @param iblk
+ * @return int extent下标，[0, ext_cnt]
+ */
+static int newfs_ext_upper(struct newfs_inode * inode, uint64_t iblk) {
+    int lo = 0, hi = inode->ext_cnt, mid;
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if (inode->extents[mid].lblk <= iblk) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/**
+ * @brief 确保extent数组还能再容纳n个extent，预留后的newfs_ext_insert至多新增n个extent而不会失败
+ *
+ * @param inode
+ * @param n
+ * @return int 内存不足返回-NEWFS_ERROR_NOSPACE，数组不变
+ */
+int newfs_ext_reserve(struct newfs_inode * inode, int n) {
+    struct newfs_extent* grown;
+    int cap = inode->ext_cap == 0 ? NEWFS_EXTENTS_INLINE : inode->ext_cap;
+    while (cap < inode->ext_cnt + n) {
+        cap *= 2;
+    }
+    if (cap == inode->ext_cap) {
+        return NEWFS_ERROR_NONE;
+    }
+    grown = (struct newfs_extent*)realloc(inode->extents, cap * sizeof(struct newfs_extent));
+    if (grown == NULL) {
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    inode->extents = grown;
+    inode->ext_cap = cap;
+    return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 在有序位置插入单块映射，能与前后extent拼接时直接延长
+ *
+ * @param inode
+ * @param iblk
+ * @param pblk
+ * @return int 需要新的extent而内存不足时返回-NEWFS_ERROR_NOSPACE，映射不变
+ */
+int newfs_ext_insert(struct newfs_inode * inode, uint64_t iblk, uint64_t pblk) {
+    int i = newfs_ext_upper(inode, iblk);
+    struct newfs_extent* prev = i > 0 ? &inode->extents[i - 1] : NULL;
+    struct newfs_extent* next = i < inode->ext_cnt ? &inode->extents[i] : NULL;
+
+    newfs_mark_inode_dirty(inode);
+    if (prev && prev->lblk + prev->len == iblk && prev->pblk + prev->len == pblk) {
+        prev->len++;
+        if (next && prev->lblk + prev->len == next->lblk && prev->pblk + prev->len == next->pblk) {
+            prev->len += next->len;
+            memmove(next, next + 1, (inode->ext_cnt - i - 1) * sizeof(struct newfs_extent));
+            inode->ext_cnt--;
+        }
+        return NEWFS_ERROR_NONE;
+    }
+    if (next && iblk + 1 == next->lblk && pblk + 1 == next->pblk) {
+        next->lblk--;
+        next->pblk--;
+        next->len++;
+        return NEWFS_ERROR_NONE;
+    }
+    if (newfs_ext_reserve(inode, 1) != NEWFS_ERROR_NONE) {
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    memmove(&inode->extents[i + 1], &inode->extents[i],
+            (inode->ext_cnt - i) * sizeof(struct newfs_extent));
+    inode->extents[i].lblk = iblk;
+    inode->extents[i].len  = 1;
+    inode->extents[i].pblk = pblk;
+    inode->ext_cnt++;
+    return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 文件内块号到数据块号的映射，同时给出从iblk起连续的块数
+ *
+ * @param inode
+ * @param iblk 文件内第iblk个块
+ * @param run 输出，映射块时为所在extent剩余的块数，空洞时为到下一个extent的块数
+ * @return int64_t 数据块号，空洞返回NEWFS_BLK_NONE
+ */
+int64_t newfs_bmap_run(struct newfs_inode * inode, uint64_t iblk, uint64_t * run) {
+    int i = newfs_ext_upper(inode, iblk);
+    struct newfs_extent* ext;
+    if (i > 0) {
+        ext = &inode->extents[i - 1];
+        if (iblk < ext->lblk + ext->len) {
+            *run = ext->lblk + ext->len - iblk;
+            return ext->pblk + (iblk - ext->lblk);
+        }
+    }
+    *run = i < inode->ext_cnt ? inode->extents[i].lblk - iblk : NEWFS_MAX_FILE_BLKS - iblk;
+    return NEWFS_BLK_NONE;
+}
+
+/**
+ * @brief 文件内块号到数据块号的映射
+ *
+ * @param inode
+ * @param iblk 文件内第iblk个块
+ * @param alloc 空洞时是否分配新块，优先紧跟前一个extent，新块在缓存中清零
+ * @return int64_t 数据块号，空洞且不分配时返回NEWFS_BLK_NONE，出错返回负错误码
+ */
+int64_t newfs_bmap(struct newfs_inode * inode, uint64_t iblk, boolean alloc) {
+    struct newfs_cache_blk* blk;
+    struct newfs_extent*    prev;
+    uint64_t run;
+    int64_t  blkno, goal = 0;
+    int      i, ret;
+    if (iblk >= NEWFS_MAX_FILE_BLKS) {
+        return -NEWFS_ERROR_FBIG;
+    }
+    blkno = newfs_bmap_run(inode, iblk, &run);
+    if (blkno != NEWFS_BLK_NONE || !alloc) {
+        return blkno;
+    }
+    i = newfs_ext_upper(inode, iblk);
+    if (i > 0) {
+        prev = &inode->extents[i - 1];
+        goal = prev->pblk + (iblk - prev->lblk);
+    }
+    blkno = newfs_alloc_data_blk_near(goal);
+    if (blkno < 0) {
+        return blkno;
+    }
+    ret = newfs_ext_insert(inode, iblk, blkno);
+    if (ret != NEWFS_ERROR_NONE) {
+        newfs_free_data_blk(blkno);
+        return ret;
+    }
+    NEWFS_CACHE_LOCK();
+    blk = newfs_cache_get(NEWFS_DATA_BLKNO(blkno), FALSE);
+    if (blk == NULL) {
+        NEWFS_CACHE_UNLOCK();
+        return -NEWFS_ERROR_IO;
+    }
+    if (NEWFS_IS_DIR(inode)) {                        /* 目录叶子块属于元数据 */
+        newfs_cache_mark_meta_dirty(blk);
+    }
+    else {
+        newfs_cache_mark_dirty(blk);
+    }
+    NEWFS_CACHE_UNLOCK();
+    return blkno;
+}
+
+/**
+ * @brief 内联文件增长到超过NEWFS_INLINE_MAX时，把已有数据迁移到数据块
+ *
+ * @param inode
+ * @return int 空间不足时撤销已分配的块，文件保持内联
+ */
+static int newfs_inline_migrate(struct newfs_inode * inode) {
+    uint8_t* data = inode->inline_data;
+    uint64_t size = inode->size;
+    inode->inline_data = NULL;
+    if (size > 0 && newfs_write_data(inode, data, size, 0) != (int)size) {
+        newfs_truncate_data(inode, 0);
+        inode->inline_data = data;
+        inode->size        = size;
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    free(data);
+    newfs_mark_inode_dirty(inode);
+    return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 读文件数据，只读取请求覆盖的块，空洞读出脏页内容或0；
+ * 对齐的整块按extent合并成一次连续读
+ *
+ * @param inode
+ * @param buf
+ * @param size
+ * @param offset
+ * @return int 读取的字节数，出错返回负错误码
+ */
+int newfs_read_data(struct newfs_inode * inode, uint8_t * buf, int size, uint64_t offset) {
+    uint64_t iblk, run;
+    uint8_t* page;
+    int64_t  blkno;
+    int      bias, len, nblks;
+    int      done = 0;
+    if (offset >= inode->size) {
+        return 0;
+    }
+    if (size > inode->size - offset) {
+        size = inode->size - offset;
+    }
+    if (inode->inline_data != NULL) {
+        memcpy(buf, inode->inline_data + offset, size);
+        return size;
+    }
+    while (done < size) {
+        iblk  = (offset + done) / NEWFS_BLK_SZ();
+        bias  = (offset + done) % NEWFS_BLK_SZ();
+        blkno = newfs_bmap_run(inode, iblk, &run);
+        if (blkno == NEWFS_BLK_NONE && inode->dp_cnt > 0) {
+            run = 1;                                  /* 空洞中可能有脏页，逐块处理 */
+        }
+        if (bias == 0 && size - done >= NEWFS_BLK_SZ()) {
+            nblks = (size - done) / NEWFS_BLK_SZ();
+            nblks = run < (uint64_t)nblks ? (int)run : nblks;
+            len   = nblks * NEWFS_BLK_SZ();
+        }
+        else {
+            nblks = 0;
+            len   = NEWFS_BLK_SZ() - bias < size - done ? NEWFS_BLK_SZ() - bias : size - done;
+        }
+        if (blkno == NEWFS_BLK_NONE) {
+            page = inode->dp_cnt > 0 ? newfs_da_find(inode, iblk) : NULL;
+            if (page != NULL) {
+                memcpy(buf + done, page + bias, len);
+            }
+            else {
+                memset(buf + done, 0, len);
+            }
+        }
+        else if (nblks > 0) {
+            if (newfs_cache_read_direct(NEWFS_DATA_BLKNO(blkno), nblks, buf + done) != NEWFS_ERROR_NONE) {
+                return -NEWFS_ERROR_IO;
+            }
+        }
+        else if (newfs_driver_read(NEWFS_DATA_OFS(blkno) + bias, buf + done, len) != NEWFS_ERROR_NONE) {
+            return -NEWFS_ERROR_IO;
+        }
+        done += len;
+    }
+    return done;
+}
+
+/**
+ * @brief 写文件数据，已映射的块经缓存写入，非整块写只修改所在块；
+ * 普通文件的空洞写入延迟分配的脏页，目录的叶子块立即分配并按元数据写入
+ *
+ * @param inode
+ * @param buf
+ * @param size
+ * @param offset
+ * @return int 写入的字节数，出错返回负错误码
+ */
+int newfs_write_data(struct newfs_inode * inode, const uint8_t * buf, int size, uint64_t offset) {
+    uint64_t iblk;
+    uint8_t* page;
+    int64_t  blkno = NEWFS_ERROR_NONE;
+    int      bias, len;
+    int      done = 0;
+    if (inode->inline_data != NULL) {
+        if (offset + size <= NEWFS_INLINE_MAX) {
+            memcpy(inode->inline_data + offset, buf, size);
+            if (offset + size > inode->size) {
+                inode->size = offset + size;
+            }
+            newfs_mark_inode_dirty(inode);
+            return size;
+        }
+        if (newfs_inline_migrate(inode) != NEWFS_ERROR_NONE) {
+            return -NEWFS_ERROR_NOSPACE;
+        }
+    }
+    while (done < size) {
+        iblk  = (offset + done) / NEWFS_BLK_SZ();
+        bias  = (offset + done) % NEWFS_BLK_SZ();
+        len   = NEWFS_BLK_SZ() - bias < size - done ? NEWFS_BLK_SZ() - bias : size - done;
+        blkno = newfs_bmap(inode, iblk, NEWFS_IS_DIR(inode));
+        if (blkno == NEWFS_BLK_NONE) {                /* 空洞写入脏页，写回时再分配数据块 */
+            page = newfs_da_page(inode, iblk);
+            if (page == NULL) {
+                blkno = -NEWFS_ERROR_NOSPACE;
+                break;
+            }
+            memcpy(page + bias, buf + done, len);
+            done += len;
+            if (inode->dp_cnt >= NEWFS_DA_MAX_PAGES()) {
+                NEWFS_ATOMIC_INC(&newfs_ctx->da.stats.full_flushes);
+                if ((blkno = newfs_da_flush(inode)) != NEWFS_ERROR_NONE) {
+                    break;
+                }
+            }
+            continue;
+        }
+        if (blkno < 0) {
+            break;
+        }
+        if ((NEWFS_IS_DIR(inode) ? newfs_driver_write : newfs_driver_write_data)
+                (NEWFS_DATA_OFS(blkno) + bias, (uint8_t *)buf + done, len) != NEWFS_ERROR_NONE) {
+            blkno = -NEWFS_ERROR_IO;
+            break;
+        }
+        done += len;
+    }
+    if (offset + done > inode->size) {
+        inode->size = offset + done;
+        newfs_mark_inode_dirty(inode);
+    }
+    return done == 0 && size != 0 ? (int)blkno : done;
+}
+
+/**
+ * @brief 改变文件大小，缩小时释放多余的数据块并清零尾块剩余部分
+ *
+ * @param inode
+ * @param size
+ * @return int
+ */
+int newfs_truncate_data(struct newfs_inode * inode, uint64_t size) {
+    struct newfs_cache_blk* blk;
+    struct newfs_extent*    ext;
+    uint64_t nblks = NEWFS_ROUND_UP(size, NEWFS_BLK_SZ()) / NEWFS_BLK_SZ();
+    uint64_t keep, run, j;
+    int64_t  blkno;
+    int      i, bias;
+    if (nblks > NEWFS_MAX_FILE_BLKS) {
+        return -NEWFS_ERROR_FBIG;
+    }
+    if (inode->inline_data != NULL && size <= NEWFS_INLINE_MAX) {
+        if (size < inode->size) {                       /* 保持内联区超出size的部分为0 */
+            memset(inode->inline_data + size, 0, inode->size - size);
+        }
+        inode->size = size;
+        newfs_mark_inode_dirty(inode);
+        return NEWFS_ERROR_NONE;
+    }
+    if (inode->inline_data != NULL && newfs_inline_migrate(inode) != NEWFS_ERROR_NONE) {
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    if (size < inode->size) {
+        newfs_da_truncate(inode, size);
+        for (i = inode->ext_cnt - 1; i >= 0; i--) {
+            ext = &inode->extents[i];
+            if (ext->lblk + ext->len <= nblks) {
+                break;
+            }
+            keep = ext->lblk < nblks ? nblks - ext->lblk : 0;
+            newfs_cache_discard(NEWFS_DATA_BLKNO(ext->pblk + keep), ext->len - keep);   /* 先丢弃再释放 */
+            for (j = keep; j < ext->len; j++) {
+                newfs_free_data_blk(ext->pblk + j);
+            }
+            ext->len = keep;
+            if (keep == 0) {
+                inode->ext_cnt--;
+            }
+        }
+        bias  = size % NEWFS_BLK_SZ();
+        blkno = newfs_bmap_run(inode, size / NEWFS_BLK_SZ(), &run);
+        if (bias != 0 && blkno >= 0) {
+            NEWFS_CACHE_LOCK();
+            blk = newfs_cache_get(NEWFS_DATA_BLKNO(blkno), TRUE);
+            if (blk == NULL) {
+                NEWFS_CACHE_UNLOCK();
+                return -NEWFS_ERROR_IO;
+            }
+            memset(blk->data + bias, 0, NEWFS_BLK_SZ() - bias);
+            newfs_cache_mark_dirty(blk);
+            NEWFS_CACHE_UNLOCK();
+        }
+    }
+    inode->size = size;
+    newfs_mark_inode_dirty(inode);
+    return NEWFS_ERROR_NONE;
 }
 
 /**
@@ -336,6 +1069,28 @@ struct newfs_dentry* newfs_get_dentry(struct newfs_inode * inode, int dir) {
     return NULL;
 }
 
+/**
+ * @brief 取得dentry指向的inode，未载入时从磁盘读入；
+ * 共享模式下多个线程可能同时载入，由load_lock串行化，载入完成后才对其他线程可见
+ * 
+ * @param dentry 
+ * @return struct newfs_inode* 读入失败返回NULL，dentry->inode保持为NULL，下次访问时重试
+ */
+struct newfs_inode* newfs_dentry_inode(struct newfs_dentry* dentry) {
+    struct newfs_inode* inode = NEWFS_ATOMIC_GET(&dentry->inode);
+    if (inode != NULL) {
+        return inode;
+    }
+    pthread_mutex_lock(&newfs_ctx->load_lock);
+    inode = dentry->inode;
+    if (inode == NULL) {
+        inode = newfs_read_inode(dentry, dentry->ino);
+        NEWFS_ATOMIC_SET(&dentry->inode, inode);
+    }
+    pthread_mutex_unlock(&newfs_ctx->load_lock);
+    return inode;
+}
+
 /**
  * @brief 跟据path找到目录项
  * path: /qwe/ad  total_lvl = 2,
@@ -348,128 +1103,191 @@ struct newfs_dentry* newfs_get_dentry(struct newfs_inode * inode, int dir) {
  *      1) find /'s inode       lvl = 1
  *      2) find qwe's dentry
  *  
+ * 调用者持有命名空间锁（共享或独占），查找期间不会有inode被淘汰
+ * 
  * @param path 
- * @return struct newfs_inode* 
+ * @return struct newfs_dentry* 路径上的inode读入失败时返回NULL，调用者返回-NEWFS_ERROR_IO
  */
 struct newfs_dentry* newfs_lookup(const char * path, boolean* is_find, boolean* is_root) {
-    struct newfs_dentry* dentry_cursor = newfs_super.root_dentry;
+    struct newfs_dentry* dentry_cursor = newfs_ctx->root_dentry;
     struct newfs_dentry* dentry_ret = NULL;
+    struct newfs_dentry* dentry_child;
     struct newfs_inode*  inode; 
-    int   total_lvl = newfs_calc_lvl(path);
-    int   lvl = 0;
-    boolean is_hit;
-    char* fname = NULL;
-    char* path_cpy = (char*)malloc(sizeof(path));
+    const char* fname = path;
+    int         len;
+    uint32_t    hash;
     *is_root = FALSE;
-    strcpy(path_cpy, path);
+    *is_find = FALSE;
 
-    if (total_lvl == 0) {                           /* 根目录 */
+    while (*fname == '/') {
+        fname++;
+    }
+    if (*fname == '\0') {                          /* 根目录 */
         *is_find = TRUE;
         *is_root = TRUE;
-        dentry_ret = newfs_super.root_dentry;
+        dentry_ret = newfs_ctx->root_dentry;
     }
-    fname = strtok(path_cpy, "/");       
-    while (fname)
-    {   // 按目录层级深入
-        lvl++;
-        if (dentry_cursor->inode == NULL) {           /* Cache机制 */
-            newfs_read_inode(dentry_cursor, dentry_cursor->ino);
+    while (*fname != '\0')
+    {   // 按目录层级深入，就地切分路径分量，不复制路径
+        for (len = 0; fname[len] != '\0' && fname[len] != '/'; len++);
+        inode = newfs_dentry_inode(dentry_cursor);    /* Cache机制 */
+        if (inode == NULL) {
+            return NULL;
         }
-
-        inode = dentry_cursor->inode;
+        newfs_icache_touch(inode);
         // 到了某个层级发现不是文件夹而是文件，返回这个文件的dentry
-        if (NEWFS_IS_REG(inode) && lvl < total_lvl) {
+        if (NEWFS_IS_REG(inode)) {
             NEWFS_DBG("[%s] not a dir\n", __func__);
-            dentry_ret = inode->dentry;
+            dentry_ret = dentry_cursor;
             break;
         }
-        if (NEWFS_IS_DIR(inode)) {
-            // 是文件夹，进入
-            dentry_cursor = inode->dentrys;
-            is_hit        = FALSE;
-
-            while (dentry_cursor)
-            {   
-                // 遍历同级目录，找到名字匹配的文件夹
-                if (memcmp(dentry_cursor->fname, fname, strlen(fname)) == 0) {
-                    is_hit = TRUE;
-                    break;
-                }
-                dentry_cursor = dentry_cursor->brother;
-            }
-            // 没有找到匹配的文件（夹）名，返回上一级的dentry
-            if (!is_hit) {
-                *is_find = FALSE;
-                NEWFS_DBG("[%s] not found %s\n", __func__, fname);
-                dentry_ret = inode->dentry;
-                break;
-            }
-            // 找到了，层级数也是最终的，返回dentry游标
-            if (is_hit && lvl == total_lvl) {
-                *is_find = TRUE;
-                dentry_ret = dentry_cursor;
-                break;
+        // 是文件夹，先查目录项缓存，未命中再查目录哈希索引并记录结果
+        dentry_child = NULL;
+        if (len < NEWFS_MAX_FILE_NAME) {
+            hash = newfs_name_hash(fname, len);
+            if (!newfs_dcache_lookup(dentry_cursor, fname, len, hash, &dentry_child)) {
+                dentry_child = newfs_dir_find(inode, fname, len, hash);
+                newfs_dcache_add(dentry_cursor, fname, len, hash, dentry_child);
             }
         }
-        fname = strtok(NULL, "/"); 
+        // 没有找到匹配的文件（夹）名，返回上一级的dentry
+        if (dentry_child == NULL) {
+            NEWFS_DBG("[%s] not found %.*s\n", __func__, len, fname);
+            dentry_ret = dentry_cursor;
+            break;
+        }
+        dentry_cursor = dentry_child;
+        fname += len;
+        while (*fname == '/') {
+            fname++;
+        }
+        // 找到了，层级数也是最终的，返回dentry游标
+        if (*fname == '\0') {
+            *is_find = TRUE;
+            dentry_ret = dentry_cursor;
+        }
     }
 
-    if (dentry_ret->inode == NULL) {
-        dentry_ret->inode = newfs_read_inode(dentry_ret, dentry_ret->ino);
+    inode = newfs_dentry_inode(dentry_ret);
+    if (inode == NULL) {
+        return NULL;
     }
-    
+    newfs_icache_touch(inode);
     return dentry_ret;
 }
 
 
 /**
- * @brief 
+ * @brief 把内存中的超级块写入块缓存，随下一次日志提交落盘
  * 
  * @return int 
  */
-int newfs_umount() {
+static int newfs_write_super() {
     struct newfs_super_d  newfs_super_d; 
 
-    if (!newfs_super.is_mounted) {
-        return NEWFS_ERROR_NONE;
-    }
-
-    newfs_sync_inode(newfs_super.root_dentry->inode);     /* 从根节点向下刷写节点 */
-                                                    
+    memset(&newfs_super_d, 0, sizeof(struct newfs_super_d));
     newfs_super_d.magic_num         = NEWFS_MAGIC_NUM;
-    newfs_super_d.map_inode_blks    = newfs_super.map_inode_blks;
-    newfs_super_d.map_inode_offset  = newfs_super.map_inode_offset;
+    newfs_super_d.sz_blk            = newfs_ctx->sz_blk;
+    newfs_super_d.map_inode_blks    = newfs_ctx->map_inode_blks;
+    newfs_super_d.map_inode_offset  = newfs_ctx->map_inode_offset;
 
     // 数据位图
-    newfs_super_d.map_data_blks     = newfs_super.map_data_blks;
-    newfs_super_d.map_data_offset   = newfs_super.map_data_offset;
+    newfs_super_d.map_data_blks     = newfs_ctx->map_data_blks;
+    newfs_super_d.map_data_offset   = newfs_ctx->map_data_offset;
 
 
-    newfs_super_d.inode_offset      = newfs_super.inode_offset;
-    newfs_super_d.data_offset       = newfs_super.data_offset;
-    newfs_super_d.sz_usage          = newfs_super.sz_usage;
+    newfs_super_d.inode_offset      = newfs_ctx->inode_offset;
+    newfs_super_d.data_offset       = newfs_ctx->data_offset;
+    newfs_super_d.sz_usage          = newfs_ctx->sz_usage;
 
-    newfs_super_d.max_ino           = newfs_super.max_ino;
-    newfs_super_d.max_data          = newfs_super.max_data; 
+    newfs_super_d.max_ino           = newfs_ctx->max_ino;
+    newfs_super_d.max_data          = newfs_ctx->max_data; 
+    newfs_super_d.journal_offset    = NEWFS_BLKS_SZ(newfs_ctx->journal.sb_blkno);
+    newfs_super_d.journal_blks      = newfs_ctx->journal.nblks + 1;
 
-    if (newfs_driver_write(NEWFS_SUPER_OFS, (uint8_t *)&newfs_super_d, 
-                     sizeof(struct newfs_super_d)) != NEWFS_ERROR_NONE) {
+    return newfs_driver_write(NEWFS_SUPER_OFS, (uint8_t *)&newfs_super_d, sizeof(struct newfs_super_d));
+}
+
+/**
+ * @brief 
+ * 
+ * @return int 
+ */
+int newfs_umount() {
+    if (!newfs_ctx->is_mounted) {
+        return NEWFS_ERROR_NONE;
+    }
+    NEWFS_EVENT(NEWFS_LOG_INFO, NEWFS_EV_UMOUNT, 0, 0, 0);
+    newfs_trace_stop();
+    newfs_ra_stop();                                  /* 之后不再有并发的预读与回写 */
+    newfs_wb_stop();
+    if (newfs_reap_orphans() != NEWFS_ERROR_NONE) {   /* 句柄均已关闭，删除名字已删除的inode */
         return -NEWFS_ERROR_IO;
     }
-    // 写回inode位图
-    if (newfs_driver_write(newfs_super_d.map_inode_offset, (uint8_t *)(newfs_super.map_inode), 
-                         NEWFS_BLKS_SZ(newfs_super_d.map_inode_blks)) != NEWFS_ERROR_NONE) {
+
+    if (newfs_write_super() != NEWFS_ERROR_NONE) {
         return -NEWFS_ERROR_IO;
     }
-    // 写回data位图
-    if (newfs_driver_write(newfs_super_d.map_data_offset, (uint8_t *)(newfs_super.map_data), 
-                         NEWFS_BLKS_SZ(newfs_super_d.map_data_blks)) != NEWFS_ERROR_NONE) {
+    // 只提交脏inode与脏位图块，再检查点写回原位
+    if (newfs_sync() != NEWFS_ERROR_NONE || newfs_journal_checkpoint() != NEWFS_ERROR_NONE) {
         return -NEWFS_ERROR_IO;
     }
+    if (NEWFS_LOG_ON(NEWFS_LOG_INFO)) {
+        newfs_dump_all(stderr);
+    }
+    newfs_log_close();
+    newfs_cache_destroy();
+    newfs_dcache_destroy();
+    newfs_icache_destroy();
 
-    free(newfs_super.map_inode);
-    ddriver_close(NEWFS_DRIVER());
+    newfs_bitmap_destroy(&newfs_ctx->inode_bm);
+    newfs_bitmap_destroy(&newfs_ctx->data_bm);
+    free(newfs_ctx->map_inode);
+    free(newfs_ctx->map_data);
+    newfs_backend_close(NEWFS_DRIVER());
+    newfs_slab_destroy(&newfs_ctx->dentry_slab);
+    newfs_slab_destroy(&newfs_ctx->inode_slab);
+    pthread_mutex_destroy(&newfs_ctx->dirty_lock);
+    pthread_mutex_destroy(&newfs_ctx->load_lock);
+    pthread_rwlock_destroy(&newfs_ctx->ns_lock);
+    newfs_stats_destroy();
 
+    newfs_ctx->is_mounted = FALSE;
+    return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 检查超级块记录的布局：块大小合法，各区按布局顺序排列且不重叠，
+ * 数据区不超出设备；镜像被截断或超级块损坏时拒绝挂载，不让后续读写越界
+ * 
+ * @param super_d 
+ * @return int 不合法返回-NEWFS_ERROR_INVAL
+ */
+static int newfs_super_check(struct newfs_super_d* super_d) {
+    uint64_t sz_blk = super_d->sz_blk;
+    uint64_t disk_blks;
+    if (sz_blk < NEWFS_MIN_BLK_SZ || sz_blk > NEWFS_MAX_BLK_SZ ||
+        (sz_blk & (sz_blk - 1)) != 0 || sz_blk % NEWFS_IO_SZ() != 0) {
+        NEWFS_ERR("[%s] bad block size %lu\n", __func__, (unsigned long)sz_blk);
+        return -NEWFS_ERROR_INVAL;
+    }
+    disk_blks = NEWFS_DISK_SZ() / sz_blk;
+    /* 先限定各项不超过设备，之后的乘法与加法不会溢出 */
+    if (super_d->data_offset > NEWFS_DISK_SZ() || super_d->map_inode_blks > disk_blks ||
+        super_d->map_data_blks > disk_blks || super_d->journal_blks > disk_blks ||
+        super_d->max_data > disk_blks || super_d->max_ino > NEWFS_DISK_SZ() / NEWFS_INO_SZ() ||
+        super_d->max_ino == 0 || super_d->journal_blks < NEWFS_JOURNAL_LEAST_BLKS ||
+        super_d->max_ino > super_d->map_inode_blks * sz_blk * UINT8_BITS ||
+        super_d->map_inode_offset < NEWFS_SUPER_OFS + sz_blk ||
+        super_d->map_data_offset < super_d->map_inode_offset + super_d->map_inode_blks * sz_blk ||
+        super_d->inode_offset < super_d->map_data_offset + super_d->map_data_blks * sz_blk ||
+        super_d->journal_offset < super_d->inode_offset + super_d->max_ino * NEWFS_INO_SZ() ||
+        super_d->data_offset < super_d->journal_offset + super_d->journal_blks * sz_blk ||
+        super_d->data_offset + super_d->max_data * sz_blk > NEWFS_DISK_SZ()) {
+        NEWFS_ERR("[%s] layout does not fit the device (%lu bytes)\n", __func__,
+                  (unsigned long)NEWFS_DISK_SZ());
+        return -NEWFS_ERROR_INVAL;
+    }
     return NEWFS_ERROR_NONE;
 }
 
@@ -477,139 +1295,205 @@ int newfs_umount() {
  * @brief 挂载newfs, Layout 如下
  * 
  * Layout
- * | Super | Inode Map | Data |
+ * | Super | Inode Map | Data Map | Inodes | Journal | Data |
  * 
- * IO_SZ = BLK_SZ
- * 
- * 每个Inode占用一个Blk
+ * 布局由mkfs.newfs决定并记录在超级块中，挂载时只读取超级块；
+ * 指定--format或后端不持久（ram）时先按默认几何参数格式化
  * @param options 
  * @return int 
  */
 int newfs_mount(struct custom_options options){
     int                 ret = NEWFS_ERROR_NONE;
-    int                 driver_fd;
     struct newfs_super_d  newfs_super_d; 
+    struct newfs_geometry geo;
     struct newfs_dentry*  root_dentry;
     struct newfs_inode*   root_inode;
+    uint8_t*              buf;
+    int                   sz_super;
+    boolean               log_opened = FALSE;
 
-    int                 inode_num;
-    int                 map_inode_blks;
-    int                 map_data_blks;
-    int                 inode_blks;
-    
-    int                 super_blks;
-    boolean             is_init = FALSE;
-
-    newfs_super.is_mounted = FALSE;
-
-    // driver_fd = open(options.device, O_RDWR);
-    driver_fd = ddriver_open(options.device);
+    newfs_ctx->is_mounted = FALSE;
+    if (options.log_level > 0) {
+        newfs_log_level = options.log_level;
+    }
+    if (options.log != NULL) {                        /* 已由同进程的其他实例打开时共用 */
+        log_opened = newfs_log_open(options.log, newfs_log_level > NEWFS_LOG_INFO ? newfs_log_level : NEWFS_LOG_INFO)
+                     == NEWFS_ERROR_NONE;
+    }
+    pthread_rwlock_init(&newfs_ctx->ns_lock, NULL);
+    pthread_mutex_init(&newfs_ctx->load_lock, NULL);
+    pthread_mutex_init(&newfs_ctx->dirty_lock, NULL);
+    if (newfs_stats_init() != NEWFS_ERROR_NONE) {
+        ret = -NEWFS_ERROR_NOSPACE;
+        goto err_locks;
+    }
 
-    if (driver_fd < 0) {
-        return driver_fd;
+    ret = newfs_backend_open(NEWFS_DRIVER(), options.backend, options.device, options.disk_mb);
+    if (ret != NEWFS_ERROR_NONE) {
+        goto err_stats;
     }
 
-    newfs_super.driver_fd = driver_fd;
-    ddriver_ioctl(NEWFS_DRIVER(), IOC_REQ_DEVICE_SIZE,  &newfs_super.sz_disk);
-    ddriver_ioctl(NEWFS_DRIVER(), IOC_REQ_DEVICE_IO_SZ, &newfs_super.sz_io);
-    printf("!!!!io size:%d!!!!",newfs_super.sz_io);
-    // 块大小1k
-    newfs_super.sz_blk = 1024;
-    
-    root_dentry = new_dentry("/", NEWFS_DIR);
-    int a = sizeof(struct newfs_inode_d);
-    int a1 = sizeof(int);
-    // int a2 = sizeof(enum);
-    int b = sizeof(struct newfs_super_d);
-    int c = sizeof(struct newfs_dentry_d);
-    // 读取super块
-    if (newfs_driver_read(NEWFS_SUPER_OFS, (uint8_t *)(&newfs_super_d), sizeof(struct newfs_super_d)) != NEWFS_ERROR_NONE) {
-        return -NEWFS_ERROR_IO;
+    newfs_ctx->sz_disk = NEWFS_DRIVER()->sz_disk;
+    newfs_ctx->sz_io   = NEWFS_DRIVER()->sz_io;
+    if (options.format || NEWFS_DRIVER()->ops->transient) {
+        newfs_geometry_default(&geo);
+        ret = newfs_mkfs(&geo);
+        if (ret != NEWFS_ERROR_NONE) {
+            goto err_backend;
+        }
+    }
+    // 读取super块，块大小尚未确定，按IO单元读
+    sz_super = sizeof(struct newfs_super_d);
+    sz_super = NEWFS_ROUND_UP(sz_super, NEWFS_IO_SZ());
+    buf = (uint8_t*)malloc(sz_super);
+    if (buf == NULL) {
+        ret = -NEWFS_ERROR_NOSPACE;
+        goto err_backend;
+    }
+    if (newfs_backend_read(NEWFS_DRIVER(), buf, sz_super, NEWFS_SUPER_OFS) != NEWFS_ERROR_NONE) {
+        free(buf);
+        ret = -NEWFS_ERROR_IO;
+        goto err_backend;
     }   
+    memcpy(&newfs_super_d, buf, sizeof(struct newfs_super_d));
+    free(buf);
 
     // 幻数判断
     if (newfs_super_d.magic_num != NEWFS_MAGIC_NUM) {     
-       
-        // super_blks块数
-        // super_blks = NEWFS_ROUND_UP(sizeof(struct newfs_super_d), NEWFS_BLK_SZ()) / NEWFS_BLK_SZ();
-        super_blks = NEWFS_ROUND_UP(sizeof(struct newfs_super_d), NEWFS_BLK_SZ()) / NEWFS_BLK_SZ();
-
-        // inode_num  =  NEWFS_DISK_SZ() / NEWFS_BLK_SZ();
-        inode_num  =  512;
-        map_inode_blks = NEWFS_ROUND_UP(NEWFS_ROUND_UP(inode_num, UINT32_BITS), NEWFS_BLK_SZ()) / NEWFS_BLK_SZ();
-        
-        
-        // 新增数据位图
-        // map_data_blks = NEWFS_ROUND_UP(NEWFS_ROUND_UP(NEWFS_DATA_PER_FILE * inode_num, UINT32_BITS), NEWFS_BLK_SZ())  / NEWFS_BLK_SZ();
-        map_data_blks = 1;
-
-        // inode块数
-        inode_blks = NEWFS_ROUND_UP(sizeof(struct newfs_inode_d) * inode_num, NEWFS_BLK_SZ()) / NEWFS_BLK_SZ();
-        
-                                                      /* 布局layout */
-        // 最多支持的文件数
-        newfs_super_d.max_ino           = inode_num;
-        // 最多的数据块数 
-        newfs_super_d.max_data          = NEWFS_DISK_SZ()/NEWFS_BLK_SZ() - super_blks - map_data_blks - map_inode_blks - inode_blks; 
-        newfs_super_d.map_inode_offset  = NEWFS_SUPER_OFS + NEWFS_BLKS_SZ(super_blks);
-        newfs_super_d.map_data_offset   = newfs_super_d.map_inode_offset + NEWFS_BLKS_SZ(map_inode_blks);
-        
-        newfs_super_d.inode_offset      = newfs_super_d.map_data_offset + NEWFS_BLKS_SZ(map_data_blks);
-        newfs_super_d.data_offset       = newfs_super_d.inode_offset + NEWFS_BLKS_SZ(inode_blks);
-
-        newfs_super_d.map_inode_blks    = map_inode_blks;
-        newfs_super_d.map_data_blks     = map_data_blks;
-        newfs_super_d.sz_usage          = 0;
-
-        is_init = TRUE;
-    }
-    newfs_super.sz_usage            = newfs_super_d.sz_usage;   
-
-    newfs_super.map_inode           = (uint8_t *)malloc(NEWFS_BLKS_SZ(newfs_super_d.map_inode_blks));
-    newfs_super.map_inode_blks      = newfs_super_d.map_inode_blks;
-    newfs_super.map_inode_offset    = newfs_super_d.map_inode_offset;
-
-    newfs_super.map_data            = (uint8_t *)malloc(NEWFS_BLKS_SZ(newfs_super_d.map_data_blks));
-    newfs_super.map_data_blks       = newfs_super_d.map_data_blks;
-    newfs_super.map_data_offset     = newfs_super_d.map_data_offset;
-
-    newfs_super.inode_offset        = newfs_super_d.inode_offset;
-    newfs_super.data_offset         = newfs_super_d.data_offset;
+        NEWFS_ERR("[%s] no newfs found on %s, run mkfs.newfs first\n", __func__, options.device);
+        ret = -NEWFS_ERROR_INVAL;
+        goto err_backend;
+    }
+    if (newfs_super_check(&newfs_super_d) != NEWFS_ERROR_NONE) {
+        ret = -NEWFS_ERROR_INVAL;
+        goto err_backend;
+    }
+    newfs_ctx->sz_blk = newfs_super_d.sz_blk;        /* 之后的缓存、位图与映射都以块为单位 */
+    newfs_slab_init(&newfs_ctx->dentry_slab, "dentry", sizeof(struct newfs_dentry));
+    newfs_slab_init(&newfs_ctx->inode_slab, "inode", sizeof(struct newfs_inode));
+    root_dentry = new_dentry(NULL, "/", 1, NEWFS_DIR);
+    if (root_dentry == NULL) {
+        ret = -NEWFS_ERROR_NOSPACE;
+        goto err_slab;
+    }
+    newfs_ctx->root_dentry = root_dentry;            /* newfs_icache_destroy经它释放根inode */
+    ret = -NEWFS_ERROR_NOSPACE;
+    if (newfs_cache_init(options.cache_blks) != NEWFS_ERROR_NONE) {
+        goto err_slab;
+    }
+    if (newfs_dcache_init(options.dcache_ents) != NEWFS_ERROR_NONE) {
+        goto err_cache;
+    }
+    if (newfs_icache_init(options.cache_mb) != NEWFS_ERROR_NONE) {
+        goto err_dcache;
+    }
+    // 重放日志后位图、inode表等元数据才是最新的
+    if (newfs_journal_init(newfs_super_d.journal_offset, newfs_super_d.journal_blks, FALSE) != NEWFS_ERROR_NONE) {
+        ret = -NEWFS_ERROR_IO;
+        goto err_icache;
+    }
+    newfs_ctx->sz_usage            = newfs_super_d.sz_usage;   
+
+    newfs_ctx->map_inode           = (uint8_t *)malloc(NEWFS_BLKS_SZ(newfs_super_d.map_inode_blks));
+    newfs_ctx->map_inode_blks      = newfs_super_d.map_inode_blks;
+    newfs_ctx->map_inode_offset    = newfs_super_d.map_inode_offset;
+
+    newfs_ctx->map_data            = (uint8_t *)malloc(NEWFS_BLKS_SZ(newfs_super_d.map_data_blks));
+    newfs_ctx->map_data_blks       = newfs_super_d.map_data_blks;
+    newfs_ctx->map_data_offset     = newfs_super_d.map_data_offset;
+
+    newfs_ctx->inode_offset        = newfs_super_d.inode_offset;
+    newfs_ctx->data_offset         = newfs_super_d.data_offset;
     // 最多支持的文件数
-    newfs_super.max_ino             = newfs_super_d.max_ino  ;
+    newfs_ctx->max_ino             = newfs_super_d.max_ino  ;
     // 最多的数据块数 
-    newfs_super.max_data            = newfs_super_d.max_data   ; 
+    newfs_ctx->max_data            = newfs_super_d.max_data   ; 
+    if (newfs_ctx->map_inode == NULL || newfs_ctx->map_data == NULL) {
+        goto err_maps;
+    }
     
-    // newfs_dump_map(0);
-    if (is_init) {
-        // 初始化位图
-        memset(newfs_super.map_inode, 0, NEWFS_BLKS_SZ(newfs_super_d.map_inode_blks));
-        memset(newfs_super.map_data, 0, NEWFS_BLKS_SZ(newfs_super_d.map_data_blks));
-    } else {
-        // 读入位图
-        if (newfs_driver_read(newfs_super_d.map_inode_offset, (uint8_t *)(newfs_super.map_inode), 
-        NEWFS_BLKS_SZ(newfs_super_d.map_inode_blks)) != NEWFS_ERROR_NONE){
-            return -NEWFS_ERROR_IO;
-        }
-        if (newfs_driver_read(newfs_super_d.map_data_offset, (uint8_t *)(newfs_super.map_data),
-                NEWFS_BLKS_SZ(newfs_super_d.map_data_blks)) != NEWFS_ERROR_NONE){
-            return -NEWFS_ERROR_IO;
-        }
+    // 读入位图
+    ret = -NEWFS_ERROR_IO;
+    if (newfs_driver_read(newfs_super_d.map_inode_offset, (uint8_t *)(newfs_ctx->map_inode), 
+    NEWFS_BLKS_SZ(newfs_super_d.map_inode_blks)) != NEWFS_ERROR_NONE){
+        goto err_maps;
     }
-
-     newfs_dump_map(0);
-    if (is_init) {                                    /* 分配根节点 */
-        root_inode = newfs_alloc_inode(root_dentry);
-        newfs_sync_inode(root_inode);
+    if (newfs_driver_read(newfs_super_d.map_data_offset, (uint8_t *)(newfs_ctx->map_data),
+            NEWFS_BLKS_SZ(newfs_super_d.map_data_blks)) != NEWFS_ERROR_NONE){
+        goto err_maps;
+    }
+    // 位图只有map_data_blks块，数据块数不能超过位图能表示的范围
+    if (newfs_ctx->max_data > NEWFS_BLKS_SZ(newfs_ctx->map_data_blks) * UINT8_BITS) {
+        newfs_ctx->max_data = NEWFS_BLKS_SZ(newfs_ctx->map_data_blks) * UINT8_BITS;
     }
+    ret = -NEWFS_ERROR_NOSPACE;
+    if (newfs_bitmap_init(&newfs_ctx->inode_bm, newfs_ctx->map_inode, newfs_ctx->max_ino) != NEWFS_ERROR_NONE) {
+        goto err_maps;
+    }
+    if (newfs_bitmap_init(&newfs_ctx->data_bm, newfs_ctx->map_data, newfs_ctx->max_data) != NEWFS_ERROR_NONE) {
+        goto err_inode_bm;
+    }
+
+    newfs_ctx->dirty_inodes = NULL;
+    newfs_ctx->dirty_cnt    = 0;
+    newfs_ctx->orphans      = NULL;
 
-    // newfs_dump_map(0);
     root_inode              = newfs_read_inode(root_dentry, NEWFS_ROOT_INO);
+    if (root_inode == NULL) {
+        ret = -NEWFS_ERROR_IO;
+        goto err_bitmaps;
+    }
     root_dentry->inode      = root_inode;
-    newfs_super.root_dentry = root_dentry;
-    newfs_super.is_mounted  = TRUE;
+    newfs_ctx->is_mounted  = TRUE;
+    ret = -NEWFS_ERROR_NOSPACE;
+    if (newfs_wb_start(options.dirty_expire, options.dirty_ratio) != NEWFS_ERROR_NONE) {
+        goto err_wb;
+    }
+    if (newfs_ra_start(options.ra_max) != NEWFS_ERROR_NONE) {
+        goto err_ra;
+    }
+    if (options.trace != NULL && newfs_trace_start(options.trace, options.trace_mb) != NEWFS_ERROR_NONE) {
+        ret = -NEWFS_ERROR_IO;
+        goto err_ra;
+    }
+    NEWFS_EVENT(NEWFS_LOG_INFO, NEWFS_EV_MOUNT, newfs_ctx->sz_blk, newfs_ctx->max_ino, newfs_ctx->max_data);
+    return NEWFS_ERROR_NONE;
 
-    // newfs_dump_map(0);
-    // newfs_dump_map(1);
+    /* 按初始化的逆序释放已经建立的部分 */
+err_ra:
+    newfs_ra_stop();
+err_wb:
+    newfs_wb_stop();                                  /* 尚无写入，不必回写 */
+    newfs_ctx->is_mounted = FALSE;
+err_bitmaps:
+    newfs_bitmap_destroy(&newfs_ctx->data_bm);
+err_inode_bm:
+    newfs_bitmap_destroy(&newfs_ctx->inode_bm);
+err_maps:
+    free(newfs_ctx->map_inode);
+    free(newfs_ctx->map_data);
+    newfs_ctx->map_inode = NULL;
+    newfs_ctx->map_data  = NULL;
+err_icache:
+    newfs_icache_destroy();
+err_dcache:
+    newfs_dcache_destroy();
+err_cache:
+    newfs_cache_destroy();
+err_slab:
+    newfs_ctx->root_dentry = NULL;
+    newfs_slab_destroy(&newfs_ctx->dentry_slab);
+    newfs_slab_destroy(&newfs_ctx->inode_slab);
+err_backend:
+    newfs_backend_close(NEWFS_DRIVER());
+err_stats:
+    newfs_stats_destroy();
+err_locks:
+    pthread_mutex_destroy(&newfs_ctx->dirty_lock);
+    pthread_mutex_destroy(&newfs_ctx->load_lock);
+    pthread_rwlock_destroy(&newfs_ctx->ns_lock);
+    if (log_opened) {
+        newfs_log_close();
+    }
     return ret;
 }
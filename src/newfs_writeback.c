@@ -0,0 +1,161 @@
+#include "../include/newfs.h"
+#include <time.h>
+/******************************************************************************
+* SECTION: 后台回写
+*
+* 回写线程周期性检查：最早的脏数据驻留超过dirty_expire，或脏块与延迟分配的
+* 脏页占块缓存的比例超过dirty_ratio时，调用newfs_sync写回文件数据并把元数据提交到日志；
+* 提交后脏块仍然过多时再做检查点，把已提交的元数据写回原位。
+* 回写线程在wb.lock上等待，决定回写后释放wb.lock，
+* 持有命名空间写锁执行newfs_sync，与FUSE操作互斥。
+*******************************************************************************/
+static uint64_t newfs_now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static boolean newfs_wb_over_ratio() {
+    struct newfs_cache* cache = &newfs_ctx->cache;
+    uint64_t dirty = NEWFS_ATOMIC_GET(&cache->dirty_cnt) + NEWFS_ATOMIC_GET(&newfs_ctx->da.pages);
+    return dirty * 100 >= (uint64_t)newfs_ctx->wb.ratio * cache->capacity;
+}
+
+static void* newfs_wb_thread(void* arg) {
+    struct newfs_writeback* wb = &newfs_ctx_switch((struct newfs_super*)arg)->wb;
+    struct timespec         ts;
+    uint64_t                now;
+    uint64_t                since;
+    pthread_mutex_lock(&wb->lock);
+    while (!wb->stop) {
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_nsec += (long)NEWFS_WB_TICK_MS * 1000000;
+        ts.tv_sec  += ts.tv_nsec / 1000000000;
+        ts.tv_nsec %= 1000000000;
+        pthread_cond_timedwait(&wb->cond, &wb->lock, &ts);
+        since = NEWFS_ATOMIC_GET(&wb->dirty_since);
+        if (wb->stop || since == 0) {
+            continue;
+        }
+        now = newfs_now_ms();
+        if (now - since >= (uint64_t)wb->expire_ms) {
+            wb->stats.expire_runs++;
+            NEWFS_EVENT(NEWFS_LOG_INFO, NEWFS_EV_WB_RUN, 0, 0, 0);
+        }
+        else if (newfs_wb_over_ratio()) {
+            wb->stats.ratio_runs++;
+            NEWFS_EVENT(NEWFS_LOG_INFO, NEWFS_EV_WB_RUN, 0, 0, 1);
+        }
+        else {
+            continue;
+        }
+        pthread_mutex_unlock(&wb->lock);
+        NEWFS_WRLOCK();
+        if (newfs_sync() != NEWFS_ERROR_NONE ||
+            (newfs_wb_over_ratio() && newfs_journal_checkpoint() != NEWFS_ERROR_NONE)) {
+            NEWFS_ERR("[%s] writeback io error\n", __func__);
+        }
+        NEWFS_UNLOCK();
+        pthread_mutex_lock(&wb->lock);
+    }
+    pthread_mutex_unlock(&wb->lock);
+    return NULL;
+}
+
+/**
+ * @brief 启动回写线程，挂载完成后调用
+ *
+ * @param expire_ms 脏数据最长驻留时间，<=0时不启动回写线程
+ * @param ratio 脏块百分比阈值
+ * @return int
+ */
+int newfs_wb_start(int expire_ms, int ratio) {
+    struct newfs_writeback* wb = &newfs_ctx->wb;
+    memset(wb, 0, sizeof(struct newfs_writeback));
+    wb->expire_ms = expire_ms;
+    wb->ratio     = ratio > 0 && ratio <= 100 ? ratio : NEWFS_DEFAULT_DIRTY_RATIO;
+    if (newfs_ctx->cache.dirty_cnt > 0 || newfs_ctx->dirty_cnt > 0) {
+        wb->dirty_since = newfs_now_ms();             /* 格式化留下的脏数据 */
+    }
+    if (expire_ms <= 0) {
+        return NEWFS_ERROR_NONE;
+    }
+    pthread_mutex_init(&wb->lock, NULL);
+    pthread_cond_init(&wb->cond, NULL);
+    if (pthread_create(&wb->thread, NULL, newfs_wb_thread, newfs_ctx) != 0) {
+        pthread_cond_destroy(&wb->cond);
+        pthread_mutex_destroy(&wb->lock);
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    wb->running = TRUE;
+    return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 停止回写线程，卸载前调用，调用者不能持有命名空间锁
+ *
+ * @return void
+ */
+void newfs_wb_stop() {
+    struct newfs_writeback* wb = &newfs_ctx->wb;
+    if (!wb->running) {
+        return;
+    }
+    pthread_mutex_lock(&wb->lock);
+    wb->stop = TRUE;
+    pthread_cond_signal(&wb->cond);
+    pthread_mutex_unlock(&wb->lock);
+    pthread_join(wb->thread, NULL);
+    pthread_cond_destroy(&wb->cond);
+    pthread_mutex_destroy(&wb->lock);
+    wb->running = FALSE;
+}
+
+/**
+ * @brief 有数据变脏时调用，记录最早变脏的时刻，脏块过多时唤醒回写线程
+ *
+ * @return void
+ */
+void newfs_wb_note_dirty() {
+    struct newfs_writeback* wb    = &newfs_ctx->wb;
+    uint64_t                since = 0;
+    if (NEWFS_ATOMIC_GET(&wb->dirty_since) == 0) {
+        __atomic_compare_exchange_n(&wb->dirty_since, &since, newfs_now_ms(), FALSE,
+                                    __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+    }
+    if (wb->running && newfs_wb_over_ratio()) {
+        pthread_mutex_lock(&wb->lock);
+        pthread_cond_signal(&wb->cond);
+        pthread_mutex_unlock(&wb->lock);
+    }
+}
+
+/**
+ * @brief 全部脏数据已写回
+ *
+ * @return void
+ */
+void newfs_wb_clean() {
+    NEWFS_ATOMIC_SET(&newfs_ctx->wb.dirty_since, 0);
+}
+
+/**
+ * @brief 为延迟分配的脏页分配数据块，写回一个文件的数据块；调用者持有inode写锁。
+ * 要求落盘时调用者随后在命名空间写锁下用newfs_sync提交一次日志事务，
+ * 该文件的inode、extent块、所在目录的目录项与位图随同一事务持久化
+ *
+ * @param inode
+ * @return int
+ */
+int newfs_fsync_inode(struct newfs_inode* inode) {
+    int i;
+    int ret = newfs_da_flush(inode);
+    for (i = 0; i < inode->ext_cnt && !NEWFS_IS_DIR(inode); i++) {
+        ret |= newfs_cache_sync_range(NEWFS_DATA_BLKNO(inode->extents[i].pblk), inode->extents[i].len);
+    }
+    if (ret != NEWFS_ERROR_NONE) {
+        return -NEWFS_ERROR_IO;
+    }
+    NEWFS_ATOMIC_INC(&newfs_ctx->wb.stats.fsyncs);
+    return NEWFS_ERROR_NONE;
+}
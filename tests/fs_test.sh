@@ -139,6 +139,7 @@ function test_remount() {
 
 function test_main() {
     ddriver -r
+    ../build/mkfs.${PROJECT_NAME} --device="$HOME"/ddriver
     test_mount "[all-the-mount-test]"
     echo ""
     test_mkdir "[all-the-mkdir-test]"
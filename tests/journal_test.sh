@@ -0,0 +1,157 @@
+#!/bin/bash
+# 日志重放测试：挂载期间fsync后复制镜像，模拟掉电时的磁盘状态。
+# 完整复制的镜像重新挂载后，两次提交的目录树都应重放出来；
+# 把最后一个事务的提交块清零（提交块未写完），重放应停在前一个事务，
+# 该事务的目录树不出现，之前的目录树完好，且之后仍能正常读写、卸载、再挂载
+ORIGIN_WORK_DIR=$PWD
+
+WORK_DIR=$(cd `dirname $0`; pwd)
+cd $WORK_DIR
+
+MNTPOINT='./mnt'
+PROJECT_NAME="newfs"
+IMAGE="$WORK_DIR/journal.img"
+CRASH_IMAGE="$WORK_DIR/journal_crash.img"
+REF_DIR="$WORK_DIR/journal_ref"
+FILES=${FILES:-20}
+FAILS=0
+
+function pass() {
+    RES=$1
+    echo -e "\033[32mpass: ${RES}\033[0m"
+}
+
+function fail() {
+    RES=$1
+    FAILS=$(($FAILS+1))
+    echo -e "\033[31mfail: ${RES}\033[0m"
+}
+
+function do_mount() {
+    # 关闭后台回写、放大块缓存，保证已提交的元数据在复制镜像前只存在于日志中
+    ../build/${PROJECT_NAME} --backend=file --device="$1" --disk-mb=16 --dirty-expire=0 \
+        --cache-blks=4096 ${MNTPOINT}
+    if [ $? -ne 0 ]; then
+        fail "mount $1"
+        exit 1
+    fi
+}
+
+function do_umount() {
+    fusermount -u ${MNTPOINT}
+    if [ $? -ne 0 ]; then
+        fail "umount"
+        exit 1
+    fi
+}
+
+# 在目录$1下创建FILES个文件，并对其中一个fsync提交事务
+function make_tree() {
+    DIR=$1
+    mkdir -p ${MNTPOINT}/${DIR}/sub || return 1
+    for i in $(seq 1 $FILES); do
+        cp ${REF_DIR}/r$(( i % 8 )) ${MNTPOINT}/${DIR}/f${i} || return 1
+    done
+    cp ${REF_DIR}/r0 ${MNTPOINT}/${DIR}/sub/g || return 1
+    sync ${MNTPOINT}/${DIR}/f1 || return 1
+}
+
+function check_tree() {
+    TEST_CASE=$1
+    DIR=$2
+    BAD=0
+    CNT=$(ls ${MNTPOINT}/${DIR} 2> /dev/null | wc -l)
+    [ "$CNT" -ne $(( $FILES + 1 )) ] && BAD=$(($BAD+1))
+    for i in $(seq 1 $FILES); do
+        cmp -s ${REF_DIR}/r$(( i % 8 )) ${MNTPOINT}/${DIR}/f${i} || BAD=$(($BAD+1))
+    done
+    cmp -s ${REF_DIR}/r0 ${MNTPOINT}/${DIR}/sub/g || BAD=$(($BAD+1))
+    if [ $BAD -ne 0 ]; then
+        fail "$TEST_CASE $DIR: $BAD entries missing or wrong"
+    else
+        pass "$TEST_CASE $DIR matches"
+    fi
+}
+
+function check_absent() {
+    TEST_CASE=$1
+    DIR=$2
+    if stat ${MNTPOINT}/${DIR} > /dev/null 2>&1; then
+        fail "$TEST_CASE $DIR should not exist"
+    else
+        pass "$TEST_CASE $DIR does not exist"
+    fi
+}
+
+# 统计文件中某一项的数值，如 journal_stat "replayed txns"
+function journal_stat() {
+    sed -n "s/.* $1 \([0-9]*\).*/\1/p" ${MNTPOINT}/.newfs/stats | head -1
+}
+
+function test_main() {
+    rm -rf "$IMAGE" "$CRASH_IMAGE" ${REF_DIR}
+    mkdir -p ${MNTPOINT} ${REF_DIR}
+    for i in $(seq 0 7); do
+        head -c $(( i * 1531 + 1 )) /dev/urandom > ${REF_DIR}/r${i}
+    done
+
+    echo ">>>>>>>>>>>>>>>>>>>> TEST_JOURNAL_REPLAY"
+    ../build/mkfs.${PROJECT_NAME} --backend=file --device="$IMAGE" --disk-mb=16 || exit 1
+    do_mount "$IMAGE"
+    make_tree a || fail "make tree a"
+    make_tree b || fail "make tree b"
+    cp "$IMAGE" "$CRASH_IMAGE"
+    do_umount
+
+    # 复制的镜像里元数据只在日志中，挂载时靠重放恢复
+    do_mount "$CRASH_IMAGE"
+    REPLAYED=$(journal_stat "replayed txns")
+    if [ "$REPLAYED" -ge 2 ]; then
+        pass "[replay] $REPLAYED transactions replayed"
+    else
+        fail "[replay] $REPLAYED transactions replayed"
+    fi
+    check_tree "[replay]" a
+    check_tree "[replay]" b
+    do_umount
+    echo "<<<<<<<<<<<<<<<<<<<<"
+
+    echo ">>>>>>>>>>>>>>>>>>>> TEST_JOURNAL_TORN_COMMIT"
+    do_mount "$IMAGE"
+    make_tree c || fail "make tree c"
+    make_tree e || fail "make tree e"
+    # 最后一个事务的提交块是环形日志中head之前的一块
+    BLK_SZ=$(sed -n 's/.*block size \([0-9]*\) bytes.*/\1/p' ${MNTPOINT}/.newfs/stats | head -1)
+    JBLKS=$(sed -n 's/^journal: \([0-9]*\) blks.*/\1/p' ${MNTPOINT}/.newfs/stats)
+    JSTART=$(journal_stat "from blk")
+    HEAD=$(journal_stat "head")
+    cp "$IMAGE" "$CRASH_IMAGE"
+    do_umount
+    dd if=/dev/zero of="$CRASH_IMAGE" bs=$BLK_SZ count=1 conv=notrunc \
+        seek=$(( $JSTART + ($HEAD + $JBLKS - 1) % $JBLKS )) 2> /dev/null || fail "tear commit block"
+
+    do_mount "$CRASH_IMAGE"
+    check_tree "[torn commit]" a
+    check_tree "[torn commit]" b
+    check_tree "[torn commit]" c
+    check_absent "[torn commit]" e
+    make_tree d || fail "make tree d"
+    do_umount
+    do_mount "$CRASH_IMAGE"
+    check_tree "[torn commit remount]" c
+    check_tree "[torn commit remount]" d
+    check_absent "[torn commit remount]" e
+    do_umount
+    echo "<<<<<<<<<<<<<<<<<<<<"
+
+    rm -rf "$IMAGE" "$CRASH_IMAGE" ${REF_DIR}
+    if [ $FAILS -eq 0 ]; then
+        pass "journal test passed"
+    else
+        fail "journal test: $FAILS failures"
+    fi
+}
+
+test_main
+cd $ORIGIN_WORK_DIR
+[ $FAILS -eq 0 ]
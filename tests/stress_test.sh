@@ -0,0 +1,214 @@
+#!/bin/bash
+# 多线程挂载下的并发压力测试：多个进程同时创建、查找、写入、读取，
+# 结束后检查文件数量、大小、内容，并在重新挂载后再检查一次；
+# 随后并发删除、重命名，检查删除结果并在重新挂载后再检查一次
+ORIGIN_WORK_DIR=$PWD
+
+WORK_DIR=$(cd `dirname $0`; pwd)
+cd $WORK_DIR
+
+MNTPOINT='./mnt'
+PROJECT_NAME="newfs"
+IMAGE="$WORK_DIR/stress.img"
+REF_DIR="$WORK_DIR/stress_ref"
+WORKERS=${WORKERS:-8}
+FILES=${FILES:-25}                   # 共 2*WORKERS*FILES 个文件，需在inode数以内
+READERS=${READERS:-4}
+FAILS=0
+
+function pass() {
+    RES=$1
+    echo -e "\033[32mpass: ${RES}\033[0m"
+}
+
+function fail() {
+    RES=$1
+    FAILS=$(($FAILS+1))
+    echo -e "\033[31mfail: ${RES}\033[0m"
+}
+
+function do_mount() {
+    # 不加-s，使用FUSE默认的多线程循环
+    ../build/${PROJECT_NAME} --backend=file --device="$IMAGE" --disk-mb=16 ${MNTPOINT}
+    if [ $? -ne 0 ]; then
+        fail "mount"
+        exit 1
+    fi
+}
+
+function do_umount() {
+    fusermount -u ${MNTPOINT}
+    if [ $? -ne 0 ]; then
+        fail "umount"
+        exit 1
+    fi
+}
+
+# 每个worker在共享目录和自己的目录里创建文件并写入参考内容
+function worker() {
+    ID=$1
+    mkdir ${MNTPOINT}/w${ID} || return 1
+    for i in $(seq 1 $FILES); do
+        cp ${REF_DIR}/r$(( (ID + i) % 8 )) ${MNTPOINT}/shared/f${ID}_${i} || return 1
+        cp ${REF_DIR}/r$(( i % 8 )) ${MNTPOINT}/w${ID}/f${i} || return 1
+        stat ${MNTPOINT}/shared/f${ID}_${i} > /dev/null || return 1
+        ls ${MNTPOINT}/shared > /dev/null || return 1
+    done
+}
+
+# reader在worker写入期间反复查找、读取已有文件
+function reader() {
+    for round in $(seq 1 20); do
+        for i in $(seq 0 7); do
+            cmp -s ${REF_DIR}/r${i} ${MNTPOINT}/base/b${i} || return 1
+        done
+        stat ${MNTPOINT}/base/missing > /dev/null 2>&1 && return 1
+    done
+    return 0
+}
+
+# 删除奇数号共享文件，把偶数号共享文件移入自己的目录；不存在的文件、非空目录不能删除成功
+function remover() {
+    ID=$1
+    for i in $(seq 1 $FILES); do
+        if [ $(( i % 2 )) -eq 1 ]; then
+            rm ${MNTPOINT}/shared/f${ID}_${i} || return 1
+            stat ${MNTPOINT}/shared/f${ID}_${i} > /dev/null 2>&1 && return 1
+        else
+            mv ${MNTPOINT}/shared/f${ID}_${i} ${MNTPOINT}/w${ID}/g${i} || return 1
+        fi
+        ls ${MNTPOINT}/shared > /dev/null || return 1
+    done
+    rm ${MNTPOINT}/shared/f${ID}_1 2> /dev/null && return 1
+    rmdir ${MNTPOINT}/w${ID} 2> /dev/null && return 1
+    return 0
+}
+
+function check_removed() {
+    TEST_CASE=$1
+    CNT=$(ls ${MNTPOINT}/shared | wc -l)
+    if [ "$CNT" -ne 0 ]; then
+        fail "$TEST_CASE shared has $CNT entries left"
+    else
+        pass "$TEST_CASE shared is empty"
+    fi
+    BAD=0
+    for ID in $(seq 1 $WORKERS); do
+        CNT=$(ls ${MNTPOINT}/w${ID} | wc -l)
+        [ "$CNT" -ne $(( $FILES + $FILES / 2 )) ] && BAD=$(($BAD+1))
+        for i in $(seq 2 2 $FILES); do
+            cmp -s ${REF_DIR}/r$(( (ID + i) % 8 )) ${MNTPOINT}/w${ID}/g${i} || BAD=$(($BAD+1))
+        done
+    done
+    if [ $BAD -ne 0 ]; then
+        fail "$TEST_CASE $BAD renamed files missing or wrong"
+    else
+        pass "$TEST_CASE renamed files match"
+    fi
+}
+
+function check_tree() {
+    TEST_CASE=$1
+    CNT=$(ls ${MNTPOINT}/shared | wc -l)
+    if [ "$CNT" -ne $(($WORKERS * $FILES)) ]; then
+        fail "$TEST_CASE shared has $CNT entries"
+    else
+        pass "$TEST_CASE shared has $CNT entries"
+    fi
+    BAD=0
+    for ID in $(seq 1 $WORKERS); do
+        CNT=$(ls ${MNTPOINT}/w${ID} | wc -l)
+        [ "$CNT" -ne $FILES ] && BAD=$(($BAD+1))
+        for i in $(seq 1 $FILES); do
+            cmp -s ${REF_DIR}/r$(( (ID + i) % 8 )) ${MNTPOINT}/shared/f${ID}_${i} || BAD=$(($BAD+1))
+            cmp -s ${REF_DIR}/r$(( i % 8 )) ${MNTPOINT}/w${ID}/f${i} || BAD=$(($BAD+1))
+        done
+    done
+    if [ $BAD -ne 0 ]; then
+        fail "$TEST_CASE $BAD files with wrong size or content"
+    else
+        pass "$TEST_CASE all file sizes and contents match"
+    fi
+}
+
+function test_main() {
+    rm -rf "$IMAGE" ${REF_DIR}
+    mkdir -p ${MNTPOINT} ${REF_DIR}
+    for i in $(seq 0 7); do
+        head -c $(( i * 1531 + 1 )) /dev/urandom > ${REF_DIR}/r${i}
+    done
+
+    echo ">>>>>>>>>>>>>>>>>>>> TEST_STRESS"
+    ../build/mkfs.${PROJECT_NAME} --backend=file --device="$IMAGE" --disk-mb=16 || exit 1
+    do_mount
+    mkdir ${MNTPOINT}/shared ${MNTPOINT}/base
+    for i in $(seq 0 7); do
+        cp ${REF_DIR}/r${i} ${MNTPOINT}/base/b${i}
+    done
+
+    PIDS=""
+    for ID in $(seq 1 $WORKERS); do
+        worker $ID &
+        PIDS="$PIDS $!"
+    done
+    for ID in $(seq 1 $READERS); do
+        reader &
+        PIDS="$PIDS $!"
+    done
+    for PID in $PIDS; do
+        wait $PID || fail "worker $PID"
+    done
+    check_tree "[concurrent]"
+    echo "<<<<<<<<<<<<<<<<<<<<"
+
+    echo ">>>>>>>>>>>>>>>>>>>> TEST_STRESS_REMOUNT"
+    do_umount
+    do_mount
+    check_tree "[remount]"
+    echo "<<<<<<<<<<<<<<<<<<<<"
+
+    echo ">>>>>>>>>>>>>>>>>>>> TEST_STRESS_REMOVE"
+    PIDS=""
+    for ID in $(seq 1 $WORKERS); do
+        remover $ID &
+        PIDS="$PIDS $!"
+    done
+    for PID in $PIDS; do
+        wait $PID || fail "remover $PID"
+    done
+    check_removed "[remove]"
+    do_umount
+    do_mount
+    check_removed "[remove remount]"
+
+    PIDS=""
+    for ID in $(seq 1 $WORKERS); do
+        rm -r ${MNTPOINT}/w${ID} &
+        PIDS="$PIDS $!"
+    done
+    for PID in $PIDS; do
+        wait $PID || fail "rm -r $PID"
+    done
+    rmdir ${MNTPOINT}/shared || fail "rmdir shared"
+    do_umount
+    do_mount
+    CNT=$(ls ${MNTPOINT} | wc -l)
+    if [ "$CNT" -ne 1 ]; then
+        fail "[rm -r remount] root has $CNT entries"
+    else
+        pass "[rm -r remount] only base is left"
+    fi
+    do_umount
+    echo "<<<<<<<<<<<<<<<<<<<<"
+
+    rm -rf "$IMAGE" ${REF_DIR}
+    if [ $FAILS -eq 0 ]; then
+        pass "stress test passed"
+    else
+        fail "stress test: $FAILS failures"
+    fi
+}
+
+test_main
+cd $ORIGIN_WORK_DIR
+[ $FAILS -eq 0 ]
@@ -0,0 +1,83 @@
+#include "../include/newfs.h"
+#include <getopt.h>
+/******************************************************************************
+* SECTION: 全局变量
+*******************************************************************************/
+struct custom_options newfs_options;			 /* 全局选项 */
+
+static const struct option long_options[] = {
+	{"block-size",      required_argument, NULL, 'b'},
+	{"inodes",          required_argument, NULL, 'N'},
+	{"bytes-per-inode", required_argument, NULL, 'i'},
+	{"journal-blks",    required_argument, NULL, 'J'},
+	{"backend",         required_argument, NULL, 'B'},
+	{"device",          required_argument, NULL, 'd'},
+	{"disk-mb",         required_argument, NULL, 'm'},
+	{"help",            no_argument,       NULL, 'h'},
+	{NULL, 0, NULL, 0}
+};
+
+static void usage(const char* prog) {
+	fprintf(stderr,
+			"usage: %s [options] --device=<path>\n"
+			"  -b, --block-size=<bytes>       块大小，%d~%d的2的幂，默认%d，小于%lluMB的设备为%d\n"
+			"  -N, --inodes=<n>               inode数\n"
+			"  -i, --bytes-per-inode=<bytes>  未指定-N时每多少字节设备空间一个inode，默认%d\n"
+			"  -J, --journal-blks=<n>         日志区块数（含日志超级块），默认%dKB且不少于%d块\n"
+			"      --backend=<name>           ddriver/file/mmap/ram，默认%s\n"
+			"      --device=<path>            设备或镜像路径\n"
+			"      --disk-mb=<n>              新建镜像的大小（MB），默认%d\n",
+			prog, NEWFS_MIN_BLK_SZ, NEWFS_MAX_BLK_SZ, NEWFS_DEFAULT_BLK_SZ,
+			NEWFS_SMALL_DISK_SZ >> 20, NEWFS_SMALL_BLK_SZ, NEWFS_DEFAULT_INODE_RATIO,
+			NEWFS_JOURNAL_SZ >> 10, NEWFS_JOURNAL_MIN_BLKS, newfs_backend_default(),
+			NEWFS_DEFAULT_DISK_MB);
+}
+/******************************************************************************
+* SECTION: mkfs入口
+*******************************************************************************/
+int main(int argc, char **argv)
+{
+	struct newfs_geometry geo;
+	int opt, ret;
+
+	newfs_geometry_default(&geo);
+	newfs_options.device  = NULL;
+	newfs_options.backend = NULL;
+	newfs_options.disk_mb = NEWFS_DEFAULT_DISK_MB;
+	while ((opt = getopt_long(argc, argv, "b:N:i:J:h", long_options, NULL)) != -1) {
+		switch (opt) {
+		case 'b': geo.sz_blk       = atoi(optarg); break;
+		case 'N': geo.inodes       = atoi(optarg); break;
+		case 'i': geo.inode_ratio  = atoi(optarg); break;
+		case 'J': geo.journal_blks = atoi(optarg); break;
+		case 'B': newfs_options.backend = optarg;  break;
+		case 'd': newfs_options.device  = optarg;  break;
+		case 'm': newfs_options.disk_mb = atoi(optarg); break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+	if (optind < argc && newfs_options.device == NULL) {
+		newfs_options.device = argv[optind];
+	}
+	if (newfs_options.device == NULL) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	ret = newfs_backend_open(NEWFS_DRIVER(), newfs_options.backend, newfs_options.device,
+							 newfs_options.disk_mb);
+	if (ret != NEWFS_ERROR_NONE) {
+		fprintf(stderr, "%s: cannot open %s\n", argv[0], newfs_options.device);
+		return 1;
+	}
+	ret = newfs_mkfs(&geo);
+	newfs_backend_close(NEWFS_DRIVER());
+	if (ret != NEWFS_ERROR_NONE) {
+		fprintf(stderr, "%s: format failed (%d), check the geometry against the device size\n",
+				argv[0], ret);
+		return 1;
+	}
+	return 0;
+}
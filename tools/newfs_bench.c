@@ -0,0 +1,452 @@
+#include "../include/newfs.h"
+#include <getopt.h>
+#include <time.h>
+/******************************************************************************
+* SECTION: 进程内基准测试
+*
+* 不经过FUSE与内核，直接调用newfs的各个入口，在镜像文件或RAM盘上运行各场景。
+* 每个场景输出一行JSON：操作数、总耗时、ops/s、单次操作延迟的p50/p99，
+* 以及平均每次操作的设备读写次数。写场景结束时fsync所写的文件或目录，计入耗时与设备操作数，
+* 使延迟写回的开销不被漏算。文件系统自身的调试输出重定向到/dev/null。
+*******************************************************************************/
+struct bench_opts {
+	int          files;                                     /* create/readdir的文件数 */
+	int          depth;                                     /* lookup的目录深度 */
+	int          lookups;
+	int          listings;
+	int          churn_files;
+	int          churn_ops;
+	int          io_mb;                                     /* 顺序读写的文件大小 */
+	int          io_sz;                                     /* 顺序读写每次的字节数 */
+	int          rand_ops;
+	int          mounts;
+	unsigned int seed;
+	const char*  only;                                      /* 只运行该场景 */
+	boolean      verbose;
+};
+
+struct bench_run {
+	const char*  name;
+	uint64_t*    lat;                                       /* 每次操作的延迟（ns） */
+	int          ops;
+	int          cap;
+	uint64_t     start;
+	uint64_t     reads;                                     /* 设备计数的起点 */
+	uint64_t     writes;
+	uint64_t     dev_reads;                                 /* 已累计的设备读写次数 */
+	uint64_t     dev_writes;
+};
+
+struct custom_options     newfs_options;               /* 挂载选项 */
+static FILE*              bench_out;
+static struct bench_opts  bench;
+static uint64_t           bench_rng;
+
+static uint64_t bench_now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint64_t bench_rand() {                             /* xorshift64，按--seed可复现 */
+	bench_rng ^= bench_rng << 13;
+	bench_rng ^= bench_rng >> 7;
+	bench_rng ^= bench_rng << 17;
+	return bench_rng;
+}
+
+static int bench_cmp(const void* a, const void* b) {
+	uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+	return x < y ? -1 : x > y;
+}
+
+static void bench_fail(const char* what, const char* path, int ret) {
+	fprintf(stderr, "newfs_bench: %s %s failed (%d)\n", what, path, ret);
+	exit(1);
+}
+
+/**
+ * @brief 开始一个场景，记录设备计数的起点
+ *
+ * @param run
+ * @param name
+ * @param cap 最多记录的操作数
+ * @return boolean 该场景是否需要运行
+ */
+static boolean bench_begin(struct bench_run* run, const char* name, int cap) {
+	if (bench.only != NULL && strcmp(bench.only, name) != 0) {
+		return FALSE;
+	}
+	memset(run, 0, sizeof(struct bench_run));
+	run->name   = name;
+	run->cap    = cap;
+	run->lat    = (uint64_t*)malloc(sizeof(uint64_t) * (cap > 0 ? cap : 1));
+	run->reads  = NEWFS_ATOMIC_GET(&NEWFS_DRIVER()->stats.reads);
+	run->writes = NEWFS_ATOMIC_GET(&NEWFS_DRIVER()->stats.writes);
+	run->start  = bench_now();
+	return TRUE;
+}
+
+/* 累计到目前为止的设备读写，重新挂载会清零后端计数，卸载后需先调用 */
+static void bench_dev_take(struct bench_run* run) {
+	run->dev_reads  += NEWFS_ATOMIC_GET(&NEWFS_DRIVER()->stats.reads) - run->reads;
+	run->dev_writes += NEWFS_ATOMIC_GET(&NEWFS_DRIVER()->stats.writes) - run->writes;
+	run->reads       = NEWFS_ATOMIC_GET(&NEWFS_DRIVER()->stats.reads);
+	run->writes      = NEWFS_ATOMIC_GET(&NEWFS_DRIVER()->stats.writes);
+}
+
+static inline void bench_record(struct bench_run* run, uint64_t t0) {
+	if (run->ops < run->cap) {
+		run->lat[run->ops++] = bench_now() - t0;
+	}
+}
+
+/**
+ * @brief 结束场景：fsync后输出一行JSON
+ *
+ * @param run
+ * @param sync 结束前要fsync的路径，NULL则不同步
+ * @return void
+ */
+static void bench_end(struct bench_run* run, const char* sync) {
+	uint64_t elapsed, reads, writes, p50 = 0, p99 = 0;
+	if (sync != NULL && newfs_fsync(sync, 0, NULL) != NEWFS_ERROR_NONE) {
+		bench_fail("fsync", sync, -NEWFS_ERROR_IO);
+	}
+	elapsed = bench_now() - run->start;
+	bench_dev_take(run);
+	reads   = run->dev_reads;
+	writes  = run->dev_writes;
+	if (run->ops > 0) {
+		qsort(run->lat, run->ops, sizeof(uint64_t), bench_cmp);
+		p50 = run->lat[(run->ops - 1) * 50 / 100];
+		p99 = run->lat[(run->ops - 1) * 99 / 100];
+	}
+	fprintf(bench_out, "{\"scenario\": \"%s\", \"ops\": %d, \"secs\": %.6f, \"ops_per_sec\": %.1f, "
+			"\"p50_us\": %.2f, \"p99_us\": %.2f, \"dev_reads_per_op\": %.3f, \"dev_writes_per_op\": %.3f}\n",
+			run->name, run->ops, elapsed / 1e9, elapsed == 0 ? 0.0 : run->ops / (elapsed / 1e9),
+			p50 / 1e3, p99 / 1e3, run->ops == 0 ? 0.0 : (double)reads / run->ops,
+			run->ops == 0 ? 0.0 : (double)writes / run->ops);
+	fflush(bench_out);
+	free(run->lat);
+}
+/******************************************************************************
+* SECTION: 场景
+*******************************************************************************/
+/* 在同一目录下连续创建文件 */
+static void bench_create() {
+	struct bench_run run;
+	char     path[64];
+	uint64_t t0;
+	int      i, ret;
+	if (!bench_begin(&run, "create", bench.files)) {
+		return;
+	}
+	if ((ret = newfs_mkdir("/c", 0755)) != 0) {
+		bench_fail("mkdir", "/c", ret);
+	}
+	for (i = 0; i < bench.files; i++) {
+		sprintf(path, "/c/file%07d", i);
+		t0 = bench_now();
+		if ((ret = newfs_mknod(path, S_IFREG | 0644, 0)) != 0) {
+			bench_fail("mknod", path, ret);
+		}
+		bench_record(&run, t0);
+	}
+	bench_end(&run, "/c");
+}
+
+/* 建一条depth层的目录链，反复getattr最深处的路径 */
+static void bench_lookup() {
+	struct bench_run run;
+	struct stat st;
+	char     path[NEWFS_MAX_FILE_NAME * 64];
+	uint64_t t0;
+	int      i, len = 0, ret;
+	if (!bench_begin(&run, "lookup", bench.lookups)) {
+		return;
+	}
+	for (i = 0; i < bench.depth; i++) {
+		len += sprintf(path + len, "/level%02d", i);
+		if ((ret = newfs_mkdir(path, 0755)) != 0) {
+			bench_fail("mkdir", path, ret);
+		}
+	}
+	for (i = 0; i < bench.lookups; i++) {
+		t0 = bench_now();
+		if ((ret = newfs_getattr(path, &st)) != 0) {
+			bench_fail("getattr", path, ret);
+		}
+		bench_record(&run, t0);
+	}
+	bench_end(&run, NULL);
+}
+
+static int bench_filler(void* buf, const char* name, const struct stat* st, off_t off) {
+	(*(int*)buf)++;
+	return 0;
+}
+
+/* 完整列出create场景建立的目录，一次列出为一次操作 */
+static void bench_readdir() {
+	struct bench_run run;
+	struct fuse_file_info fi;
+	uint64_t t0;
+	int      i, cnt, ret;
+	if (!bench_begin(&run, "readdir", bench.listings)) {
+		return;
+	}
+	for (i = 0; i < bench.listings; i++) {
+		memset(&fi, 0, sizeof(struct fuse_file_info));
+		cnt = 0;
+		t0  = bench_now();
+		if ((ret = newfs_opendir("/c", &fi)) != 0 ||
+			(ret = newfs_readdir("/c", &cnt, bench_filler, 0, &fi)) != 0) {
+			bench_fail("readdir", "/c (run create first)", ret);
+		}
+		newfs_releasedir("/c", &fi);
+		bench_record(&run, t0);
+	}
+	bench_end(&run, NULL);
+}
+
+/* 在一组小文件上反复截断、重写、读回 */
+static void bench_churn() {
+	struct bench_run run;
+	static char buf[4096], rbuf[4096];
+	char     path[64];
+	uint64_t t0;
+	int      i, sz, ret;
+	if (!bench_begin(&run, "churn", bench.churn_ops)) {
+		return;
+	}
+	if ((ret = newfs_mkdir("/s", 0755)) != 0) {
+		bench_fail("mkdir", "/s", ret);
+	}
+	for (i = 0; i < bench.churn_files; i++) {
+		sprintf(path, "/s/small%05d", i);
+		if ((ret = newfs_mknod(path, S_IFREG | 0644, 0)) != 0) {
+			bench_fail("mknod", path, ret);
+		}
+	}
+	for (i = 0; i < (int)sizeof(buf); i++) {
+		buf[i] = (char)bench_rand();
+	}
+	for (i = 0; i < bench.churn_ops; i++) {
+		sprintf(path, "/s/small%05d", (int)(bench_rand() % bench.churn_files));
+		sz = 1 + bench_rand() % sizeof(buf);
+		t0 = bench_now();
+		if ((ret = newfs_truncate(path, 0)) != 0 ||
+			(ret = newfs_write(path, buf, sz, 0, NULL)) != sz ||
+			(ret = newfs_read(path, rbuf, sizeof(rbuf), 0, NULL)) != sz) {
+			bench_fail("churn", path, ret);
+		}
+		bench_record(&run, t0);
+	}
+	bench_end(&run, "/s");
+}
+
+/* 顺序写与顺序读；读经过open，启用顺序预读 */
+static void bench_seq() {
+	struct bench_run run;
+	struct fuse_file_info fi;
+	char*    buf = (char*)malloc(bench.io_sz);
+	uint64_t t0, off, size = (uint64_t)bench.io_mb << 20;
+	int      n   = size / bench.io_sz, i, ret;
+	for (i = 0; i < bench.io_sz; i++) {
+		buf[i] = (char)bench_rand();
+	}
+	if (bench_begin(&run, "seqwrite", n)) {
+		if ((ret = newfs_mknod("/seq", S_IFREG | 0644, 0)) != 0) {
+			bench_fail("mknod", "/seq", ret);
+		}
+		for (off = 0; off + bench.io_sz <= size; off += bench.io_sz) {
+			t0 = bench_now();
+			if ((ret = newfs_write("/seq", buf, bench.io_sz, off, NULL)) != bench.io_sz) {
+				bench_fail("write", "/seq", ret);
+			}
+			bench_record(&run, t0);
+		}
+		bench_end(&run, "/seq");
+	}
+	if (bench_begin(&run, "seqread", n)) {
+		memset(&fi, 0, sizeof(struct fuse_file_info));
+		if ((ret = newfs_open("/seq", &fi)) != 0) {
+			bench_fail("open", "/seq (run seqwrite first)", ret);
+		}
+		for (off = 0; off + bench.io_sz <= size; off += bench.io_sz) {
+			t0 = bench_now();
+			if ((ret = newfs_read("/seq", buf, bench.io_sz, off, &fi)) != bench.io_sz) {
+				bench_fail("read", "/seq", ret);
+			}
+			bench_record(&run, t0);
+		}
+		newfs_release("/seq", &fi);
+		bench_end(&run, NULL);
+	}
+	free(buf);
+}
+
+/* 在/seq中按4KB对齐的随机位置读写4KB */
+static void bench_rand_io() {
+	struct bench_run run;
+	static char buf[4096];
+	uint64_t t0, off, slots = ((uint64_t)bench.io_mb << 20) / sizeof(buf);
+	int      i, ret;
+	if (bench_begin(&run, "randwrite", bench.rand_ops)) {
+		for (i = 0; i < bench.rand_ops; i++) {
+			off = bench_rand() % slots * sizeof(buf);
+			t0  = bench_now();
+			if ((ret = newfs_write("/seq", buf, sizeof(buf), off, NULL)) != sizeof(buf)) {
+				bench_fail("write", "/seq (run seqwrite first)", ret);
+			}
+			bench_record(&run, t0);
+		}
+		bench_end(&run, "/seq");
+	}
+	if (bench_begin(&run, "randread", bench.rand_ops)) {
+		for (i = 0; i < bench.rand_ops; i++) {
+			off = bench_rand() % slots * sizeof(buf);
+			t0  = bench_now();
+			if ((ret = newfs_read("/seq", buf, sizeof(buf), off, NULL)) != sizeof(buf)) {
+				bench_fail("read", "/seq (run seqwrite first)", ret);
+			}
+			bench_record(&run, t0);
+		}
+		bench_end(&run, NULL);
+	}
+}
+
+/* 卸载再挂载，一次卸载加挂载为一次操作；RAM盘每次挂载都会重新格式化 */
+static void bench_mount() {
+	struct bench_run run;
+	uint64_t t0;
+	int      i, ret;
+	if (!bench_begin(&run, "remount", bench.mounts)) {
+		return;
+	}
+	for (i = 0; i < bench.mounts; i++) {
+		t0 = bench_now();
+		if ((ret = newfs_umount()) != 0) {
+			bench_fail("umount", "/", ret);
+		}
+		bench_dev_take(&run);
+		run.reads  = 0;                                     /* 打开后端时计数从0开始 */
+		run.writes = 0;
+		if ((ret = newfs_mount(newfs_options)) != 0) {
+			bench_fail("mount", "/", ret);
+		}
+		bench_record(&run, t0);
+	}
+	bench_end(&run, NULL);
+}
+/******************************************************************************
+* SECTION: 入口
+*******************************************************************************/
+static const struct option long_options[] = {
+	{"backend",     required_argument, NULL, 'B'},
+	{"device",      required_argument, NULL, 'd'},
+	{"disk-mb",     required_argument, NULL, 'm'},
+	{"cache-blks",  required_argument, NULL, 'c'},
+	{"files",       required_argument, NULL, 'f'},
+	{"depth",       required_argument, NULL, 'D'},
+	{"io-mb",       required_argument, NULL, 'I'},
+	{"io-size",     required_argument, NULL, 'z'},
+	{"rand-ops",    required_argument, NULL, 'r'},
+	{"mounts",      required_argument, NULL, 'M'},
+	{"seed",        required_argument, NULL, 's'},
+	{"scenario",    required_argument, NULL, 'S'},
+	{"verbose",     no_argument,       NULL, 'v'},
+	{"help",        no_argument,       NULL, 'h'},
+	{NULL, 0, NULL, 0}
+};
+
+static void usage(const char* prog) {
+	fprintf(stderr,
+			"usage: %s [options]\n"
+			"      --backend=<name>    file/mmap/ram，默认ram\n"
+			"      --device=<path>     镜像路径，file/mmap后端必须指定，每次运行都会重新格式化\n"
+			"      --disk-mb=<n>       新建镜像或RAM盘的大小（MB），默认256\n"
+			"      --cache-blks=<n>    块缓存容量（块数）\n"
+			"      --files=<n>         create/readdir的文件数，默认10000\n"
+			"      --depth=<n>         lookup的目录深度，默认32\n"
+			"      --io-mb=<n>         顺序读写的文件大小（MB），默认64\n"
+			"      --io-size=<bytes>   顺序读写每次的字节数，默认131072\n"
+			"      --rand-ops=<n>      随机读写的次数，默认20000\n"
+			"      --mounts=<n>        卸载再挂载的次数，默认20\n"
+			"      --seed=<n>          随机数种子\n"
+			"      --scenario=<name>   只运行create/lookup/readdir/churn/seqwrite/seqread/\n"
+			"                          randwrite/randread/remount之一，依赖前面场景的需一并运行\n"
+			"      --verbose           保留文件系统自身的输出\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+	int opt, ret;
+
+	memset(&newfs_options, 0, sizeof(struct custom_options));
+	newfs_options.backend      = "ram";
+	newfs_options.disk_mb      = 256;
+	newfs_options.dcache_ents  = NEWFS_DEFAULT_DCACHE_ENTS;
+	newfs_options.cache_mb     = NEWFS_DEFAULT_CACHE_MB;
+	newfs_options.dirty_expire = NEWFS_DEFAULT_DIRTY_EXPIRE;
+	newfs_options.dirty_ratio  = NEWFS_DEFAULT_DIRTY_RATIO;
+	newfs_options.ra_max       = NEWFS_DEFAULT_RA_MAX;
+	bench.files       = 10000;
+	bench.depth       = 32;
+	bench.lookups     = 100000;
+	bench.listings    = 20;
+	bench.churn_files = 256;
+	bench.churn_ops   = 20000;
+	bench.io_mb       = 64;
+	bench.io_sz       = 128 * 1024;
+	bench.rand_ops    = 20000;
+	bench.mounts      = 20;
+	bench.seed        = 1;
+	while ((opt = getopt_long(argc, argv, "h", long_options, NULL)) != -1) {
+		switch (opt) {
+		case 'B': newfs_options.backend    = optarg;       break;
+		case 'd': newfs_options.device     = optarg;       break;
+		case 'm': newfs_options.disk_mb    = atoi(optarg); break;
+		case 'c': newfs_options.cache_blks = atoi(optarg); break;
+		case 'f': bench.files    = atoi(optarg); break;
+		case 'D': bench.depth    = atoi(optarg); break;
+		case 'I': bench.io_mb    = atoi(optarg); break;
+		case 'z': bench.io_sz    = atoi(optarg); break;
+		case 'r': bench.rand_ops = atoi(optarg); break;
+		case 'M': bench.mounts   = atoi(optarg); break;
+		case 's': bench.seed     = strtoul(optarg, NULL, 0); break;
+		case 'S': bench.only     = optarg;       break;
+		case 'v': bench.verbose  = TRUE;         break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+	if (bench.files <= 0 || bench.depth <= 0 || bench.depth > 64 || bench.io_mb <= 0 ||
+		bench.io_sz <= 0 || bench.rand_ops < 0 || bench.mounts < 0) {
+		usage(argv[0]);
+		return 1;
+	}
+	bench_rng = bench.seed == 0 ? 1 : bench.seed;
+
+	bench_out = fdopen(dup(STDOUT_FILENO), "w");
+	if (!bench.verbose && freopen("/dev/null", "w", stdout) == NULL) {
+		return 1;
+	}
+	newfs_options.format = 1;                               /* 每次运行都从空文件系统开始 */
+	ret = newfs_mount(newfs_options);
+	newfs_options.format = 0;
+	if (ret != NEWFS_ERROR_NONE) {
+		bench_fail("mount", newfs_options.device != NULL ? newfs_options.device : "ram", ret);
+	}
+	bench_create();
+	bench_lookup();
+	bench_readdir();
+	bench_churn();
+	bench_seq();
+	bench_rand_io();
+	bench_mount();
+	newfs_umount();
+	return 0;
+}
@@ -0,0 +1,150 @@
+#include "../include/newfs.h"
+#include <getopt.h>
+/******************************************************************************
+* SECTION: 事件日志解码
+*
+* 读入--log写出的二进制事件日志，把各线程的事件按时间合并，每个事件输出一行：
+* 相对打开日志的时间（秒）、线程号、事件名与参数。--summary只输出每种事件的次数。
+* 环形区写满后被覆盖的事件数在各线程的段头中，一并输出。
+*******************************************************************************/
+struct logdump_ev {
+	struct newfs_event     ev;
+	uint32_t               tid;
+};
+
+static struct option long_options[] = {
+	{"summary",     no_argument,       NULL, 's'},
+	{"help",        no_argument,       NULL, 'h'},
+	{NULL, 0, NULL, 0}
+};
+
+static void usage(const char* prog) {
+	fprintf(stderr,
+			"usage: %s [options] <log>\n"
+			"      --summary           只输出每种事件的次数\n", prog);
+}
+
+static int logdump_cmp(const void* l, const void* r) {
+	const struct logdump_ev* a = (const struct logdump_ev*)l;
+	const struct logdump_ev* b = (const struct logdump_ev*)r;
+	if (a->ev.ts_ns != b->ev.ts_ns) {
+		return a->ev.ts_ns < b->ev.ts_ns ? -1 : 1;
+	}
+	return a->tid < b->tid ? -1 : a->tid > b->tid;
+}
+
+/**
+ * @brief 读入日志文件中全部线程的事件
+ *
+ * @param fp
+ * @param hdr 输出，文件头
+ * @param evs 输出，全部事件，需由调用者free
+ * @param cnt 输出，事件数
+ * @param dropped 输出，被覆盖的事件总数
+ * @return int 文件不完整或不是事件日志返回-NEWFS_ERROR_INVAL
+ */
+static int logdump_load(FILE* fp, struct newfs_log_hdr* hdr, struct logdump_ev** evs,
+						uint64_t* cnt, uint64_t* dropped) {
+	struct newfs_log_chunk chunk;
+	struct logdump_ev*     grown;
+	uint64_t cap = 0, i;
+	uint32_t r;
+
+	*evs     = NULL;
+	*cnt     = 0;
+	*dropped = 0;
+	if (fread(hdr, sizeof(struct newfs_log_hdr), 1, fp) != 1 || hdr->magic != NEWFS_LOG_MAGIC ||
+		hdr->version != NEWFS_LOG_VERSION || hdr->ev_size != sizeof(struct newfs_event)) {
+		return -NEWFS_ERROR_INVAL;
+	}
+	for (r = 0; r < hdr->rings; r++) {
+		if (fread(&chunk, sizeof(struct newfs_log_chunk), 1, fp) != 1 || chunk.count > NEWFS_LOG_RING_EVS) {
+			return -NEWFS_ERROR_INVAL;
+		}
+		if (*cnt + chunk.count > cap) {
+			cap   = (*cnt + chunk.count) * 2;
+			grown = (struct logdump_ev*)realloc(*evs, cap * sizeof(struct logdump_ev));
+			if (grown == NULL) {
+				return -NEWFS_ERROR_NOSPACE;
+			}
+			*evs = grown;
+		}
+		for (i = 0; i < chunk.count; i++, (*cnt)++) {
+			if (fread(&(*evs)[*cnt].ev, sizeof(struct newfs_event), 1, fp) != 1) {
+				return -NEWFS_ERROR_INVAL;
+			}
+			(*evs)[*cnt].tid = chunk.tid;
+		}
+		*dropped += chunk.dropped;
+	}
+	return NEWFS_ERROR_NONE;
+}
+
+int main(int argc, char **argv)
+{
+	struct newfs_log_hdr hdr;
+	struct logdump_ev*   evs;
+	struct newfs_event*  ev;
+	uint64_t counts[NEWFS_EV_CNT + 1] = { 0 };
+	uint64_t cnt, dropped, i;
+	uint64_t args[3];
+	boolean  summary = FALSE;
+	const char* name;
+	FILE*    fp;
+	int      opt, ret, k;
+
+	while ((opt = getopt_long(argc, argv, "h", long_options, NULL)) != -1) {
+		switch (opt) {
+		case 's': summary = TRUE; break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+	if (optind != argc - 1) {
+		usage(argv[0]);
+		return 1;
+	}
+	fp = fopen(argv[optind], "rb");
+	if (fp == NULL) {
+		fprintf(stderr, "%s: cannot open %s\n", argv[0], argv[optind]);
+		return 1;
+	}
+	ret = logdump_load(fp, &hdr, &evs, &cnt, &dropped);
+	fclose(fp);
+	if (ret != NEWFS_ERROR_NONE) {
+		fprintf(stderr, "%s: %s is not a readable newfs log\n", argv[0], argv[optind]);
+		free(evs);
+		return 1;
+	}
+	qsort(evs, cnt, sizeof(struct logdump_ev), logdump_cmp);
+
+	for (i = 0; i < cnt; i++) {
+		ev = &evs[i].ev;
+		counts[ev->type < NEWFS_EV_CNT ? ev->type : NEWFS_EV_CNT]++;
+		if (summary) {
+			continue;
+		}
+		printf("%14.6f [%u] %s", ev->ts_ns / 1e9, evs[i].tid, newfs_event_name(ev->type));
+		args[0] = ev->a;
+		args[1] = ev->b;
+		args[2] = ev->c;
+		for (k = 0; k < 3; k++) {
+			if ((name = newfs_event_arg(ev->type, k)) != NULL) {
+				printf(" %s=%ld", name, (long)args[k]);
+			}
+		}
+		printf("\n");
+	}
+	if (summary) {
+		for (k = 0; k <= NEWFS_EV_CNT; k++) {
+			if (counts[k] != 0) {
+				printf("%-16s %lu\n", newfs_event_name(k), (unsigned long)counts[k]);
+			}
+		}
+	}
+	printf("# %lu events from %u threads, %lu overwritten\n",
+		   (unsigned long)cnt, hdr.rings, (unsigned long)dropped);
+	free(evs);
+	return 0;
+}
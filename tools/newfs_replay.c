@@ -0,0 +1,280 @@
+#include "../include/newfs.h"
+#include <getopt.h>
+#include <time.h>
+/******************************************************************************
+* SECTION: 跟踪重放
+*
+* 读入--trace记录的跟踪文件，在新格式化的镜像或RAM盘上按记录顺序逐条重放。
+* 默认尽快重放，--timing按记录的开始时间重放。记录中的句柄映射到重放时打开的句柄。
+* 每种操作输出一行JSON：次数、与记录返回值不一致的次数、记录与重放的平均延迟；
+* 最后一行为汇总。跟踪只保留环形区内最近的记录，且挂载前已有的文件不在跟踪中，
+* 这类操作会计入不一致。
+*******************************************************************************/
+#define REPLAY_HANDLE_BUCKETS   4096
+
+struct replay_handle {
+	uint64_t               fh;                                  /* 跟踪中的句柄 */
+	struct fuse_file_info  fi;                                  /* 重放时打开的句柄 */
+	struct replay_handle*  next;
+};
+
+struct replay_op {
+	uint64_t               count;
+	uint64_t               mismatches;
+	uint64_t               orig_ns;
+	uint64_t               replay_ns;
+};
+
+struct custom_options     newfs_options;                       /* 挂载选项 */
+static struct replay_handle* replay_handles[REPLAY_HANDLE_BUCKETS];
+static struct replay_op      replay_ops[NEWFS_OP_CNT];
+
+static uint64_t replay_now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static struct replay_handle** replay_slot(uint64_t fh) {
+	struct replay_handle** slot = &replay_handles[(fh >> 4) % REPLAY_HANDLE_BUCKETS];
+	while (*slot != NULL && (*slot)->fh != fh) {
+		slot = &(*slot)->next;
+	}
+	return slot;
+}
+
+/**
+ * @brief 取得跟踪句柄对应的重放句柄
+ *
+ * @param fh 跟踪中的句柄
+ * @return struct fuse_file_info* 未经open的操作返回NULL
+ */
+static struct fuse_file_info* replay_fi(uint64_t fh) {
+	struct replay_handle* h = fh != 0 ? *replay_slot(fh) : NULL;
+	return h != NULL ? &h->fi : NULL;
+}
+
+static int replay_filler(void* buf, const char* name, const struct stat* st, off_t off) {
+	return 0;
+}
+
+/**
+ * @brief 重放open/opendir，成功时记下句柄的映射
+ *
+ * @param rec
+ * @param path
+ * @return int 操作的返回值
+ */
+static int replay_open(struct newfs_trace_rec* rec, const char* path) {
+	struct replay_handle* h = (struct replay_handle*)calloc(1, sizeof(struct replay_handle));
+	struct replay_handle** slot;
+	int ret;
+	h->fi.flags = rec->mode;
+	ret = rec->op == NEWFS_OP_OPEN ? newfs_open(path, &h->fi) : newfs_opendir(path, &h->fi);
+	if (ret != NEWFS_ERROR_NONE || rec->fh == 0) {
+		if (ret == NEWFS_ERROR_NONE) {
+			rec->op == NEWFS_OP_OPEN ? newfs_release(path, &h->fi) : newfs_releasedir(path, &h->fi);
+		}
+		free(h);
+		return ret;
+	}
+	slot = replay_slot(rec->fh);
+	if (*slot != NULL) {                                      /* 句柄地址被复用而未见到release */
+		h->next = (*slot)->next;
+		free(*slot);
+	}
+	h->fh = rec->fh;
+	*slot = h;
+	return ret;
+}
+
+/**
+ * @brief 重放release/releasedir，并删除句柄的映射
+ *
+ * @param rec
+ * @param path
+ * @return int
+ */
+static int replay_release(struct newfs_trace_rec* rec, const char* path) {
+	struct replay_handle** slot = replay_slot(rec->fh);
+	struct replay_handle*  h    = *slot;
+	struct fuse_file_info  fi;
+	int ret;
+	if (rec->fh == 0 || h == NULL) {
+		memset(&fi, 0, sizeof(struct fuse_file_info));
+		return rec->op == NEWFS_OP_RELEASE ? newfs_release(path, &fi) : newfs_releasedir(path, &fi);
+	}
+	ret = rec->op == NEWFS_OP_RELEASE ? newfs_release(path, &h->fi) : newfs_releasedir(path, &h->fi);
+	*slot = h->next;
+	free(h);
+	return ret;
+}
+
+/**
+ * @brief 重放一条记录
+ *
+ * @param rec
+ * @param path 以'\0'结尾的路径
+ * @param buf 读写缓冲，不小于rec->size
+ * @return int 操作的返回值
+ */
+static int replay_one(struct newfs_trace_rec* rec, const char* path, char* buf) {
+	struct stat st;
+	switch (rec->op) {
+	case NEWFS_OP_GETATTR:    return newfs_getattr(path, &st);
+	case NEWFS_OP_MKDIR:      return newfs_mkdir(path, rec->mode);
+	case NEWFS_OP_MKNOD:      return newfs_mknod(path, rec->mode, 0);
+	case NEWFS_OP_READDIR:    return newfs_readdir(path, NULL, replay_filler, rec->off, replay_fi(rec->fh));
+	case NEWFS_OP_READ:       return newfs_read(path, buf, rec->size, rec->off, replay_fi(rec->fh));
+	case NEWFS_OP_WRITE:      return newfs_write(path, buf, rec->size, rec->off, replay_fi(rec->fh));
+	case NEWFS_OP_TRUNCATE:   return newfs_truncate(path, rec->off);
+	case NEWFS_OP_OPEN:
+	case NEWFS_OP_OPENDIR:    return replay_open(rec, path);
+	case NEWFS_OP_RELEASE:
+	case NEWFS_OP_RELEASEDIR: return replay_release(rec, path);
+	case NEWFS_OP_FSYNC:      return newfs_fsync(path, 0, NULL);
+	case NEWFS_OP_FLUSH:      return newfs_flush(path, NULL);
+	case NEWFS_OP_UNLINK:     return newfs_unlink(path);
+	case NEWFS_OP_RMDIR:      return newfs_rmdir(path);
+	case NEWFS_OP_RENAME:                           /* 路径为from与to，以'\0'分隔 */
+		return strlen(path) < rec->path_len ? newfs_rename(path, path + strlen(path) + 1) : -NEWFS_ERROR_INVAL;
+	default:                  return -NEWFS_ERROR_UNSUPPORTED;
+	}
+}
+/******************************************************************************
+* SECTION: 入口
+*******************************************************************************/
+static const struct option long_options[] = {
+	{"backend",     required_argument, NULL, 'B'},
+	{"device",      required_argument, NULL, 'd'},
+	{"disk-mb",     required_argument, NULL, 'm'},
+	{"cache-blks",  required_argument, NULL, 'c'},
+	{"timing",      no_argument,       NULL, 't'},
+	{"verbose",     no_argument,       NULL, 'v'},
+	{"help",        no_argument,       NULL, 'h'},
+	{NULL, 0, NULL, 0}
+};
+
+static void usage(const char* prog) {
+	fprintf(stderr,
+			"usage: %s [options] <trace>\n"
+			"      --backend=<name>    file/mmap/ram，默认ram\n"
+			"      --device=<path>     镜像路径，file/mmap后端必须指定，重放前重新格式化\n"
+			"      --disk-mb=<n>       新建镜像或RAM盘的大小（MB），默认256\n"
+			"      --cache-blks=<n>    块缓存容量（块数）\n"
+			"      --timing            按记录的时间间隔重放，默认尽快重放\n"
+			"      --verbose           保留文件系统自身的输出\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+	struct newfs_trace_hdr  hdr;
+	struct newfs_trace_rec* rec;
+	struct replay_op*       rop;
+	uint8_t* ring;
+	char*    buf = NULL;
+	char     path[UINT16_MAX + 1];
+	uint64_t pos, t0, begin, elapsed, first_ts = 0, last_ts = 0, records = 0, mismatches = 0, buf_sz = 0;
+	uint64_t reads, writes;
+	boolean  timing = FALSE, verbose = FALSE;
+	FILE*    out;
+	int      opt, ret, op;
+
+	memset(&newfs_options, 0, sizeof(struct custom_options));
+	newfs_options.backend      = "ram";
+	newfs_options.disk_mb      = 256;
+	newfs_options.dcache_ents  = NEWFS_DEFAULT_DCACHE_ENTS;
+	newfs_options.cache_mb     = NEWFS_DEFAULT_CACHE_MB;
+	newfs_options.dirty_expire = NEWFS_DEFAULT_DIRTY_EXPIRE;
+	newfs_options.dirty_ratio  = NEWFS_DEFAULT_DIRTY_RATIO;
+	newfs_options.ra_max       = NEWFS_DEFAULT_RA_MAX;
+	while ((opt = getopt_long(argc, argv, "h", long_options, NULL)) != -1) {
+		switch (opt) {
+		case 'B': newfs_options.backend    = optarg;       break;
+		case 'd': newfs_options.device     = optarg;       break;
+		case 'm': newfs_options.disk_mb    = atoi(optarg); break;
+		case 'c': newfs_options.cache_blks = atoi(optarg); break;
+		case 't': timing  = TRUE; break;
+		case 'v': verbose = TRUE; break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+	if (optind != argc - 1) {
+		usage(argv[0]);
+		return 1;
+	}
+	if (newfs_trace_load(argv[optind], &hdr, &ring) != NEWFS_ERROR_NONE) {
+		fprintf(stderr, "%s: %s is not a readable newfs trace\n", argv[0], argv[optind]);
+		return 1;
+	}
+
+	out = fdopen(dup(STDOUT_FILENO), "w");
+	if (!verbose && freopen("/dev/null", "w", stdout) == NULL) {
+		return 1;
+	}
+	newfs_options.format = 1;                               /* 从空文件系统开始重放 */
+	ret = newfs_mount(newfs_options);
+	newfs_options.format = 0;
+	if (ret != NEWFS_ERROR_NONE) {
+		fprintf(stderr, "%s: mount failed (%d)\n", argv[0], ret);
+		return 1;
+	}
+
+	begin = replay_now();
+	for (pos = hdr.tail; (rec = newfs_trace_next(&hdr, ring, &pos)) != NULL; ) {
+		memcpy(path, rec->path, rec->path_len);
+		path[rec->path_len] = '\0';
+		if (rec->size > buf_sz) {
+			buf_sz = rec->size;
+			buf    = (char*)realloc(buf, buf_sz);
+			memset(buf, 0x5a, buf_sz);
+		}
+		if (records == 0) {
+			first_ts = rec->ts_ns;                              /* 环形区覆盖过时从保留的第一条算起 */
+		}
+		if (timing && rec->ts_ns - first_ts > replay_now() - begin) {
+			t0 = rec->ts_ns - first_ts - (replay_now() - begin);
+			nanosleep(&(struct timespec){ t0 / 1000000000ULL, t0 % 1000000000ULL }, NULL);
+		}
+		t0  = replay_now();
+		ret = replay_one(rec, path, buf);
+		rop = &replay_ops[rec->op];
+		rop->replay_ns += replay_now() - t0;
+		rop->orig_ns   += rec->lat_ns;
+		rop->count++;
+		if ((ret < 0) != (rec->ret < 0) ||
+			((rec->op == NEWFS_OP_READ || rec->op == NEWFS_OP_WRITE) && ret != rec->ret)) {
+			rop->mismatches++;
+			mismatches++;
+		}
+		records++;
+		last_ts = rec->ts_ns + rec->lat_ns;
+	}
+	elapsed = replay_now() - begin;
+	reads   = NEWFS_ATOMIC_GET(&NEWFS_DRIVER()->stats.reads);
+	writes  = NEWFS_ATOMIC_GET(&NEWFS_DRIVER()->stats.writes);
+	newfs_umount();
+
+	for (op = 0; op < NEWFS_OP_CNT; op++) {
+		rop = &replay_ops[op];
+		if (rop->count == 0) {
+			continue;
+		}
+		fprintf(out, "{\"op\": \"%s\", \"count\": %lu, \"mismatches\": %lu, \"orig_avg_us\": %.2f, "
+				"\"replay_avg_us\": %.2f}\n", newfs_op_name(op), (unsigned long)rop->count,
+				(unsigned long)rop->mismatches, rop->orig_ns / 1e3 / rop->count,
+				rop->replay_ns / 1e3 / rop->count);
+	}
+	fprintf(out, "{\"records\": %lu, \"recorded_total\": %lu, \"mismatches\": %lu, \"trace_secs\": %.6f, "
+			"\"replay_secs\": %.6f, \"ops_per_sec\": %.1f, \"dev_reads\": %lu, \"dev_writes\": %lu}\n",
+			(unsigned long)records, (unsigned long)hdr.records, (unsigned long)mismatches,
+			(last_ts - first_ts) / 1e9,
+			elapsed / 1e9, elapsed == 0 ? 0.0 : records / (elapsed / 1e9),
+			(unsigned long)reads, (unsigned long)writes);
+	fclose(out);
+	free(buf);
+	free(ring);
+	return 0;
+}